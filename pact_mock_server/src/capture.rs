@@ -0,0 +1,354 @@
+//!
+//! Recording of the raw requests received by a mock server to a capture file, so the traffic can
+//! be replayed against a mock server later, or used to diagnose slow matching with real inputs.
+//!
+//! Requests are handed to a background writer thread over a bounded queue, so recording never
+//! blocks the handling of a request. If the writer falls behind and the queue fills up, requests
+//! are dropped from the capture (and counted) rather than slowing the mock server down.
+//!
+//! Capture files use the same length-prefixed record format as journal exports (see the
+//! `journal_export` module), with the magic bytes `PACTCAP\0`. Capture files are never compressed,
+//! so that the records written before a crash can still be read.
+//!
+
+use std::fs::File;
+use std::io::{self, Read, Write};
+use std::sync::Arc;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::thread;
+use std::time::{SystemTime, UNIX_EPOCH};
+
+use anyhow::anyhow;
+use base64::Engine;
+use base64::engine::general_purpose::STANDARD as BASE64;
+use bytes::Bytes;
+use serde_json::{json, Value};
+use tokio::sync::mpsc;
+use tracing::{debug, error, warn};
+
+use crate::journal_export::{RecordReader, RecordWriter, write_bytes, write_varint};
+
+/// Magic bytes at the start of a capture file
+const MAGIC: &[u8; 8] = b"PACTCAP\0";
+/// Record that is a captured request
+const RECORD_REQUEST: u8 = 3;
+/// Number of requests that can be queued for the writer thread
+const CAPTURE_QUEUE_SIZE: usize = 4096;
+
+/// Request as it was received by the mock server
+#[derive(Debug, Clone, PartialEq)]
+pub struct CapturedRequest {
+  /// Time the request was received, in microseconds since the Unix epoch
+  pub timestamp: u64,
+  /// Session the request was for (from the `X-Pact-Session` header)
+  pub session: Option<String>,
+  /// Request method
+  pub method: String,
+  /// Request path, as received
+  pub path: String,
+  /// Raw query string
+  pub query: Option<String>,
+  /// Request headers, in the order they were received
+  pub headers: Vec<(String, String)>,
+  /// Request body
+  pub body: Bytes
+}
+
+impl CapturedRequest {
+  /// Captures the parts of a hyper request. The body is added once it has been read.
+  pub(crate) fn from_hyper_request<B>(request: &hyper::Request<B>, session: Option<String>) -> CapturedRequest {
+    let timestamp = SystemTime::now().duration_since(UNIX_EPOCH)
+      .map(|duration| duration.as_micros() as u64)
+      .unwrap_or_default();
+    CapturedRequest {
+      timestamp,
+      session,
+      method: request.method().to_string(),
+      path: request.uri().path().to_string(),
+      query: request.uri().query().map(|query| query.to_string()),
+      headers: request.headers().iter()
+        .map(|(name, value)| (name.to_string(), String::from_utf8_lossy(value.as_bytes()).to_string()))
+        .collect(),
+      body: Bytes::new()
+    }
+  }
+
+  /// Converts the request to JSON. Bodies that are not valid UTF-8 are base64 encoded.
+  pub fn to_json(&self) -> Value {
+    let body = match std::str::from_utf8(&self.body) {
+      Ok(body) => json!(body),
+      Err(_) => json!({ "base64": BASE64.encode(&self.body) })
+    };
+    json!({
+      "timestamp": self.timestamp,
+      "session": self.session,
+      "method": self.method,
+      "path": self.path,
+      "query": self.query,
+      "headers": self.headers.iter().map(|(name, value)| json!([name, value])).collect::<Vec<Value>>(),
+      "body": body
+    })
+  }
+}
+
+/// Writes captured requests to a capture file
+pub struct CaptureWriter {
+  records: RecordWriter,
+  record: Vec<u8>,
+  requests: usize
+}
+
+impl CaptureWriter {
+  /// Creates a writer, writing the capture file header to `out`
+  pub fn new(out: impl Write + Send + 'static) -> anyhow::Result<CaptureWriter> {
+    Ok(CaptureWriter {
+      records: RecordWriter::new(out, MAGIC, false)?,
+      record: Vec::with_capacity(1024),
+      requests: 0
+    })
+  }
+
+  /// Writes a request to the capture file
+  pub fn write_request(&mut self, request: &CapturedRequest) -> io::Result<()> {
+    let mut record = std::mem::take(&mut self.record);
+    record.clear();
+    record.push(RECORD_REQUEST);
+    write_varint(&mut record, request.timestamp);
+    self.records.write_optional_string(&mut record, request.session.as_deref())?;
+    self.records.write_string(&mut record, &request.method)?;
+    self.records.write_string(&mut record, &request.path)?;
+    self.records.write_optional_string(&mut record, request.query.as_deref())?;
+    write_varint(&mut record, request.headers.len() as u64);
+    for (name, value) in &request.headers {
+      self.records.write_string(&mut record, name)?;
+      self.records.write_string(&mut record, value)?;
+    }
+    write_bytes(&mut record, &request.body);
+    self.records.write_record(&record)?;
+    self.record = record;
+    self.requests += 1;
+    Ok(())
+  }
+
+  /// Number of requests that have been written
+  pub fn requests(&self) -> usize {
+    self.requests
+  }
+
+  /// Flushes any buffered requests to the file
+  pub fn flush(&mut self) -> io::Result<()> {
+    self.records.flush()
+  }
+}
+
+/// If the input starts with the magic bytes of a capture file. Only the magic bytes are read, so
+/// this can be used to tell capture files apart from other files before reading them.
+pub fn is_capture_file(mut input: impl Read) -> bool {
+  let mut magic = [0_u8; 8];
+  input.read_exact(&mut magic).is_ok() && &magic == MAGIC
+}
+
+/// Reads the requests from a capture file. This is an iterator over the requests in the file.
+pub struct CaptureReader {
+  records: RecordReader
+}
+
+impl CaptureReader {
+  /// Creates a reader, reading and validating the capture file header from `input`
+  pub fn new(input: impl Read + Send + 'static) -> anyhow::Result<CaptureReader> {
+    let records = RecordReader::new(input, MAGIC)
+      .map_err(|err| anyhow!("Not a valid capture file - {}", err))?;
+    Ok(CaptureReader { records })
+  }
+
+  /// Reads the next request, returning `None` at the end of the file
+  pub fn read_request(&mut self) -> anyhow::Result<Option<CapturedRequest>> {
+    self.records.read_record(|reader, record_type, cursor| {
+      if record_type != RECORD_REQUEST {
+        return Err(anyhow!("Unknown capture file record type {}", record_type));
+      }
+      let timestamp = cursor.varint()?;
+      let session = reader.optional_string(cursor)?;
+      let method = reader.string(cursor)?;
+      let path = reader.string(cursor)?;
+      let query = reader.optional_string(cursor)?;
+      let count = cursor.varint()?;
+      let mut headers = vec![];
+      for _ in 0..count {
+        headers.push((reader.string(cursor)?, reader.string(cursor)?));
+      }
+      let body = Bytes::copy_from_slice(cursor.bytes()?);
+      Ok(CapturedRequest { timestamp, session, method, path, query, headers, body })
+    })
+  }
+}
+
+impl Iterator for CaptureReader {
+  type Item = anyhow::Result<CapturedRequest>;
+
+  fn next(&mut self) -> Option<Self::Item> {
+    self.read_request().transpose()
+  }
+}
+
+/// Handle a mock server uses to record the requests it receives to a capture file
+#[derive(Debug, Clone)]
+pub struct RequestCapture {
+  path: String,
+  sender: mpsc::Sender<CapturedRequest>,
+  captured: Arc<AtomicUsize>,
+  dropped: Arc<AtomicUsize>
+}
+
+impl RequestCapture {
+  /// Creates the capture file (replacing any existing file), and starts the thread that writes
+  /// the requests to it. The thread finishes once all the handles to the capture have been
+  /// dropped (i.e. the mock server has shut down).
+  pub fn start(path: &str) -> anyhow::Result<RequestCapture> {
+    let file = File::create(path)
+      .map_err(|err| anyhow!("Failed to create capture file {} - {}", path, err))?;
+    let mut writer = CaptureWriter::new(file)?;
+    let (sender, mut receiver) = mpsc::channel::<CapturedRequest>(CAPTURE_QUEUE_SIZE);
+    let captured = Arc::new(AtomicUsize::new(0));
+
+    let captured_count = captured.clone();
+    let file_path = path.to_string();
+    thread::Builder::new()
+      .name("mock-server-capture".to_string())
+      .spawn(move || {
+        while let Some(request) = receiver.blocking_recv() {
+          let mut result = writer.write_request(&request);
+          // Write out anything else that has been queued before flushing
+          while let (true, Ok(request)) = (result.is_ok(), receiver.try_recv()) {
+            result = writer.write_request(&request);
+          }
+          if let Err(err) = result.and_then(|_| writer.flush()) {
+            error!("Failed to write to capture file {}, no more requests will be captured - {}", file_path, err);
+            return;
+          }
+          captured_count.store(writer.requests(), Ordering::Relaxed);
+        }
+        debug!("Capture to {} finished, {} requests captured", file_path, writer.requests());
+      })?;
+
+    Ok(RequestCapture {
+      path: path.to_string(),
+      sender,
+      captured,
+      dropped: Arc::new(AtomicUsize::new(0))
+    })
+  }
+
+  /// Queues a request to be written to the capture file. This never blocks; if the queue is full
+  /// the request is dropped from the capture.
+  pub fn record(&self, request: CapturedRequest) {
+    if self.sender.try_send(request).is_err() {
+      let dropped = self.dropped.fetch_add(1, Ordering::Relaxed) + 1;
+      if dropped.is_power_of_two() {
+        warn!("Capture to {} is not keeping up, {} requests have been dropped", self.path, dropped);
+      }
+    }
+  }
+
+  /// Path to the capture file
+  pub fn path(&self) -> &str {
+    self.path.as_str()
+  }
+
+  /// Number of requests that have been written to the capture file
+  pub fn captured(&self) -> usize {
+    self.captured.load(Ordering::Relaxed)
+  }
+
+  /// Number of requests that were dropped from the capture
+  pub fn dropped(&self) -> usize {
+    self.dropped.load(Ordering::Relaxed)
+  }
+
+  /// Converts the capture state to JSON
+  pub fn to_json(&self) -> Value {
+    json!({
+      "file": self.path,
+      "captured": self.captured(),
+      "dropped": self.dropped()
+    })
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use std::sync::Mutex;
+
+  use expectest::prelude::*;
+
+  use super::*;
+
+  #[derive(Clone, Default)]
+  struct SharedBuffer(Arc<Mutex<Vec<u8>>>);
+
+  impl Write for SharedBuffer {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+      self.0.lock().unwrap().write(buf)
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+      Ok(())
+    }
+  }
+
+  #[test]
+  fn captured_requests_can_be_read_back() {
+    let request = CapturedRequest {
+      timestamp: 1700000000000000,
+      session: Some("one".to_string()),
+      method: "POST".to_string(),
+      path: "/test".to_string(),
+      query: Some("a=1&b=2".to_string()),
+      headers: vec![
+        ("content-type".to_string(), "application/json".to_string()),
+        ("x-test".to_string(), "a".to_string()),
+        ("x-test".to_string(), "b".to_string())
+      ],
+      body: Bytes::from_static(b"{\"a\": 1}")
+    };
+
+    let buffer = SharedBuffer::default();
+    let mut writer = CaptureWriter::new(buffer.clone()).unwrap();
+    writer.write_request(&request).unwrap();
+    writer.write_request(&CapturedRequest { timestamp: 1700000000000100, query: None, .. request.clone() }).unwrap();
+    writer.flush().unwrap();
+
+    let data = buffer.0.lock().unwrap().clone();
+    let requests: Vec<CapturedRequest> = CaptureReader::new(io::Cursor::new(data)).unwrap()
+      .collect::<anyhow::Result<_>>()
+      .unwrap();
+    expect!(requests.len()).to(be_equal_to(2));
+    expect!(&requests[0]).to(be_equal_to(&request));
+    expect!(requests[1].query.clone()).to(be_none());
+  }
+
+  #[test]
+  fn is_capture_file_checks_the_magic_bytes() {
+    let buffer = SharedBuffer::default();
+    CaptureWriter::new(buffer.clone()).unwrap().flush().unwrap();
+    let data = buffer.0.lock().unwrap().clone();
+    expect!(is_capture_file(io::Cursor::new(data))).to(be_true());
+
+    expect!(is_capture_file(io::Cursor::new(b"PACTCAP".to_vec()))).to(be_false());
+    expect!(is_capture_file(io::Cursor::new(b"{\"consumer\": {}}".to_vec()))).to(be_false());
+  }
+
+  #[test]
+  fn capture_json_encodes_binary_bodies() {
+    let request = CapturedRequest {
+      timestamp: 0,
+      session: None,
+      method: "GET".to_string(),
+      path: "/".to_string(),
+      query: None,
+      headers: vec![],
+      body: Bytes::from_static(&[0xFF, 0x00, 0x01, 0x02])
+    };
+    expect!(request.to_json()["body"]["base64"].clone()).to(be_equal_to(json!("/wABAg==")));
+  }
+}
@@ -1,9 +1,13 @@
 use std::borrow::BorrowMut;
 use std::collections::HashMap;
+use std::future::Future;
 #[cfg(feature = "tls")]  use std::io;
 use std::net::SocketAddr;
 #[cfg(feature = "tls")] use std::pin::Pin;
 use std::sync::{Arc, Mutex};
+use std::time::Instant;
+
+use futures::channel::oneshot;
 
 #[cfg(feature = "tls")] use futures::prelude::*;
 #[cfg(feature = "tls")] use futures::StreamExt;
@@ -23,14 +27,18 @@ use pact_models::v4::http_parts::HttpRequest;
 #[cfg(feature = "tls")] use rustls::ServerConfig;
 use serde_json::json;
 #[cfg(feature = "tls")] use tokio::net::{TcpListener, TcpStream};
+use tokio::task::JoinHandle;
 #[cfg(feature = "tls")] use tokio_rustls::server::TlsStream;
 #[cfg(feature = "tls")] use tokio_rustls::TlsAcceptor;
 use tracing::{debug, error, info, trace, warn};
 
 use pact_matching::logging::LOG_ID;
 
-use crate::matching::{match_request, MatchResult};
-use crate::mock_server::MockServer;
+use crate::capture::CapturedRequest;
+use crate::journal::MatchJournal;
+use crate::matching::{match_request_with_index, MatchResult, RoutingIndex};
+use crate::mock_server::{DEFAULT_DRAIN_TIMEOUT, MockServer};
+use crate::status::RequestStats;
 
 #[derive(Debug, Clone)]
 enum InteractionError {
@@ -254,24 +262,62 @@ async fn match_result_to_hyper_response(
   }
 }
 
+/// Header requests can use to specify the session they are for
+const SESSION_HEADER: &str = "x-pact-session";
+/// Path prefix requests can use to specify the session they are for (if enabled)
+const SESSION_PATH_PREFIX: &str = "/_session/";
+
+/// Splits a `/_session/{id}/path` path into the session ID and the remaining path
+fn strip_session_prefix(path: &str) -> Option<(String, String)> {
+  path.strip_prefix(SESSION_PATH_PREFIX)
+    .filter(|rest| !rest.is_empty())
+    .map(|rest| match rest.split_once('/') {
+      Some((session, path)) => (session.to_string(), format!("/{}", path)),
+      None => (rest.to_string(), "/".to_string())
+    })
+}
+
 async fn handle_request(
-  req: hyper::Request<Body>,
-  pact: Arc<dyn Pact + Send + Sync>,
-  matches: Arc<Mutex<Vec<MatchResult>>>,
+  mut req: hyper::Request<Body>,
+  routes: Arc<RoutingIndex>,
+  matches: Arc<Mutex<MatchJournal>>,
   mock_server: Arc<Mutex<MockServer>>
 ) -> Result<Response<Body>, InteractionError> {
   debug!("Creating pact request from hyper request");
 
-  {
+  let (session_path_prefix, capture, proxy) = {
     let mut guard = mock_server.lock().unwrap();
     let mock_server = guard.borrow_mut();
-    mock_server.metrics.requests = mock_server.metrics.requests + 1;
-    mock_server.metrics.requests_by_path.entry(req.uri().path().to_string())
+    mock_server.last_activity = Instant::now();
+    let metrics = Arc::make_mut(&mut mock_server.metrics);
+    metrics.requests = metrics.requests + 1;
+    metrics.requests_by_path.entry(req.uri().path().to_string())
       .and_modify(|e| *e += 1)
       .or_insert(1);
-  }
+    (mock_server.config.session_path_prefix, mock_server.capture.clone(), mock_server.proxy.clone())
+  };
 
-  let pact_request = hyper_request_to_pact_request(req).await?;
+  let mut session = req.headers_mut().remove(SESSION_HEADER)
+    .and_then(|value| value.to_str().ok().map(|value| value.to_string()));
+  let captured = capture.as_ref().map(|_| CapturedRequest::from_hyper_request(&req, session.clone()));
+  // The raw query string and headers are kept for forwarding unmatched requests
+  let proxy_parts = proxy.map(|proxy| (proxy, req.uri().query().map(|query| query.to_string()), req.headers().clone()));
+  let mut pact_request = hyper_request_to_pact_request(req).await?;
+  if let (Some(capture), Some(mut captured)) = (capture, captured) {
+    if let OptionalBody::Present(body, _, _) = &pact_request.body {
+      captured.body = body.clone();
+    }
+    capture.record(captured);
+  }
+  if session_path_prefix {
+    if let Some((path_session, path)) = strip_session_prefix(&pact_request.path) {
+      session = Some(path_session);
+      pact_request.path = path;
+    }
+  }
+  if let Some(session) = &session {
+    debug!("Request is for session '{}'", session);
+  }
   info!("Received request {} {}", pact_request.method, pact_request.path);
   if pact_request.has_text_body() {
     debug!(
@@ -303,13 +349,40 @@ async fn handle_request(
     );
   }
 
-  // This unwrap is safe, as all pact models can be upgraded to V4 format
-  let v4_pact = pact.as_v4_pact().unwrap();
-  let match_result = match_request(&pact_request, &v4_pact).await;
-
-  matches.lock().unwrap().push(match_result.clone());
-
-  match_result_to_hyper_response(&pact_request, match_result, mock_server).await
+  let match_result = match_request_with_index(&pact_request, &routes).await;
+
+  // Only unexpected requests are forwarded. Requests that partly matched an interaction in the
+  // pact are mismatches, and unexpected CORS pre-flight requests are handled by the mock server.
+  let unexpected = matches!(match_result, MatchResult::RequestNotFound(_)) && !match_result.cors_preflight();
+  match proxy_parts {
+    Some((proxy, query, headers)) if unexpected => {
+      info!("Request did not match any interaction, forwarding it to {}", proxy.upstream());
+      let result = proxy.forward(&pact_request, query.as_deref(), headers).await;
+      // Unexpected requests that were forwarded are recorded as candidate interactions, so they
+      // are not mismatches
+      if result.is_ok() {
+        matches.lock().unwrap().push_proxied(match_result.clone(), session);
+      } else {
+        matches.lock().unwrap().push_for_session(match_result.clone(), session);
+      }
+      match result {
+        Ok(response) => Ok(response),
+        Err(err) => {
+          error!("{}", err);
+          Response::builder()
+            .status(502)
+            .header(hyper::header::CONTENT_TYPE, "application/json; charset=utf-8")
+            .header("X-Pact", match_result.match_key())
+            .body(Body::from(error_body(&pact_request, &err.to_string())))
+            .map_err(|_| InteractionError::ResponseBodyError)
+        }
+      }
+    }
+    _ => {
+      matches.lock().unwrap().push_for_session(match_result.clone(), session);
+      match_result_to_hyper_response(&pact_request, match_result, mock_server).await
+    }
+  }
 }
 
 // TODO: Should instead use some form of X-Pact headers
@@ -336,40 +409,147 @@ fn handle_mock_request_error(result: Result<Response<Body>, InteractionError>) -
     }
 }
 
+/// Executor for the connections of a mock server. It keeps the handles of the connection tasks,
+/// so any connections still open once the drain deadline has passed can be aborted.
+#[derive(Debug, Clone, Default)]
+struct ConnectionTracker {
+  tasks: Arc<Mutex<Vec<JoinHandle<()>>>>
+}
+
+impl ConnectionTracker {
+  /// Number of connections that are still open
+  fn open(&self) -> usize {
+    self.tasks.lock().unwrap().iter().filter(|task| !task.is_finished()).count()
+  }
+
+  /// Aborts the connections that are still open, returning the number aborted
+  fn abort(&self) -> usize {
+    let tasks = std::mem::take(&mut *self.tasks.lock().unwrap());
+    tasks.iter()
+      .filter(|task| !task.is_finished())
+      .map(|task| task.abort())
+      .count()
+  }
+}
+
+impl<F> hyper::rt::Executor<F> for ConnectionTracker
+  where F: Future + Send + 'static,
+        F::Output: Send + 'static {
+  fn execute(&self, future: F) {
+    let task = tokio::spawn(async move {
+      future.await;
+    });
+    let mut tasks = self.tasks.lock().unwrap();
+    tasks.retain(|task| !task.is_finished());
+    tasks.push(task);
+  }
+}
+
+/// Aborts any open connections when the server future is dropped, so aborting the server task
+/// does not leave its connections running
+struct AbortConnectionsOnDrop(ConnectionTracker);
+
+impl Drop for AbortConnectionsOnDrop {
+  fn drop(&mut self) {
+    self.0.abort();
+  }
+}
+
+/// Wraps the shutdown signal, so the server future knows when it has been received
+fn drain_signal(shutdown: impl Future<Output = ()>) -> (impl Future<Output = ()>, oneshot::Receiver<()>) {
+  let (signalled_tx, signalled_rx) = oneshot::channel();
+  let signal = async move {
+    shutdown.await;
+    let _ = signalled_tx.send(());
+  };
+  (signal, signalled_rx)
+}
+
+/// Drives the server until the shutdown signal is received, and then drains its connections.
+/// Hyper stops accepting connections and closes the idle ones as soon as the signal is received,
+/// and connections with requests in flight are given up to the drain timeout of the mock server to
+/// complete, after which they are aborted. The counts are added to the mock server metrics.
+async fn drain_connections(
+  server: impl Future<Output = Result<(), hyper::Error>>,
+  signalled: oneshot::Receiver<()>,
+  connections: ConnectionTracker,
+  mock_server: Arc<Mutex<MockServer>>
+) {
+  let _guard = AbortConnectionsOnDrop(connections.clone());
+  let drain_timeout = mock_server.lock().unwrap().config.drain_timeout.unwrap_or(DEFAULT_DRAIN_TIMEOUT);
+  tokio::pin!(server);
+
+  tokio::select! {
+    biased;
+    result = &mut server => {
+      if let Err(err) = result {
+        error!("Mock server failed - {}", err);
+      }
+      return;
+    }
+    _ = signalled => {}
+  }
+
+  let open = connections.open();
+  let (drained, aborted) = match tokio::time::timeout(drain_timeout, &mut server).await {
+    Ok(_) => (open, 0),
+    Err(_) => {
+      let aborted = connections.abort();
+      warn!("Aborted {} connection(s) that were still open {:?} after the shutdown signal", aborted, drain_timeout);
+      (open.saturating_sub(aborted), aborted)
+    }
+  };
+
+  let mut guard = mock_server.lock().unwrap();
+  let mock_server = guard.borrow_mut();
+  debug!("Mock server {} drained {} connection(s) on shutdown", mock_server.id, drained);
+  let metrics = Arc::make_mut(&mut mock_server.metrics);
+  metrics.drained_connections += drained;
+  metrics.aborted_connections += aborted;
+}
+
 // Create and bind the server, but do not start it.
 // Returns a future that drives the server.
 // The reason that the function itself is still async (even if it performs
 // no async operations) is that it needs a tokio context to be able to call try_bind.
 pub(crate) async fn create_and_bind(
-  pact: Box<dyn Pact + Send + Sync>,
+  pact: Arc<dyn Pact + Send + Sync>,
   addr: SocketAddr,
   shutdown: impl std::future::Future<Output = ()>,
-  matches: Arc<Mutex<Vec<MatchResult>>>,
+  matches: Arc<Mutex<MatchJournal>>,
   mock_server: Arc<Mutex<MockServer>>,
   mock_server_id: &String
 ) -> Result<(impl std::future::Future<Output = ()>, SocketAddr), hyper::Error> {
-  let pact = pact.arced();
   let ms_id = Arc::new(mock_server_id.clone());
+  let connections = ConnectionTracker::default();
+  let server_mock_server = mock_server.clone();
+  let stats: Arc<RequestStats> = mock_server.lock().unwrap().request_stats();
+  // This unwrap is safe, as all pact models can be upgraded to V4 format
+  let routes = Arc::new(RoutingIndex::new(pact.as_v4_pact().unwrap()));
 
   let server = Server::try_bind(&addr)?
+    .executor(connections.clone())
     .serve(make_service_fn(move |_| {
-      let pact = pact.clone();
+      let routes = routes.clone();
       let matches = matches.clone();
-      let mock_server = mock_server.clone();
+      let mock_server = server_mock_server.clone();
       let mock_server_id = ms_id.clone();
+      let stats = stats.clone();
 
       LOG_ID.scope(mock_server_id.to_string(), async move {
         Ok::<_, hyper::Error>(
           service_fn(move |req| {
-            let pact = pact.clone();
+            let routes = routes.clone();
             let matches = matches.clone();
             let mock_server = mock_server.clone();
             let mock_server_id = mock_server_id.clone();
+            let stats = stats.clone();
 
             LOG_ID.scope(mock_server_id.to_string(), async move {
-              handle_mock_request_error(
-                handle_request(req, pact, matches, mock_server).await
-              )
+              let start = Instant::now();
+              let result = handle_request(req, routes, matches, mock_server).await;
+              stats.record(start.elapsed());
+              handle_mock_request_error(result)
             })
           })
         )
@@ -377,14 +557,11 @@ pub(crate) async fn create_and_bind(
     }));
 
   let socket_addr = server.local_addr();
+  let (signal, signalled) = drain_signal(shutdown);
 
   Ok((
       // This is the future that drives the server:
-      async {
-          let _ = server
-              .with_graceful_shutdown(shutdown)
-              .await;
-      },
+      drain_connections(server.with_graceful_shutdown(signal), signalled, connections, mock_server),
       socket_addr
   ))
 }
@@ -410,10 +587,10 @@ impl hyper::server::accept::Accept for HyperAcceptor {
 
 #[cfg(feature = "tls")]
 pub(crate) async fn create_and_bind_tls(
-  pact: Box<dyn Pact + Send + Sync>,
+  pact: Arc<dyn Pact + Send + Sync>,
   addr: SocketAddr,
   shutdown: impl std::future::Future<Output = ()>,
-  matches: Arc<Mutex<Vec<MatchResult>>>,
+  matches: Arc<Mutex<MatchJournal>>,
   tls_cfg: ServerConfig,
   mock_server: Arc<Mutex<MockServer>>
 ) -> Result<(impl std::future::Future<Output = ()>, SocketAddr), io::Error> {
@@ -431,60 +608,70 @@ pub(crate) async fn create_and_bind_tls(
     }
   });
 
-  let pact = pact.arced();
+  let connections = ConnectionTracker::default();
+  let server_mock_server = mock_server.clone();
+  let stats: Arc<RequestStats> = mock_server.lock().unwrap().request_stats();
+  // This unwrap is safe, as all pact models can be upgraded to V4 format
+  let routes = Arc::new(RoutingIndex::new(pact.as_v4_pact().unwrap()));
   let server = Server::builder(HyperAcceptor {
     stream: tls_stream.boxed()
   })
+    .executor(connections.clone())
     .serve(make_service_fn(move |_| {
-      let pact = pact.clone();
+      let routes = routes.clone();
       let matches = matches.clone();
-      let mock_server = mock_server.clone();
+      let mock_server = server_mock_server.clone();
+      let stats = stats.clone();
 
       async {
         Ok::<_, hyper::Error>(
           service_fn(move |req| {
-            let pact = pact.clone();
+            let routes = routes.clone();
             let matches = matches.clone();
             let mock_server = mock_server.clone();
+            let stats = stats.clone();
 
-            async {
-              handle_mock_request_error(
-                handle_request(req, pact, matches, mock_server).await
-              )
+            async move {
+              let start = Instant::now();
+              let result = handle_request(req, routes, matches, mock_server).await;
+              stats.record(start.elapsed());
+              handle_mock_request_error(result)
             }
           })
         )
       }
     }));
 
+  let (signal, signalled) = drain_signal(shutdown);
+
   Ok((
     // This is the future that drives the server:
-    async {
-      let _ = server
-        .with_graceful_shutdown(shutdown)
-        .await;
-    },
+    drain_connections(server.with_graceful_shutdown(signal), signalled, connections, mock_server),
     socket_addr
   ))
 }
 
 #[cfg(test)]
 mod tests {
+  use std::time::Duration;
+
   use expectest::expect;
   use expectest::prelude::*;
   use hyper::header::{ACCEPT, CONTENT_TYPE, USER_AGENT};
   use hyper::HeaderMap;
   use pact_models::prelude::RequestResponsePact;
+  use tokio::io::AsyncWriteExt;
+  use tokio::net::TcpStream;
 
   use super::*;
 
   #[tokio::test]
   async fn can_fetch_results_on_current_thread() {
     let (shutdown_tx, shutdown_rx) = futures::channel::oneshot::channel();
-    let matches = Arc::new(Mutex::new(vec![]));
+    let matches = Arc::new(Mutex::new(MatchJournal::default()));
 
     let (future, _) = create_and_bind(
-      RequestResponsePact::default().boxed(),
+      RequestResponsePact::default().arced(),
       ([0, 0, 0, 0], 0 as u16).into(),
       async {
           shutdown_rx.await.ok();
@@ -502,10 +689,53 @@ mod tests {
     join_handle.await.unwrap();
 
     // 0 matches have been produced
-    let all_matches = matches.lock().unwrap().clone();
+    let all_matches = matches.lock().unwrap().results();
     assert_eq!(all_matches, vec![]);
   }
 
+  #[tokio::test]
+  async fn shutdown_aborts_connections_that_have_not_drained_by_the_deadline() {
+    let (shutdown_tx, shutdown_rx) = futures::channel::oneshot::channel();
+    let mut mock_server = MockServer::default();
+    mock_server.config.drain_timeout = Some(Duration::from_millis(100));
+    let mock_server = Arc::new(Mutex::new(mock_server));
+
+    let (future, addr) = create_and_bind(
+      RequestResponsePact::default().arced(),
+      ([127, 0, 0, 1], 0 as u16).into(),
+      async {
+        shutdown_rx.await.ok();
+      },
+      Arc::new(Mutex::new(MatchJournal::default())),
+      mock_server.clone(),
+      &String::default()
+    ).await.unwrap();
+    let join_handle = tokio::task::spawn(future);
+
+    // The body of this request never completes, so its connection can not be drained
+    let mut stream = TcpStream::connect(addr).await.unwrap();
+    stream.write_all(b"POST / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 100\r\n\r\npartial").await.unwrap();
+    while mock_server.lock().unwrap().metrics.requests == 0 {
+      tokio::time::sleep(Duration::from_millis(10)).await;
+    }
+
+    shutdown_tx.send(()).unwrap();
+    tokio::time::timeout(Duration::from_secs(5), join_handle).await.unwrap().unwrap();
+
+    let metrics = mock_server.lock().unwrap().metrics.clone();
+    expect!(metrics.drained_connections).to(be_equal_to(0));
+    expect!(metrics.aborted_connections).to(be_equal_to(1));
+  }
+
+  #[test]
+  fn strip_session_prefix_test() {
+    expect!(strip_session_prefix("/path")).to(be_none());
+    expect!(strip_session_prefix("/_session/")).to(be_none());
+    expect!(strip_session_prefix("/_session/abc")).to(be_some().value(("abc".to_string(), "/".to_string())));
+    expect!(strip_session_prefix("/_session/abc/")).to(be_some().value(("abc".to_string(), "/".to_string())));
+    expect!(strip_session_prefix("/_session/abc/path/1")).to(be_some().value(("abc".to_string(), "/path/1".to_string())));
+  }
+
   #[test]
   fn handle_hyper_headers_with_multiple_values() {
     let mut headers = HeaderMap::new();
@@ -0,0 +1,1137 @@
+//!
+//! This module defines the journal of match results that a mock server collects, along with
+//! the approximate memory accounting used to keep it within any configured limits.
+//!
+
+use std::collections::hash_map::DefaultHasher;
+use std::collections::HashMap;
+use std::hash::{Hash, Hasher};
+use std::mem::size_of;
+use std::sync::{Arc, Mutex, OnceLock};
+use std::time::Duration;
+
+use pact_models::bodies::OptionalBody;
+use pact_models::pact::Pact;
+use pact_models::v4::http_parts::{HttpRequest, HttpResponse};
+use serde_json::{json, Value};
+use tokio::sync::watch;
+use tracing::{debug, trace, warn};
+
+use crate::matching::MatchResult;
+
+/// Entry stored in the match journal
+#[derive(Debug, Clone)]
+pub struct JournalEntry {
+  /// Sequence number of the entry. Sequence numbers start at 1, and are never reused for a
+  /// journal (even if it is reset).
+  pub sequence: u64,
+  /// Result of matching the received request
+  pub result: MatchResult,
+  /// Session the request was received for
+  pub session: Option<String>,
+  /// Approximate number of bytes held by this entry
+  pub size: usize,
+  /// If the request was not expected, and was forwarded to the proxy upstream (which records it as
+  /// a candidate interaction), so is not a mismatch
+  pub proxied: bool,
+  /// JSON form of the match result, rendered the first time it is required
+  rendered: OnceLock<Value>
+}
+
+impl PartialEq for JournalEntry {
+  fn eq(&self, other: &Self) -> bool {
+    self.sequence == other.sequence && self.result == other.result && self.session == other.session &&
+      self.size == other.size && self.proxied == other.proxied
+  }
+}
+
+impl JournalEntry {
+  /// Returns the JSON form of the match result (see `MatchResult::to_json`). This is rendered the
+  /// first time it is required and then cached with the entry, so verifying a mock server
+  /// repeatedly does not render the same mismatches each time.
+  pub fn result_json(&self) -> &Value {
+    self.rendered.get_or_init(|| self.result.to_json())
+  }
+
+  /// If this entry is a mismatch. Matched requests, CORS pre-flight requests and proxied requests
+  /// are not mismatches.
+  pub fn is_mismatch(&self) -> bool {
+    !self.result.matched() && !self.result.cors_preflight() && !self.proxied
+  }
+
+  /// Converts this entry to a JSON event, as published by the event streams
+  pub fn to_json(&self) -> Value {
+    let mut json = self.result_json().clone();
+    if let (Value::Object(map), MatchResult::RequestMatch(request, _, _)) = (&mut json, &self.result) {
+      map.insert("method".to_string(), json!(request.method));
+      map.insert("path".to_string(), json!(request.path));
+    }
+    json!({
+      "sequence": self.sequence,
+      "session": self.session,
+      "matched": self.result.matched(),
+      "proxied": self.proxied,
+      "result": json
+    })
+  }
+}
+
+/// Journal of the match results for a mock server. If a limit is set, the journal will be
+/// compacted once its approximate size goes over the limit.
+#[derive(Debug, Clone)]
+pub struct MatchJournal {
+  entries: Vec<JournalEntry>,
+  size: usize,
+  limit: Option<usize>,
+  compactions: usize,
+  /// Size the journal has to grow past before it is compacted again, when the last compaction
+  /// could not get it down to its target (0 if the last compaction did)
+  next_compaction: usize,
+  evicted: usize,
+  /// Counts of the requests received by the journal
+  counts: JournalCounts,
+  /// Counts of the requests received for each session, so a session can be reset without
+  /// recounting the entries that are left (some of which may have been compacted out)
+  session_counts: HashMap<String, JournalCounts>,
+  /// Sequence number of the last entry appended
+  last_sequence: u64,
+  /// Publishes the last sequence number whenever an entry is appended
+  appended: Arc<watch::Sender<u64>>
+}
+
+impl Default for MatchJournal {
+  fn default() -> Self {
+    let (appended, _) = watch::channel(0);
+    MatchJournal {
+      entries: vec![],
+      size: 0,
+      limit: None,
+      compactions: 0,
+      next_compaction: 0,
+      evicted: 0,
+      counts: JournalCounts::default(),
+      session_counts: HashMap::new(),
+      last_sequence: 0,
+      appended: Arc::new(appended)
+    }
+  }
+}
+
+/// Counts of the requests received by a journal, for the journal as a whole or for one session.
+/// These are kept separately from the entries, as compacting the journal removes all but the first
+/// match for each expected request, and evicts the oldest mismatches.
+#[derive(Debug, Clone, Default)]
+pub(crate) struct JournalCounts {
+  /// Number of matched requests
+  matched: usize,
+  /// Number of requests that did not match their expected request
+  mismatched: usize,
+  /// Number of unexpected requests, apart from CORS pre-flight requests
+  not_found: usize,
+  /// Number of unexpected CORS pre-flight requests
+  cors_preflight: usize,
+  /// Number of unexpected requests that were forwarded to the proxy upstream
+  proxied: usize,
+  /// Number of requests received for each expected request (matched or not)
+  received_expected: HashedMap<HttpRequest, usize>,
+  /// Number of matches for each expected request
+  request_matches: HashedMap<HttpRequest, usize>,
+  /// Number of mismatches that have been evicted
+  evicted_mismatches: usize,
+  /// Number of evicted mismatches for each expected request, so they can be attributed to the
+  /// pact with the request
+  evicted_request_mismatches: HashedMap<HttpRequest, usize>
+}
+
+impl JournalCounts {
+  /// Counts a match result
+  fn count(&mut self, result: &MatchResult, proxied: bool) {
+    let expected = match result {
+      MatchResult::RequestMatch(expected, _, _) => {
+        self.matched += 1;
+        *self.request_matches.get_or_default(expected) += 1;
+        Some(expected)
+      }
+      MatchResult::RequestMismatch(expected, _, _) => {
+        self.mismatched += 1;
+        Some(expected)
+      }
+      MatchResult::RequestNotFound(_) if result.cors_preflight() => {
+        self.cors_preflight += 1;
+        None
+      }
+      MatchResult::RequestNotFound(_) if proxied => {
+        self.proxied += 1;
+        None
+      }
+      MatchResult::RequestNotFound(_) => {
+        self.not_found += 1;
+        None
+      }
+      MatchResult::MissingRequest(_) => None
+    };
+    if let Some(expected) = expected {
+      *self.received_expected.get_or_default(expected) += 1;
+    }
+  }
+
+  /// Counts a mismatch that has been evicted from the journal
+  fn count_evicted(&mut self, result: &MatchResult) {
+    self.evicted_mismatches += 1;
+    if let MatchResult::RequestMismatch(expected, _, _) = result {
+      *self.evicted_request_mismatches.get_or_default(expected) += 1;
+    }
+  }
+
+  /// Takes the counts of a session away from these counts
+  fn subtract(&mut self, other: &JournalCounts) {
+    self.matched -= other.matched;
+    self.mismatched -= other.mismatched;
+    self.not_found -= other.not_found;
+    self.cors_preflight -= other.cors_preflight;
+    self.proxied -= other.proxied;
+    self.evicted_mismatches -= other.evicted_mismatches;
+    subtract_counts(&mut self.received_expected, &other.received_expected);
+    subtract_counts(&mut self.request_matches, &other.request_matches);
+    subtract_counts(&mut self.evicted_request_mismatches, &other.evicted_request_mismatches);
+  }
+
+  /// If the expected request has received a request (matched or not)
+  pub(crate) fn has_received(&self, expected: &HttpRequest) -> bool {
+    self.received_expected.contains_key(expected)
+  }
+
+  /// Number of times the expected request has been matched
+  pub(crate) fn request_matches(&self, expected: &HttpRequest) -> usize {
+    self.request_matches.get(expected).copied().unwrap_or_default()
+  }
+
+  fn satisfies(&self, condition: &WaitCondition) -> bool {
+    match condition {
+      WaitCondition::Matches(count) => self.matched >= *count,
+      WaitCondition::RequestMatches(request, count) => self.request_matches(request) >= *count,
+      WaitCondition::Session(_, condition) => self.satisfies(condition)
+    }
+  }
+}
+
+fn subtract_counts(counts: &mut HashedMap<HttpRequest, usize>, other: &HashedMap<HttpRequest, usize>) {
+  for (key, count) in other.iter() {
+    let value = counts.get_or_default(key);
+    *value = value.saturating_sub(*count);
+  }
+  counts.retain(|_, count| *count > 0);
+}
+
+/// Condition to wait for with `wait_for_matches`
+#[derive(Debug, Clone, PartialEq)]
+pub enum WaitCondition {
+  /// Wait until the given number of requests have been matched
+  Matches(usize),
+  /// Wait until the expected request has been matched the given number of times
+  RequestMatches(HttpRequest, usize),
+  /// Wait until the condition has been satisfied by the requests received for the session,
+  /// ignoring the requests for any other session
+  Session(String, Box<WaitCondition>)
+}
+
+impl WaitCondition {
+  /// Scopes the condition to the requests received for the session
+  pub fn for_session(self, session: &str) -> WaitCondition {
+    match self {
+      WaitCondition::Session(_, condition) => WaitCondition::Session(session.to_string(), condition),
+      condition => WaitCondition::Session(session.to_string(), Box::new(condition))
+    }
+  }
+}
+
+impl MatchJournal {
+  /// Creates a new, empty journal with an optional size limit (in bytes)
+  pub fn new(limit: Option<usize>) -> Self {
+    MatchJournal {
+      limit,
+      .. MatchJournal::default()
+    }
+  }
+
+  /// Appends a match result to the journal, compacting the journal if it is now over its limit
+  pub fn push(&mut self, result: MatchResult) {
+    self.push_for_session(result, None)
+  }
+
+  /// Appends a match result received for a session to the journal, compacting the journal if it
+  /// is now over its limit
+  pub fn push_for_session(&mut self, result: MatchResult, session: Option<String>) {
+    self.append(result, session, false)
+  }
+
+  /// Appends the result for an unexpected request that was forwarded to the proxy upstream. These
+  /// are journaled, but are not mismatches.
+  pub fn push_proxied(&mut self, result: MatchResult, session: Option<String>) {
+    self.append(result, session, true)
+  }
+
+  fn append(&mut self, result: MatchResult, session: Option<String>, proxied: bool) {
+    let size = estimate_match_size(&result) + session.as_ref().map(|s| s.len()).unwrap_or_default();
+    self.size += size;
+    self.last_sequence += 1;
+    self.count(&result, session.as_deref(), proxied);
+    self.entries.push(JournalEntry {
+      sequence: self.last_sequence,
+      result,
+      session,
+      size,
+      proxied,
+      rendered: OnceLock::new()
+    });
+
+    if let Some(limit) = self.limit {
+      if self.size > limit.max(self.next_compaction) {
+        self.compact(limit);
+      }
+    }
+
+    self.appended.send_replace(self.last_sequence);
+  }
+
+  /// Updates the counters for a match result, for the journal and the session it was received for
+  fn count(&mut self, result: &MatchResult, session: Option<&str>, proxied: bool) {
+    self.counts.count(result, proxied);
+    if let Some(session) = session {
+      match self.session_counts.get_mut(session) {
+        Some(counts) => counts.count(result, proxied),
+        None => {
+          let mut counts = JournalCounts::default();
+          counts.count(result, proxied);
+          self.session_counts.insert(session.to_string(), counts);
+        }
+      }
+    }
+  }
+
+  /// Appends a match result restored from a journal export, keeping its original sequence number
+  /// (as long as it is after the last entry in the journal), so cursors held by clients remain
+  /// valid after the journal is restored
+  pub fn push_restored(&mut self, sequence: u64, result: MatchResult, session: Option<String>, proxied: bool) {
+    if sequence > self.last_sequence + 1 {
+      self.last_sequence = sequence - 1;
+    }
+    self.append(result, session, proxied)
+  }
+
+  /// Moves the last sequence number on to `sequence` (it is never moved back), so the entries
+  /// appended to a restored journal carry on from the sequence numbers of the journal it was
+  /// restored from, even if its last entries were not exported
+  pub fn continue_from(&mut self, sequence: u64) {
+    self.last_sequence = self.last_sequence.max(sequence);
+  }
+
+  /// Swaps in an empty journal with the same limit, returning the previous one. Sequence numbers
+  /// carry on from the previous journal, and any subscribers remain subscribed.
+  pub fn reset(&mut self) -> MatchJournal {
+    let journal = MatchJournal {
+      limit: self.limit,
+      last_sequence: self.last_sequence,
+      appended: self.appended.clone(),
+      .. MatchJournal::default()
+    };
+    std::mem::replace(self, journal)
+  }
+
+  /// Sequence number of the last entry appended to the journal
+  pub fn last_sequence(&self) -> u64 {
+    self.last_sequence
+  }
+
+  /// Number of requests that have been matched
+  pub fn matched(&self) -> usize {
+    self.counts.matched
+  }
+
+  /// Number of requests that did not match their expected request
+  pub fn mismatched(&self) -> usize {
+    self.counts.mismatched
+  }
+
+  /// Number of unexpected requests, apart from CORS pre-flight requests
+  pub fn not_found(&self) -> usize {
+    self.counts.not_found
+  }
+
+  /// Number of unexpected CORS pre-flight requests
+  pub fn cors_preflight(&self) -> usize {
+    self.counts.cors_preflight
+  }
+
+  /// Number of unexpected requests that were forwarded to the proxy upstream
+  pub fn proxied(&self) -> usize {
+    self.counts.proxied
+  }
+
+  /// Number of distinct expected requests that have received a request (matched or not)
+  pub fn received_expected(&self) -> usize {
+    self.counts.received_expected.len()
+  }
+
+  /// If the expected request has received a request (matched or not)
+  pub fn has_received(&self, expected: &HttpRequest) -> bool {
+    self.counts.has_received(expected)
+  }
+
+  /// Subscribes to the journal, returning a receiver that is notified with the last sequence
+  /// number whenever an entry is appended
+  pub fn subscribe(&self) -> watch::Receiver<u64> {
+    self.appended.subscribe()
+  }
+
+  /// Number of times the expected request has been matched. This includes matches that have been
+  /// compacted out of the journal.
+  pub fn request_matches(&self, expected: &HttpRequest) -> usize {
+    self.counts.request_matches(expected)
+  }
+
+  /// Counts of the requests received by the journal
+  pub(crate) fn counts(&self) -> &JournalCounts {
+    &self.counts
+  }
+
+  /// Counts of the requests received for the session, if any have been
+  pub(crate) fn session_counts(&self, session: &str) -> Option<&JournalCounts> {
+    self.session_counts.get(session)
+  }
+
+  /// If the condition has been satisfied by the requests received by the journal
+  pub fn satisfies(&self, condition: &WaitCondition) -> bool {
+    match condition {
+      WaitCondition::Session(session, condition) => match self.session_counts.get(session) {
+        Some(counts) => counts.satisfies(condition),
+        None => JournalCounts::default().satisfies(condition)
+      },
+      _ => self.counts.satisfies(condition)
+    }
+  }
+
+  /// Number of requests that have been matched for the session
+  pub fn session_matched(&self, session: &str) -> usize {
+    self.session_counts.get(session).map(|counts| counts.matched).unwrap_or_default()
+  }
+
+  /// Removes all the entries for the given session, returning them as a new journal. The counts
+  /// for the session (including any for entries that have been compacted out of the journal) are
+  /// moved to the new journal.
+  pub fn reset_session(&mut self, session: &str) -> MatchJournal {
+    let (removed, retained): (Vec<JournalEntry>, Vec<JournalEntry>) = std::mem::take(&mut self.entries)
+      .into_iter()
+      .partition(|entry| entry.session.as_deref() == Some(session));
+    let removed_size = removed.iter().map(|entry| entry.size).sum::<usize>();
+    let counts = self.session_counts.remove(session).unwrap_or_default();
+    self.counts.subtract(&counts);
+    let mut session_counts = HashMap::new();
+    session_counts.insert(session.to_string(), counts.clone());
+    let session_journal = MatchJournal {
+      entries: removed,
+      size: removed_size,
+      limit: self.limit,
+      counts,
+      session_counts,
+      .. MatchJournal::default()
+    };
+
+    self.entries = retained;
+    self.size -= removed_size;
+    self.next_compaction = 0;
+    session_journal
+  }
+
+  /// Returns the entries with a sequence number greater than `since`. As sequence numbers are
+  /// ascending, this is a binary search and does not scan the older entries.
+  pub fn entries_since(&self, since: u64) -> &[JournalEntry] {
+    let start = self.entries.partition_point(|entry| entry.sequence <= since);
+    &self.entries[start..]
+  }
+
+  /// Returns the entries for the given session
+  pub fn session_entries<'a>(&'a self, session: &'a str) -> impl Iterator<Item = &'a JournalEntry> + Clone + 'a {
+    self.entries.iter().filter(move |entry| entry.session.as_deref() == Some(session))
+  }
+
+  /// Returns the IDs of all the sessions that have entries in the journal
+  pub fn sessions(&self) -> Vec<String> {
+    let mut sessions: Vec<String> = vec![];
+    for session in self.entries.iter().filter_map(|entry| entry.session.as_ref()) {
+      if !sessions.contains(session) {
+        sessions.push(session.clone());
+      }
+    }
+    sessions
+  }
+
+  /// All the entries in the journal
+  pub fn entries(&self) -> &[JournalEntry] {
+    self.entries.as_slice()
+  }
+
+  /// Returns a copy of all the match results in the journal
+  pub fn results(&self) -> Vec<MatchResult> {
+    self.entries.iter().map(|entry| entry.result.clone()).collect()
+  }
+
+  /// Number of entries in the journal
+  pub fn len(&self) -> usize {
+    self.entries.len()
+  }
+
+  /// If the journal has no entries
+  pub fn is_empty(&self) -> bool {
+    self.entries.is_empty()
+  }
+
+  /// Approximate number of bytes held by the journal
+  pub fn size(&self) -> usize {
+    self.size
+  }
+
+  /// Size limit of the journal in bytes, if one is set
+  pub fn limit(&self) -> Option<usize> {
+    self.limit
+  }
+
+  /// Number of times the journal has been compacted
+  pub fn compactions(&self) -> usize {
+    self.compactions
+  }
+
+  /// Total number of entries that have been evicted from the journal
+  pub fn evicted(&self) -> usize {
+    self.evicted
+  }
+
+  /// Number of mismatches that have been evicted from the journal. If this is not zero, the
+  /// mock server can not be considered as having matched all requests.
+  pub fn evicted_mismatches(&self) -> usize {
+    self.counts.evicted_mismatches
+  }
+
+  /// Number of mismatches for the given session that have been evicted from the journal
+  pub fn evicted_session_mismatches(&self, session: &str) -> usize {
+    self.session_counts.get(session).map(|counts| counts.evicted_mismatches).unwrap_or(0)
+  }
+
+  /// Number of evicted mismatches of requests against the expected requests selected by the
+  /// predicate. Evicted unexpected requests are not included, as they have no expected request.
+  pub fn evicted_request_mismatches(&self, expected: impl Fn(&HttpRequest) -> bool) -> usize {
+    self.counts.evicted_request_mismatches.iter()
+      .filter(|(request, _)| expected(request))
+      .map(|(_, count)| *count)
+      .sum()
+  }
+
+  /// Compacts the journal down to three quarters of the limit. Matched entries are reduced first
+  /// (their bodies are not needed to verify the mock server, and only the first match for each
+  /// expected request in each session is), then the oldest mismatches are evicted. If the journal can still not
+  /// get down to the target, the next compaction is put off until the journal has grown by another
+  /// quarter of the limit, rather than rescanning the journal on every push.
+  fn compact(&mut self, limit: usize) {
+    let target = limit / 4 * 3;
+    debug!("Compacting match journal ({} bytes, limit {} bytes)", self.size, limit);
+    self.compactions += 1;
+
+    for entry in self.entries.iter_mut() {
+      if let MatchResult::RequestMatch(_, response, actual) = &mut entry.result {
+        let stripped_request = strip_body(&mut actual.body);
+        let stripped_response = strip_body(&mut response.body);
+        if stripped_request || stripped_response {
+          entry.rendered = OnceLock::new();
+          self.size -= entry.size;
+          entry.size = estimate_match_size(&entry.result);
+          self.size += entry.size;
+        }
+      }
+    }
+
+    if self.size > target {
+      let mut seen = HashedSet::default();
+      let mut size = self.size;
+      let mut evicted = 0;
+      self.entries.retain(|entry| {
+        if let MatchResult::RequestMatch(expected, _, _) = &entry.result {
+          if !seen.insert((entry.session.clone(), expected.clone())) {
+            size -= entry.size;
+            evicted += 1;
+            return false;
+          }
+        }
+        true
+      });
+      self.size = size;
+      self.evicted += evicted;
+    }
+
+    if self.size > target {
+      let mut size = self.size;
+      let mut evicted = 0;
+      let mut evicted_mismatches = 0;
+      let counts = &mut self.counts;
+      let session_counts = &mut self.session_counts;
+      self.entries.retain(|entry| {
+        if size > target && !entry.result.matched() {
+          size -= entry.size;
+          evicted += 1;
+          if entry.is_mismatch() {
+            evicted_mismatches += 1;
+            counts.count_evicted(&entry.result);
+            if let Some(counts) = entry.session.as_ref().and_then(|session| session_counts.get_mut(session)) {
+              counts.count_evicted(&entry.result);
+            }
+          }
+          false
+        } else {
+          true
+        }
+      });
+      if evicted_mismatches > 0 {
+        warn!("Match journal is over its limit of {} bytes, evicted {} mismatches", limit, evicted_mismatches);
+      }
+      self.size = size;
+      self.evicted += evicted;
+    }
+
+    self.next_compaction = if self.size > target { self.size + limit / 4 } else { 0 };
+    self.entries.shrink_to_fit();
+  }
+}
+
+/// Map keyed by values that implement `Hash` and `PartialEq` but not `Eq` (like `HttpRequest`), so
+/// can not be used as keys of a `HashMap`. Keys are bucketed by their hash, and only compared
+/// with the other keys in their bucket.
+#[derive(Debug, Clone)]
+pub(crate) struct HashedMap<K, V> {
+  buckets: HashMap<u64, Vec<(K, V)>>,
+  len: usize
+}
+
+/// Set of values that implement `Hash` and `PartialEq` but not `Eq` (see `HashedMap`)
+pub(crate) type HashedSet<K> = HashedMap<K, ()>;
+
+impl <K, V> Default for HashedMap<K, V> {
+  fn default() -> Self {
+    HashedMap { buckets: HashMap::new(), len: 0 }
+  }
+}
+
+impl <K: Hash + PartialEq, V> HashedMap<K, V> {
+  fn hash_of(key: &K) -> u64 {
+    let mut hasher = DefaultHasher::new();
+    key.hash(&mut hasher);
+    hasher.finish()
+  }
+
+  /// Returns the value for the key
+  pub(crate) fn get(&self, key: &K) -> Option<&V> {
+    self.buckets.get(&Self::hash_of(key))
+      .and_then(|bucket| bucket.iter().find(|(k, _)| k == key))
+      .map(|(_, value)| value)
+  }
+
+  /// If the map has the key
+  pub(crate) fn contains_key(&self, key: &K) -> bool {
+    self.get(key).is_some()
+  }
+
+  /// Returns the value for the key, inserting the default value first if the map does not have it
+  pub(crate) fn get_or_default(&mut self, key: &K) -> &mut V where K: Clone, V: Default {
+    let bucket = self.buckets.entry(Self::hash_of(key)).or_default();
+    let index = match bucket.iter().position(|(k, _)| k == key) {
+      Some(index) => index,
+      None => {
+        bucket.push((key.clone(), V::default()));
+        self.len += 1;
+        bucket.len() - 1
+      }
+    };
+    &mut bucket[index].1
+  }
+
+  /// Number of keys in the map
+  pub(crate) fn len(&self) -> usize {
+    self.len
+  }
+
+  /// Iterates over the keys and values of the map, in no particular order
+  pub(crate) fn iter(&self) -> impl Iterator<Item = (&K, &V)> {
+    self.buckets.values().flat_map(|bucket| bucket.iter().map(|(k, v)| (k, v)))
+  }
+
+  /// Removes the keys the predicate returns false for
+  pub(crate) fn retain(&mut self, mut f: impl FnMut(&K, &mut V) -> bool) {
+    let mut len = 0;
+    self.buckets.retain(|_, bucket| {
+      bucket.retain_mut(|(k, v)| f(k, v));
+      len += bucket.len();
+      !bucket.is_empty()
+    });
+    self.len = len;
+  }
+}
+
+impl <K: Hash + PartialEq> HashedMap<K, ()> {
+  /// Adds the value to the set, returning false if it was already in the set
+  pub(crate) fn insert(&mut self, key: K) -> bool {
+    let bucket = self.buckets.entry(Self::hash_of(&key)).or_default();
+    if bucket.iter().any(|(k, _)| *k == key) {
+      false
+    } else {
+      bucket.push((key, ()));
+      self.len += 1;
+      true
+    }
+  }
+}
+
+/// Waits until the condition has been satisfied by the journal, or the timeout expires. Waiters
+/// are woken whenever an entry is appended to the journal, so the journal is not polled. Returns
+/// true if the condition was satisfied.
+pub async fn wait_for_matches(
+  journal: Arc<Mutex<MatchJournal>>,
+  condition: WaitCondition,
+  timeout: Duration
+) -> bool {
+  let mut receiver = journal.lock().unwrap().subscribe();
+  let wait = async {
+    loop {
+      let satisfied = journal.lock().unwrap().satisfies(&condition);
+      if satisfied {
+        return true;
+      }
+      if receiver.changed().await.is_err() {
+        return false;
+      }
+      trace!("Journal has been appended to, checking wait condition {:?}", condition);
+    }
+  };
+  tokio::time::timeout(timeout, wait).await.unwrap_or(false)
+}
+
+fn strip_body(body: &mut OptionalBody) -> bool {
+  if body.is_present() {
+    *body = OptionalBody::Empty;
+    true
+  } else {
+    false
+  }
+}
+
+fn estimate_body_size(body: &OptionalBody) -> usize {
+  match body {
+    OptionalBody::Present(bytes, _, _) => bytes.len(),
+    _ => 0
+  }
+}
+
+/// Approximate number of bytes held by a request
+pub(crate) fn estimate_request_size(request: &HttpRequest) -> usize {
+  let query = request.query.as_ref()
+    .map(|query| query.iter()
+      .map(|(k, v)| k.len() + v.iter().map(|v| v.as_ref().map(|v| v.len()).unwrap_or_default()).sum::<usize>())
+      .sum::<usize>())
+    .unwrap_or_default();
+  let headers = request.headers.as_ref()
+    .map(|headers| headers.iter()
+      .map(|(k, v)| k.len() + v.iter().map(|v| v.len()).sum::<usize>())
+      .sum::<usize>())
+    .unwrap_or_default();
+  size_of::<HttpRequest>() + request.method.len() + request.path.len() + query + headers +
+    estimate_body_size(&request.body)
+}
+
+/// Approximate number of bytes held by a response
+pub(crate) fn estimate_response_size(response: &HttpResponse) -> usize {
+  let headers = response.headers.as_ref()
+    .map(|headers| headers.iter()
+      .map(|(k, v)| k.len() + v.iter().map(|v| v.len()).sum::<usize>())
+      .sum::<usize>())
+    .unwrap_or_default();
+  size_of::<HttpResponse>() + headers + estimate_body_size(&response.body)
+}
+
+/// Approximate number of bytes held by a match result
+pub(crate) fn estimate_match_size(result: &MatchResult) -> usize {
+  size_of::<JournalEntry>() + match result {
+    MatchResult::RequestMatch(expected, response, actual) =>
+      estimate_request_size(expected) + estimate_response_size(response) + estimate_request_size(actual),
+    MatchResult::RequestMismatch(expected, actual, mismatches) =>
+      estimate_request_size(expected) + estimate_request_size(actual) +
+        mismatches.iter().map(|m| m.description().len()).sum::<usize>(),
+    MatchResult::RequestNotFound(actual) => estimate_request_size(actual),
+    MatchResult::MissingRequest(expected) => estimate_request_size(expected)
+  }
+}
+
+/// Approximate number of bytes held by a Pact. Only HTTP interactions are accounted for.
+pub(crate) fn estimate_pact_size(pact: &dyn Pact) -> usize {
+  pact.interactions().iter()
+    .map(|interaction| interaction.description().len() + match interaction.as_v4_http() {
+      Some(http) => estimate_request_size(&http.request) + estimate_response_size(&http.response),
+      None => 0
+    })
+    .sum()
+}
+
+#[cfg(test)]
+mod tests {
+  use expectest::prelude::*;
+  use pact_models::bodies::OptionalBody;
+  use pact_models::v4::http_parts::{HttpRequest, HttpResponse};
+
+  use crate::matching::MatchResult;
+
+  use super::*;
+
+  #[test]
+  fn journal_accounts_for_the_size_of_its_entries() {
+    let mut journal = MatchJournal::new(None);
+    expect!(journal.size()).to(be_equal_to(0));
+
+    let request = HttpRequest { body: OptionalBody::Present("0123456789".into(), None, None), .. HttpRequest::default() };
+    journal.push(MatchResult::RequestNotFound(request.clone()));
+    expect!(journal.len()).to(be_equal_to(1));
+    expect!(journal.size()).to(be_greater_or_equal_to(estimate_request_size(&request)));
+  }
+
+  #[test]
+  fn journal_compacts_matches_when_over_the_limit() {
+    let expected = HttpRequest { path: "/test".to_string(), .. HttpRequest::default() };
+    let actual = HttpRequest {
+      path: "/test".to_string(),
+      body: OptionalBody::Present(vec![b'x'; 4096].into(), None, None),
+      .. HttpRequest::default()
+    };
+    let result = MatchResult::RequestMatch(expected.clone(), HttpResponse::default(), actual);
+    let mut journal = MatchJournal::new(Some(estimate_match_size(&result) * 2));
+
+    journal.push(result.clone());
+    journal.push(result.clone());
+    journal.push(result.clone());
+
+    expect!(journal.compactions()).to(be_greater_than(0));
+    expect!(journal.evicted_mismatches()).to(be_equal_to(0));
+    expect!(journal.results().iter().all(|r| r.matched())).to(be_true());
+    expect!(journal.size()).to(be_less_or_equal_to(estimate_match_size(&result) * 2));
+  }
+
+  #[test]
+  fn journal_keeps_the_first_match_for_each_session_when_compacting() {
+    let request = HttpRequest { path: "/test".to_string(), .. HttpRequest::default() };
+    let result = MatchResult::RequestMatch(request.clone(), HttpResponse::default(), request);
+    let mut journal = MatchJournal::new(Some(estimate_match_size(&result) * 4));
+
+    for _ in 0..3 {
+      journal.push_for_session(result.clone(), Some("a".to_string()));
+      journal.push_for_session(result.clone(), Some("b".to_string()));
+    }
+
+    expect!(journal.compactions()).to(be_greater_than(0));
+    expect!(journal.session_entries("a").count()).to(be_greater_than(0));
+    expect!(journal.session_entries("b").count()).to(be_greater_than(0));
+  }
+
+  #[test]
+  fn journal_counts_matches_that_have_been_compacted() {
+    let request = HttpRequest { path: "/test".to_string(), .. HttpRequest::default() };
+    let result = MatchResult::RequestMatch(request.clone(), HttpResponse::default(), request.clone());
+    let mut journal = MatchJournal::new(Some(estimate_match_size(&result) * 2));
+
+    for _ in 0..5 {
+      journal.push(result.clone());
+    }
+
+    expect!(journal.len()).to(be_less_than(5));
+    expect!(journal.request_matches(&request)).to(be_equal_to(5));
+    expect!(journal.satisfies(&WaitCondition::RequestMatches(request.clone(), 5))).to(be_true());
+    expect!(journal.satisfies(&WaitCondition::RequestMatches(request, 6))).to(be_false());
+  }
+
+  #[test]
+  fn proxied_requests_are_not_mismatches() {
+    let request = HttpRequest { path: "/unexpected".to_string(), .. HttpRequest::default() };
+    let mut journal = MatchJournal::new(None);
+    journal.push_proxied(MatchResult::RequestNotFound(request.clone()), None);
+    journal.push(MatchResult::RequestNotFound(request));
+
+    expect!(journal.proxied()).to(be_equal_to(1));
+    expect!(journal.not_found()).to(be_equal_to(1));
+    expect!(journal.entries()[0].is_mismatch()).to(be_false());
+    expect!(journal.entries()[1].is_mismatch()).to(be_true());
+  }
+
+  #[test]
+  fn journal_can_continue_from_a_restored_sequence_number() {
+    let mut journal = MatchJournal::new(None);
+    journal.push_restored(3, MatchResult::RequestNotFound(HttpRequest::default()), None, false);
+    journal.continue_from(10);
+    journal.continue_from(5);
+    journal.push(MatchResult::RequestNotFound(HttpRequest::default()));
+    expect!(journal.last_sequence()).to(be_equal_to(11));
+  }
+
+  #[test]
+  fn hashed_set_only_inserts_a_value_once() {
+    let mut set = HashedSet::default();
+    let request = HttpRequest { path: "/test".to_string(), .. HttpRequest::default() };
+    expect!(set.insert((Some("a".to_string()), request.clone()))).to(be_true());
+    expect!(set.insert((Some("a".to_string()), request.clone()))).to(be_false());
+    expect!(set.insert((Some("b".to_string()), request.clone()))).to(be_true());
+    expect!(set.contains_key(&(None, request))).to(be_false());
+    expect!(set.len()).to(be_equal_to(2));
+  }
+
+  #[test]
+  fn journal_evicts_the_oldest_mismatches_as_a_last_resort() {
+    let request = HttpRequest {
+      path: "/unexpected".to_string(),
+      body: OptionalBody::Present(vec![b'x'; 4096].into(), None, None),
+      .. HttpRequest::default()
+    };
+    let result = MatchResult::RequestNotFound(request);
+    let mut journal = MatchJournal::new(Some(estimate_match_size(&result) * 2));
+
+    journal.push(result.clone());
+    journal.push(result.clone());
+    journal.push(result.clone());
+
+    expect!(journal.len()).to(be_less_than(3));
+    expect!(journal.evicted_mismatches()).to(be_greater_than(0));
+  }
+
+  #[test]
+  fn journal_counts_evicted_mismatches_for_each_session() {
+    let request = HttpRequest {
+      path: "/unexpected".to_string(),
+      body: OptionalBody::Present(vec![b'x'; 4096].into(), None, None),
+      .. HttpRequest::default()
+    };
+    let result = MatchResult::RequestNotFound(request);
+    let mut journal = MatchJournal::new(Some(estimate_match_size(&result) * 2));
+
+    journal.push_for_session(result.clone(), Some("a".to_string()));
+    journal.push_for_session(result.clone(), Some("a".to_string()));
+    journal.push_for_session(result.clone(), Some("b".to_string()));
+
+    expect!(journal.evicted_session_mismatches("a")).to(be_greater_than(0));
+    expect!(journal.evicted_session_mismatches("b")).to(be_equal_to(0));
+
+    let evicted = journal.evicted_mismatches();
+    let session_journal = journal.reset_session("a");
+    expect!(session_journal.evicted_mismatches()).to(be_equal_to(evicted));
+    expect!(journal.evicted_mismatches()).to(be_equal_to(0));
+    expect!(journal.evicted_session_mismatches("a")).to(be_equal_to(0));
+  }
+
+  #[test]
+  fn journal_backs_off_compacting_when_it_can_not_get_under_the_target() {
+    let matches: Vec<MatchResult> = (0..14).map(|i| {
+      let request = HttpRequest { path: format!("/test/{:02}", i), .. HttpRequest::default() };
+      MatchResult::RequestMatch(request.clone(), HttpResponse::default(), request)
+    }).collect();
+    let mut journal = MatchJournal::new(Some(estimate_match_size(&matches[0]) * 10));
+
+    for result in &matches[..11] {
+      journal.push(result.clone());
+    }
+    expect!(journal.compactions()).to(be_equal_to(1));
+
+    // Distinct matches can not be compacted, so the next compaction waits for the journal to grow
+    // by another quarter of the limit
+    journal.push(matches[11].clone());
+    journal.push(matches[12].clone());
+    expect!(journal.compactions()).to(be_equal_to(1));
+    journal.push(matches[13].clone());
+    expect!(journal.compactions()).to(be_equal_to(2));
+    expect!(journal.len()).to(be_equal_to(matches.len()));
+  }
+
+  #[test]
+  fn journal_counts_evicted_mismatches_for_each_expected_request() {
+    let body = OptionalBody::Present(vec![b'x'; 4096].into(), None, None);
+    let orders = HttpRequest { path: "/orders".to_string(), .. HttpRequest::default() };
+    let users = HttpRequest { path: "/users".to_string(), .. HttpRequest::default() };
+    let mismatch = |expected: &HttpRequest| MatchResult::RequestMismatch(expected.clone(),
+      HttpRequest { body: body.clone(), .. expected.clone() }, vec![]);
+    let mut journal = MatchJournal::new(Some(estimate_match_size(&mismatch(&orders)) * 2));
+
+    journal.push(mismatch(&orders));
+    journal.push(mismatch(&orders));
+    journal.push(mismatch(&users));
+
+    let evicted_orders = journal.evicted_request_mismatches(|expected| expected.path == "/orders");
+    expect!(evicted_orders).to(be_greater_than(0));
+    expect!(journal.evicted_request_mismatches(|expected| expected.path == "/users")).to(be_equal_to(0));
+    expect!(journal.evicted_request_mismatches(|_| true)).to(be_equal_to(journal.evicted_mismatches()));
+  }
+
+  #[test]
+  fn journal_keeps_the_counts_of_other_sessions_when_a_compacted_session_is_reset() {
+    let body = OptionalBody::Present(vec![b'x'; 4096].into(), None, None);
+    let matched = HttpRequest { path: "/matched".to_string(), .. HttpRequest::default() };
+    let evicted = HttpRequest { path: "/evicted".to_string(), .. HttpRequest::default() };
+    let mismatched = HttpRequest { path: "/mismatched".to_string(), .. HttpRequest::default() };
+    let matches = MatchResult::RequestMatch(matched.clone(), HttpResponse::default(),
+      HttpRequest { body: body.clone(), .. matched.clone() });
+    let mismatch = |expected: &HttpRequest| MatchResult::RequestMismatch(expected.clone(),
+      HttpRequest { body: body.clone(), .. expected.clone() }, vec![]);
+    let mut journal = MatchJournal::new(Some(estimate_match_size(&mismatch(&mismatched)) * 2));
+
+    for _ in 0..3 {
+      journal.push_for_session(matches.clone(), Some("a".to_string()));
+      journal.push_for_session(matches.clone(), Some("b".to_string()));
+    }
+    journal.push_for_session(mismatch(&evicted), Some("b".to_string()));
+    journal.push_for_session(mismatch(&mismatched), Some("b".to_string()));
+    journal.push_for_session(mismatch(&mismatched), Some("b".to_string()));
+    expect!(journal.compactions()).to(be_greater_than(0));
+    expect!(journal.evicted_session_mismatches("b")).to(be_greater_than(0));
+
+    let removed = journal.reset_session("a");
+    expect!(removed.matched()).to(be_equal_to(3));
+    expect!(journal.matched()).to(be_equal_to(3));
+    expect!(journal.request_matches(&matched)).to(be_equal_to(3));
+    expect!(journal.mismatched()).to(be_equal_to(3));
+    expect!(journal.has_received(&matched)).to(be_true());
+    expect!(journal.has_received(&evicted)).to(be_true());
+    expect!(journal.satisfies(&WaitCondition::Matches(3))).to(be_true());
+    expect!(journal.satisfies(&WaitCondition::Matches(4))).to(be_false());
+
+    journal.reset_session("b");
+    expect!(journal.matched()).to(be_equal_to(0));
+    expect!(journal.received_expected()).to(be_equal_to(0));
+    expect!(journal.evicted_mismatches()).to(be_equal_to(0));
+  }
+
+  #[test]
+  fn journal_can_reset_a_single_session() {
+    let request = HttpRequest { path: "/unexpected".to_string(), .. HttpRequest::default() };
+    let result = MatchResult::RequestNotFound(request);
+    let mut journal = MatchJournal::new(None);
+
+    journal.push_for_session(result.clone(), Some("a".to_string()));
+    journal.push_for_session(result.clone(), Some("b".to_string()));
+    journal.push(result.clone());
+    expect!(journal.sessions()).to(be_equal_to(vec!["a".to_string(), "b".to_string()]));
+
+    let size = journal.size();
+    let removed = journal.reset_session("a");
+    expect!(removed.len()).to(be_equal_to(1));
+    expect!(journal.len()).to(be_equal_to(2));
+    expect!(journal.session_entries("a").count()).to(be_equal_to(0));
+    expect!(journal.session_entries("b").count()).to(be_equal_to(1));
+    expect!(journal.size() + removed.size()).to(be_equal_to(size));
+    expect!(journal.not_found()).to(be_equal_to(2));
+    expect!(removed.not_found()).to(be_equal_to(1));
+  }
+
+  #[test]
+  fn journal_tracks_the_received_requests_when_a_session_is_reset() {
+    let first = HttpRequest { path: "/first".to_string(), .. HttpRequest::default() };
+    let second = HttpRequest { path: "/second".to_string(), .. HttpRequest::default() };
+    let mut journal = MatchJournal::new(None);
+
+    journal.push_for_session(MatchResult::RequestMatch(first.clone(), HttpResponse::default(), first.clone()),
+      Some("a".to_string()));
+    journal.push_for_session(MatchResult::RequestMatch(second.clone(), HttpResponse::default(), second.clone()),
+      Some("b".to_string()));
+    expect!(journal.received_expected()).to(be_equal_to(2));
+
+    let removed = journal.reset_session("a");
+    expect!(journal.has_received(&first)).to(be_false());
+    expect!(journal.has_received(&second)).to(be_true());
+    expect!(journal.received_expected()).to(be_equal_to(1));
+    expect!(removed.has_received(&first)).to(be_true());
+  }
+
+  #[test]
+  fn journal_sequence_numbers_carry_on_after_a_reset() {
+    let result = MatchResult::RequestNotFound(HttpRequest::default());
+    let mut journal = MatchJournal::new(None);
+    journal.push(result.clone());
+    journal.push(result.clone());
+    expect!(journal.last_sequence()).to(be_equal_to(2));
+
+    let previous = journal.reset();
+    expect!(previous.len()).to(be_equal_to(2));
+    expect!(journal.is_empty()).to(be_true());
+    journal.push(result.clone());
+    expect!(journal.entries()[0].sequence).to(be_equal_to(3));
+  }
+
+  #[test]
+  fn journal_entries_since_returns_only_the_newer_entries() {
+    let result = MatchResult::RequestNotFound(HttpRequest::default());
+    let mut journal = MatchJournal::new(None);
+    for _ in 0..5 {
+      journal.push(result.clone());
+    }
+
+    let sequences = |entries: &[JournalEntry]| entries.iter().map(|e| e.sequence).collect::<Vec<u64>>();
+    expect!(sequences(journal.entries_since(0))).to(be_equal_to(vec![1, 2, 3, 4, 5]));
+    expect!(sequences(journal.entries_since(3))).to(be_equal_to(vec![4, 5]));
+    expect!(journal.entries_since(5).is_empty()).to(be_true());
+    expect!(journal.entries_since(100).is_empty()).to(be_true());
+  }
+
+  #[test]
+  fn journal_entry_json_is_only_rendered_once() {
+    let request = HttpRequest { path: "/unexpected".to_string(), .. HttpRequest::default() };
+    let mut journal = MatchJournal::new(None);
+    journal.push(MatchResult::RequestNotFound(request));
+
+    let entry = &journal.entries()[0];
+    let first = entry.result_json() as *const Value;
+    let second = entry.result_json() as *const Value;
+    expect!(first).to(be_equal_to(second));
+    expect!(entry.result_json()).to(be_equal_to(&entry.result.to_json()));
+  }
+
+  #[tokio::test]
+  async fn wait_for_matches_is_woken_when_the_journal_is_appended_to() {
+    let request = HttpRequest::default();
+    let result = MatchResult::RequestMatch(request.clone(), HttpResponse::default(), request.clone());
+    let journal = Arc::new(Mutex::new(MatchJournal::new(None)));
+
+    let waiter = tokio::spawn(wait_for_matches(journal.clone(), WaitCondition::Matches(2), Duration::from_secs(5)));
+    journal.lock().unwrap().push(result.clone());
+    journal.lock().unwrap().push(result.clone());
+    expect!(waiter.await.unwrap()).to(be_true());
+
+    let timed_out = wait_for_matches(journal.clone(), WaitCondition::RequestMatches(request, 3),
+      Duration::from_millis(10)).await;
+    expect!(timed_out).to(be_false());
+  }
+
+  #[tokio::test]
+  async fn wait_for_matches_for_a_session_ignores_the_matches_of_other_sessions() {
+    let expected = HttpRequest { path: "/test".to_string(), .. HttpRequest::default() };
+    let actual = HttpRequest {
+      body: OptionalBody::Present(vec![b'x'; 4096].into(), None, None),
+      .. expected.clone()
+    };
+    let result = MatchResult::RequestMatch(expected.clone(), HttpResponse::default(), actual);
+    let journal = Arc::new(Mutex::new(MatchJournal::new(Some(estimate_match_size(&result) * 2))));
+    {
+      let mut journal = journal.lock().unwrap();
+      for _ in 0..4 {
+        journal.push_for_session(result.clone(), Some("old".to_string()));
+      }
+      expect!(journal.compactions()).to(be_greater_than(0));
+    }
+
+    let condition = WaitCondition::Matches(2).for_session("new");
+    let timed_out = wait_for_matches(journal.clone(), condition.clone(), Duration::from_millis(10)).await;
+    expect!(timed_out).to(be_false());
+
+    let waiter = tokio::spawn(wait_for_matches(journal.clone(), condition, Duration::from_secs(5)));
+    journal.lock().unwrap().push_for_session(result.clone(), Some("new".to_string()));
+    journal.lock().unwrap().push_for_session(result.clone(), Some("new".to_string()));
+    expect!(waiter.await.unwrap()).to(be_true());
+    expect!(journal.lock().unwrap().session_matched("new")).to(be_equal_to(2));
+  }
+}
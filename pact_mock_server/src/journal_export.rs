@@ -0,0 +1,881 @@
+//!
+//! Compact binary export of a mock server's match journal, for analysing the requests received
+//! during a test run after it has completed.
+//!
+//! The export starts with a header (the magic bytes `PACTJNL\0`, a format version and a flags
+//! byte), followed by a stream of length-prefixed records. If the compressed flag is set, the
+//! records are written as a single zstd frame. There are two types of record:
+//!
+//! * String records add a string to the string table. Strings that repeat across requests (methods,
+//!   paths, header names and values, mismatch descriptions) are written once and then referred to
+//!   by their index in the table.
+//! * Entry records are a journal entry: the sequence number, session, kind of result, the index of
+//!   the expected interaction in the Pact, the actual request received, and the descriptions of
+//!   any mismatches.
+//!
+//! Both the writer and reader work a record at a time, so exports of any size are written and read
+//! in bounded memory. The same record format (with different magic bytes) is used for request
+//! capture files (see the `capture` module).
+//!
+
+use std::collections::HashMap;
+use std::fmt::{Display, Formatter};
+use std::io::{self, BufReader, BufWriter, Read, Write};
+use std::sync::{Arc, Mutex};
+
+use anyhow::anyhow;
+use bytes::Bytes;
+use pact_models::bodies::OptionalBody;
+use pact_models::content_types::ContentType;
+use pact_models::pact::Pact;
+use pact_models::PactSpecification;
+use pact_models::v4::http_parts::HttpRequest;
+use pact_models::v4::pact::V4Pact;
+use pact_models::v4::synch_http::SynchronousHttp;
+use serde_json::{json, Value};
+use tracing::debug;
+
+use crate::journal::{JournalEntry, MatchJournal};
+use crate::matching::{match_request, MatchResult};
+
+/// Magic bytes at the start of a journal export
+const MAGIC: &[u8; 8] = b"PACTJNL\0";
+/// Version of the file format
+const VERSION: u8 = 1;
+/// Flag set if the records are compressed
+const FLAG_COMPRESSED: u8 = 0x01;
+
+/// Record that adds a string to the string table
+const RECORD_STRING: u8 = 1;
+/// Record that is a journal entry
+pub(crate) const RECORD_ENTRY: u8 = 2;
+
+/// Maximum number of strings interned by the writer. Once the table is full, new strings are
+/// written inline, so the memory used by the writer stays bounded.
+const MAX_INTERNED_STRINGS: usize = 65536;
+/// Strings longer than this are always written inline
+const MAX_INTERNED_LENGTH: usize = 256;
+/// Number of journal entries copied out of the journal each time it is locked while exporting
+const EXPORT_BATCH: usize = 1024;
+
+/// The kind of result an exported entry is for
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum EntryKind {
+  /// The request matched an interaction
+  Matched,
+  /// The request was for an interaction, but did not match it
+  Mismatched,
+  /// The request was not expected
+  NotFound,
+  /// The expected request was not received
+  Missing,
+  /// The request was not expected, and was forwarded to the proxy upstream
+  Proxied
+}
+
+impl EntryKind {
+  fn from_u8(value: u8) -> Option<EntryKind> {
+    match value {
+      0 => Some(EntryKind::Matched),
+      1 => Some(EntryKind::Mismatched),
+      2 => Some(EntryKind::NotFound),
+      3 => Some(EntryKind::Missing),
+      4 => Some(EntryKind::Proxied),
+      _ => None
+    }
+  }
+
+  fn to_u8(&self) -> u8 {
+    match self {
+      EntryKind::Matched => 0,
+      EntryKind::Mismatched => 1,
+      EntryKind::NotFound => 2,
+      EntryKind::Missing => 3,
+      EntryKind::Proxied => 4
+    }
+  }
+}
+
+impl Display for EntryKind {
+  fn fmt(&self, f: &mut Formatter<'_>) -> std::fmt::Result {
+    match self {
+      EntryKind::Matched => write!(f, "request-match"),
+      EntryKind::Mismatched => write!(f, "request-mismatch"),
+      EntryKind::NotFound => write!(f, "request-not-found"),
+      EntryKind::Missing => write!(f, "missing-request"),
+      EntryKind::Proxied => write!(f, "request-proxied")
+    }
+  }
+}
+
+/// Journal entry as stored in an export
+#[derive(Debug, Clone, PartialEq)]
+pub struct ExportedEntry {
+  /// Sequence number of the entry in the journal
+  pub sequence: u64,
+  /// Session the request was received for
+  pub session: Option<String>,
+  /// Kind of result
+  pub kind: EntryKind,
+  /// Index of the expected interaction in the interactions of the Pact (of all types), if there
+  /// is one
+  pub interaction: Option<usize>,
+  /// Request that was received (or the expected request for missing requests)
+  pub request: HttpRequest,
+  /// Descriptions of the mismatches
+  pub mismatches: Vec<String>
+}
+
+impl ExportedEntry {
+  /// Creates the export form of a journal entry. `expected` are the expected requests of the Pact
+  /// by interaction index (`None` for interactions that are not HTTP, see
+  /// `MockServer::expected_request_list`), and are used to find the index of the expected
+  /// interaction.
+  pub fn from_journal_entry(entry: &JournalEntry, expected: &[Option<HttpRequest>]) -> ExportedEntry {
+    let index = |request: &HttpRequest| expected.iter().position(|r| r.as_ref() == Some(request));
+    let (kind, interaction, request, mismatches) = match &entry.result {
+      MatchResult::RequestMatch(expected, _, actual) =>
+        (EntryKind::Matched, index(expected), actual.clone(), vec![]),
+      MatchResult::RequestMismatch(expected, actual, mismatches) =>
+        (EntryKind::Mismatched, index(expected), actual.clone(),
+         mismatches.iter().map(|m| m.description()).collect()),
+      MatchResult::RequestNotFound(actual) if entry.proxied => (EntryKind::Proxied, None, actual.clone(), vec![]),
+      MatchResult::RequestNotFound(actual) => (EntryKind::NotFound, None, actual.clone(), vec![]),
+      MatchResult::MissingRequest(expected) => (EntryKind::Missing, index(expected), expected.clone(), vec![])
+    };
+    ExportedEntry {
+      sequence: entry.sequence,
+      session: entry.session.clone(),
+      kind,
+      interaction,
+      request,
+      mismatches
+    }
+  }
+
+  /// Converts the entry to JSON
+  pub fn to_json(&self) -> Value {
+    json!({
+      "sequence": self.sequence,
+      "session": self.session,
+      "type": self.kind.to_string(),
+      "interaction": self.interaction,
+      "request": self.request.as_v3_request().to_json(&PactSpecification::V3),
+      "mismatches": self.mismatches
+    })
+  }
+}
+
+/// Writes the length-prefixed records of a binary file, along with the string table. This is
+/// shared by the journal export and request capture formats.
+pub(crate) struct RecordWriter {
+  out: Box<dyn Write + Send>,
+  strings: HashMap<String, u64>
+}
+
+impl RecordWriter {
+  /// Creates a writer, writing the header with the given magic bytes to `out`. If `compress` is
+  /// set, the records will be compressed with zstd (this requires the `zstd` feature).
+  pub(crate) fn new(out: impl Write + Send + 'static, magic: &[u8; 8], compress: bool) -> anyhow::Result<RecordWriter> {
+    let mut out = BufWriter::new(out);
+    out.write_all(magic)?;
+    out.write_all(&[VERSION, if compress { FLAG_COMPRESSED } else { 0 }])?;
+    let out: Box<dyn Write + Send> = if compress {
+      compressed_writer(out)?
+    } else {
+      Box::new(out)
+    };
+    Ok(RecordWriter {
+      out,
+      strings: HashMap::new()
+    })
+  }
+
+  /// Writes a record
+  pub(crate) fn write_record(&mut self, record: &[u8]) -> io::Result<()> {
+    self.out.write_all(&(record.len() as u32).to_le_bytes())?;
+    self.out.write_all(record)
+  }
+
+  /// Flushes any buffered records
+  pub(crate) fn flush(&mut self) -> io::Result<()> {
+    self.out.flush()
+  }
+
+  /// Writes a reference to a string to the record. 0 is an inline string, otherwise it is the
+  /// index in the string table plus 1. If the string is new, it is first added to the table with a
+  /// string record.
+  pub(crate) fn write_string(&mut self, record: &mut Vec<u8>, value: &str) -> io::Result<()> {
+    if let Some(index) = self.strings.get(value) {
+      write_varint(record, *index + 1);
+    } else if value.len() <= MAX_INTERNED_LENGTH && self.strings.len() < MAX_INTERNED_STRINGS {
+      let index = self.strings.len() as u64;
+      let mut string_record = Vec::with_capacity(value.len() + 1);
+      string_record.push(RECORD_STRING);
+      string_record.extend_from_slice(value.as_bytes());
+      self.write_record(&string_record)?;
+      self.strings.insert(value.to_string(), index);
+      write_varint(record, index + 1);
+    } else {
+      write_varint(record, 0);
+      write_bytes(record, value.as_bytes());
+    }
+    Ok(())
+  }
+
+  /// Writes an optional string to the record
+  pub(crate) fn write_optional_string(&mut self, record: &mut Vec<u8>, value: Option<&str>) -> io::Result<()> {
+    match value {
+      Some(value) => {
+        record.push(1);
+        self.write_string(record, value)
+      }
+      None => {
+        record.push(0);
+        Ok(())
+      }
+    }
+  }
+
+  /// Writes a journal entry as a record, using `record` as the buffer to encode it in
+  pub(crate) fn write_entry(&mut self, record: &mut Vec<u8>, entry: &ExportedEntry) -> io::Result<()> {
+    record.clear();
+    record.push(RECORD_ENTRY);
+    write_varint(record, entry.sequence);
+    record.push(entry.kind.to_u8());
+    write_varint(record, entry.interaction.map(|i| i as u64 + 1).unwrap_or_default());
+    self.write_optional_string(record, entry.session.as_deref())?;
+    self.write_request(record, &entry.request)?;
+    write_varint(record, entry.mismatches.len() as u64);
+    for mismatch in &entry.mismatches {
+      self.write_string(record, mismatch)?;
+    }
+    self.write_record(record)
+  }
+
+  /// Writes a request to the record
+  pub(crate) fn write_request(&mut self, record: &mut Vec<u8>, request: &HttpRequest) -> io::Result<()> {
+    self.write_string(record, &request.method)?;
+    self.write_string(record, &request.path)?;
+
+    match &request.query {
+      Some(query) => {
+        write_varint(record, query.len() as u64 + 1);
+        for (key, values) in query {
+          self.write_string(record, key)?;
+          write_varint(record, values.len() as u64);
+          for value in values {
+            self.write_optional_string(record, value.as_deref())?;
+          }
+        }
+      }
+      None => write_varint(record, 0)
+    }
+
+    match &request.headers {
+      Some(headers) => {
+        write_varint(record, headers.len() as u64 + 1);
+        for (key, values) in headers {
+          self.write_string(record, key)?;
+          write_varint(record, values.len() as u64);
+          for value in values {
+            self.write_string(record, value)?;
+          }
+        }
+      }
+      None => write_varint(record, 0)
+    }
+
+    match &request.body {
+      OptionalBody::Missing => record.push(0),
+      OptionalBody::Empty => record.push(1),
+      OptionalBody::Null => record.push(2),
+      OptionalBody::Present(bytes, content_type, _) => {
+        record.push(3);
+        let content_type = content_type.as_ref().map(|ct| ct.to_string());
+        self.write_optional_string(record, content_type.as_deref())?;
+        write_bytes(record, bytes);
+      }
+    }
+    Ok(())
+  }
+}
+
+/// Writes journal entries to an export
+pub struct JournalExportWriter {
+  records: RecordWriter,
+  record: Vec<u8>,
+  entries: usize
+}
+
+impl JournalExportWriter {
+  /// Creates a writer, writing the export header to `out`. If `compress` is set, the records will
+  /// be compressed with zstd (this requires the `zstd` feature).
+  pub fn new(out: impl Write + Send + 'static, compress: bool) -> anyhow::Result<JournalExportWriter> {
+    Ok(JournalExportWriter {
+      records: RecordWriter::new(out, MAGIC, compress)?,
+      record: Vec::with_capacity(1024),
+      entries: 0
+    })
+  }
+
+  /// Writes an entry to the export
+  pub fn write_entry(&mut self, entry: &ExportedEntry) -> io::Result<()> {
+    self.records.write_entry(&mut self.record, entry)?;
+    self.entries += 1;
+    Ok(())
+  }
+
+  /// Number of entries that have been written
+  pub fn entries(&self) -> usize {
+    self.entries
+  }
+
+  /// Flushes the export, completing any compressed frame
+  pub fn finish(mut self) -> io::Result<usize> {
+    self.records.flush()?;
+    Ok(self.entries)
+  }
+}
+
+#[cfg(feature = "zstd")]
+fn compressed_writer(out: impl Write + Send + 'static) -> anyhow::Result<Box<dyn Write + Send>> {
+  let encoder = zstd::stream::write::Encoder::new(out, 0)?;
+  Ok(Box::new(encoder.auto_finish()))
+}
+
+#[cfg(not(feature = "zstd"))]
+fn compressed_writer(_out: impl Write + Send + 'static) -> anyhow::Result<Box<dyn Write + Send>> {
+  Err(anyhow!("Compressed files require the zstd feature to be enabled"))
+}
+
+#[cfg(feature = "zstd")]
+fn compressed_reader(input: impl Read + Send + 'static) -> anyhow::Result<Box<dyn Read + Send>> {
+  Ok(Box::new(zstd::stream::read::Decoder::new(input)?))
+}
+
+#[cfg(not(feature = "zstd"))]
+fn compressed_reader(_input: impl Read + Send + 'static) -> anyhow::Result<Box<dyn Read + Send>> {
+  Err(anyhow!("Compressed files require the zstd feature to be enabled"))
+}
+
+/// Reads the length-prefixed records written by a `RecordWriter`. String records are added to
+/// the string table as they are read, and all other records are passed on.
+pub(crate) struct RecordReader {
+  input: Box<dyn Read + Send>,
+  strings: Vec<String>,
+  record: Vec<u8>,
+  compressed: bool
+}
+
+impl RecordReader {
+  /// Creates a reader, reading and validating the header from `input`
+  pub(crate) fn new(input: impl Read + Send + 'static, magic: &[u8; 8]) -> anyhow::Result<RecordReader> {
+    let mut input = BufReader::new(input);
+    let mut header = [0_u8; 10];
+    input.read_exact(&mut header)
+      .map_err(|err| anyhow!("Failed to read the file header - {}", err))?;
+    if &header[0..8] != magic {
+      return Err(anyhow!("The file header is invalid (expected {})", String::from_utf8_lossy(&magic[0..7])));
+    }
+    if header[8] != VERSION {
+      return Err(anyhow!("File format version {} is not supported", header[8]));
+    }
+    let compressed = header[9] & FLAG_COMPRESSED != 0;
+    let input: Box<dyn Read + Send> = if compressed {
+      compressed_reader(input)?
+    } else {
+      Box::new(input)
+    };
+    Ok(RecordReader {
+      input,
+      strings: vec![],
+      record: vec![],
+      compressed
+    })
+  }
+
+  /// If the records are compressed
+  pub(crate) fn compressed(&self) -> bool {
+    self.compressed
+  }
+
+  /// Reads the next record that is not a string record, and decodes it with the given function
+  /// (which is passed the record type and a cursor over the rest of the record). Returns `None`
+  /// at the end of the file.
+  pub(crate) fn read_record<R>(
+    &mut self,
+    decode: impl FnOnce(&RecordReader, u8, &mut RecordCursor) -> anyhow::Result<R>
+  ) -> anyhow::Result<Option<R>> {
+    loop {
+      let mut length = [0_u8; 4];
+      match self.input.read_exact(&mut length) {
+        Ok(_) => {}
+        Err(err) if err.kind() == io::ErrorKind::UnexpectedEof => return Ok(None),
+        Err(err) => return Err(err.into())
+      }
+      let length = u32::from_le_bytes(length) as usize;
+      self.record.resize(length, 0);
+      self.input.read_exact(&mut self.record)
+        .map_err(|err| anyhow!("File is truncated - {}", err))?;
+
+      match self.record.first() {
+        Some(&RECORD_STRING) => {
+          let value = String::from_utf8(self.record[1..].to_vec())?;
+          self.strings.push(value);
+        }
+        Some(&record_type) => {
+          let record = std::mem::take(&mut self.record);
+          let result = decode(self, record_type, &mut RecordCursor::new(&record[1..]));
+          self.record = record;
+          return result.map(Some);
+        }
+        None => return Err(anyhow!("File contains an empty record"))
+      }
+    }
+  }
+
+  /// Reads a string reference from the record
+  pub(crate) fn string(&self, cursor: &mut RecordCursor) -> anyhow::Result<String> {
+    match cursor.varint()? {
+      0 => Ok(String::from_utf8(cursor.bytes()?.to_vec())?),
+      index => self.strings.get(index as usize - 1)
+        .cloned()
+        .ok_or_else(|| anyhow!("Record refers to an unknown string {}", index - 1))
+    }
+  }
+
+  /// Reads an optional string from the record
+  pub(crate) fn optional_string(&self, cursor: &mut RecordCursor) -> anyhow::Result<Option<String>> {
+    match cursor.byte()? {
+      0 => Ok(None),
+      _ => self.string(cursor).map(Some)
+    }
+  }
+
+  /// Reads a request from the record
+  pub(crate) fn request(&self, cursor: &mut RecordCursor) -> anyhow::Result<HttpRequest> {
+    let method = self.string(cursor)?;
+    let path = self.string(cursor)?;
+
+    let query = match cursor.varint()? {
+      0 => None,
+      count => {
+        let mut query = HashMap::new();
+        for _ in 1..count {
+          let key = self.string(cursor)?;
+          let mut values = vec![];
+          for _ in 0..cursor.varint()? {
+            values.push(self.optional_string(cursor)?);
+          }
+          query.insert(key, values);
+        }
+        Some(query)
+      }
+    };
+
+    let headers = match cursor.varint()? {
+      0 => None,
+      count => {
+        let mut headers = HashMap::new();
+        for _ in 1..count {
+          let key = self.string(cursor)?;
+          let mut values = vec![];
+          for _ in 0..cursor.varint()? {
+            values.push(self.string(cursor)?);
+          }
+          headers.insert(key, values);
+        }
+        Some(headers)
+      }
+    };
+
+    let body = match cursor.byte()? {
+      0 => OptionalBody::Missing,
+      1 => OptionalBody::Empty,
+      2 => OptionalBody::Null,
+      _ => {
+        let content_type = self.optional_string(cursor)?
+          .and_then(|ct| ContentType::parse(ct.as_str()).ok());
+        OptionalBody::Present(Bytes::copy_from_slice(cursor.bytes()?), content_type, None)
+      }
+    };
+
+    Ok(HttpRequest {
+      method,
+      path,
+      query,
+      headers,
+      body,
+      .. HttpRequest::default()
+    })
+  }
+}
+
+/// Reads the entries from an export. This is an iterator over the entries in the export.
+pub struct JournalExportReader {
+  records: RecordReader
+}
+
+impl JournalExportReader {
+  /// Creates a reader, reading and validating the export header from `input`
+  pub fn new(input: impl Read + Send + 'static) -> anyhow::Result<JournalExportReader> {
+    let records = RecordReader::new(input, MAGIC)
+      .map_err(|err| anyhow!("Not a valid journal export - {}", err))?;
+    Ok(JournalExportReader { records })
+  }
+
+  /// If the export is compressed
+  pub fn compressed(&self) -> bool {
+    self.records.compressed()
+  }
+
+  /// Reads the next entry, returning `None` at the end of the export
+  pub fn read_entry(&mut self) -> anyhow::Result<Option<ExportedEntry>> {
+    self.records.read_record(|reader, record_type, cursor| {
+      if record_type == RECORD_ENTRY {
+        decode_entry(reader, cursor)
+      } else {
+        Err(anyhow!("Unknown journal export record type {}", record_type))
+      }
+    })
+  }
+}
+
+pub(crate) fn decode_entry(reader: &RecordReader, cursor: &mut RecordCursor) -> anyhow::Result<ExportedEntry> {
+  let sequence = cursor.varint()?;
+  let kind = EntryKind::from_u8(cursor.byte()?)
+    .ok_or_else(|| anyhow!("Journal export contains an invalid entry kind"))?;
+  let interaction = match cursor.varint()? {
+    0 => None,
+    index => Some(index as usize - 1)
+  };
+  let session = reader.optional_string(cursor)?;
+  let request = reader.request(cursor)?;
+  let count = cursor.varint()?;
+  let mut mismatches = vec![];
+  for _ in 0..count {
+    mismatches.push(reader.string(cursor)?);
+  }
+  Ok(ExportedEntry { sequence, session, kind, interaction, request, mismatches })
+}
+
+impl Iterator for JournalExportReader {
+  type Item = anyhow::Result<ExportedEntry>;
+
+  fn next(&mut self) -> Option<Self::Item> {
+    self.read_entry().transpose()
+  }
+}
+
+/// Cursor over the contents of a record
+pub(crate) struct RecordCursor<'a> {
+  data: &'a [u8],
+  position: usize
+}
+
+impl <'a> RecordCursor<'a> {
+  pub(crate) fn new(data: &'a [u8]) -> Self {
+    RecordCursor { data, position: 0 }
+  }
+
+  pub(crate) fn byte(&mut self) -> anyhow::Result<u8> {
+    let byte = *self.data.get(self.position)
+      .ok_or_else(|| anyhow!("Journal export record is truncated"))?;
+    self.position += 1;
+    Ok(byte)
+  }
+
+  pub(crate) fn varint(&mut self) -> anyhow::Result<u64> {
+    let mut value = 0_u64;
+    let mut shift = 0;
+    loop {
+      let byte = self.byte()?;
+      if shift >= 64 {
+        return Err(anyhow!("Journal export record contains an invalid number"));
+      }
+      value |= ((byte & 0x7F) as u64) << shift;
+      if byte & 0x80 == 0 {
+        return Ok(value);
+      }
+      shift += 7;
+    }
+  }
+
+  pub(crate) fn bytes(&mut self) -> anyhow::Result<&'a [u8]> {
+    let length = self.varint()? as usize;
+    let end = self.position.checked_add(length)
+      .filter(|end| *end <= self.data.len())
+      .ok_or_else(|| anyhow!("Journal export record is truncated"))?;
+    let bytes = &self.data[self.position..end];
+    self.position = end;
+    Ok(bytes)
+  }
+
+  /// If all of the record has been read. Fields added to a record in later versions are read only
+  /// if the record has not ended, so older records can still be read.
+  pub(crate) fn at_end(&self) -> bool {
+    self.position >= self.data.len()
+  }
+}
+
+pub(crate) fn write_varint(buffer: &mut Vec<u8>, mut value: u64) {
+  while value >= 0x80 {
+    buffer.push((value as u8 & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  buffer.push(value as u8);
+}
+
+pub(crate) fn write_bytes(buffer: &mut Vec<u8>, bytes: &[u8]) {
+  write_varint(buffer, bytes.len() as u64);
+  buffer.extend_from_slice(bytes);
+}
+
+/// Exports the entries in a match journal. The journal is only locked while a batch of entries is
+/// copied out of it, so the mock server can keep handling requests while a large journal is
+/// exported. Entries appended to the journal while it is being exported are included. Returns the
+/// number of entries exported.
+pub fn export_journal(
+  journal: &Arc<Mutex<MatchJournal>>,
+  expected: &[Option<HttpRequest>],
+  writer: &mut JournalExportWriter
+) -> io::Result<usize> {
+  let count = for_each_exported_entry(journal, expected, |entry| writer.write_entry(entry))?;
+  debug!("Exported {} journal entries", count);
+  Ok(count)
+}
+
+/// Calls `f` with the export form of each entry in the journal, copying the entries out of the
+/// journal in batches
+pub(crate) fn for_each_exported_entry(
+  journal: &Arc<Mutex<MatchJournal>>,
+  expected: &[Option<HttpRequest>],
+  mut f: impl FnMut(&ExportedEntry) -> io::Result<()>
+) -> io::Result<usize> {
+  let mut cursor = 0;
+  let mut count = 0;
+  loop {
+    let batch: Vec<ExportedEntry> = {
+      let journal = journal.lock().unwrap();
+      journal.entries_since(cursor).iter()
+        .take(EXPORT_BATCH)
+        .map(|entry| ExportedEntry::from_journal_entry(entry, expected))
+        .collect()
+    };
+    if batch.is_empty() {
+      break;
+    }
+    for entry in &batch {
+      f(entry)?;
+      cursor = entry.sequence;
+    }
+    count += batch.len();
+  }
+  Ok(count)
+}
+
+/// Imports the entries from a journal export into a match journal, so the journal of a mock server
+/// can be restored in another process. Matched requests are rebuilt from the interactions of the
+/// Pact using the interaction index, and mismatched requests are matched against the Pact again
+/// to rebuild their mismatches (the export only has their descriptions). Missing requests are
+/// skipped, as they are worked out when the mock server is verified. The entries are read as they
+/// are imported, and the journal is only locked while each batch is appended. Returns the number
+/// of entries imported.
+pub async fn import_journal(
+  journal: &Arc<Mutex<MatchJournal>>,
+  pact: &V4Pact,
+  entries: impl Iterator<Item = anyhow::Result<ExportedEntry>>
+) -> anyhow::Result<usize> {
+  let interactions: Vec<Option<SynchronousHttp>> = pact.interactions().iter()
+    .map(|interaction| interaction.as_v4_http())
+    .collect();
+  let mut batch = Vec::with_capacity(EXPORT_BATCH);
+  let mut count = 0;
+  for entry in entries {
+    let entry = entry?;
+    let result = match entry.kind {
+      EntryKind::Matched => match entry.interaction.and_then(|index| interactions.get(index)).and_then(Option::as_ref) {
+        Some(interaction) => MatchResult::RequestMatch(interaction.request.clone(),
+          interaction.response.clone(), entry.request),
+        None => return Err(anyhow!("Journal entry {} is for interaction {:?}, which is not in the Pact",
+          entry.sequence, entry.interaction))
+      },
+      EntryKind::Mismatched => match_request(&entry.request, pact).await,
+      EntryKind::NotFound | EntryKind::Proxied => MatchResult::RequestNotFound(entry.request),
+      EntryKind::Missing => continue
+    };
+    batch.push((entry.sequence, result, entry.session, entry.kind == EntryKind::Proxied));
+    if batch.len() >= EXPORT_BATCH {
+      count += append_batch(journal, &mut batch);
+    }
+  }
+  count += append_batch(journal, &mut batch);
+  debug!("Imported {} journal entries", count);
+  Ok(count)
+}
+
+fn append_batch(journal: &Arc<Mutex<MatchJournal>>, batch: &mut Vec<(u64, MatchResult, Option<String>, bool)>) -> usize {
+  let count = batch.len();
+  let mut journal = journal.lock().unwrap();
+  for (sequence, result, session, proxied) in batch.drain(..) {
+    journal.push_restored(sequence, result, session, proxied);
+  }
+  count
+}
+
+#[cfg(test)]
+mod tests {
+  use expectest::prelude::*;
+  use maplit::hashmap;
+  use pact_models::bodies::OptionalBody;
+  use pact_models::v4::async_message::AsynchronousMessage;
+  use pact_models::v4::http_parts::{HttpRequest, HttpResponse};
+  use pact_models::v4::interaction::V4Interaction;
+
+  use super::*;
+
+  /// Writer target that can be read back after the writer has been finished
+  #[derive(Clone, Default)]
+  struct SharedBuffer(Arc<Mutex<Vec<u8>>>);
+
+  impl Write for SharedBuffer {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+      self.0.lock().unwrap().write(buf)
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+      Ok(())
+    }
+  }
+
+  #[test]
+  fn export_can_be_read_back() {
+    let request = HttpRequest {
+      method: "POST".to_string(),
+      path: "/test".to_string(),
+      query: Some(hashmap!{ "a".to_string() => vec![Some("1".to_string()), None] }),
+      headers: Some(hashmap!{ "x-test".to_string() => vec!["yes".to_string()] }),
+      body: OptionalBody::Present("{\"a\": 1}".into(), Some(ContentType::parse("application/json").unwrap()), None),
+      .. HttpRequest::default()
+    };
+    let entries = vec![
+      ExportedEntry {
+        sequence: 1,
+        session: Some("one".to_string()),
+        kind: EntryKind::Mismatched,
+        interaction: Some(0),
+        request: request.clone(),
+        mismatches: vec!["Expected 1 but got 2".to_string()]
+      },
+      ExportedEntry {
+        sequence: 200,
+        session: None,
+        kind: EntryKind::NotFound,
+        interaction: None,
+        request: HttpRequest { path: "x".repeat(1000), .. request.clone() },
+        mismatches: vec![]
+      }
+    ];
+
+    let buffer = SharedBuffer::default();
+    let mut writer = JournalExportWriter::new(buffer.clone(), false).unwrap();
+    for entry in &entries {
+      writer.write_entry(entry).unwrap();
+    }
+    expect!(writer.finish().unwrap()).to(be_equal_to(2));
+
+    let data = buffer.0.lock().unwrap().clone();
+    let reader = JournalExportReader::new(io::Cursor::new(data)).unwrap();
+    let read: Vec<ExportedEntry> = reader.collect::<anyhow::Result<_>>().unwrap();
+    expect!(read).to(be_equal_to(entries));
+  }
+
+  #[tokio::test]
+  async fn import_rebuilds_the_journal_entries() {
+    let interaction = SynchronousHttp {
+      request: HttpRequest { path: "/expected".to_string(), .. HttpRequest::default() },
+      .. SynchronousHttp::default()
+    };
+    let pact = V4Pact {
+      interactions: vec![interaction.boxed_v4()],
+      .. V4Pact::default()
+    };
+    let actual = HttpRequest { path: "/expected".to_string(), .. HttpRequest::default() };
+    let entries = vec![
+      ExportedEntry {
+        sequence: 5,
+        session: Some("one".to_string()),
+        kind: EntryKind::Matched,
+        interaction: Some(0),
+        request: actual.clone(),
+        mismatches: vec![]
+      },
+      ExportedEntry {
+        sequence: 9,
+        session: None,
+        kind: EntryKind::NotFound,
+        interaction: None,
+        request: HttpRequest { path: "/unexpected".to_string(), .. HttpRequest::default() },
+        mismatches: vec![]
+      },
+      ExportedEntry {
+        sequence: 10,
+        session: None,
+        kind: EntryKind::Missing,
+        interaction: Some(0),
+        request: interaction.request.clone(),
+        mismatches: vec![]
+      }
+    ];
+
+    let journal = Arc::new(Mutex::new(MatchJournal::default()));
+    let count = import_journal(&journal, &pact, entries.into_iter().map(Ok)).await.unwrap();
+    expect!(count).to(be_equal_to(2));
+
+    let journal = journal.lock().unwrap();
+    expect!(journal.last_sequence()).to(be_equal_to(9));
+    expect!(journal.matched()).to(be_equal_to(1));
+    expect!(journal.entries()[0].sequence).to(be_equal_to(5));
+    expect!(journal.entries()[0].session.clone()).to(be_some().value("one"));
+    expect!(journal.entries()[0].result.clone()).to(be_equal_to(MatchResult::RequestMatch(
+      interaction.request.clone(), interaction.response.clone(), actual)));
+  }
+
+  #[tokio::test]
+  async fn interaction_indexes_are_positions_in_the_pact() {
+    let request = HttpRequest { path: "/expected".to_string(), .. HttpRequest::default() };
+    let mut journal = MatchJournal::default();
+    journal.push(MatchResult::RequestMatch(request.clone(), HttpResponse::default(), request.clone()));
+
+    let entry = ExportedEntry::from_journal_entry(&journal.entries()[0], &[None, Some(request.clone())]);
+    expect!(entry.interaction).to(be_some().value(1));
+
+    let interaction = SynchronousHttp { request: request.clone(), .. SynchronousHttp::default() };
+    let pact = V4Pact {
+      interactions: vec![AsynchronousMessage::default().boxed_v4(), interaction.boxed_v4()],
+      .. V4Pact::default()
+    };
+    let journal = Arc::new(Mutex::new(MatchJournal::default()));
+    let count = import_journal(&journal, &pact, vec![Ok(entry)].into_iter()).await.unwrap();
+    expect!(count).to(be_equal_to(1));
+    expect!(journal.lock().unwrap().request_matches(&request)).to(be_equal_to(1));
+  }
+
+  #[test]
+  fn reader_rejects_data_that_is_not_an_export() {
+    expect!(JournalExportReader::new(io::Cursor::new(b"{\"not\": \"an export\"}".to_vec()))).to(be_err());
+  }
+
+  #[test]
+  fn varints_round_trip() {
+    for value in [0_u64, 1, 127, 128, 300, u32::MAX as u64, u64::MAX] {
+      let mut buffer = vec![];
+      write_bytes(&mut buffer, b"");
+      write_varint(&mut buffer, value);
+      let mut cursor = RecordCursor::new(&buffer);
+      expect!(cursor.bytes().unwrap().is_empty()).to(be_true());
+      expect!(cursor.varint().unwrap()).to(be_equal_to(value));
+    }
+  }
+}
@@ -7,20 +7,26 @@
 //! crate.
 //!
 //! ## Crate features
-//! All features are enabled by default
+//! All features are enabled by default, apart from `zstd`
 //!
 //! * `datetime`: Enables support of date and time expressions and generators.
 //! * `xml`: Enables support for parsing XML documents.
 //! * `plugins`: Enables support for using plugins.
 //! * `multipart`: Enables support for MIME multipart bodies.
 //! * `tls`: Enables support for mock servers using TLS. This will add the following dependencies: hyper-rustls, rustls, rustls-pemfile, tokio-rustls.
+//! * `zstd`: Enables compressed match journal exports. This will add the zstd dependency.
 
 #![warn(missing_docs)]
 
+use std::collections::BTreeMap;
+use std::fs::File;
+use std::future::Future;
+use std::path::Path;
 #[cfg(feature = "plugins")] use std::path::PathBuf;
-use std::sync::Mutex;
+use std::sync::{Arc, Mutex};
+use std::time::Duration;
 
-#[cfg(feature = "plugins")] use anyhow::anyhow;
+use anyhow::anyhow;
 use itertools::Either;
 #[cfg(feature = "plugins")] use itertools::Itertools;
 use lazy_static::*;
@@ -35,18 +41,37 @@ use pact_models::pact::{load_pact_from_json, Pact};
   CatalogueEntryType,
   register_core_entries
 };
-#[cfg(feature = "plugins")] use pact_plugin_driver::plugin_manager::get_mock_server_results;
+#[cfg(feature = "plugins")] use pact_plugin_driver::mock_server::MockServerResult;
 #[cfg(feature = "tls")] use rustls::ServerConfig;
-use serde_json::json;
+use serde_json::{json, Value};
 #[allow(unused_imports)] use tracing::{error, info, warn};
 use uuid::Uuid;
 
-use crate::mock_server::{MockServer, MockServerConfig};
-use crate::server_manager::{PluginMockServer, ServerManager};
+use crate::journal::{MatchJournal, wait_for_matches, WaitCondition};
+use crate::journal_export::{export_journal, import_journal, JournalExportWriter};
+use crate::mock_server::{DEFAULT_DRAIN_TIMEOUT, MismatchIter, MockServer, MockServerConfig, MockServerVerification};
+use crate::server_manager::{
+  MockServerStart,
+  PluginMockServer,
+  ServerManager,
+  ShutdownReport,
+  ShutdownSelector,
+  TransportStartMetrics
+};
+#[cfg(feature = "plugins")] use crate::server_manager::PluginResults;
+use crate::snapshot::{MockServerSnapshot, SnapshotReader, write_snapshot};
+use crate::status::MockServerStatus;
 
+pub mod capture;
+pub mod journal;
+pub mod journal_export;
 pub mod matching;
 pub mod mock_server;
+pub mod multi_pact;
+pub mod proxy;
 pub mod server_manager;
+pub mod snapshot;
+pub mod status;
 mod hyper_server;
 #[cfg(feature = "tls")] pub mod tls;
 mod utils;
@@ -149,6 +174,22 @@ pub fn start_mock_server_with_config(
     .map(|addr| addr.port() as i32)
 }
 
+/// Starts a batch of mock servers (see `MockServerStart`). The mock servers are bound concurrently
+/// and registered with one lock of the server manager, which is much quicker than calling
+/// `start_mock_server_with_config` for each of them when a test harness starts many mock servers up
+/// front. Returns the port (or the error) for each mock server, in the same order as the batch.
+pub fn start_mock_servers(servers: Vec<MockServerStart>) -> Vec<Result<i32, String>> {
+  configure_core_catalogue();
+  pact_matching::matchers::configure_core_catalogue();
+
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .start_mock_servers(servers)
+    .into_iter()
+    .map(|result| result.map(|addr| addr.port() as i32))
+    .collect()
+}
+
 /// Starts a TLS mock server with the given ID, pact and port number. The ID needs to be unique. A port
 /// number of 0 will result in an auto-allocated port by the operating system. Returns the port
 /// that the mock server is running on wrapped in a `Result`.
@@ -241,6 +282,41 @@ pub fn start_mock_server_for_transport(
     .map(|addr| addr.port() as i32)
 }
 
+/// Loads a plugin into the warm pool of the server manager, so mock servers for the transports it
+/// provides start without waiting for the plugin process, and the process is reused across mock
+/// servers. Returns the time taken to load the plugin. Use `release_warm_plugin` to remove it from
+/// the pool.
+///
+/// Requires the plugins feature to be enabled.
+#[cfg(feature = "plugins")]
+pub fn warm_plugin(name: &str, version: Option<String>) -> anyhow::Result<std::time::Duration> {
+  configure_core_catalogue();
+  pact_matching::matchers::configure_core_catalogue();
+
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .warm_plugin(name, version)
+}
+
+/// Removes a plugin from the warm pool of the server manager. Returns false if the plugin was not
+/// in the pool.
+///
+/// Requires the plugins feature to be enabled.
+#[cfg(feature = "plugins")]
+pub fn release_warm_plugin(name: &str) -> bool {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .release_warm_plugin(name)
+}
+
+/// Returns the start up latency of the mock servers started for plugin transports, by transport
+/// key, including how many were started while their plugin was in the warm pool.
+pub fn transport_start_metrics() -> BTreeMap<String, TransportStartMetrics> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .transport_start_metrics()
+}
+
 /// Creates a mock server. Requires the pact JSON as a string as well as the port for the mock
 /// server to run on. A value of 0 for the port will result in a
 /// port being allocated by the operating system. The port of the mock server is returned.
@@ -304,35 +380,70 @@ pub fn create_tls_mock_server(
 /// is no mock server on the given port, or if any request has not been successfully matched.
 ///
 /// Note that for mock servers provided by plugins, if the call to the plugin fails, a value of false
-/// will also be returned.
+/// will also be returned. The results are always fetched from the plugin, so requests it has
+/// received since they were last fetched are included.
 pub fn mock_server_matched(mock_server_port: i32) -> bool {
-  MANAGER.lock().unwrap()
-    .get_or_insert_with(ServerManager::new)
-    .find_mock_server_by_port(mock_server_port as u16, &|_server_manager, _, mock_server| {
-      match mock_server {
-        Either::Left(mock_server) => mock_server.mismatches().is_empty(),
-        Either::Right(_plugin_mock_server) => {
-          #[cfg(feature = "plugins")]
-          {
-            let results = _server_manager.exec_async(get_mock_server_results(&_plugin_mock_server.mock_server_details));
-            match results {
-              Ok(results) => results.is_empty(),
-              Err(err) => {
-                error!("Request to plugin to get matching results failed - {}", err);
-                false
-              }
-            }
-          }
-
-          #[cfg(not(feature = "plugins"))]
-          {
-            error!("Plugin mock server support requires the plugins feature to be enabled");
+  match find_local_or_plugin_mock_server(mock_server_port, &|mock_server| mock_server.all_matched()) {
+    Some(Either::Left(matched)) => matched,
+    Some(Either::Right((_plugin_mock_server, _id, _runtime))) => {
+      #[cfg(feature = "plugins")]
+      {
+        let details = &_plugin_mock_server.mock_server_details;
+        match _runtime.block_on(plugin_results(&_id).fresh_results(details, &_runtime)) {
+          Ok(results) => results.is_empty(),
+          Err(err) => {
+            error!("Request to plugin to get matching results failed - {}", err);
             false
           }
         }
       }
+
+      #[cfg(not(feature = "plugins"))]
+      {
+        error!("Plugin mock server support requires the plugins feature to be enabled");
+        false
+      }
+    }
+    None => false
+  }
+}
+
+/// Finds the mock server with the provided port. For a local mock server, the result of the
+/// function is returned. For a mock server provided by a plugin, a clone of it is returned with its
+/// ID and the runtime of the server manager, so its results can be fetched from the plugin after
+/// the server manager lock has been released.
+fn find_local_or_plugin_mock_server<R>(
+  mock_server_port: i32,
+  f: &dyn Fn(&MockServer) -> R
+) -> Option<Either<R, (PluginMockServer, String, tokio::runtime::Handle)>> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|manager, id, mock_server| {
+      mock_server.map_left(|mock_server| f(mock_server))
+        .map_right(|plugin_mock_server| (plugin_mock_server.clone(), id.clone(), manager.runtime_handle()))
     })
-    .unwrap_or(false)
+}
+
+/// Results fetched from the plugin for the plugin mock server with the given ID, which are cached
+/// by the server manager
+#[cfg(feature = "plugins")]
+fn plugin_results(id: &str) -> PluginResults {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .plugin_results(id)
+}
+
+/// Returns the status of the mock server with the provided port: its request counters, latency
+/// histogram and the coverage of its interactions (see the `status` module). Unlike
+/// `mock_server_matched` and `mock_server_mismatches`, this does not build the mismatches, so it
+/// can be polled at a high frequency.
+///
+/// Returns `None` if there is no mock server with the provided port, or it is provided by a plugin.
+pub fn mock_server_status(mock_server_port: i32) -> Option<MockServerStatus> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|_, _, ms| ms.left().map(|ms| ms.status()))
+    .flatten()
 }
 
 /// Gets all the mismatches from a mock server in JSON format. The port number of the mock
@@ -343,53 +454,243 @@ pub fn mock_server_matched(mock_server_port: i32) -> bool {
 /// For mock servers provided by plugins, if the call to the plugin fails, a JSON value with an
 /// error attribute will be returned.
 pub fn mock_server_mismatches(mock_server_port: i32) -> Option<String> {
-  MANAGER.lock().unwrap()
-    .get_or_insert_with(ServerManager::new)
-    .find_mock_server_by_port(mock_server_port as u16, &|_manager, _, mock_server| {
-      match mock_server {
-        Either::Left(mock_server) => {
-          let mismatches = mock_server.mismatches().iter()
-            .map(|mismatch| mismatch.to_json() )
-            .collect::<Vec<serde_json::Value>>();
-          json!(mismatches).to_string()
-        }
-        Either::Right(_plugin_mock_server) => {
-          #[cfg(feature = "plugins")]
-          {
-            let results = _manager.exec_async(get_mock_server_results(&_plugin_mock_server.mock_server_details));
-            match results {
-              Ok(results) => {
-                json!(results.iter().map(|item| {
-                json!({
-                  "path": item.path,
-                  "error": item.error,
-                  "mismatches": item.mismatches.iter().map(|mismatch| {
-                    json!({
-                      "expected": mismatch.expected,
-                      "actual": mismatch.actual,
-                      "mismatch": mismatch.mismatch,
-                      "path": mismatch.path,
-                      "diff": mismatch.diff.clone().unwrap_or_default()
-                    })
-                  }).collect_vec()
-                })
-              }).collect_vec())
-              },
-              Err(err) => {
-                error!("Request to plugin to get matching results failed - {}", err);
-                json!({ "error": format!("Request to plugin to get matching results failed - {}", err) })
-              }
-            }.to_string()
+  match find_local_or_plugin_mock_server(mock_server_port, &|mock_server| json!(mock_server.mismatches_json()).to_string())? {
+    Either::Left(mismatches) => Some(mismatches),
+    Either::Right((_plugin_mock_server, _id, _runtime)) => {
+      #[cfg(feature = "plugins")]
+      {
+        let details = &_plugin_mock_server.mock_server_details;
+        let mismatches = match _runtime.block_on(plugin_results(&_id).results(details, &_runtime)) {
+          Ok(results) => json!(plugin_mismatches_json(&results)),
+          Err(err) => {
+            error!("Request to plugin to get matching results failed - {}", err);
+            json!({ "error": format!("Request to plugin to get matching results failed - {}", err) })
           }
+        };
+        Some(mismatches.to_string())
+      }
 
-          #[cfg(not(feature = "plugins"))]
-          {
-            error!("Plugin mock server support requires the plugins feature to be enabled");
-            json!({ "error": "Plugin mock server support requires the plugins feature to be enabled" }).to_string()
-          }
-        }
+      #[cfg(not(feature = "plugins"))]
+      {
+        error!("Plugin mock server support requires the plugins feature to be enabled");
+        Some(json!({ "error": "Plugin mock server support requires the plugins feature to be enabled" }).to_string())
       }
+    }
+  }
+}
+
+/// Converts the results returned by a plugin mock server to the JSON form of the mismatches
+#[cfg(feature = "plugins")]
+fn plugin_mismatches_json(results: &[MockServerResult]) -> Vec<Value> {
+  results.iter().map(|item| {
+    json!({
+      "path": item.path,
+      "error": item.error,
+      "mismatches": item.mismatches.iter().map(|mismatch| {
+        json!({
+          "expected": mismatch.expected,
+          "actual": mismatch.actual,
+          "mismatch": mismatch.mismatch,
+          "path": mismatch.path,
+          "diff": mismatch.diff.clone().unwrap_or_default()
+        })
+      }).collect_vec()
     })
+  }).collect_vec()
+}
+
+/// Resets the mock server with the provided port, so that it can be reused without having to be
+/// shut down and restarted. The match journal and metrics of the mock server are cleared. Returns
+/// a boolean value to indicate if the mock server was reset.
+///
+/// This will only work for locally managed mock servers, not mock servers provided by plugins.
+pub fn reset_mock_server(mock_server_port: i32) -> bool {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port_mut(mock_server_port as u16, &|mock_server| {
+      mock_server.reset();
+    })
+    .is_some()
+}
+
+/// Resets the mock server with the provided port (see `reset_mock_server`), returning the
+/// mismatches for the requests received before the reset in JSON format (the same format as
+/// `mock_server_mismatches`).
+///
+/// If there is no mock server with the provided port number, or it is provided by a plugin,
+/// `None` is returned.
+pub fn reset_mock_server_with_mismatches(mock_server_port: i32) -> Option<String> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port_mut(mock_server_port as u16, &|mock_server| {
+      let journal = mock_server.reset();
+      json!(mock_server.mismatches_json_for(&journal)).to_string()
+    })
+}
+
+/// Function to check if a mock server has matched all the requests for a session. Requests
+/// specify their session with the `X-Pact-Session` header (or a `/_session/{id}` path prefix if
+/// enabled in the mock server config). Returns false if there is no mock server on the given port,
+/// any request for the session has not been successfully matched, or the mock server is
+/// provided by a plugin.
+pub fn mock_server_session_matched(mock_server_port: i32, session: &str) -> bool {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|_, _, mock_server| {
+      mock_server.left()
+        .map(|mock_server| mock_server.session_matched(session))
+        .unwrap_or(false)
+    })
+    .unwrap_or(false)
+}
+
+/// Gets all the mismatches for a session from a mock server in JSON format (the same format as
+/// `mock_server_mismatches`).
+///
+/// If there is no mock server with the provided port number, or it is provided by a plugin,
+/// `None` is returned.
+pub fn mock_server_session_mismatches(mock_server_port: i32, session: &str) -> Option<String> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|_, _, mock_server| {
+      mock_server.left().map(|mock_server| json!(mock_server.session_mismatches_json(session)).to_string())
+    })
+    .flatten()
+}
+
+/// External interface to get the mismatches received by the mock server with the provided port
+/// after the sequence number `since`, so a test can check for new mismatches as it goes without
+/// fetching the full list each time. Returns a JSON string of the form
+/// `{ "mismatches": [...], "cursor": <sequence>, "evictedMismatches": <count> }`, where `cursor`
+/// is the value to pass as `since` on the next call (pass 0 on the first call). Each mismatch has
+/// the `sequence` number of the request it is for. If `evictedMismatches` is not zero, mismatches
+/// have been evicted from the match journal and some may be missing. Expected requests that have not been received are not included; use
+/// `mock_server_mismatches` once the test has completed for those.
+///
+/// Returns `None` if there is no mock server running on the port, or if the mock server is
+/// provided by a plugin (which does not support this).
+pub fn mock_server_mismatches_since(mock_server_port: i32, since: u64) -> Option<String> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|_, _, mock_server| {
+      mock_server.left().map(|mock_server| mock_server.mismatches_since_json(since).to_string())
+    })
+    .flatten()
+}
+
+/// External interface to read the mismatches of the mock server with the provided port a page at
+/// a time, so a very large set of mismatches does not have to be built as one JSON string. Returns
+/// a JSON string of the form `{ "mismatches": [...], "cursor": <sequence>, "complete": <bool> }`
+/// with at most `limit` mismatches from the match journal. Pass 0 as the cursor for the first page,
+/// and then the returned cursor until `complete` is true. The expected requests that were not
+/// received are returned with the last page.
+///
+/// Returns `None` if there is no mock server running on the port, or if the mock server is
+/// provided by a plugin.
+pub fn mock_server_mismatches_page(mock_server_port: i32, cursor: u64, limit: usize) -> Option<String> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|_, _, mock_server| {
+      mock_server.left().map(|mock_server| mock_server.mismatches_page(cursor, limit).to_json().to_string())
+    })
+    .flatten()
+}
+
+/// Returns an iterator over the mismatches (in JSON form) of the mock server with the provided
+/// port, that reads them from the match journal `page_size` at a time. The iterator does not hold
+/// the server manager lock, so it can be consumed while the mock server is still running.
+///
+/// Returns `None` if there is no mock server running on the port, or if the mock server is
+/// provided by a plugin.
+pub fn mock_server_mismatch_iter(mock_server_port: i32, page_size: usize) -> Option<MismatchIter> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|_, _, mock_server| {
+      mock_server.left().map(|mock_server| mock_server.mismatch_iter(page_size))
+    })
+    .flatten()
+}
+
+/// External interface to get the candidate interactions recorded by the mock server with the
+/// provided port from the requests it forwarded to its proxy upstream (see the `proxy` module).
+/// Returns a JSON string with an array of interactions in the V4 Pact format. Interactions where
+/// a body was over the recording limit have the body removed, and `truncated` set.
+///
+/// Returns `None` if there is no mock server running on the port, or if the mock server is
+/// provided by a plugin.
+pub fn mock_server_recorded_interactions(mock_server_port: i32) -> Option<String> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|_, _, mock_server| {
+      mock_server.left().map(|mock_server| {
+        let interactions: Vec<Value> = mock_server.recorded_interactions().iter()
+          .map(|interaction| interaction.to_json())
+          .collect();
+        Value::Array(interactions).to_string()
+      })
+    })
+    .flatten()
+}
+
+/// Resets a session for the mock server with the provided port, removing all the requests
+/// received for the session without affecting any other session. Returns a boolean value to
+/// indicate if the mock server was found.
+pub fn reset_mock_server_session(mock_server_port: i32, session: &str) -> bool {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port_mut(mock_server_port as u16, &|mock_server| {
+      mock_server.reset_session(session);
+    })
+    .is_some()
+}
+
+fn mock_server_wait_condition(
+  mock_server_port: i32,
+  interaction: Option<&str>,
+  count: usize
+) -> Option<(Arc<Mutex<MatchJournal>>, WaitCondition, tokio::runtime::Handle)> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|manager, _, mock_server| {
+      mock_server.left()
+        .and_then(|mock_server| mock_server.wait_condition(interaction, count)
+          .map(|condition| (mock_server.journal(), condition, manager.runtime_handle())))
+    })
+    .flatten()
+}
+
+/// Waits until the mock server with the provided port has matched `count` requests (or `count`
+/// requests for the interaction with the given description), or the timeout expires. The wait is
+/// woken as requests are received, so there is no need to poll `mock_server_matched`. Returns
+/// true if the matches were received before the timeout.
+///
+/// Returns false if there is no mock server with the provided port, there is no interaction with
+/// the given description, or the mock server is provided by a plugin.
+///
+/// This function blocks the calling thread. Use `wait_for_mock_server_matches` from async code.
+pub fn mock_server_wait_for_matches(
+  mock_server_port: i32,
+  interaction: Option<&str>,
+  count: usize,
+  timeout: Duration
+) -> bool {
+  match mock_server_wait_condition(mock_server_port, interaction, count) {
+    Some((journal, condition, runtime)) => runtime.block_on(wait_for_matches(journal, condition, timeout)),
+    None => false
+  }
+}
+
+/// Async version of `mock_server_wait_for_matches`.
+pub async fn wait_for_mock_server_matches(
+  mock_server_port: i32,
+  interaction: Option<&str>,
+  count: usize,
+  timeout: Duration
+) -> bool {
+  match mock_server_wait_condition(mock_server_port, interaction, count) {
+    Some((journal, condition, _)) => wait_for_matches(journal, condition, timeout).await,
+    None => false
+  }
 }
 
 /// Write Pact File Errors
@@ -400,6 +701,136 @@ pub enum WritePactFileErr {
   NoMockServer
 }
 
+/// Exports the match journal of the mock server with the provided port to a file, in the compact
+/// binary format defined in the `journal_export` module. If `compress` is set, the export is
+/// compressed with zstd (which requires the `zstd` feature). The journal is exported in batches,
+/// so the mock server can keep handling requests while it is being exported.
+///
+/// Returns the number of entries exported. Returns an error if there is no mock server running
+/// on the port (or it is provided by a plugin), or the file can not be written.
+pub fn export_mock_server_journal(mock_server_port: i32, path: &Path, compress: bool) -> anyhow::Result<usize> {
+  let (journal, expected) = MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|_, _, ms| {
+      ms.left().map(|ms| (ms.journal(), ms.expected_request_list()))
+    })
+    .flatten()
+    .ok_or_else(|| anyhow!("No mock server running with port {}", mock_server_port))?;
+  let file = File::create(path)
+    .map_err(|err| anyhow!("Failed to create journal export file {} - {}", path.display(), err))?;
+  let mut writer = JournalExportWriter::new(file, compress)?;
+  export_journal(&journal, &expected, &mut writer)?;
+  Ok(writer.finish()?)
+}
+
+/// Writes a snapshot of the mock server with the provided port (its pact, config, metrics and
+/// match journal) to a file, so it can be restored in another process with
+/// `restore_mock_server_snapshot`. Compressed snapshots require the `zstd` feature. Returns the
+/// number of journal entries written.
+pub fn snapshot_mock_server(mock_server_port: i32, path: &Path, compress: bool) -> anyhow::Result<usize> {
+  let (snapshot, journal, expected) = MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|_, _, ms| {
+      ms.left().map(|ms| MockServerSnapshot::from_mock_server(ms)
+        .map(|snapshot| (snapshot, ms.journal(), ms.expected_request_list())))
+    })
+    .flatten()
+    .ok_or_else(|| anyhow!("No mock server running with port {}", mock_server_port))??;
+  let file = File::create(path)
+    .map_err(|err| anyhow!("Failed to create snapshot file {} - {}", path.display(), err))?;
+  write_snapshot(&snapshot, &journal, &expected, file, compress)
+}
+
+/// Restores a mock server from a snapshot written by `snapshot_mock_server`. The match journal is
+/// restored first, and the mock server is then started with it and the ID, pact, config and metrics
+/// from the snapshot, so no requests are handled before the journal is in place. The mock server is
+/// bound to the address from the snapshot (the loopback address for snapshots that do not have
+/// one) on the given port (or the port from the snapshot if `None`, with 0 allocating a port). Only
+/// HTTP mock servers can be restored with this function. Returns the port of the restored mock
+/// server.
+pub fn restore_mock_server_snapshot(path: &Path, port: Option<u16>) -> anyhow::Result<i32> {
+  let file = File::open(path)
+    .map_err(|err| anyhow!("Failed to open snapshot file {} - {}", path.display(), err))?;
+  let reader = SnapshotReader::new(file)?;
+  let snapshot = reader.snapshot().clone();
+  if snapshot.tls {
+    return Err(anyhow!("Mock server {} used TLS, and can not be restored without the TLS config", snapshot.id));
+  }
+
+  let pact = snapshot.load_pact()?;
+  let v4_pact = pact.as_v4_pact()?;
+  configure_core_catalogue();
+  pact_matching::matchers::configure_core_catalogue();
+  let journal = Arc::new(Mutex::new(MatchJournal::new(snapshot.config.journal_limit)));
+  let runtime = MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .runtime_handle();
+  let entries = runtime.block_on(import_journal(&journal, &v4_pact, reader))?;
+  journal.lock().unwrap().continue_from(snapshot.last_sequence);
+
+  let ip = snapshot.address.as_ref()
+    .and_then(|address| address.parse::<std::net::IpAddr>().ok())
+    .unwrap_or_else(|| [127, 0, 0, 1].into());
+  let addr = std::net::SocketAddr::new(ip, port.or(snapshot.port).unwrap_or_default());
+  let port = MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .start_restored_mock_server(snapshot.id.clone(), pact, addr, snapshot.config.clone(), journal,
+      snapshot.metrics.clone())
+    .map_err(|err| anyhow!(err))?
+    .port();
+  info!("Restored mock server {} on {}:{} with {} journal entries", snapshot.id, ip, port, entries);
+  Ok(port as i32)
+}
+
+/// Writes the pact file for a local or plugin mock server
+fn write_mock_server_pact(
+  mock_server: Either<&MockServer, &PluginMockServer>,
+  directory: &Option<String>,
+  overwrite: bool
+) -> Result<(), WritePactFileErr> {
+  match mock_server {
+    Either::Left(mock_server) => {
+      mock_server.write_pact(directory, overwrite)
+        .map(|_| ())
+        .map_err(|err| {
+          error!("Failed to write pact to file - {}", err);
+          WritePactFileErr::IOError
+        })
+    }
+    Either::Right(_plugin_mock_server) => {
+      #[cfg(feature = "plugins")]
+      {
+        let mut pact = _plugin_mock_server.pact.clone();
+        pact.add_md_version("mockserver", option_env!("CARGO_PKG_VERSION").unwrap_or("unknown"));
+        let pact_file_name = pact.default_file_name();
+        let filename = match directory {
+          Some(path) => {
+            let mut path = PathBuf::from(path);
+            path.push(pact_file_name);
+            path
+          },
+          None => PathBuf::from(pact_file_name)
+        };
+
+        info!("Writing pact out to '{}'", filename.display());
+        match write_pact(pact.boxed(), filename.as_path(), PactSpecification::V4, overwrite) {
+          Ok(_) => Ok(()),
+          Err(err) => {
+            warn!("Failed to write pact to file - {}", err);
+            Err(WritePactFileErr::IOError)
+          }
+        }
+      }
+
+      #[cfg(not(feature = "plugins"))]
+      {
+        error!("Plugin mock server support requires the plugins feature to be enabled");
+        Err(WritePactFileErr::NoMockServer)
+      }
+    }
+  }
+}
+
 /// Trigger a mock server to write out its pact file. This function should
 /// be called if all the consumer tests have passed. The directory to write the file to is passed
 /// as the second parameter. If `None` is passed in, the current working directory is used.
@@ -416,47 +847,7 @@ pub fn write_pact_file(
     let opt_result = MANAGER.lock().unwrap()
         .get_or_insert_with(ServerManager::new)
         .find_mock_server_by_port(mock_server_port as u16, &|_, _, ms| {
-          match ms {
-            Either::Left(mock_server) => {
-              mock_server.write_pact(&directory, overwrite)
-                .map(|_| ())
-                .map_err(|err| {
-                  error!("Failed to write pact to file - {}", err);
-                  WritePactFileErr::IOError
-                })
-            }
-            Either::Right(_plugin_mock_server) => {
-              #[cfg(feature = "plugins")]
-              {
-                let mut pact = _plugin_mock_server.pact.clone();
-                pact.add_md_version("mockserver", option_env!("CARGO_PKG_VERSION").unwrap_or("unknown"));
-                let pact_file_name = pact.default_file_name();
-                let filename = match directory {
-                  Some(ref path) => {
-                    let mut path = PathBuf::from(path);
-                    path.push(pact_file_name);
-                    path
-                  },
-                  None => PathBuf::from(pact_file_name)
-                };
-
-                info!("Writing pact out to '{}'", filename.display());
-                match write_pact(pact.boxed(), filename.as_path(), PactSpecification::V4, overwrite) {
-                  Ok(_) => Ok(()),
-                  Err(err) => {
-                    warn!("Failed to write pact to file - {}", err);
-                    Err(WritePactFileErr::IOError)
-                  }
-                }
-              }
-
-              #[cfg(not(feature = "plugins"))]
-              {
-                error!("Plugin mock server support requires the plugins feature to be enabled");
-                Err(WritePactFileErr::NoMockServer)
-              }
-            }
-          }
+          write_mock_server_pact(ms, &directory, overwrite)
         });
 
     match opt_result {
@@ -468,6 +859,76 @@ pub fn write_pact_file(
     }
 }
 
+/// Starts a mock server that serves several pacts on one listener, for a consumer that talks to
+/// several providers through one base URL. Requests are matched against the interactions of all
+/// the pacts, and each pact can then be verified with `verify_mock_server_pact` and written with
+/// `write_pact_file_for` independently (`write_pact_file` writes all of them). A port of 0 will
+/// result in a port being allocated by the operating system. Returns the port the mock server is
+/// running on.
+///
+/// Unexpected requests (ones that do not match an interaction in any of the pacts) are never
+/// attributed to a pact, so they do not fail `verify_mock_server_pact`. Only verifying the mock
+/// server as a whole (with `mock_server_matched` or `verify_mock_server_async`) catches them.
+pub fn start_multi_pact_mock_server(
+  id: String,
+  pacts: Vec<Box<dyn Pact + Send + Sync>>,
+  addr: std::net::SocketAddr,
+  config: MockServerConfig
+) -> Result<i32, String> {
+  configure_core_catalogue();
+  pact_matching::matchers::configure_core_catalogue();
+
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .start_multi_pact_mock_server(id, pacts, addr, config)
+    .map(|addr| addr.port() as i32)
+}
+
+/// Verifies one of the pacts served by the mock server with the provided port (by its position in
+/// the pacts the mock server was started with), using only the requests for the interactions of
+/// that pact. For a mock server with one pact, position 0 is the same as verifying the mock server.
+/// Unexpected requests can not be attributed to a pact, so they are not included.
+///
+/// Returns `None` if there is no mock server with the provided port (or it is provided by a
+/// plugin), or it does not have a pact at that position.
+pub fn verify_mock_server_pact(mock_server_port: i32, index: usize) -> Option<MockServerVerification> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|_, _, mock_server| {
+      mock_server.left().and_then(|mock_server| mock_server.verify_pact(index))
+    })
+    .flatten()
+}
+
+/// Writes one of the pacts served by the mock server with the provided port (by its position in
+/// the pacts the mock server was started with) to a file in the directory. See `write_pact_file`.
+///
+/// Returns an error if there is no mock server with the provided port (or it is provided by a
+/// plugin), or the file can not be written.
+pub fn write_pact_file_for(
+  mock_server_port: i32,
+  index: usize,
+  directory: Option<String>,
+  overwrite: bool
+) -> Result<(), WritePactFileErr> {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|_, _, mock_server| {
+      match mock_server.left() {
+        Some(mock_server) => mock_server.write_pact_for(index, &directory, overwrite)
+          .map_err(|err| {
+            error!("Failed to write pact to file - {}", err);
+            WritePactFileErr::IOError
+          }),
+        None => Err(WritePactFileErr::NoMockServer)
+      }
+    })
+    .unwrap_or_else(|| {
+      error!("No mock server running on port {}", mock_server_port);
+      Err(WritePactFileErr::NoMockServer)
+    })
+}
+
 /// Shuts down the mock server with the provided port. Returns a boolean value to indicate if
 /// the mock server was successfully shut down.
 pub fn shutdown_mock_server(mock_server_port: i32) -> bool {
@@ -495,5 +956,207 @@ pub fn shutdown_mock_server_by_id(id: &str) -> bool {
     .shutdown_mock_server_by_id(id.to_string())
 }
 
+/// Shuts down a group of mock servers (by ID, by tag or all of them) concurrently. The shutdown
+/// signal is sent to all the mock servers, and then they are waited on (without holding the lock
+/// on the mock servers) up to the deadline. Any that have not stopped by then are aborted, and
+/// are reported as forced.
+pub fn shutdown_mock_servers(selector: ShutdownSelector, deadline: Duration) -> ShutdownReport {
+  let (batch, runtime) = {
+    let mut guard = MANAGER.lock().unwrap();
+    let manager = guard.get_or_insert_with(ServerManager::new);
+    (manager.begin_shutdown(selector), manager.runtime_handle())
+  };
+  runtime.block_on(batch.wait(deadline))
+}
+
+/// Sets the tags of the mock server with the provided port, so it can be shut down with other
+/// mock servers with the same tag by `shutdown_mock_servers`. Returns false if there is no mock
+/// server running with that port.
+pub fn set_mock_server_tags(mock_server_port: i32, tags: Vec<String>) -> bool {
+  let mut guard = MANAGER.lock().unwrap();
+  let manager = guard.get_or_insert_with(ServerManager::new);
+  match manager.find_mock_server_by_port(mock_server_port as u16, &|_, id, _| id.clone()) {
+    Some(id) => manager.set_mock_server_tags(id.as_str(), tags),
+    None => false
+  }
+}
+
+/// Time allowed on top of the drain timeout of a mock server for it to stop, when shutting it down
+/// with `shutdown_mock_server_async`
+const SHUTDOWN_GRACE_PERIOD: Duration = Duration::from_secs(1);
+
+/// Handle to the runtime of the server manager, which the async functions run their work on
+fn manager_runtime() -> tokio::runtime::Handle {
+  MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .runtime_handle()
+}
+
+/// Async version of `start_mock_server_with_config`. The mock server is bound and spawned on the
+/// runtime of the server manager and the returned future only waits for that, so it can be
+/// awaited from any executor (including another Tokio runtime) without blocking a thread or
+/// nesting runtimes. Returns the port that the mock server is running on.
+pub async fn start_mock_server_async(
+  id: String,
+  pact: Box<dyn Pact + Send + Sync>,
+  addr: std::net::SocketAddr,
+  config: MockServerConfig
+) -> Result<i32, String> {
+  configure_core_catalogue();
+  pact_matching::matchers::configure_core_catalogue();
+
+  let (mock_server, future) = manager_runtime()
+    .spawn(MockServer::new(id.clone(), pact, addr, config))
+    .await
+    .map_err(|err| format!("Could not start server: {}", err))??;
+  let addr = MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .add_mock_server(id, mock_server, future, addr);
+  Ok(addr.port() as i32)
+}
+
+/// Async version of `start_tls_mock_server_with_config` (see `start_mock_server_async`).
+#[cfg(feature = "tls")]
+pub async fn start_tls_mock_server_async(
+  id: String,
+  pact: Box<dyn Pact + Send + Sync>,
+  addr: std::net::SocketAddr,
+  tls: &ServerConfig,
+  config: MockServerConfig
+) -> Result<i32, String> {
+  configure_core_catalogue();
+  pact_matching::matchers::configure_core_catalogue();
+
+  let tls = tls.clone();
+  let server_id = id.clone();
+  let (mock_server, future) = manager_runtime()
+    .spawn(async move { MockServer::new_tls(server_id, pact, addr, &tls, config).await })
+    .await
+    .map_err(|err| format!("Could not start server: {}", err))??;
+  let addr = MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .add_mock_server(id, mock_server, future, addr);
+  Ok(addr.port() as i32)
+}
+
+/// Verifies the mock server with the provided port, returning the JSON form of the mock server
+/// (with its status) and its mismatches. The mock server shares its pact and journal with the
+/// copy that is verified, and the verification runs on the blocking pool of the server manager, so
+/// the calling executor is not blocked for large pacts. Plugin mock servers have their results
+/// fetched from the plugin without blocking.
+///
+/// Returns `None` if there is no mock server with the provided port.
+pub async fn verify_mock_server_async(mock_server_port: i32) -> Option<MockServerVerification> {
+  let (id, mock_server, runtime) = MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|manager, id, ms| {
+      (id.clone(), ms.map_left(|ms| ms.clone()).map_right(|ms| ms.clone()), manager.runtime_handle())
+    })?;
+
+  match mock_server {
+    Either::Left(mock_server) => runtime.spawn_blocking(move || mock_server.verify()).await.ok(),
+    Either::Right(_plugin_mock_server) => {
+      #[cfg(feature = "plugins")]
+      {
+        let details = &_plugin_mock_server.mock_server_details;
+        let mismatches = match plugin_results(&id).fresh_results(details, &runtime).await {
+          Ok(results) => plugin_mismatches_json(&results),
+          Err(err) => {
+            error!("Request to plugin to get matching results failed - {}", err);
+            vec![json!({ "error": format!("Request to plugin to get matching results failed - {}", err) })]
+          }
+        };
+        Some(MockServerVerification {
+          mock_server: json!({
+            "id": id,
+            "port": mock_server_port,
+            "provider": _plugin_mock_server.pact.provider.name,
+            "status": if mismatches.is_empty() { "ok" } else { "error" }
+          }),
+          mismatches,
+          evicted_mismatches: 0
+        })
+      }
+
+      #[cfg(not(feature = "plugins"))]
+      {
+        error!("Plugin mock server {} requires the plugins feature to be enabled", id);
+        None
+      }
+    }
+  }
+}
+
+/// Async version of `write_pact_file`. The pact file is written on the blocking pool of the server
+/// manager, so the calling executor is not blocked by the file IO.
+pub async fn write_pact_file_async(
+  mock_server_port: i32,
+  directory: Option<String>,
+  overwrite: bool
+) -> Result<(), WritePactFileErr> {
+  let (mock_server, runtime) = MANAGER.lock().unwrap()
+    .get_or_insert_with(ServerManager::new)
+    .find_mock_server_by_port(mock_server_port as u16, &|manager, _, ms| {
+      (ms.map_left(|ms| ms.clone()).map_right(|ms| ms.clone()), manager.runtime_handle())
+    })
+    .ok_or_else(|| {
+      error!("No mock server running on port {}", mock_server_port);
+      WritePactFileErr::NoMockServer
+    })?;
+  runtime.spawn_blocking(move || write_mock_server_pact(mock_server.as_ref(), &directory, overwrite))
+    .await
+    .unwrap_or(Err(WritePactFileErr::IOError))
+}
+
+/// Async version of `shutdown_mock_server`. The mock server is sent the shutdown signal, and the
+/// returned future completes once it has drained its connections (or been aborted after its drain
+/// timeout). Returns false if there is no mock server with the provided port, or it could not be
+/// shut down.
+pub async fn shutdown_mock_server_async(mock_server_port: i32) -> bool {
+  let (batch, runtime, deadline) = {
+    let mut guard = MANAGER.lock().unwrap();
+    let manager = guard.get_or_insert_with(ServerManager::new);
+    let found = manager.find_mock_server_by_port(mock_server_port as u16, &|_, id, ms| {
+      let drain_timeout = ms.left().and_then(|ms| ms.config.drain_timeout).unwrap_or(DEFAULT_DRAIN_TIMEOUT);
+      (id.clone(), drain_timeout)
+    });
+    match found {
+      Some((id, drain_timeout)) => (
+        manager.begin_shutdown(ShutdownSelector::Ids(vec![id])),
+        manager.runtime_handle(),
+        drain_timeout + SHUTDOWN_GRACE_PERIOD
+      ),
+      None => return false
+    }
+  };
+  match runtime.spawn(batch.wait(deadline)).await {
+    Ok(report) => report.failed.is_empty() && report.not_found.is_empty(),
+    Err(_) => false
+  }
+}
+
+/// Async version of `shutdown_mock_servers`.
+pub async fn shutdown_mock_servers_async(selector: ShutdownSelector, deadline: Duration) -> ShutdownReport {
+  let (batch, runtime) = {
+    let mut guard = MANAGER.lock().unwrap();
+    let manager = guard.get_or_insert_with(ServerManager::new);
+    (manager.begin_shutdown(selector), manager.runtime_handle())
+  };
+  runtime.spawn(batch.wait(deadline)).await.unwrap_or_default()
+}
+
+/// Runs the future on the runtime of the server manager, calling `callback` with its result once
+/// it completes. This is for callers that can not await a future, like language bindings with their
+/// own event loop, for example `spawn_with_callback(shutdown_mock_server_async(port), callback)`.
+/// The callback is called on a runtime thread, so it should hand the result off rather than block.
+pub fn spawn_with_callback<R: Send + 'static>(
+  future: impl Future<Output = R> + Send + 'static,
+  callback: impl FnOnce(R) + Send + 'static
+) {
+  manager_runtime().spawn(async move {
+    callback(future.await);
+  });
+}
+
 #[cfg(test)]
 mod tests;
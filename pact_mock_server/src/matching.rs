@@ -3,6 +3,7 @@
 //! against a list of potential interactions.
 //!
 
+use std::collections::HashMap;
 use std::fmt::{Debug, Display, Formatter};
 
 use futures::prelude::*;
@@ -15,6 +16,7 @@ use pact_models::PactSpecification;
 use pact_models::prelude::Pact;
 use pact_models::prelude::v4::SynchronousHttp;
 use pact_models::v4::http_parts::{HttpRequest, HttpResponse};
+use pact_models::v4::interaction::V4Interaction;
 use pact_models::v4::V4InteractionType;
 use pact_models::v4::pact::V4Pact;
 
@@ -120,7 +122,67 @@ pub async fn match_request(
   req: &HttpRequest,
   pact: &V4Pact,
 ) -> MatchResult {
-  let interactions = pact.filter_interactions(V4InteractionType::Synchronous_HTTP);
+  match_candidates(req, pact, None).await
+}
+
+/// Index of the HTTP interactions of a Pact by request method, so that a request is only matched
+/// against the interactions with the same method. For a mock server serving several pacts, this
+/// is the routing table over the interactions of all of them.
+#[derive(Debug, Clone, Default)]
+pub struct RoutingIndex {
+  /// Pact the interactions are from
+  pact: V4Pact,
+  /// Positions of the HTTP interactions in the Pact, by upper case request method
+  by_method: HashMap<String, Vec<usize>>
+}
+
+impl RoutingIndex {
+  /// Builds the index over the HTTP interactions of the Pact
+  pub fn new(pact: V4Pact) -> RoutingIndex {
+    let mut by_method: HashMap<String, Vec<usize>> = HashMap::new();
+    for (index, interaction) in pact.interactions.iter().enumerate() {
+      if let Some(http) = interaction.as_v4_http() {
+        by_method.entry(http.request.method.to_uppercase()).or_default().push(index);
+      }
+    }
+    RoutingIndex { pact, by_method }
+  }
+
+  /// Pact the index was built from
+  pub fn pact(&self) -> &V4Pact {
+    &self.pact
+  }
+
+  /// Positions in the Pact of the HTTP interactions for the request method
+  pub fn candidates(&self, method: &str) -> &[usize] {
+    self.by_method.get(&method.to_uppercase())
+      .map(|candidates| candidates.as_slice())
+      .unwrap_or_default()
+  }
+}
+
+///
+/// Matches a request against the interactions in the routing index with the same method. A
+/// request with a method that no interaction has is not found, the same as with `match_request`.
+///
+pub async fn match_request_with_index(
+  req: &HttpRequest,
+  index: &RoutingIndex
+) -> MatchResult {
+  match_candidates(req, &index.pact, Some(index.candidates(&req.method))).await
+}
+
+async fn match_candidates(
+  req: &HttpRequest,
+  pact: &V4Pact,
+  candidates: Option<&[usize]>
+) -> MatchResult {
+  let interactions = match candidates {
+    Some(candidates) => candidates.iter()
+      .map(|index| pact.interactions[*index].boxed_v4())
+      .collect(),
+    None => pact.filter_interactions(V4InteractionType::Synchronous_HTTP)
+  };
   let match_results = futures::stream::iter(interactions)
     .filter(|i| future::ready(i.is_request_response()))
     .then(|i| async move {
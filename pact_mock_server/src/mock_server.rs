@@ -6,11 +6,14 @@
 use std::cell::RefCell;
 use std::collections::HashMap;
 use std::ffi::CString;
+use std::mem::size_of;
 use std::ops::DerefMut;
 use std::path::PathBuf;
-use std::sync::{Arc, Mutex};
+use std::sync::{Arc, Mutex, OnceLock};
+use std::time::{Duration, Instant};
 use pact_models::json_utils::json_to_string;
 
+use anyhow::anyhow;
 use pact_models::pact::{Pact, write_pact};
 use pact_models::PactSpecification;
 use pact_models::sync_pact::RequestResponsePact;
@@ -20,9 +23,18 @@ use serde::{Deserialize, Serialize};
 use serde_json::{json, Value};
 use tracing::{debug, info, trace, warn};
 
+use crate::capture::RequestCapture;
 use crate::hyper_server;
+use crate::journal::{estimate_pact_size, JournalCounts, JournalEntry, MatchJournal, WaitCondition};
 use crate::matching::MatchResult;
-use crate::utils::json_to_bool;
+use crate::multi_pact::{combine_pacts, PactSource};
+use crate::proxy::{RecordedInteraction, RecordingProxy};
+use crate::status::{MockServerStatus, RequestStats};
+use crate::utils::{json_to_bool, json_to_usize};
+
+/// Time open connections are given to complete their requests when a mock server is shut down,
+/// if the mock server config does not set one
+pub const DEFAULT_DRAIN_TIMEOUT: Duration = Duration::from_secs(5);
 
 /// Mock server configuration
 #[derive(Debug, Default, Clone, PartialEq)]
@@ -32,7 +44,23 @@ pub struct MockServerConfig {
   /// Pact specification to use
   pub pact_specification: PactSpecification,
   /// Configuration required for the transport used
-  pub transport_config: HashMap<String, Value>
+  pub transport_config: HashMap<String, Value>,
+  /// Approximate limit (in bytes) of the match journal. When the journal goes over this limit,
+  /// it will be compacted, and as a last resort the oldest mismatches evicted.
+  pub journal_limit: Option<usize>,
+  /// If requests can specify their session with a `/_session/{id}` path prefix (as well as with
+  /// the `X-Pact-Session` header). The prefix is removed before the request is matched.
+  pub session_path_prefix: bool,
+  /// File to record the raw requests received by the mock server to (see the `capture` module)
+  pub capture_file: Option<String>,
+  /// Upstream URL to forward requests that do not match any interaction to, recording the
+  /// exchanges as candidate interactions (see the `proxy` module)
+  pub proxy_url: Option<String>,
+  /// Limit of the bytes of each body that are recorded when proxying (defaults to 1 MiB)
+  pub proxy_body_limit: Option<usize>,
+  /// Time open connections are given to complete their requests on shutdown before they are
+  /// aborted (defaults to `DEFAULT_DRAIN_TIMEOUT`)
+  pub drain_timeout: Option<Duration>
 }
 
 impl MockServerConfig {
@@ -46,6 +74,18 @@ impl MockServerConfig {
           config.cors_preflight = json_to_bool(v).unwrap_or_default();
         } else if k == "pactSpecification" {
           config.pact_specification = PactSpecification::from(json_to_string(v));
+        } else if k == "journalLimit" {
+          config.journal_limit = json_to_usize(v);
+        } else if k == "sessionPathPrefix" {
+          config.session_path_prefix = json_to_bool(v).unwrap_or_default();
+        } else if k == "captureFile" {
+          config.capture_file = v.as_str().map(|file| file.to_string());
+        } else if k == "proxyUrl" {
+          config.proxy_url = v.as_str().map(|url| url.to_string());
+        } else if k == "proxyBodyLimit" {
+          config.proxy_body_limit = json_to_usize(v);
+        } else if k == "drainTimeout" {
+          config.drain_timeout = json_to_usize(v).map(|ms| Duration::from_millis(ms as u64));
         } else {
           config.transport_config.insert(k.clone(), v.clone());
         }
@@ -54,6 +94,35 @@ impl MockServerConfig {
 
     config
   }
+
+  /// Converts the config to JSON, in the form read by `from_json`
+  pub fn to_json(&self) -> Value {
+    let mut map = serde_json::Map::new();
+    for (k, v) in &self.transport_config {
+      map.insert(k.clone(), v.clone());
+    }
+    map.insert("corsPreflight".to_string(), json!(self.cors_preflight));
+    if self.pact_specification != PactSpecification::Unknown {
+      map.insert("pactSpecification".to_string(), json!(self.pact_specification.to_string()));
+    }
+    map.insert("sessionPathPrefix".to_string(), json!(self.session_path_prefix));
+    if let Some(limit) = self.journal_limit {
+      map.insert("journalLimit".to_string(), json!(limit));
+    }
+    if let Some(file) = &self.capture_file {
+      map.insert("captureFile".to_string(), json!(file));
+    }
+    if let Some(url) = &self.proxy_url {
+      map.insert("proxyUrl".to_string(), json!(url));
+    }
+    if let Some(limit) = self.proxy_body_limit {
+      map.insert("proxyBodyLimit".to_string(), json!(limit));
+    }
+    if let Some(timeout) = self.drain_timeout {
+      map.insert("drainTimeout".to_string(), json!(timeout.as_millis() as u64));
+    }
+    Value::Object(map)
+  }
 }
 
 /// Mock server scheme
@@ -86,7 +155,134 @@ pub struct MockServerMetrics {
   /// Total requests
   pub requests: usize,
   /// Total requests by path
-  pub requests_by_path: HashMap<String, usize>
+  pub requests_by_path: HashMap<String, usize>,
+  /// Connections that completed their requests and closed when the mock server was shut down
+  #[serde(default)]
+  pub drained_connections: usize,
+  /// Connections that were aborted because they were still open after the drain timeout
+  #[serde(default)]
+  pub aborted_connections: usize
+}
+
+impl MockServerMetrics {
+  /// Approximate number of bytes held by the metrics
+  pub fn size(&self) -> usize {
+    size_of::<MockServerMetrics>() + self.requests_by_path.keys()
+      .map(|path| path.len() + size_of::<(String, usize)>())
+      .sum::<usize>()
+  }
+}
+
+/// Approximate memory held by a mock server
+#[derive(Debug, Default, Clone, Serialize, Deserialize, Eq, PartialEq)]
+pub struct MockServerMemory {
+  /// Bytes held by the Pact the mock server is based on
+  pub pact: usize,
+  /// Bytes held by the match journal
+  pub journal: usize,
+  /// Number of entries in the match journal
+  pub journal_entries: usize,
+  /// Limit of the match journal in bytes
+  pub journal_limit: Option<usize>,
+  /// Number of times the match journal has been compacted
+  pub compactions: usize,
+  /// Number of entries evicted from the match journal
+  pub evicted_entries: usize,
+  /// Number of mismatches evicted from the match journal
+  pub evicted_mismatches: usize,
+  /// Bytes held by the metrics
+  pub metrics: usize,
+  /// Total bytes held by the mock server
+  pub total: usize
+}
+
+/// Result of verifying a mock server
+#[derive(Debug, Clone, PartialEq)]
+pub struct MockServerVerification {
+  /// JSON form of the mock server, with the status from the verification
+  pub mock_server: Value,
+  /// Mismatches, unexpected requests and missing requests in JSON form
+  pub mismatches: Vec<Value>,
+  /// Number of mismatches that have been evicted from the match journal
+  pub evicted_mismatches: usize
+}
+
+impl MockServerVerification {
+  /// If the verification passed (there are no mismatches, and none have been evicted)
+  pub fn matched(&self) -> bool {
+    self.mismatches.is_empty() && self.evicted_mismatches == 0
+  }
+}
+
+/// Page of mismatches from `MockServer::mismatches_page`
+#[derive(Debug, Clone, PartialEq)]
+pub struct MismatchPage {
+  /// Mismatches in JSON form. Mismatches from the match journal have their `sequence` number.
+  pub mismatches: Vec<Value>,
+  /// Cursor to get the next page with
+  pub cursor: u64,
+  /// If this is the last page
+  pub complete: bool
+}
+
+impl MismatchPage {
+  /// Converts the page to JSON, in the form `{ "mismatches": [...], "cursor": <sequence>, "complete": <bool> }`
+  pub fn to_json(&self) -> Value {
+    json!({
+      "mismatches": self.mismatches,
+      "cursor": self.cursor,
+      "complete": self.complete
+    })
+  }
+}
+
+/// Iterator over the mismatches of a mock server, from `MockServer::mismatch_iter`
+pub struct MismatchIter {
+  mock_server: MockServer,
+  page_size: usize,
+  cursor: u64,
+  page: std::vec::IntoIter<Value>,
+  complete: bool
+}
+
+impl Iterator for MismatchIter {
+  type Item = Value;
+
+  fn next(&mut self) -> Option<Self::Item> {
+    loop {
+      if let Some(mismatch) = self.page.next() {
+        return Some(mismatch);
+      }
+      if self.complete {
+        return None;
+      }
+      let page = self.mock_server.mismatches_page(self.cursor, self.page_size);
+      self.cursor = page.cursor;
+      self.complete = page.complete;
+      self.page = page.mismatches.into_iter();
+    }
+  }
+}
+
+fn mismatch_json_with_sequence(entry: &JournalEntry) -> Value {
+  let mut json = entry.result_json().clone();
+  if let Value::Object(map) = &mut json {
+    map.insert("sequence".to_string(), json!(entry.sequence));
+  }
+  json
+}
+
+/// Number of HTTP interactions in the Pact, which are the requests the mock server expects
+fn count_http_interactions(pact: &dyn Pact) -> usize {
+  pact.interactions().iter()
+    .filter(|interaction| interaction.as_v4_http().is_some())
+    .count()
+}
+
+/// Mismatches journaled after the sequence number `since` (see `JournalEntry::is_mismatch`)
+fn new_mismatches(journal: &MatchJournal, since: u64) -> impl Iterator<Item = &JournalEntry> {
+  journal.entries_since(since).iter()
+    .filter(|entry| entry.is_mismatch())
 }
 
 /// Struct to represent the "foreground" part of mock server
@@ -103,18 +299,39 @@ pub struct MockServer {
   /// List of resources that need to be cleaned up when the mock server completes
   #[deprecated(since = "0.9.1", note = "Resources should be stored on the mock server manager entry")]
   pub resources: Vec<CString>,
-  /// Pact that this mock server is based on
-  pub pact: Box<dyn Pact + Send + Sync>,
+  /// Pact that this mock server is based on. This is shared with the running server (and any
+  /// clones of the mock server), so it is never copied.
+  pub pact: Arc<dyn Pact + Send + Sync>,
   /// Receiver of match results
-  matches: Arc<Mutex<Vec<MatchResult>>>,
+  matches: Arc<Mutex<MatchJournal>>,
   /// Shutdown signal
   shutdown_tx: RefCell<Option<futures::channel::oneshot::Sender<()>>>,
   /// Mock server config
   pub config: MockServerConfig,
-  /// Metrics collected by the mock server
-  pub metrics: MockServerMetrics,
+  /// Metrics collected by the mock server. These are shared with any clones of the mock server,
+  /// and are copied on write (with `Arc::make_mut`), so cloning the mock server does not copy the
+  /// requests by path.
+  pub metrics: Arc<MockServerMetrics>,
   /// Pact spec version to use
-  pub spec_version: PactSpecification
+  pub spec_version: PactSpecification,
+  /// Approximate number of bytes held by the Pact
+  pact_size: usize,
+  /// Number of HTTP interactions in the Pact, counted when the mock server is created
+  http_interactions: usize,
+  /// Expected requests from the Pact, along with the JSON to report them as missing. This is only
+  /// built the first time the mock server is verified, and is shared with any clones.
+  expected_requests: Arc<OnceLock<Vec<(HttpRequest, Value)>>>,
+  /// Time the mock server last received a request (or was started)
+  pub(crate) last_activity: Instant,
+  /// Capture of the requests received, if enabled in the config
+  pub(crate) capture: Option<RequestCapture>,
+  /// Proxy to forward unmatched requests to, if enabled in the config
+  pub(crate) proxy: Option<RecordingProxy>,
+  /// Request counters and latencies, updated by the running server. These are shared with any clones.
+  stats: Arc<RequestStats>,
+  /// Pacts the mock server was started with when it serves several pacts (see `new_multi`). The
+  /// Pact of the mock server is then the combination of these. Empty for a mock server with one pact.
+  sources: Arc<Vec<PactSource>>
 }
 
 impl MockServer {
@@ -124,9 +341,24 @@ impl MockServer {
     pact: Box<dyn Pact + Send + Sync>,
     addr: std::net::SocketAddr,
     config: MockServerConfig
+  ) -> Result<(Arc<Mutex<MockServer>>, impl std::future::Future<Output = ()>), String> {
+    let matches = Arc::new(Mutex::new(MatchJournal::new(config.journal_limit)));
+    MockServer::new_with_journal(id, pact, addr, config, matches).await
+  }
+
+  /// Create a new mock server that starts with the given match journal, for instance one restored
+  /// from a snapshot. The journal is in place before the server handles any requests.
+  pub(crate) async fn new_with_journal(
+    id: String,
+    pact: Box<dyn Pact + Send + Sync>,
+    addr: std::net::SocketAddr,
+    config: MockServerConfig,
+    matches: Arc<Mutex<MatchJournal>>
   ) -> Result<(Arc<Mutex<MockServer>>, impl std::future::Future<Output = ()>), String> {
     let (shutdown_tx, shutdown_rx) = futures::channel::oneshot::channel();
-    let matches = Arc::new(Mutex::new(vec![]));
+    let capture = start_capture(&config)?;
+    let proxy = start_proxy(&config)?;
+    let pact = pact.arced();
 
     #[allow(deprecated)]
     let mock_server = Arc::new(Mutex::new(MockServer {
@@ -135,12 +367,20 @@ impl MockServer {
       address: None,
       scheme: MockServerScheme::HTTP,
       resources: vec![],
-      pact: pact.boxed(),
+      pact: pact.clone(),
       matches: matches.clone(),
       shutdown_tx: RefCell::new(Some(shutdown_tx)),
       config: config.clone(),
-      metrics: MockServerMetrics::default(),
-      spec_version: pact_specification(config.pact_specification, pact.specification_version())
+      metrics: Default::default(),
+      spec_version: pact_specification(config.pact_specification, pact.specification_version()),
+      pact_size: estimate_pact_size(pact.as_ref()),
+      http_interactions: count_http_interactions(pact.as_ref()),
+      expected_requests: Default::default(),
+      last_activity: Instant::now(),
+      capture,
+      proxy,
+      stats: Default::default(),
+      sources: Default::default()
     }));
 
     let (future, socket_addr) = hyper_server::create_and_bind(
@@ -167,6 +407,23 @@ impl MockServer {
     Ok((mock_server.clone(), future))
   }
 
+  /// Create a new mock server that serves several pacts on one listener (see the `multi_pact`
+  /// module). Requests are routed over the interactions of all the pacts, and each pact can be
+  /// verified (`verify_pact`) and written (`write_pact_for`) on its own.
+  pub async fn new_multi(
+    id: String,
+    pacts: Vec<Box<dyn Pact + Send + Sync>>,
+    addr: std::net::SocketAddr,
+    config: MockServerConfig
+  ) -> Result<(Arc<Mutex<MockServer>>, impl std::future::Future<Output = ()>), String> {
+    let (pact, sources) = combine_pacts(pacts).map_err(|err| err.to_string())?;
+    debug!("Starting mock server {} for {} pacts with {} interactions", id, sources.len(),
+      pact.interactions.len());
+    let (mock_server, future) = MockServer::new(id, pact.boxed(), addr, config).await?;
+    mock_server.lock().unwrap().sources = Arc::new(sources);
+    Ok((mock_server, future))
+  }
+
   /// Create a new TLS mock server, consisting of its state (self) and its executable server future.
   #[cfg(feature = "tls")]
   pub async fn new_tls(
@@ -175,9 +432,25 @@ impl MockServer {
     addr: std::net::SocketAddr,
     tls: &ServerConfig,
     config: MockServerConfig
+  ) -> Result<(Arc<Mutex<MockServer>>, impl std::future::Future<Output = ()>), String> {
+    let matches = Arc::new(Mutex::new(MatchJournal::new(config.journal_limit)));
+    MockServer::new_tls_with_journal(id, pact, addr, tls, config, matches).await
+  }
+
+  /// Create a new TLS mock server that starts with the given match journal (see `new_with_journal`)
+  #[cfg(feature = "tls")]
+  pub(crate) async fn new_tls_with_journal(
+    id: String,
+    pact: Box<dyn Pact + Send + Sync>,
+    addr: std::net::SocketAddr,
+    tls: &ServerConfig,
+    config: MockServerConfig,
+    matches: Arc<Mutex<MatchJournal>>
   ) -> Result<(Arc<Mutex<MockServer>>, impl std::future::Future<Output = ()>), String> {
     let (shutdown_tx, shutdown_rx) = futures::channel::oneshot::channel();
-    let matches = Arc::new(Mutex::new(vec![]));
+    let capture = start_capture(&config)?;
+    let proxy = start_proxy(&config)?;
+    let pact = pact.arced();
 
     #[allow(deprecated)]
     let mock_server = Arc::new(Mutex::new(MockServer {
@@ -186,12 +459,20 @@ impl MockServer {
       address: None,
       scheme: MockServerScheme::HTTPS,
       resources: vec![],
-      pact: pact.boxed(),
+      pact: pact.clone(),
       matches: matches.clone(),
       shutdown_tx: RefCell::new(Some(shutdown_tx)),
       config: config.clone(),
-      metrics: MockServerMetrics::default(),
-      spec_version: pact_specification(config.pact_specification, pact.specification_version())
+      metrics: Default::default(),
+      spec_version: pact_specification(config.pact_specification, pact.specification_version()),
+      pact_size: estimate_pact_size(pact.as_ref()),
+      http_interactions: count_http_interactions(pact.as_ref()),
+      expected_requests: Default::default(),
+      last_activity: Instant::now(),
+      capture,
+      proxy,
+      stats: Default::default(),
+      sources: Default::default()
     }));
 
     let (future, socket_addr) = hyper_server::create_and_bind_tls(
@@ -235,59 +516,417 @@ impl MockServer {
 
     /// Converts this mock server to a `Value` struct
     pub fn to_json(&self) -> serde_json::Value {
+      self.to_json_with_status(self.all_matched())
+    }
+
+    fn to_json_with_status(&self, matched: bool) -> Value {
       json!({
         "id" : self.id.clone(),
         "port" : self.port.unwrap_or_default() as u64,
         "address" : self.address.clone().unwrap_or_default(),
         "scheme" : self.scheme.to_string(),
         "provider" : self.pact.provider().name.clone(),
-        "status" : if self.mismatches().is_empty() { "ok" } else { "error" },
-        "metrics" : self.metrics
+        "status" : if matched { "ok" } else { "error" },
+        "metrics" : &*self.metrics,
+        "memory" : self.memory_usage(),
+        "capture" : self.capture.as_ref().map(|capture| capture.to_json()),
+        "proxy" : self.proxy.as_ref().map(|proxy| proxy.to_json())
       })
     }
 
     /// Returns all collected matches
     pub fn matches(&self) -> Vec<MatchResult> {
-        self.matches.lock().unwrap().clone()
+        self.matches.lock().unwrap().results()
+    }
+
+  /// Returns true if all the expected requests have been received and there have been no
+  /// mismatches, including any mismatches that have been evicted from the match journal.
+  pub fn all_matched(&self) -> bool {
+    let evicted_mismatches = self.matches.lock().unwrap().evicted_mismatches();
+    evicted_mismatches == 0 && self.mismatches().is_empty()
+  }
+
+  /// Returns the status of this mock server (its request counters, latency histogram and the
+  /// coverage of its interactions). This only reads counters, so is cheap enough to be polled
+  /// frequently, unlike `to_json` or `mismatches`.
+  pub fn status(&self) -> MockServerStatus {
+    let mut status = MockServerStatus::default();
+    self.stats.fill(&mut status);
+    {
+      let journal = self.matches.lock().unwrap();
+      status.matched = journal.matched() as u64;
+      status.mismatched = journal.mismatched() as u64;
+      status.not_found = journal.not_found() as u64;
+      status.cors_preflight = journal.cors_preflight() as u64;
+      status.evicted_mismatches = journal.evicted_mismatches() as u64;
+      status.interactions_received = journal.received_expected() as u64;
+    }
+    status.interactions = self.http_interactions as u64;
+    status
+  }
+
+  /// Request counters shared with the running server
+  pub(crate) fn request_stats(&self) -> Arc<RequestStats> {
+    self.stats.clone()
+  }
+
+  /// Returns a shared handle to the match journal of this mock server. This can be used to access
+  /// the journal without holding a lock on the mock server.
+  pub fn journal(&self) -> Arc<Mutex<MatchJournal>> {
+    self.matches.clone()
+  }
+
+  /// Returns the condition to wait for `count` matches. If an interaction description is given,
+  /// the condition will be for matches of that interaction. Returns `None` if there is no HTTP
+  /// interaction with that description in the Pact.
+  pub fn wait_condition(&self, interaction: Option<&str>, count: usize) -> Option<WaitCondition> {
+    match interaction {
+      Some(description) => self.pact.interactions().iter()
+        .find(|i| i.description() == description)
+        .and_then(|i| i.as_v4_http())
+        .map(|i| WaitCondition::RequestMatches(i.request, count)),
+      None => Some(WaitCondition::Matches(count))
+    }
+  }
+
+  /// Returns the time the mock server last received a request, or when it was started if it has
+  /// not received any requests.
+  pub fn last_activity(&self) -> Instant {
+    self.last_activity
+  }
+
+  /// Returns the candidate interactions recorded from the requests forwarded to the proxy
+  /// upstream. Returns an empty list if the mock server is not configured with a proxy URL.
+  pub fn recorded_interactions(&self) -> Vec<RecordedInteraction> {
+    self.proxy.as_ref()
+      .map(|proxy| proxy.recorded_interactions())
+      .unwrap_or_default()
+  }
+
+  /// Returns the approximate memory held by this mock server
+  pub fn memory_usage(&self) -> MockServerMemory {
+    let journal = self.matches.lock().unwrap();
+    let metrics = self.metrics.size();
+    MockServerMemory {
+      pact: self.pact_size,
+      journal: journal.size(),
+      journal_entries: journal.len(),
+      journal_limit: journal.limit(),
+      compactions: journal.compactions(),
+      evicted_entries: journal.evicted(),
+      evicted_mismatches: journal.evicted_mismatches(),
+      metrics,
+      total: self.pact_size + journal.size() + metrics
+    }
+  }
+
+  /// Verifies the mock server, working out the mismatches once with the match journal locked.
+  /// The result has the mismatches (including any missing requests) in JSON form, and the JSON
+  /// form of the mock server with the status from the verification.
+  pub fn verify(&self) -> MockServerVerification {
+    let (mismatches, evicted_mismatches) = {
+      let journal = self.matches.lock().unwrap();
+      (self.mismatches_json_for(&journal), journal.evicted_mismatches())
+    };
+    let matched = mismatches.is_empty() && evicted_mismatches == 0;
+    MockServerVerification {
+      mock_server: self.to_json_with_status(matched),
+      mismatches,
+      evicted_mismatches
     }
+  }
+
+  /// Pacts served by the mock server. This is the Pact the mock server was started with, or for a
+  /// mock server started with several pacts (`new_multi`), each of those pacts.
+  pub fn pacts(&self) -> Vec<Arc<dyn Pact + Send + Sync>> {
+    if self.sources.is_empty() {
+      vec![self.pact.clone()]
+    } else {
+      self.sources.iter().map(|source| source.pact.clone()).collect()
+    }
+  }
+
+  /// Verifies one of the pacts served by the mock server (by its position in `pacts`), using only
+  /// the journal entries for the interactions of that pact. Requests that did not match any
+  /// interaction can not be attributed to a pact, so they only fail `verify`. The same goes for
+  /// evicted mismatches: only the ones against the interactions of the pact are counted. Returns
+  /// `None` if there is no pact at that position.
+  pub fn verify_pact(&self, index: usize) -> Option<MockServerVerification> {
+    if self.sources.is_empty() {
+      return if index == 0 { Some(self.verify()) } else { None };
+    }
+
+    let source = self.sources.get(index)?;
+    let (mismatches, evicted_mismatches) = {
+      let journal = self.matches.lock().unwrap();
+      let mismatches = journal.entries().iter()
+        .filter(|entry| match &entry.result {
+          MatchResult::RequestMismatch(expected, _, _) => source.has_request(expected),
+          _ => false
+        })
+        .map(|entry| entry.result_json().clone())
+        .chain(source.requests().iter()
+          .filter(|request| !journal.has_received(request))
+          .map(|request| MatchResult::MissingRequest(request.clone()).to_json()))
+        .collect::<Vec<Value>>();
+      (mismatches, journal.evicted_request_mismatches(|expected| source.has_request(expected)))
+    };
+    let mut mock_server = self.to_json_with_status(mismatches.is_empty() && evicted_mismatches == 0);
+    mock_server["provider"] = json!(source.provider());
+    mock_server["pact"] = json!(index);
+    Some(MockServerVerification {
+      mock_server,
+      mismatches,
+      evicted_mismatches
+    })
+  }
+
+  /// Verifies a session of the mock server (see `verify`). The status of the mock server in the
+  /// result is for the session.
+  pub fn verify_session(&self, session: &str) -> MockServerVerification {
+    let (mismatches, evicted_mismatches) = {
+      let journal = self.matches.lock().unwrap();
+      let mismatches = self.mismatches_json_from(journal.session_entries(session), journal.session_counts(session));
+      (mismatches, journal.evicted_session_mismatches(session))
+    };
+    MockServerVerification {
+      mock_server: self.to_json_with_status(mismatches.is_empty() && evicted_mismatches == 0),
+      mismatches,
+      evicted_mismatches
+    }
+  }
 
     /// Returns all the mismatches that have occurred with this mock server
     pub fn mismatches(&self) -> Vec<MatchResult> {
-      let matches = self.matches();
-      let mismatches = matches.iter()
-        .filter(|m| !m.matched() && !m.cors_preflight())
-        .cloned();
-      let requests: Vec<HttpRequest> = matches.iter().map(|m| {
-        match m {
-          MatchResult::RequestMatch(request, _, _) => Some(request),
-          MatchResult::RequestMismatch(request, _, _) => Some(request),
-          MatchResult::RequestNotFound(_) => None,
-          MatchResult::MissingRequest(_) => None
+      let journal = self.matches.lock().unwrap();
+      self.mismatches_for(&journal)
+    }
+
+  /// Returns all the mismatches recorded in the given match journal, along with any requests
+  /// from the Pact that are not in the journal.
+  pub fn mismatches_for(&self, journal: &MatchJournal) -> Vec<MatchResult> {
+    self.mismatches_from(journal.entries().iter(), Some(journal.counts()))
+  }
+
+  /// Returns all the mismatches that have occurred for a session, along with any requests from
+  /// the Pact that have not been received for the session.
+  pub fn session_mismatches(&self, session: &str) -> Vec<MatchResult> {
+    let journal = self.matches.lock().unwrap();
+    self.mismatches_from(journal.session_entries(session), journal.session_counts(session))
+  }
+
+  /// Returns all the mismatches, unexpected requests and missing requests in JSON form (the
+  /// same as calling `to_json` on each of the `mismatches`, but the JSON for each one is only
+  /// rendered once)
+  pub fn mismatches_json(&self) -> Vec<Value> {
+    let journal = self.matches.lock().unwrap();
+    self.mismatches_json_for(&journal)
+  }
+
+  /// Returns all the mismatches recorded in the given match journal, along with any requests
+  /// from the Pact that are not in the journal, in JSON form
+  pub fn mismatches_json_for(&self, journal: &MatchJournal) -> Vec<Value> {
+    self.mismatches_json_from(journal.entries().iter(), Some(journal.counts()))
+  }
+
+  /// Returns all the mismatches that have occurred for a session in JSON form
+  pub fn session_mismatches_json(&self, session: &str) -> Vec<Value> {
+    let journal = self.matches.lock().unwrap();
+    self.mismatches_json_from(journal.session_entries(session), journal.session_counts(session))
+  }
+
+  /// Returns the mismatches journaled after the sequence number `since`, along with the sequence
+  /// number to use as the cursor for the next call. Only the entries after the cursor are
+  /// examined, so repeated calls are proportional to the number of new requests. Expected
+  /// requests that have not been received are not included, as they are only known once the test
+  /// has completed (use `mismatches` for those).
+  pub fn mismatches_since(&self, since: u64) -> (Vec<JournalEntry>, u64) {
+    let journal = self.matches.lock().unwrap();
+    (new_mismatches(&journal, since).cloned().collect(), journal.last_sequence())
+  }
+
+  /// Returns the mismatches journaled after the sequence number `since` as JSON, in the form
+  /// `{ "mismatches": [...], "cursor": <sequence>, "evictedMismatches": <count> }`. If mismatches
+  /// have been evicted from the match journal, some mismatches after the cursor may be missing.
+  pub fn mismatches_since_json(&self, since: u64) -> Value {
+    let journal = self.matches.lock().unwrap();
+    let mismatches = new_mismatches(&journal, since)
+      .map(mismatch_json_with_sequence)
+      .collect::<Vec<Value>>();
+    json!({
+      "mismatches": mismatches,
+      "cursor": journal.last_sequence(),
+      "evictedMismatches": journal.evicted_mismatches()
+    })
+  }
+
+  /// Returns a page of at most `limit` mismatches in JSON form, starting after the cursor (pass 0
+  /// for the first page). Only the page is rendered, so the mismatches of a journal with a very
+  /// large number of unexpected requests can be read with bounded memory. The last page (where
+  /// `complete` is set) also has the expected requests that have not been received, so it can have
+  /// more than `limit` mismatches, up to the number of interactions in the pact.
+  pub fn mismatches_page(&self, cursor: u64, limit: usize) -> MismatchPage {
+    let limit = limit.max(1);
+    let journal = self.matches.lock().unwrap();
+    let mut entries = new_mismatches(&journal, cursor);
+    let page: Vec<&JournalEntry> = entries.by_ref().take(limit).collect();
+    let mut mismatches: Vec<Value> = page.iter().map(|entry| mismatch_json_with_sequence(entry)).collect();
+
+    match page.last() {
+      Some(last) if page.len() == limit && entries.next().is_some() => MismatchPage {
+        mismatches,
+        cursor: last.sequence,
+        complete: false
+      },
+      _ => {
+        mismatches.extend(self.expected_requests().iter()
+          .filter(|(request, _)| !journal.has_received(request))
+          .map(|(_, json)| json.clone()));
+        MismatchPage {
+          mismatches,
+          cursor: journal.last_sequence(),
+          complete: true
         }
-      }).filter(|o| o.is_some())
-        .map(|o| o.unwrap().clone())
-        .collect();
+      }
+    }
+  }
+
+  /// Returns an iterator over the mismatches (in JSON form), that fetches them from the match
+  /// journal a page at a time (see `mismatches_page`). The iterator does not hold a lock on the
+  /// mock server or its journal between pages.
+  pub fn mismatch_iter(&self, page_size: usize) -> MismatchIter {
+    MismatchIter {
+      mock_server: self.clone(),
+      page_size,
+      cursor: 0,
+      page: vec![].into_iter(),
+      complete: false
+    }
+  }
+
+  /// Returns true if all the expected requests have been received for the session, and there
+  /// have been no mismatches.
+  pub fn session_matched(&self, session: &str) -> bool {
+    self.session_mismatches(session).is_empty()
+  }
+
+  /// Resets a session, removing all its entries from the match journal. The removed entries are
+  /// returned as a journal, so they can be verified with `mismatches_for` if required.
+  pub fn reset_session(&mut self, session: &str) -> MatchJournal {
+    debug!("Mock server {} resetting session '{}'", self.id, session);
+    self.matches.lock().unwrap().reset_session(session)
+  }
+
+  /// Returns the mismatches in the entries, followed by the expected requests that have not been
+  /// received. The received requests are looked up in the hashed counts kept by the journal (for
+  /// the journal or a session), so this does not scan the entries for each expected request.
+  fn mismatches_from<'a>(
+    &self,
+    entries: impl Iterator<Item = &'a JournalEntry>,
+    received: Option<&JournalCounts>
+  ) -> Vec<MatchResult> {
+    let mismatches = entries
+      .filter(|entry| entry.is_mismatch())
+      .map(|entry| entry.result.clone());
+    let missing = self.expected_requests().iter()
+      .filter(|(req, _)| !received.map(|counts| counts.has_received(req)).unwrap_or_default())
+      .map(|(req, _)| MatchResult::MissingRequest(req.clone()));
+    mismatches.chain(missing).collect()
+  }
+
+  /// Same as `mismatches_from`, but returns the mismatches in JSON form. The JSON is cached with
+  /// the journal entries and expected requests, so is only rendered once.
+  fn mismatches_json_from<'a>(
+    &self,
+    entries: impl Iterator<Item = &'a JournalEntry>,
+    received: Option<&JournalCounts>
+  ) -> Vec<Value> {
+    let mismatches = entries
+      .filter(|entry| entry.is_mismatch())
+      .map(|entry| entry.result_json().clone());
+    let missing = self.expected_requests().iter()
+      .filter(|(req, _)| !received.map(|counts| counts.has_received(req)).unwrap_or_default())
+      .map(|(_, json)| json.clone());
+    mismatches.chain(missing).collect()
+  }
 
-      let interactions = self.pact.interactions();
-      let missing = interactions.iter()
-        .map(|i| i.as_v4_http().unwrap().request)
-        .filter(|req| !requests.contains(req))
-        .map(|req| MatchResult::MissingRequest(req.clone()));
-      mismatches.chain(missing).collect()
+  /// Returns the expected requests from the Pact by interaction index, with `None` for the
+  /// interactions that are not HTTP, so the indexes match the positions of the interactions in
+  /// the Pact
+  pub fn expected_request_list(&self) -> Vec<Option<HttpRequest>> {
+    self.pact.interactions().iter()
+      .map(|i| i.as_v4_http().map(|i| i.request))
+      .collect()
+  }
+
+  fn expected_requests(&self) -> &[(HttpRequest, Value)] {
+    self.expected_requests.get_or_init(|| {
+      self.pact.interactions().iter()
+        .filter_map(|i| i.as_v4_http())
+        .map(|i| {
+          let json = MatchResult::MissingRequest(i.request.clone()).to_json();
+          (i.request, json)
+        })
+        .collect()
+    })
+  }
+
+  /// Resets the mock server so it can be reused, swapping in an empty match journal and zeroed
+  /// metrics, and clearing any interactions recorded by the proxy. The previous journal is
+  /// returned, so it can be verified with `mismatches_for` if required.
+  pub fn reset(&mut self) -> MatchJournal {
+    let journal = self.matches.lock().unwrap().reset();
+    debug!("Mock server {} reset - {:?}", self.id, self.metrics);
+    self.metrics = Default::default();
+    self.stats.reset();
+    if let Some(proxy) = &self.proxy {
+      proxy.reset();
     }
+    journal
+  }
 
-  /// Mock server writes its pact out to the provided directory
+  /// Mock server writes its pact out to the provided directory. A mock server started with several
+  /// pacts writes each of them to its own file.
   pub fn write_pact(&self, output_path: &Option<String>, overwrite: bool) -> anyhow::Result<()> {
     trace!("write_pact: output_path = {:?}, overwrite = {}", output_path, overwrite);
-    let pact = if self.pact.is_v4() {
-      let mut v4_pact = self.pact.as_v4_pact().unwrap_or_default();
+    if self.sources.is_empty() {
+      self.write_pact_from(self.pact.as_ref(), self.spec_version, output_path, overwrite)
+    } else {
+      for index in 0..self.sources.len() {
+        self.write_pact_for(index, output_path, overwrite)?;
+      }
+      Ok(())
+    }
+  }
+
+  /// Writes one of the pacts served by the mock server (by its position in `pacts`) to a file,
+  /// so the pacts of a mock server started with several pacts can be written independently.
+  pub fn write_pact_for(&self, index: usize, output_path: &Option<String>, overwrite: bool) -> anyhow::Result<()> {
+    if self.sources.is_empty() && index == 0 {
+      return self.write_pact(output_path, overwrite);
+    }
+    let source = self.sources.get(index)
+      .ok_or_else(|| anyhow!("Mock server {} does not have a pact at position {}", self.id, index))?;
+    let spec_version = pact_specification(self.config.pact_specification, source.pact.specification_version());
+    self.write_pact_from(source.pact.as_ref(), spec_version, output_path, overwrite)
+  }
+
+  fn write_pact_from(
+    &self,
+    pact: &(dyn Pact + Send + Sync),
+    spec_version: PactSpecification,
+    output_path: &Option<String>,
+    overwrite: bool
+  ) -> anyhow::Result<()> {
+    let pact = if pact.is_v4() {
+      let mut v4_pact = pact.as_v4_pact().unwrap_or_default();
       v4_pact.add_md_version("mockserver", option_env!("CARGO_PKG_VERSION").unwrap_or("unknown"));
       for interaction in &mut v4_pact.interactions {
         interaction.set_transport(Some("http".to_string()));
       }
       v4_pact.boxed()
     } else {
-      let mut pact = self.pact.boxed();
+      let mut pact = pact.boxed();
       pact.add_md_version("mockserver", option_env!("CARGO_PKG_VERSION").unwrap_or("unknown"));
       pact
     };
@@ -303,9 +942,9 @@ impl MockServer {
     };
 
     info!("Writing pact out to '{}'", filename.display());
-    let specification = match self.spec_version {
+    let specification = match spec_version {
       PactSpecification::Unknown => PactSpecification::V3,
-      _ => self.spec_version
+      _ => spec_version
     };
     match write_pact(pact, filename.as_path(), specification, overwrite) {
       Ok(_) => Ok(()),
@@ -335,7 +974,8 @@ fn pact_specification(spec1: PactSpecification, spec2: PactSpecification) -> Pac
 }
 
 impl Clone for MockServer {
-  /// Make a clone all of the MockServer fields.
+  /// Make a clone all of the MockServer fields. The Pact, match journal, metrics and expected
+  /// requests are shared with the original, so cloning is cheap.
   /// Note that the clone of the original server cannot be shut down directly.
   #[allow(deprecated)]
   fn clone(&self) -> MockServer {
@@ -345,16 +985,46 @@ impl Clone for MockServer {
       address: self.address.clone(),
       scheme: self.scheme.clone(),
       resources: vec![],
-      pact: self.pact.boxed(),
+      pact: self.pact.clone(),
       matches: self.matches.clone(),
       shutdown_tx: RefCell::new(None),
       config: self.config.clone(),
       metrics: self.metrics.clone(),
-      spec_version: self.spec_version
+      spec_version: self.spec_version,
+      pact_size: self.pact_size,
+      http_interactions: self.http_interactions,
+      expected_requests: self.expected_requests.clone(),
+      last_activity: self.last_activity,
+      capture: self.capture.clone(),
+      proxy: self.proxy.clone(),
+      stats: self.stats.clone(),
+      sources: self.sources.clone()
     }
   }
 }
 
+fn start_capture(config: &MockServerConfig) -> Result<Option<RequestCapture>, String> {
+  match &config.capture_file {
+    Some(file) => {
+      let capture = RequestCapture::start(file.as_str()).map_err(|err| err.to_string())?;
+      info!("Recording requests to capture file {}", file);
+      Ok(Some(capture))
+    }
+    None => Ok(None)
+  }
+}
+
+fn start_proxy(config: &MockServerConfig) -> Result<Option<RecordingProxy>, String> {
+  match &config.proxy_url {
+    Some(url) => {
+      let proxy = RecordingProxy::new(url.as_str(), config.proxy_body_limit).map_err(|err| err.to_string())?;
+      info!("Forwarding unmatched requests to {}", url);
+      Ok(Some(proxy))
+    }
+    None => Ok(None)
+  }
+}
+
 impl Default for MockServer {
   #[allow(deprecated)]
   fn default() -> Self {
@@ -364,24 +1034,43 @@ impl Default for MockServer {
       port: None,
       address: None,
       resources: vec![],
-      pact: Box::new(RequestResponsePact::default()),
-      matches: Arc::new(Mutex::new(vec![])),
+      pact: Arc::new(RequestResponsePact::default()),
+      matches: Arc::new(Mutex::new(MatchJournal::default())),
       shutdown_tx: RefCell::new(None),
       config: Default::default(),
       metrics: Default::default(),
-      spec_version: Default::default()
+      spec_version: Default::default(),
+      pact_size: 0,
+      http_interactions: 0,
+      expected_requests: Default::default(),
+      last_activity: Instant::now(),
+      capture: None,
+      proxy: None,
+      stats: Default::default(),
+      sources: Default::default()
     }
   }
 }
 
 #[cfg(test)]
 mod tests {
+  use std::sync::Arc;
+  use std::time::{Duration, Instant};
+
   use expectest::prelude::*;
   use maplit::hashmap;
+  use pact_models::pact::Pact;
   use pact_models::PactSpecification;
+  use pact_models::v4::http_parts::{HttpRequest, HttpResponse};
+  use pact_models::v4::interaction::V4Interaction;
+  use pact_models::v4::pact::V4Pact;
+  use pact_models::v4::synch_http::SynchronousHttp;
   use serde_json::{json, Value};
 
+  use crate::matching::MatchResult;
+  use crate::mock_server::MockServer;
   use crate::MockServerConfig;
+  use crate::proxy::RecordingProxy;
 
   #[test]
   fn test_mock_server_config_from_json() {
@@ -395,14 +1084,212 @@ mod tests {
       "corsPreflight": true,
       "pactSpecification": "V4",
       "tlsKey": "key",
-      "tlsCertificate": "cert"
+      "tlsCertificate": "cert",
+      "journalLimit": 1048576,
+      "proxyUrl": "http://localhost:1234",
+      "proxyBodyLimit": 1024
     }))).to(be_equal_to(MockServerConfig {
       cors_preflight: true,
       pact_specification: PactSpecification::V4,
       transport_config: hashmap! {
         "tlsKey".to_string() => json!("key"),
         "tlsCertificate".to_string() => json!("cert")
-      }
+      },
+      journal_limit: Some(1048576),
+      proxy_url: Some("http://localhost:1234".to_string()),
+      proxy_body_limit: Some(1024),
+      .. MockServerConfig::default()
     }));
   }
+
+  #[test]
+  fn mock_server_config_json_round_trips() {
+    let config = MockServerConfig {
+      cors_preflight: true,
+      pact_specification: PactSpecification::V4,
+      transport_config: hashmap! { "tlsKey".to_string() => json!("key") },
+      journal_limit: Some(1024),
+      session_path_prefix: true,
+      capture_file: Some("requests.capture".to_string()),
+      proxy_url: Some("http://localhost:1234".to_string()),
+      proxy_body_limit: None,
+      drain_timeout: Some(Duration::from_millis(250))
+    };
+    expect!(MockServerConfig::from_json(&config.to_json())).to(be_equal_to(config));
+    expect!(MockServerConfig::from_json(&MockServerConfig::default().to_json())).to(be_equal_to(MockServerConfig::default()));
+  }
+
+  #[test]
+  fn proxied_requests_are_not_mismatches_and_reset_clears_the_proxy() {
+    let proxy = RecordingProxy::new("http://localhost:1234", None).unwrap();
+    let mut mock_server = MockServer { proxy: Some(proxy.clone()), .. MockServer::default() };
+    let request = HttpRequest { path: "/unexpected".to_string(), .. HttpRequest::default() };
+    mock_server.journal().lock().unwrap().push_proxied(MatchResult::RequestNotFound(request.clone()), None);
+    proxy.record(request, HttpResponse::default(), false);
+
+    expect!(mock_server.mismatches().is_empty()).to(be_true());
+    expect!(mock_server.recorded_interactions().len()).to(be_equal_to(1));
+
+    mock_server.reset();
+    expect!(mock_server.recorded_interactions().is_empty()).to(be_true());
+  }
+
+  #[test]
+  fn mismatches_since_only_returns_the_new_mismatches() {
+    let mock_server = MockServer::default();
+    let request = HttpRequest { path: "/unexpected".to_string(), .. HttpRequest::default() };
+    {
+      let journal = mock_server.journal();
+      let mut journal = journal.lock().unwrap();
+      journal.push(MatchResult::RequestNotFound(request.clone()));
+      journal.push(MatchResult::RequestMatch(HttpRequest::default(), HttpResponse::default(), HttpRequest::default()));
+    }
+
+    let (mismatches, cursor) = mock_server.mismatches_since(0);
+    expect!(mismatches.len()).to(be_equal_to(1));
+    expect!(cursor).to(be_equal_to(2));
+
+    let (mismatches, cursor) = mock_server.mismatches_since(cursor);
+    expect!(mismatches.is_empty()).to(be_true());
+    expect!(cursor).to(be_equal_to(2));
+
+    mock_server.journal().lock().unwrap().push(MatchResult::RequestNotFound(request));
+    let json = mock_server.mismatches_since_json(cursor);
+    expect!(json["cursor"].clone()).to(be_equal_to(json!(3)));
+    expect!(json["evictedMismatches"].clone()).to(be_equal_to(json!(0)));
+    expect!(json["mismatches"][0]["sequence"].clone()).to(be_equal_to(json!(3)));
+    expect!(json["mismatches"][0]["type"].clone()).to(be_equal_to(json!("request-not-found")));
+  }
+
+  #[test]
+  fn verify_returns_the_mismatches_and_status() {
+    let mock_server = MockServer::default();
+    let request = HttpRequest { path: "/unexpected".to_string(), .. HttpRequest::default() };
+    mock_server.journal().lock().unwrap().push(MatchResult::RequestNotFound(request));
+
+    let verification = mock_server.verify();
+    expect!(verification.matched()).to(be_false());
+    expect!(verification.mismatches.len()).to(be_equal_to(1));
+    expect!(verification.mock_server["status"].clone()).to(be_equal_to(json!("error")));
+
+    let session = mock_server.verify_session("other");
+    expect!(session.matched()).to(be_true());
+    expect!(session.mock_server["status"].clone()).to(be_equal_to(json!("ok")));
+  }
+
+  #[test]
+  fn status_agrees_with_the_verification() {
+    let interactions: Vec<SynchronousHttp> = (0..2)
+      .map(|i| SynchronousHttp {
+        description: format!("interaction {}", i),
+        request: HttpRequest { path: format!("/items/{}", i), .. HttpRequest::default() },
+        .. SynchronousHttp::default()
+      })
+      .collect();
+    let pact = V4Pact {
+      interactions: interactions.iter().map(|i| i.boxed_v4()).collect(),
+      .. V4Pact::default()
+    };
+    let mock_server = MockServer {
+      http_interactions: count_http_interactions(&pact),
+      pact: pact.arced(),
+      .. MockServer::default()
+    };
+    let expected = interactions[0].request.clone();
+    {
+      let journal = mock_server.journal();
+      let mut journal = journal.lock().unwrap();
+      journal.push(MatchResult::RequestMatch(expected.clone(), HttpResponse::default(), expected.clone()));
+      journal.push(MatchResult::RequestMatch(expected.clone(), HttpResponse::default(), expected.clone()));
+      journal.push(MatchResult::RequestNotFound(HttpRequest { method: "OPTIONS".to_string(), .. HttpRequest::default() }));
+    }
+
+    let status = mock_server.status();
+    expect!(status.matched).to(be_equal_to(2));
+    expect!(status.cors_preflight).to(be_equal_to(1));
+    expect!(status.interactions).to(be_equal_to(2));
+    expect!(status.interactions_received).to(be_equal_to(1));
+    expect!(status.missing()).to(be_equal_to(1));
+    expect!(status.all_matched()).to(be_equal_to(mock_server.all_matched()));
+
+    let other = interactions[1].request.clone();
+    mock_server.journal().lock().unwrap()
+      .push(MatchResult::RequestMatch(other.clone(), HttpResponse::default(), other));
+    let status = mock_server.status();
+    expect!(status.all_matched()).to(be_true());
+    expect!(status.all_matched()).to(be_equal_to(mock_server.all_matched()));
+  }
+
+  #[test]
+  fn mismatches_can_be_read_a_page_at_a_time() {
+    let interaction = SynchronousHttp {
+      request: HttpRequest { path: "/expected".to_string(), .. HttpRequest::default() },
+      .. SynchronousHttp::default()
+    };
+    let pact = V4Pact { interactions: vec![interaction.boxed_v4()], .. V4Pact::default() };
+    let mock_server = MockServer { pact: pact.arced(), .. MockServer::default() };
+    {
+      let journal = mock_server.journal();
+      let mut journal = journal.lock().unwrap();
+      for i in 0..5 {
+        journal.push(MatchResult::RequestNotFound(HttpRequest { path: format!("/unexpected/{}", i), .. HttpRequest::default() }));
+        journal.push(MatchResult::RequestNotFound(HttpRequest { method: "OPTIONS".to_string(), .. HttpRequest::default() }));
+      }
+    }
+
+    let page = mock_server.mismatches_page(0, 2);
+    expect!(page.mismatches.len()).to(be_equal_to(2));
+    expect!(page.complete).to(be_false());
+    expect!(page.cursor).to(be_equal_to(3));
+
+    let mismatches: Vec<Value> = mock_server.mismatch_iter(2).collect();
+    expect!(mismatches.len()).to(be_equal_to(6));
+    expect!(mismatches[4]["path"].clone()).to(be_equal_to(json!("/unexpected/4")));
+    expect!(mismatches[5]["type"].clone()).to(be_equal_to(json!("missing-request")));
+    expect!(mismatches.len()).to(be_equal_to(mock_server.mismatches_json().len()));
+  }
+
+  #[test]
+  fn clones_share_the_pact_and_journal() {
+    let mock_server = MockServer::default();
+    let clone = mock_server.clone();
+    expect!(Arc::ptr_eq(&clone.pact, &mock_server.pact)).to(be_true());
+    expect!(Arc::ptr_eq(&clone.journal(), &mock_server.journal())).to(be_true());
+    expect!(Arc::ptr_eq(&clone.metrics, &mock_server.metrics)).to(be_true());
+  }
+
+  #[test]
+  #[ignore]
+  fn verify_latency_with_a_large_pact() {
+    let interactions: Vec<SynchronousHttp> = (0..1000)
+      .map(|i| SynchronousHttp {
+        description: format!("interaction {}", i),
+        request: HttpRequest { path: format!("/items/{}", i), .. HttpRequest::default() },
+        .. SynchronousHttp::default()
+      })
+      .collect();
+    let pact = V4Pact {
+      interactions: interactions.iter().map(|i| i.boxed_v4()).collect(),
+      .. V4Pact::default()
+    };
+    let mock_server = MockServer { pact: pact.arced(), .. MockServer::default() };
+    {
+      let journal = mock_server.journal();
+      let mut journal = journal.lock().unwrap();
+      for interaction in &interactions {
+        journal.push(MatchResult::RequestMatch(interaction.request.clone(), HttpResponse::default(),
+          interaction.request.clone()));
+      }
+    }
+
+    let iterations = 100;
+    let start = Instant::now();
+    for _ in 0..iterations {
+      let view = mock_server.clone();
+      expect!(view.verify().matched()).to(be_true());
+    }
+    let elapsed = start.elapsed();
+    println!("Verified a mock server with 1000 interactions {} times in {:?} ({:?} per verification)",
+      iterations, elapsed, elapsed / iterations);
+  }
 }
@@ -0,0 +1,122 @@
+//!
+//! Mock servers that serve several pacts on one listener, for consumers that talk to several
+//! providers through one base URL (like an API gateway). The interactions of all the pacts are
+//! combined into one Pact, which the mock server builds its routing index over, so there is no
+//! need for a reverse proxy in front of a mock server per provider.
+//!
+//! The match journal is shared by the pacts. Each entry is attributed to the pact (or pacts) that
+//! has its expected request, so each pact can be verified and written on its own. Requests that
+//! did not match any interaction can not be attributed to a pact, so they only fail the
+//! verification of the mock server as a whole.
+//!
+
+use std::sync::Arc;
+
+use anyhow::anyhow;
+use itertools::Itertools;
+use pact_models::pact::Pact;
+use pact_models::prelude::Provider;
+use pact_models::v4::http_parts::HttpRequest;
+use pact_models::v4::pact::V4Pact;
+
+use crate::journal::HashedSet;
+
+/// Pact served by a mock server that was started with several pacts
+#[derive(Debug, Clone)]
+pub struct PactSource {
+  /// Pact as it was loaded
+  pub pact: Arc<dyn Pact + Send + Sync>,
+  /// Requests of the HTTP interactions in the Pact
+  requests: Vec<HttpRequest>,
+  /// The same requests, for looking up if a request is expected by the Pact
+  expected: HashedSet<HttpRequest>
+}
+
+impl PactSource {
+  /// Name of the provider of the Pact
+  pub fn provider(&self) -> String {
+    self.pact.provider().name
+  }
+
+  /// Requests of the HTTP interactions in the Pact
+  pub fn requests(&self) -> &[HttpRequest] {
+    self.requests.as_slice()
+  }
+
+  /// If the request is expected by one of the interactions in the Pact
+  pub fn has_request(&self, request: &HttpRequest) -> bool {
+    self.expected.contains_key(request)
+  }
+}
+
+/// Combines the pacts into one V4 Pact with the interactions of all of them (in the order of the
+/// pacts), for a mock server to serve on one listener. The combined Pact has the consumer of the
+/// first pact, and the names of all the providers. Returns an error if no pacts are given, or a
+/// pact can not be converted to the V4 format.
+pub fn combine_pacts(pacts: Vec<Box<dyn Pact + Send + Sync>>) -> anyhow::Result<(V4Pact, Vec<PactSource>)> {
+  if pacts.is_empty() {
+    return Err(anyhow!("At least one pact is required to start a mock server"));
+  }
+
+  let mut combined = V4Pact::default();
+  let mut sources = vec![];
+  for pact in pacts {
+    let v4_pact = pact.as_v4_pact()?;
+    let requests: Vec<HttpRequest> = v4_pact.interactions.iter()
+      .filter_map(|interaction| interaction.as_v4_http())
+      .map(|interaction| interaction.request)
+      .collect();
+    let mut expected = HashedSet::default();
+    for request in &requests {
+      expected.insert(request.clone());
+    }
+    combined.interactions.extend(v4_pact.interactions);
+    sources.push(PactSource { pact: pact.arced(), requests, expected });
+  }
+  combined.consumer = sources[0].pact.consumer();
+  combined.provider = Provider {
+    name: sources.iter().map(|source| source.provider()).unique().join(", ")
+  };
+
+  Ok((combined, sources))
+}
+
+#[cfg(test)]
+mod tests {
+  use expectest::prelude::*;
+  use pact_models::prelude::Consumer;
+  use pact_models::v4::interaction::V4Interaction;
+  use pact_models::v4::synch_http::SynchronousHttp;
+
+  use super::*;
+
+  fn pact(provider: &str, path: &str) -> Box<dyn Pact + Send + Sync> {
+    let interaction = SynchronousHttp {
+      request: HttpRequest { path: path.to_string(), .. HttpRequest::default() },
+      .. SynchronousHttp::default()
+    };
+    V4Pact {
+      consumer: Consumer { name: "gateway-client".to_string() },
+      provider: Provider { name: provider.to_string() },
+      interactions: vec![interaction.boxed_v4()],
+      .. V4Pact::default()
+    }.boxed()
+  }
+
+  #[test]
+  fn combine_pacts_combines_the_interactions_and_keeps_the_sources() {
+    let (combined, sources) = combine_pacts(vec![pact("orders", "/orders"), pact("users", "/users")]).unwrap();
+    expect!(combined.interactions.len()).to(be_equal_to(2));
+    expect!(combined.consumer.name).to(be_equal_to("gateway-client"));
+    expect!(combined.provider.name).to(be_equal_to("orders, users"));
+    expect!(sources.len()).to(be_equal_to(2));
+    expect!(sources[1].provider()).to(be_equal_to("users"));
+    expect!(sources[1].has_request(&HttpRequest { path: "/users".to_string(), .. HttpRequest::default() })).to(be_true());
+    expect!(sources[1].has_request(&HttpRequest { path: "/orders".to_string(), .. HttpRequest::default() })).to(be_false());
+  }
+
+  #[test]
+  fn combine_pacts_requires_a_pact() {
+    expect!(combine_pacts(vec![])).to(be_err());
+  }
+}
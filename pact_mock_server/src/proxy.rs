@@ -0,0 +1,301 @@
+//!
+//! Recording proxy mode. When a mock server is configured with a proxy URL, requests that do not
+//! match any interaction are forwarded to that upstream (for example, a local stand-in for the
+//! provider), and the request and response are recorded as a candidate interaction for the Pact.
+//!
+//! Upstream responses are streamed back to the client as they are received, and the body is teed
+//! to the recorder rather than collected first, so proxying large responses does not buffer them.
+//! The recorder only keeps the first `proxyBodyLimit` bytes of each body; interactions with
+//! bodies over the limit are recorded with the body removed and are marked as truncated.
+//!
+
+use std::collections::{HashMap, HashSet};
+use std::sync::{Arc, Mutex};
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use bytes::{Bytes, BytesMut};
+use hyper::{Body, Client, HeaderMap, Request, Response, Uri};
+use hyper::body::HttpBody;
+use hyper::client::HttpConnector;
+use hyper::header::HOST;
+use pact_models::bodies::OptionalBody;
+use pact_models::http_parts::HttpPart;
+use pact_models::v4::http_parts::{HttpRequest, HttpResponse};
+use pact_models::v4::interaction::V4Interaction;
+use pact_models::v4::synch_http::SynchronousHttp;
+use serde_json::{json, Value};
+use tracing::{debug, warn};
+
+/// Default limit of the bytes of each body kept by the recorder
+pub const DEFAULT_PROXY_BODY_LIMIT: usize = 1024 * 1024;
+/// Maximum number of distinct interactions that will be recorded
+const MAX_RECORDED_INTERACTIONS: usize = 10000;
+
+/// Interaction recorded from a request that was forwarded to the upstream
+#[derive(Debug, Clone)]
+pub struct RecordedInteraction {
+  /// Candidate interaction built from the request and the upstream response
+  pub interaction: SynchronousHttp,
+  /// If the request or response body was over the recording limit, and has been removed
+  pub truncated: bool
+}
+
+impl RecordedInteraction {
+  /// Converts the recorded interaction to JSON, in the V4 Pact interaction format
+  pub fn to_json(&self) -> Value {
+    let mut json = self.interaction.to_json();
+    if self.truncated {
+      if let Value::Object(map) = &mut json {
+        map.insert("truncated".to_string(), Value::Bool(true));
+      }
+    }
+    json
+  }
+}
+
+#[derive(Debug, Default)]
+struct Recorder {
+  interactions: Vec<RecordedInteraction>,
+  keys: HashSet<String>
+}
+
+/// Forwards unmatched requests to an upstream server, recording the exchanges
+#[derive(Debug, Clone)]
+pub struct RecordingProxy {
+  upstream: Uri,
+  client: Client<HttpConnector>,
+  body_limit: usize,
+  recorder: Arc<Mutex<Recorder>>,
+  forwarded: Arc<AtomicUsize>,
+  failed: Arc<AtomicUsize>
+}
+
+impl RecordingProxy {
+  /// Creates a proxy to the upstream URL. Only `http` upstreams are supported.
+  pub fn new(upstream: &str, body_limit: Option<usize>) -> anyhow::Result<RecordingProxy> {
+    let uri = upstream.trim_end_matches('/').parse::<Uri>()
+      .map_err(|err| anyhow::anyhow!("Proxy URL '{}' is not valid - {}", upstream, err))?;
+    if uri.scheme_str() != Some("http") || uri.authority().is_none() {
+      return Err(anyhow::anyhow!("Proxy URL '{}' must be an absolute http URL", upstream));
+    }
+    Ok(RecordingProxy {
+      upstream: uri,
+      client: Client::new(),
+      body_limit: body_limit.unwrap_or(DEFAULT_PROXY_BODY_LIMIT),
+      recorder: Arc::new(Mutex::new(Recorder::default())),
+      forwarded: Arc::new(AtomicUsize::new(0)),
+      failed: Arc::new(AtomicUsize::new(0))
+    })
+  }
+
+  /// Forwards the request to the upstream. `headers` and `query` are the original (raw) request
+  /// headers and query string, and `request` is the request the mock server has matched. The
+  /// response is returned as soon as the upstream has sent the response head; the body is
+  /// streamed through, and the interaction is recorded once it is complete.
+  pub(crate) async fn forward(
+    &self,
+    request: &HttpRequest,
+    query: Option<&str>,
+    mut headers: HeaderMap
+  ) -> anyhow::Result<Response<Body>> {
+    let path_and_query = match query {
+      Some(query) => format!("{}{}?{}", self.upstream.path().trim_end_matches('/'), request.path, query),
+      None => format!("{}{}", self.upstream.path().trim_end_matches('/'), request.path)
+    };
+    let uri = Uri::builder()
+      .scheme("http")
+      .authority(self.upstream.authority().unwrap().clone())
+      .path_and_query(path_and_query)
+      .build()?;
+    debug!("Forwarding request {} {} to {}", request.method, request.path, uri);
+
+    headers.remove(HOST);
+    let (request_body, request_truncated) = match &request.body {
+      OptionalBody::Present(body, _, _) => (body.clone(), body.len() > self.body_limit),
+      _ => (Bytes::new(), false)
+    };
+    let mut upstream_request = Request::builder()
+      .method(request.method.as_str())
+      .uri(uri)
+      .body(Body::from(request_body))?;
+    *upstream_request.headers_mut() = headers;
+
+    let response = match self.client.request(upstream_request).await {
+      Ok(response) => response,
+      Err(err) => {
+        self.failed.fetch_add(1, Ordering::Relaxed);
+        return Err(anyhow::anyhow!("Request to proxy upstream {} failed - {}", self.upstream, err));
+      }
+    };
+    self.forwarded.fetch_add(1, Ordering::Relaxed);
+
+    let (parts, mut upstream_body) = response.into_parts();
+    let mut recorded_request = request.clone();
+    if request_truncated {
+      recorded_request.body = OptionalBody::Missing;
+    }
+    let recorded_response = HttpResponse {
+      status: parts.status.as_u16(),
+      headers: header_map(&parts.headers),
+      .. HttpResponse::default()
+    };
+
+    let (mut sender, body) = Body::channel();
+    let proxy = self.clone();
+    tokio::spawn(async move {
+      let mut tee = BytesMut::new();
+      let mut truncated = request_truncated;
+      while let Some(chunk) = upstream_body.data().await {
+        match chunk {
+          Ok(chunk) => {
+            if !truncated {
+              if tee.len() + chunk.len() > proxy.body_limit {
+                truncated = true;
+                tee = BytesMut::new();
+              } else {
+                tee.extend_from_slice(&chunk);
+              }
+            }
+            if sender.send_data(chunk).await.is_err() {
+              debug!("Client went away before the proxied response was complete");
+              return;
+            }
+          }
+          Err(err) => {
+            warn!("Failed to read the response from proxy upstream - {}", err);
+            sender.abort();
+            return;
+          }
+        }
+      }
+      let body = if truncated || tee.is_empty() {
+        OptionalBody::Missing
+      } else {
+        OptionalBody::Present(tee.freeze(), recorded_response.content_type(), None)
+      };
+      proxy.record(recorded_request, HttpResponse { body, .. recorded_response }, truncated);
+    });
+
+    Ok(Response::from_parts(parts, body))
+  }
+
+  pub(crate) fn record(&self, request: HttpRequest, response: HttpResponse, truncated: bool) {
+    let key = interaction_key(&request);
+    let mut recorder = self.recorder.lock().unwrap();
+    if recorder.keys.contains(&key) {
+      return;
+    }
+    if recorder.interactions.len() >= MAX_RECORDED_INTERACTIONS {
+      warn!("Maximum number of recorded interactions reached, not recording {}", key);
+      return;
+    }
+    debug!("Recording interaction for {}", key);
+    let interaction = SynchronousHttp {
+      description: key.clone(),
+      request,
+      response,
+      .. SynchronousHttp::default()
+    };
+    recorder.keys.insert(key);
+    recorder.interactions.push(RecordedInteraction { interaction, truncated });
+  }
+
+  /// URL of the upstream that requests are forwarded to
+  pub fn upstream(&self) -> String {
+    self.upstream.to_string()
+  }
+
+  /// Returns the interactions that have been recorded, in the order they were received
+  pub fn recorded_interactions(&self) -> Vec<RecordedInteraction> {
+    self.recorder.lock().unwrap().interactions.clone()
+  }
+
+  /// Clears the recorded interactions and the forwarded request counters
+  pub fn reset(&self) {
+    let mut recorder = self.recorder.lock().unwrap();
+    recorder.interactions.clear();
+    recorder.keys.clear();
+    self.forwarded.store(0, Ordering::Relaxed);
+    self.failed.store(0, Ordering::Relaxed);
+  }
+
+  /// Converts the proxy state to JSON
+  pub fn to_json(&self) -> Value {
+    json!({
+      "upstream": self.upstream(),
+      "forwarded": self.forwarded.load(Ordering::Relaxed),
+      "failed": self.failed.load(Ordering::Relaxed),
+      "recorded": self.recorder.lock().unwrap().interactions.len()
+    })
+  }
+}
+
+/// Key used to de-duplicate the recorded interactions
+fn interaction_key(request: &HttpRequest) -> String {
+  match &request.query {
+    Some(query) => {
+      let mut params: Vec<String> = query.iter()
+        .flat_map(|(key, values)| values.iter().map(move |value| match value {
+          Some(value) => format!("{}={}", key, value),
+          None => key.clone()
+        }))
+        .collect();
+      params.sort();
+      format!("{} {}?{}", request.method, request.path, params.join("&"))
+    }
+    None => format!("{} {}", request.method, request.path)
+  }
+}
+
+fn header_map(headers: &HeaderMap) -> Option<HashMap<String, Vec<String>>> {
+  let mut map: HashMap<String, Vec<String>> = HashMap::new();
+  for (name, value) in headers {
+    if let Ok(value) = value.to_str() {
+      map.entry(name.to_string()).or_default().push(value.to_string());
+    }
+  }
+  if map.is_empty() { None } else { Some(map) }
+}
+
+#[cfg(test)]
+mod tests {
+  use expectest::prelude::*;
+  use maplit::hashmap;
+
+  use super::*;
+
+  #[test]
+  fn proxy_url_must_be_absolute_http() {
+    expect!(RecordingProxy::new("http://localhost:1234", None)).to(be_ok());
+    expect!(RecordingProxy::new("https://localhost:1234", None)).to(be_err());
+    expect!(RecordingProxy::new("/relative", None)).to(be_err());
+  }
+
+  #[test]
+  fn interaction_key_is_independent_of_query_order() {
+    let request = HttpRequest {
+      method: "GET".to_string(),
+      path: "/items".to_string(),
+      query: Some(hashmap!{
+        "b".to_string() => vec![Some("2".to_string())],
+        "a".to_string() => vec![Some("1".to_string()), None]
+      }),
+      .. HttpRequest::default()
+    };
+    expect!(interaction_key(&request)).to(be_equal_to("GET /items?a&a=1&b=2".to_string()));
+  }
+
+  #[test]
+  fn duplicate_requests_are_only_recorded_once() {
+    let proxy = RecordingProxy::new("http://localhost:1234", None).unwrap();
+    let request = HttpRequest { path: "/one".to_string(), .. HttpRequest::default() };
+    proxy.record(request.clone(), HttpResponse::default(), false);
+    proxy.record(request, HttpResponse::default(), false);
+    proxy.record(HttpRequest { path: "/two".to_string(), .. HttpRequest::default() }, HttpResponse::default(), true);
+
+    let recorded = proxy.recorded_interactions();
+    expect!(recorded.len()).to(be_equal_to(2));
+    expect!(recorded[0].interaction.description.clone()).to(be_equal_to("GET /one".to_string()));
+    expect!(recorded[1].to_json()["truncated"].clone()).to(be_equal_to(json!(true)));
+  }
+}
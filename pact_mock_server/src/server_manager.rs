@@ -4,24 +4,32 @@
 
 use std::collections::BTreeMap;
 use std::ffi::CString;
-#[cfg(feature = "plugins")] use std::future::Future;
+use std::future::Future;
 use std::net::SocketAddr;
 #[cfg(feature = "plugins")] use std::net::ToSocketAddrs;
 use std::sync::{Arc, Mutex};
+use std::time::Duration;
+#[cfg(feature = "plugins")] use std::time::Instant;
 
 use anyhow::anyhow;
+use futures::future::{BoxFuture, FutureExt, join_all};
 use itertools::Either;
 #[cfg(feature = "plugins")] use maplit::hashmap;
 use pact_models::pact::Pact;
 #[cfg(feature = "plugins")] use pact_models::prelude::v4::V4Pact;
 #[cfg(feature = "plugins")] use pact_plugin_driver::catalogue_manager::{CatalogueEntry, CatalogueEntryProviderType};
-#[cfg(feature = "plugins")] use pact_plugin_driver::mock_server::MockServerDetails;
+#[cfg(feature = "plugins")] use pact_plugin_driver::mock_server::{MockServerDetails, MockServerResult};
+#[cfg(feature = "plugins")] use pact_plugin_driver::plugin_manager::{drop_plugin_access, get_mock_server_results, load_plugin};
+#[cfg(feature = "plugins")] use pact_plugin_driver::plugin_models::{PluginDependency, PluginDependencyType};
 #[cfg(feature = "tls")] use rustls::ServerConfig;
-#[cfg(not(feature = "plugins"))] use serde::{Deserialize, Serialize};
-use tracing::{debug, error, trace};
+use serde::{Deserialize, Serialize};
+#[cfg(feature = "plugins")] use serde_json::json;
+use serde_json::Value;
+use tracing::{debug, error, trace, warn};
 #[cfg(feature = "plugins")] use url::Url;
 
-use crate::mock_server::{MockServer, MockServerConfig};
+use crate::journal::MatchJournal;
+use crate::mock_server::{MockServer, MockServerConfig, MockServerMetrics};
 
 /// Mock server that has been provided by a plugin
 #[derive(Debug, Clone)]
@@ -35,6 +43,112 @@ pub struct PluginMockServer {
   pub pact: V4Pact
 }
 
+/// How long the results fetched from a plugin mock server are reused for
+#[cfg(feature = "plugins")]
+pub const PLUGIN_RESULTS_TTL: Duration = Duration::from_millis(500);
+
+/// Results fetched from a plugin mock server. These are kept with the entry for the mock server
+/// in the `ServerManager`, and clones share the same results.
+#[derive(Debug, Clone, Default)]
+#[cfg(feature = "plugins")]
+pub(crate) struct PluginResults {
+  /// Last results fetched, with the time they were fetched at
+  cached: Arc<Mutex<Option<(Instant, Vec<MockServerResult>)>>>,
+  /// Held while a request to the plugin is in flight, so concurrent callers share the request
+  fetching: Arc<tokio::sync::Mutex<()>>
+}
+
+#[cfg(feature = "plugins")]
+impl PluginResults {
+  /// Returns the matching results from the plugin. Results fetched within the last
+  /// `PLUGIN_RESULTS_TTL` are reused, and concurrent callers share one request to the plugin. The
+  /// request is spawned on the runtime, so this can be awaited from any executor without holding
+  /// the server manager lock. Failed requests are not cached. This is for listings and polling;
+  /// use `fresh_results` to verify the mock server.
+  pub(crate) async fn results(
+    &self,
+    details: &MockServerDetails,
+    runtime: &tokio::runtime::Handle
+  ) -> anyhow::Result<Vec<MockServerResult>> {
+    if let Some(results) = self.cached_results() {
+      return Ok(results);
+    }
+    let _fetching = self.fetching.lock().await;
+    if let Some(results) = self.cached_results() {
+      return Ok(results);
+    }
+    self.fetch_results(details, runtime).await
+  }
+
+  /// Fetches the matching results from the plugin, ignoring any cached results, so requests
+  /// received by the plugin mock server since the last fetch are included. The cache is updated
+  /// with the results.
+  pub(crate) async fn fresh_results(
+    &self,
+    details: &MockServerDetails,
+    runtime: &tokio::runtime::Handle
+  ) -> anyhow::Result<Vec<MockServerResult>> {
+    let _fetching = self.fetching.lock().await;
+    self.fetch_results(details, runtime).await
+  }
+
+  async fn fetch_results(
+    &self,
+    details: &MockServerDetails,
+    runtime: &tokio::runtime::Handle
+  ) -> anyhow::Result<Vec<MockServerResult>> {
+    let details = details.clone();
+    let results = runtime.spawn(async move { get_mock_server_results(&details).await }).await??;
+    *self.cached.lock().unwrap() = Some((Instant::now(), results.clone()));
+    Ok(results)
+  }
+
+  /// Returns the results last fetched from the plugin, if they were fetched within the last
+  /// `PLUGIN_RESULTS_TTL`
+  fn cached_results(&self) -> Option<Vec<MockServerResult>> {
+    self.cached.lock().unwrap().as_ref()
+      .filter(|(fetched, _)| fetched.elapsed() < PLUGIN_RESULTS_TTL)
+      .map(|(_, results)| results.clone())
+  }
+}
+
+/// Converts a plugin mock server into JSON for listings, with the same attributes as
+/// `MockServer::to_json` where the plugin provides them, and the URL of the mock server in `url`.
+/// The status and metrics come from the results last fetched from the plugin (however old), so a
+/// listing never waits on the plugin.
+#[cfg(feature = "plugins")]
+fn plugin_mock_server_json(id: &str, mock_server: &PluginMockServer, results: &PluginResults) -> Value {
+  let cached = results.cached.lock().unwrap();
+  let status = match cached.as_ref() {
+    Some((_, results)) if results.is_empty() => "ok",
+    Some(_) => "error",
+    None => "unknown"
+  };
+  let details = &mock_server.mock_server_details;
+  let url = Url::parse(&details.base_url).ok();
+  let scheme = url.as_ref().map(|url| url.scheme().to_string()).unwrap_or_default();
+  let address = url.as_ref()
+    .and_then(|url| url.host_str())
+    .map(|host| format!("{}:{}", host, details.port))
+    .unwrap_or_default();
+  json!({
+    "id": id,
+    "port": details.port,
+    "address": address,
+    "url": details.base_url,
+    "scheme": scheme,
+    "provider": mock_server.pact.provider.name,
+    "status": status,
+    "transport": mock_server.catalogue_entry.key,
+    "metrics": {
+      "mismatches": cached.as_ref().map(|(_, results)| results.iter()
+        .map(|result| result.mismatches.len())
+        .sum::<usize>()),
+      "resultsAge": cached.as_ref().map(|(fetched, _)| fetched.elapsed().as_millis() as u64)
+    }
+  })
+}
+
 /// Mock server that has been provided by a plugin (dummy struct)
 #[derive(Debug, Clone)]
 #[cfg(not(feature = "plugins"))]
@@ -52,13 +166,228 @@ struct ServerEntry {
   port: u16,
   /// List of resources that need to be cleaned up when the mock server completes
   pub resources: Vec<CString>,
-  join_handle: Option<tokio::task::JoinHandle<()>>
+  join_handle: Option<tokio::task::JoinHandle<()>>,
+  /// Tags used to select groups of mock servers (for instance, to shut them down together)
+  tags: Vec<String>,
+  /// Results last fetched from the plugin, for a mock server provided by a plugin
+  #[cfg(feature = "plugins")]
+  plugin_results: PluginResults
+}
+
+/// Selects the mock servers to shut down with `shutdown_mock_servers`
+#[derive(Debug, Clone, PartialEq)]
+pub enum ShutdownSelector {
+  /// Mock servers with the given IDs
+  Ids(Vec<String>),
+  /// Mock servers with the given tag
+  Tag(String),
+  /// All the mock servers
+  All
+}
+
+/// Result of shutting down a group of mock servers
+#[derive(Debug, Clone, Default, PartialEq, Serialize, Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct ShutdownReport {
+  /// Mock servers that shut down before the deadline
+  pub stopped: Vec<String>,
+  /// Mock servers that had not shut down by the deadline, and were aborted
+  pub forced: Vec<String>,
+  /// Mock servers that could not be shut down (such as plugin mock servers that returned an error)
+  pub failed: Vec<String>,
+  /// IDs that did not match a running mock server
+  pub not_found: Vec<String>,
+  /// Connections of the stopped mock servers that completed their requests during the shutdown
+  #[serde(default)]
+  pub drained_connections: usize,
+  /// Connections of the stopped mock servers that were aborted after their drain timeout
+  #[serde(default)]
+  pub aborted_connections: usize
+}
+
+enum PendingShutdown {
+  Local(String, Arc<Mutex<MockServer>>, Option<tokio::task::JoinHandle<()>>),
+  #[cfg(feature = "plugins")]
+  Plugin(String, MockServerDetails)
+}
+
+/// Mock servers that have been sent the shutdown signal, but may not have stopped yet. These are
+/// waited on with `wait`, which does not need the server manager.
+pub struct ShutdownBatch {
+  pending: Vec<PendingShutdown>,
+  report: ShutdownReport
+}
+
+impl ShutdownBatch {
+  /// Number of mock servers being shut down
+  pub fn len(&self) -> usize {
+    self.pending.len()
+  }
+
+  /// If there are no mock servers being shut down
+  pub fn is_empty(&self) -> bool {
+    self.pending.is_empty()
+  }
+
+  /// Waits for the mock servers to shut down concurrently. Any still running when the deadline
+  /// expires are aborted, and reported as forced.
+  pub async fn wait(self, deadline: Duration) -> ShutdownReport {
+    let deadline = tokio::time::Instant::now() + deadline;
+    let mut report = self.report;
+    let results = join_all(self.pending.into_iter().map(|pending| async move {
+      match pending {
+        PendingShutdown::Local(id, mock_server, Some(mut join_handle)) => {
+          match tokio::time::timeout_at(deadline, &mut join_handle).await {
+            Ok(Ok(())) => {
+              let ms = mock_server.lock().unwrap();
+              (id, Ok((true, ms.metrics.drained_connections, ms.metrics.aborted_connections)))
+            }
+            Ok(Err(err)) => (id, Err(format!("mock server task failed - {}", err))),
+            Err(_) => {
+              warn!("Mock server {} did not shut down before the deadline, aborting it", id);
+              join_handle.abort();
+              (id, Ok((false, 0, 0)))
+            }
+          }
+        }
+        PendingShutdown::Local(id, _, None) => (id, Ok((true, 0, 0))),
+        #[cfg(feature = "plugins")]
+        PendingShutdown::Plugin(id, details) => {
+          let shutdown = pact_plugin_driver::plugin_manager::shutdown_mock_server(&details);
+          match tokio::time::timeout_at(deadline, shutdown).await {
+            Ok(Ok(_)) => (id, Ok((true, 0, 0))),
+            Ok(Err(err)) => (id, Err(err.to_string())),
+            Err(_) => (id, Err("timed out".to_string()))
+          }
+        }
+      }
+    })).await;
+
+    for (id, result) in results {
+      match result {
+        Ok((true, drained, aborted)) => {
+          report.stopped.push(id);
+          report.drained_connections += drained;
+          report.aborted_connections += aborted;
+        }
+        Ok((false, _, _)) => report.forced.push(id),
+        Err(err) => {
+          error!("Failed to shut down mock server with ID {} - {}", id, err);
+          report.failed.push(id)
+        }
+      }
+    }
+    debug!("Shut down mock servers: {} stopped, {} forced, {} failed ({} connections drained, {} aborted)",
+      report.stopped.len(), report.forced.len(), report.failed.len(), report.drained_connections,
+      report.aborted_connections);
+    report
+  }
+}
+
+/// Mock server to start with `ServerManager::start_mock_servers`
+pub struct MockServerStart {
+  /// Unique ID for the mock server
+  pub id: String,
+  /// Pact model to use for the mock server
+  pub pact: Box<dyn Pact + Send + Sync>,
+  /// Socket address that the mock server should listen on
+  pub addr: SocketAddr,
+  /// Configuration for the mock server
+  pub config: MockServerConfig,
+  /// TLS config, if the mock server should use TLS
+  #[cfg(feature = "tls")]
+  pub tls: Option<ServerConfig>
+}
+
+impl MockServerStart {
+  /// Mock server with the given ID, pact, address and config, not using TLS
+  pub fn new(
+    id: String,
+    pact: Box<dyn Pact + Send + Sync>,
+    addr: SocketAddr,
+    config: MockServerConfig
+  ) -> MockServerStart {
+    MockServerStart {
+      id,
+      pact,
+      addr,
+      config,
+      #[cfg(feature = "tls")]
+      tls: None
+    }
+  }
+
+  async fn bind(self) -> Result<(Arc<Mutex<MockServer>>, BoxFuture<'static, ()>), String> {
+    #[cfg(feature = "tls")]
+    if let Some(tls) = &self.tls {
+      let (mock_server, future) = MockServer::new_tls(self.id, self.pact, self.addr, tls, self.config).await?;
+      return Ok((mock_server, future.boxed()));
+    }
+    let (mock_server, future) = MockServer::new(self.id, self.pact, self.addr, self.config).await?;
+    Ok((mock_server, future.boxed()))
+  }
+}
+
+/// Start up latency of the mock servers for a transport provided by a plugin
+#[derive(Debug, Clone, Default, PartialEq, Serialize, Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct TransportStartMetrics {
+  /// Mock servers started for the transport
+  pub starts: u64,
+  /// Mock servers started while the plugin providing the transport was in the warm pool
+  pub warm_starts: u64,
+  /// Mock servers that the plugin failed to start
+  pub failed_starts: u64,
+  /// Total time taken to start the mock servers, in microseconds
+  pub total_start_us: u64,
+  /// Longest time taken to start a mock server, in microseconds
+  pub max_start_us: u64
+}
+
+impl TransportStartMetrics {
+  /// Records the time taken to start a mock server
+  pub(crate) fn record(&mut self, latency: Duration, warm: bool, started: bool) {
+    let micros = latency.as_micros().min(u64::MAX as u128) as u64;
+    self.starts += 1;
+    if warm {
+      self.warm_starts += 1;
+    }
+    if !started {
+      self.failed_starts += 1;
+    }
+    self.total_start_us = self.total_start_us.saturating_add(micros);
+    self.max_start_us = self.max_start_us.max(micros);
+  }
+
+  /// Average time taken to start a mock server, or `None` if none have been started
+  pub fn mean_start(&self) -> Option<Duration> {
+    if self.starts == 0 {
+      None
+    } else {
+      Some(Duration::from_micros(self.total_start_us / self.starts))
+    }
+  }
+}
+
+/// Plugin that has been loaded ahead of any mock servers for its transports (see
+/// `ServerManager::warm_plugin`)
+#[cfg(feature = "plugins")]
+struct WarmPlugin {
+  /// Dependency the plugin was loaded with, used to release it
+  dependency: PluginDependency,
+  /// Time taken to load the plugin
+  warm_up: Duration
 }
 
 /// Struct to represent many mock servers running in a background thread
 pub struct ServerManager {
     runtime: tokio::runtime::Runtime,
     mock_servers: BTreeMap<String, ServerEntry>,
+    /// Plugins kept loaded for their transports, by plugin name
+    #[cfg(feature = "plugins")]
+    warm_plugins: BTreeMap<String, WarmPlugin>,
+    /// Start up latency of the mock servers, by transport key
+    transport_metrics: BTreeMap<String, TransportStartMetrics>
 }
 
 impl ServerManager {
@@ -71,7 +400,10 @@ impl ServerManager {
         .enable_all()
         .build()
         .unwrap(),
-      mock_servers: BTreeMap::new()
+      mock_servers: BTreeMap::new(),
+      #[cfg(feature = "plugins")]
+      warm_plugins: BTreeMap::new(),
+      transport_metrics: BTreeMap::new()
     }
   }
 
@@ -85,24 +417,60 @@ impl ServerManager {
     ) -> Result<SocketAddr, String> {
       let (mock_server, future) =
         self.runtime.block_on(MockServer::new(id.clone(), pact, addr, config))?;
-
-      let port = { mock_server.lock().unwrap().port.clone() };
-      self.mock_servers.insert(
-        id,
-        ServerEntry {
-          mock_server: Either::Left(mock_server),
-          port: port.unwrap_or_else(|| addr.port()),
-          resources: vec![],
-          join_handle: Some(self.runtime.spawn(future))
-        },
-      );
-
-      match port {
-        Some(port) => Ok(SocketAddr::new(addr.ip(), port)),
-        None => Ok(addr)
-      }
+      Ok(self.add_mock_server(id, mock_server, future, addr))
     }
 
+  /// Start a new server on the runtime that has been restored from a snapshot. The server starts
+  /// with the restored match journal and metrics, which are both in place before it handles any
+  /// requests.
+  pub fn start_restored_mock_server(
+    &mut self,
+    id: String,
+    pact: Box<dyn Pact + Send + Sync>,
+    addr: SocketAddr,
+    config: MockServerConfig,
+    journal: Arc<Mutex<MatchJournal>>,
+    metrics: MockServerMetrics
+  ) -> Result<SocketAddr, String> {
+    let (mock_server, future) =
+      self.runtime.block_on(MockServer::new_with_journal(id.clone(), pact, addr, config, journal))?;
+    mock_server.lock().unwrap().metrics = Arc::new(metrics);
+    Ok(self.add_mock_server(id, mock_server, future, addr))
+  }
+
+  /// Start a new TLS server on the runtime that has been restored from a snapshot (see
+  /// `start_restored_mock_server`)
+  #[cfg(feature = "tls")]
+  pub fn start_restored_tls_mock_server(
+    &mut self,
+    id: String,
+    pact: Box<dyn Pact + Send + Sync>,
+    addr: SocketAddr,
+    tls_config: &ServerConfig,
+    config: MockServerConfig,
+    journal: Arc<Mutex<MatchJournal>>,
+    metrics: MockServerMetrics
+  ) -> Result<SocketAddr, String> {
+    let (mock_server, future) = self.runtime.block_on(
+      MockServer::new_tls_with_journal(id.clone(), pact, addr, tls_config, config, journal))?;
+    mock_server.lock().unwrap().metrics = Arc::new(metrics);
+    Ok(self.add_mock_server(id, mock_server, future, addr))
+  }
+
+  /// Start a new server on the runtime that serves several pacts on one listener (see the
+  /// `multi_pact` module)
+  pub fn start_multi_pact_mock_server(
+    &mut self,
+    id: String,
+    pacts: Vec<Box<dyn Pact + Send + Sync>>,
+    addr: SocketAddr,
+    config: MockServerConfig
+  ) -> Result<SocketAddr, String> {
+    let (mock_server, future) =
+      self.runtime.block_on(MockServer::new_multi(id.clone(), pacts, addr, config))?;
+    Ok(self.add_mock_server(id, mock_server, future, addr))
+  }
+
     /// Start a new TLS server on the runtime
     #[cfg(feature = "tls")]
     pub fn start_tls_mock_server_with_addr(
@@ -115,23 +483,66 @@ impl ServerManager {
     ) -> Result<SocketAddr, String> {
       let (mock_server, future) =
         self.runtime.block_on(MockServer::new_tls(id.clone(), pact, addr, tls_config, config))?;
+      Ok(self.add_mock_server(id, mock_server, future, addr))
+    }
 
-      let port = { mock_server.lock().unwrap().port.clone() };
-      self.mock_servers.insert(
-        id,
-        ServerEntry {
-          mock_server: Either::Left(mock_server),
-          port: port.unwrap_or_else(|| addr.port()),
-          resources: vec![],
-          join_handle: Some(self.runtime.spawn(future))
-        }
-      );
+  /// Starts a batch of mock servers. The mock servers are all bound concurrently on the runtime,
+  /// and then registered together, which is much quicker than starting them one at a time.
+  /// Returns the result for each mock server (the address it is listening on, or the error if it
+  /// could not be started), in the same order as the batch.
+  pub fn start_mock_servers(&mut self, servers: Vec<MockServerStart>) -> Vec<Result<SocketAddr, String>> {
+    let mut ids = std::collections::HashSet::new();
+    let starts = servers.into_iter().map(|server| {
+      let id = server.id.clone();
+      let addr = server.addr;
+      let duplicate = self.mock_servers.contains_key(&id) || !ids.insert(id.clone());
+      async move {
+        let result = if duplicate {
+          Err(format!("There is already a mock server with ID {}", id))
+        } else {
+          server.bind().await.map_err(|err| format!("Could not start server: {}", err))
+        };
+        (id, addr, result)
+      }
+    }).collect::<Vec<_>>();
+    let bound = self.runtime.block_on(join_all(starts));
+
+    bound.into_iter()
+      .map(|(id, addr, result)| result.map(|(mock_server, future)| {
+        self.add_mock_server(id, mock_server, future, addr)
+      }))
+      .collect()
+  }
 
-      match port {
-        Some(port) => Ok(SocketAddr::new(addr.ip(), port)),
-        None => Ok(addr)
+  /// Adds a mock server that has been bound (with `MockServer::new` or `MockServer::new_tls`) to
+  /// the manager, spawning the future that drives it on the runtime. Returns the address the mock
+  /// server is listening on.
+  pub fn add_mock_server(
+    &mut self,
+    id: String,
+    mock_server: Arc<Mutex<MockServer>>,
+    future: impl Future<Output = ()> + Send + 'static,
+    addr: SocketAddr
+  ) -> SocketAddr {
+    let port = { mock_server.lock().unwrap().port.clone() };
+    self.mock_servers.insert(
+      id,
+      ServerEntry {
+        mock_server: Either::Left(mock_server),
+        port: port.unwrap_or_else(|| addr.port()),
+        resources: vec![],
+        join_handle: Some(self.runtime.spawn(future)),
+        tags: vec![],
+        #[cfg(feature = "plugins")]
+        plugin_results: PluginResults::default()
       }
+    );
+
+    match port {
+      Some(port) => SocketAddr::new(addr.ip(), port),
+      None => addr
     }
+  }
 
     /// Start a new server on the runtime
     pub fn start_mock_server(
@@ -163,7 +574,10 @@ impl ServerManager {
         mock_server: Either::Left(mock_server),
         port: port.unwrap_or_else(|| addr.port()),
         resources: vec![],
-        join_handle: Some(self.runtime.spawn(future))
+        join_handle: Some(self.runtime.spawn(future)),
+        tags: vec![],
+        #[cfg(feature = "plugins")]
+        plugin_results: PluginResults::default()
       },
     );
 
@@ -211,10 +625,18 @@ impl ServerManager {
           tls: false
         };
         let test_context = hashmap! {};
+        let warm = transport.plugin.as_ref()
+          .map(|plugin| self.warm_plugins.contains_key(&plugin.name))
+          .unwrap_or(false);
+        let start = Instant::now();
         let result = self.runtime.block_on(
           pact_plugin_driver::plugin_manager::start_mock_server_v2(transport, v4_pact.boxed(),
                                                                    mock_server_config, test_context)
-        )?;
+        );
+        self.transport_metrics.entry(transport.key.clone())
+          .or_default()
+          .record(start.elapsed(), warm, result.is_ok());
+        let result = result?;
         self.mock_servers.insert(
           id,
           ServerEntry {
@@ -225,7 +647,9 @@ impl ServerManager {
             }),
             port: result.port as u16,
             resources: vec![],
-            join_handle: None
+            join_handle: None,
+            tags: vec![],
+            plugin_results: PluginResults::default()
           }
         );
 
@@ -244,15 +668,72 @@ impl ServerManager {
     }
   }
 
+  /// Loads the plugin ahead of time and keeps it loaded, so mock servers for the transports it
+  /// provides do not have to wait for the plugin process to start, and the process is reused
+  /// across mock servers instead of being restarted when the last one using it is shut down.
+  /// Loading the plugin also registers its transports in the catalogue. Returns the time taken to
+  /// load the plugin (or the time it took when it was first warmed, if already in the pool). The
+  /// plugins still in the pool are released when the manager is dropped.
+  #[cfg(feature = "plugins")]
+  pub fn warm_plugin(&mut self, name: &str, version: Option<String>) -> anyhow::Result<Duration> {
+    if let Some(warm_plugin) = self.warm_plugins.get(name) {
+      return Ok(warm_plugin.warm_up);
+    }
+
+    let dependency = PluginDependency {
+      name: name.to_string(),
+      version,
+      dependency_type: PluginDependencyType::Plugin
+    };
+    let start = Instant::now();
+    self.runtime.block_on(load_plugin(&dependency))?;
+    let warm_up = start.elapsed();
+    debug!("Loaded plugin {} into the warm pool in {:?}", name, warm_up);
+    self.warm_plugins.insert(name.to_string(), WarmPlugin { dependency, warm_up });
+    Ok(warm_up)
+  }
+
+  /// Removes the plugin from the warm pool, releasing the reference held on it. The plugin process
+  /// is shut down by the plugin driver once nothing else is using it. Returns false if the plugin
+  /// was not in the pool.
+  #[cfg(feature = "plugins")]
+  pub fn release_warm_plugin(&mut self, name: &str) -> bool {
+    match self.warm_plugins.remove(name) {
+      Some(warm_plugin) => {
+        drop_plugin_access(&warm_plugin.dependency);
+        true
+      }
+      None => false
+    }
+  }
+
+  /// Names of the plugins in the warm pool, with the time taken to load them
+  #[cfg(feature = "plugins")]
+  pub fn warm_plugins(&self) -> Vec<(String, Duration)> {
+    self.warm_plugins.iter()
+      .map(|(name, warm_plugin)| (name.clone(), warm_plugin.warm_up))
+      .collect()
+  }
+
+  /// Start up latency of the mock servers started for plugin transports, by transport key
+  pub fn transport_start_metrics(&self) -> BTreeMap<String, TransportStartMetrics> {
+    self.transport_metrics.clone()
+  }
+
   /// Shut down a server by its id. This function will only shut down a local mock server, not one
   /// provided by a plugin.
   pub fn shutdown_mock_server_by_id(&mut self, id: String) -> bool {
     match self.mock_servers.remove(&id) {
       Some(entry) => match entry.mock_server {
         Either::Left(mock_server) => {
-          let mut ms = mock_server.lock().unwrap();
-          debug!("Shutting down mock server with ID {} - {:?}", id, ms.metrics);
-          match ms.shutdown() {
+          // The lock must be released before waiting, as the server needs it to drain the
+          // requests in flight
+          let result = {
+            let mut ms = mock_server.lock().unwrap();
+            debug!("Shutting down mock server with ID {} - {:?}", id, ms.metrics);
+            ms.shutdown()
+          };
+          match result {
             Ok(()) => {
               self.runtime.block_on(entry.join_handle.unwrap()).unwrap();
               true
@@ -282,6 +763,85 @@ impl ServerManager {
     }
   }
 
+  /// Sends the shutdown signal to the selected mock servers, and removes them from the manager.
+  /// The returned batch is then used to wait for them to stop, which can be done after any lock on
+  /// the manager has been released.
+  pub fn begin_shutdown(&mut self, selector: ShutdownSelector) -> ShutdownBatch {
+    let mut report = ShutdownReport::default();
+    let ids: Vec<String> = match selector {
+      ShutdownSelector::Ids(ids) => ids.into_iter()
+        .filter(|id| {
+          let found = self.mock_servers.contains_key(id);
+          if !found {
+            report.not_found.push(id.clone());
+          }
+          found
+        })
+        .collect(),
+      ShutdownSelector::Tag(tag) => self.mock_servers.iter()
+        .filter(|(_, entry)| entry.tags.contains(&tag))
+        .map(|(id, _)| id.clone())
+        .collect(),
+      ShutdownSelector::All => self.mock_servers.keys().cloned().collect()
+    };
+
+    let mut pending = Vec::with_capacity(ids.len());
+    for id in ids {
+      if let Some(entry) = self.mock_servers.remove(&id) {
+        match entry.mock_server {
+          Either::Left(mock_server) => {
+            let result = {
+              let mut ms = mock_server.lock().unwrap();
+              debug!("Shutting down mock server with ID {} - {:?}", id, ms.metrics);
+              ms.shutdown()
+            };
+            match result {
+              Ok(()) => pending.push(PendingShutdown::Local(id, mock_server, entry.join_handle)),
+              Err(err) => {
+                error!("Failed to shut down mock server with ID {} - {}", id, err);
+                report.failed.push(id);
+              }
+            }
+          }
+          Either::Right(_plugin_mock_server) => {
+            #[cfg(feature = "plugins")]
+            pending.push(PendingShutdown::Plugin(id, _plugin_mock_server.mock_server_details));
+            #[cfg(not(feature = "plugins"))]
+            {
+              error!("Plugins require the plugin feature to be enabled");
+              report.failed.push(id);
+            }
+          }
+        }
+      }
+    }
+    ShutdownBatch { pending, report }
+  }
+
+  /// Shuts down the selected mock servers concurrently, waiting up to the deadline for them to
+  /// stop. Mock servers that have not stopped by the deadline are aborted. Use `begin_shutdown`
+  /// to avoid holding a lock on the manager while waiting.
+  pub fn shutdown_mock_servers(&mut self, selector: ShutdownSelector, deadline: Duration) -> ShutdownReport {
+    let batch = self.begin_shutdown(selector);
+    self.runtime.block_on(batch.wait(deadline))
+  }
+
+  /// Sets the tags of a mock server. Returns false if there is no mock server with the ID.
+  pub fn set_mock_server_tags(&mut self, id: &str, tags: Vec<String>) -> bool {
+    match self.mock_servers.get_mut(id) {
+      Some(entry) => {
+        entry.tags = tags;
+        true
+      }
+      None => false
+    }
+  }
+
+  /// Returns the tags of a mock server
+  pub fn mock_server_tags(&self, id: &str) -> Option<Vec<String>> {
+    self.mock_servers.get(id).map(|entry| entry.tags.clone())
+  }
+
   /// Shut down a server by its local port number
   pub fn shutdown_mock_server_by_port(&mut self, port: u16) -> bool {
     debug!("Shutting down mock server with port {}", port);
@@ -367,6 +927,24 @@ impl ServerManager {
     }
   }
 
+  /// Find a mock server by id and apply a mutating operation on it if successful. This will
+  /// only work for locally managed mock servers, not mock servers provided by plugins.
+  pub fn find_mock_server_by_id_mut<R>(
+    &mut self,
+    id: &String,
+    f: &dyn Fn(&mut MockServer) -> R,
+  ) -> Option<R> {
+    match self.mock_servers.get_mut(id) {
+      Some(entry) => match &mut entry.mock_server {
+        Either::Left(mock_server) => {
+          Some(f(&mut mock_server.lock().unwrap()))
+        }
+        Either::Right(_) => None
+      }
+      None => None,
+    }
+  }
+
   /// Map all the running mock servers This will only work for locally managed mock servers,
   /// not mock servers provided by plugins.
   pub fn map_mock_servers<R, F>(&self, f: F) -> Vec<R>
@@ -385,10 +963,44 @@ impl ServerManager {
     return results;
   }
 
-  /// Execute a future on the Tokio runtime for the service manager
+  /// Converts all the running mock servers into JSON for listings, including the mock servers
+  /// provided by plugins
+  pub fn mock_servers_json(&self) -> Vec<Value> {
+    let mut mock_servers = self.map_mock_servers(MockServer::to_json);
+    #[cfg(feature = "plugins")]
+    for (id, entry) in self.mock_servers.iter() {
+      if let Either::Right(plugin_mock_server) = &entry.mock_server {
+        mock_servers.push(plugin_mock_server_json(id, plugin_mock_server, &entry.plugin_results));
+      }
+    }
+    mock_servers
+  }
+
+  /// Converts the mock server with the given ID into JSON, for either a local mock server or one
+  /// provided by a plugin. Returns `None` if there is no mock server with the ID.
+  pub fn mock_server_json(&self, id: &String) -> Option<Value> {
+    #[cfg(feature = "plugins")]
+    if let Some(entry) = self.mock_servers.get(id) {
+      if let Either::Right(plugin_mock_server) = &entry.mock_server {
+        return Some(plugin_mock_server_json(id, plugin_mock_server, &entry.plugin_results));
+      }
+    }
+    self.find_mock_server_by_id(id, &|_, mock_server| mock_server.left().map(|mock_server| mock_server.to_json()))
+      .flatten()
+  }
+
+  /// Results last fetched from the plugin for the mock server with the given ID (shared with the
+  /// entry for the mock server, so fetching them updates the cache)
   #[cfg(feature = "plugins")]
-  pub(crate) fn exec_async<OUT>(&self, future: impl Future<Output=OUT>) -> OUT {
-    self.runtime.block_on(future)
+  pub(crate) fn plugin_results(&self, id: &str) -> PluginResults {
+    self.mock_servers.get(id)
+      .map(|entry| entry.plugin_results.clone())
+      .unwrap_or_default()
+  }
+
+  /// Returns a handle to the Tokio runtime for the service manager
+  pub fn runtime_handle(&self) -> tokio::runtime::Handle {
+    self.runtime.handle().clone()
   }
 
   /// Store a string that needs to be cleaned up when the mock server terminates
@@ -404,12 +1016,24 @@ impl ServerManager {
   }
 }
 
+/// Releases the plugins in the warm pool, so their processes are shut down with the manager
+#[cfg(feature = "plugins")]
+impl Drop for ServerManager {
+  fn drop(&mut self) {
+    for (name, warm_plugin) in std::mem::take(&mut self.warm_plugins) {
+      debug!("Releasing warm plugin {}", name);
+      drop_plugin_access(&warm_plugin.dependency);
+    }
+  }
+}
+
 #[cfg(test)]
 mod tests {
   use std::{thread, time};
   use std::net::TcpStream;
 
   use env_logger;
+  use expectest::prelude::*;
   use pact_models::sync_pact::RequestResponsePact;
 
   use super::*;
@@ -446,4 +1070,159 @@ mod tests {
         // Server should be down
         assert!(TcpStream::connect(("127.0.0.1", server_port)).is_err());
     }
+
+  #[test]
+  fn transport_start_metrics_records_start_latency() {
+    let mut metrics = TransportStartMetrics::default();
+    expect!(metrics.mean_start()).to(be_none());
+
+    metrics.record(Duration::from_millis(300), false, true);
+    metrics.record(Duration::from_millis(20), true, true);
+    metrics.record(Duration::from_millis(10), true, false);
+    expect!(metrics.starts).to(be_equal_to(3));
+    expect!(metrics.warm_starts).to(be_equal_to(2));
+    expect!(metrics.failed_starts).to(be_equal_to(1));
+    expect!(metrics.max_start_us).to(be_equal_to(300_000));
+    expect!(metrics.mean_start()).to(be_some().value(Duration::from_millis(110)));
+  }
+
+  /// Sets up the stub plugin from the test fixtures, returning the file it logs the process ID of
+  /// each plugin process to. Returns None if python3 with grpcio (required by the stub plugin) is
+  /// not available.
+  #[cfg(all(feature = "plugins", unix))]
+  fn stub_plugin(test: &str) -> Option<std::path::PathBuf> {
+    let grpc = std::process::Command::new("python3").args(["-c", "import grpc"]).output();
+    if !grpc.map(|output| output.status.success()).unwrap_or(false) {
+      println!("Skipping {}, the stub plugin requires python3 with grpcio", test);
+      return None;
+    }
+    let plugins = std::path::Path::new(env!("CARGO_MANIFEST_DIR")).join("tests/fixtures/plugins");
+    let log = std::env::temp_dir().join(format!("{}-{}.log", test, std::process::id()));
+    let _ = std::fs::remove_file(&log);
+    std::env::set_var("PACT_PLUGIN_DIR", plugins);
+    std::env::set_var("PACT_DO_NOT_TRACK", "true");
+    std::env::set_var("STUB_PLUGIN_LOG", &log);
+    Some(log)
+  }
+
+  #[cfg(all(feature = "plugins", unix))]
+  fn plugin_processes(log: &std::path::Path) -> usize {
+    std::fs::read_to_string(log).map(|pids| pids.lines().count()).unwrap_or(0)
+  }
+
+  #[test]
+  #[cfg(all(feature = "plugins", unix))]
+  fn warm_plugins_are_reused_until_released() {
+    let log = match stub_plugin("warm_plugins_are_reused_until_released") {
+      Some(log) => log,
+      None => return
+    };
+    let dependency = PluginDependency {
+      name: "stub-plugin".to_string(),
+      version: None,
+      dependency_type: PluginDependencyType::Plugin
+    };
+
+    let mut manager = ServerManager::new();
+    manager.warm_plugin("stub-plugin", None).unwrap();
+    expect!(plugin_processes(&log)).to(be_equal_to(1));
+
+    // Loading the plugin again (as starting a mock server for its transport does) reuses the process
+    manager.runtime.block_on(load_plugin(&dependency)).unwrap();
+    drop_plugin_access(&dependency);
+    manager.runtime.block_on(load_plugin(&dependency)).unwrap();
+    drop_plugin_access(&dependency);
+    expect!(plugin_processes(&log)).to(be_equal_to(1));
+
+    // Once released, the plugin has to be started again
+    expect!(manager.release_warm_plugin("stub-plugin")).to(be_true());
+    expect!(manager.release_warm_plugin("stub-plugin")).to(be_false());
+    manager.runtime.block_on(load_plugin(&dependency)).unwrap();
+    drop_plugin_access(&dependency);
+    expect!(plugin_processes(&log)).to(be_equal_to(2));
+
+    // Dropping the manager releases the plugins still in the warm pool
+    manager.warm_plugin("stub-plugin", None).unwrap();
+    expect!(plugin_processes(&log)).to(be_equal_to(3));
+    drop(manager);
+    let runtime = tokio::runtime::Runtime::new().unwrap();
+    runtime.block_on(load_plugin(&dependency)).unwrap();
+    drop_plugin_access(&dependency);
+    expect!(plugin_processes(&log)).to(be_equal_to(4));
+
+    let _ = std::fs::remove_file(&log);
+  }
+
+  #[test]
+  fn manager_shuts_down_mock_servers_by_tag() {
+    let mut manager = ServerManager::new();
+    let mut ports = vec![];
+    for id in ["one", "two", "three"] {
+      ports.push(manager.start_mock_server(id.into(), RequestResponsePact::default().boxed(), 0,
+        MockServerConfig::default()).unwrap());
+    }
+    expect!(manager.set_mock_server_tags("one", vec!["run-1".to_string()])).to(be_true());
+    expect!(manager.set_mock_server_tags("two", vec!["run-1".to_string()])).to(be_true());
+    expect!(manager.set_mock_server_tags("missing", vec!["run-1".to_string()])).to(be_false());
+
+    let report = manager.shutdown_mock_servers(ShutdownSelector::Tag("run-1".to_string()),
+      Duration::from_secs(5));
+    expect!(report.stopped.len()).to(be_equal_to(2));
+    expect!(report.forced.is_empty()).to(be_true());
+    expect!(manager.find_mock_server_by_port(ports[2], &|_, id, _| id.clone())).to(be_some().value("three"));
+
+    let report = manager.shutdown_mock_servers(ShutdownSelector::Ids(vec!["three".to_string(),
+      "missing".to_string()]), Duration::from_secs(5));
+    expect!(report.stopped).to(be_equal_to(vec!["three".to_string()]));
+    expect!(report.not_found).to(be_equal_to(vec!["missing".to_string()]));
+  }
+
+  fn batch(prefix: &str, count: usize) -> Vec<MockServerStart> {
+    (0..count)
+      .map(|n| MockServerStart::new(format!("{}-{}", prefix, n), RequestResponsePact::default().boxed(),
+        ([127, 0, 0, 1], 0).into(), MockServerConfig::default()))
+      .collect()
+  }
+
+  #[test]
+  fn manager_starts_a_batch_of_mock_servers() {
+    let mut manager = ServerManager::new();
+    let mut servers = batch("batch", 3);
+    servers.push(MockServerStart::new("batch-1".into(), RequestResponsePact::default().boxed(),
+      ([127, 0, 0, 1], 0).into(), MockServerConfig::default()));
+
+    let results = manager.start_mock_servers(servers);
+    expect!(results.len()).to(be_equal_to(4));
+    for result in &results[0..3] {
+      let port = result.as_ref().unwrap().port();
+      expect!(TcpStream::connect(("127.0.0.1", port)).is_ok()).to(be_true());
+    }
+    expect!(results[3].is_err()).to(be_true());
+
+    let report = manager.shutdown_mock_servers(ShutdownSelector::All, Duration::from_secs(5));
+    expect!(report.stopped.len()).to(be_equal_to(3));
+  }
+
+  #[test]
+  #[ignore]
+  fn batch_start_throughput() {
+    let count = 100;
+    let mut manager = ServerManager::new();
+
+    let start = time::Instant::now();
+    for server in batch("single", count) {
+      manager.start_mock_server_with_addr(server.id, server.pact, server.addr, server.config).unwrap();
+    }
+    let single = start.elapsed();
+    manager.shutdown_mock_servers(ShutdownSelector::All, Duration::from_secs(5));
+
+    let start = time::Instant::now();
+    let results = manager.start_mock_servers(batch("batch", count));
+    let batched = start.elapsed();
+    manager.shutdown_mock_servers(ShutdownSelector::All, Duration::from_secs(5));
+
+    expect!(results.iter().all(|result| result.is_ok())).to(be_true());
+    println!("Started {} mock servers one at a time in {:?} ({:.0}/s), and as a batch in {:?} ({:.0}/s)",
+      count, single, count as f64 / single.as_secs_f64(), batched, count as f64 / batched.as_secs_f64());
+  }
 }
@@ -0,0 +1,260 @@
+//!
+//! Snapshots of the state of a mock server (its pact, config, metrics and match journal), so the
+//! mock server can be restored in another process. This allows long-lived mock servers to be
+//! migrated or restarted without losing the requests they have received.
+//!
+//! Snapshots use the same length-prefixed record format as journal exports (see the
+//! `journal_export` module), with the magic bytes `PACTSNP\0`. The first record is the header,
+//! with the pact, config and metrics, and it is followed by the journal entries in the export
+//! form. Both writing and reading a snapshot are streamed, so the journal is never held in memory
+//! twice, and large journals can be restored quickly.
+//!
+
+use std::io::{Read, Write};
+use std::sync::{Arc, Mutex};
+
+use anyhow::anyhow;
+use pact_models::pact::{load_pact_from_json, Pact};
+use pact_models::v4::http_parts::HttpRequest;
+use serde_json::Value;
+use tracing::debug;
+
+use crate::journal::MatchJournal;
+use crate::journal_export::{
+  decode_entry,
+  ExportedEntry,
+  for_each_exported_entry,
+  RECORD_ENTRY,
+  RecordReader,
+  RecordWriter,
+  write_bytes,
+  write_varint
+};
+use crate::mock_server::{MockServer, MockServerConfig, MockServerMetrics, MockServerScheme};
+
+/// Magic bytes at the start of a snapshot
+const MAGIC: &[u8; 8] = b"PACTSNP\0";
+/// Record that is the snapshot header
+const RECORD_HEADER: u8 = 4;
+
+/// State of a mock server in a snapshot, apart from its journal
+#[derive(Debug, Clone, PartialEq)]
+pub struct MockServerSnapshot {
+  /// ID of the mock server
+  pub id: String,
+  /// If the mock server was using TLS
+  pub tls: bool,
+  /// Port the mock server was running on
+  pub port: Option<u16>,
+  /// Address the mock server was bound to. This is `None` for snapshots written by older versions.
+  pub address: Option<String>,
+  /// Mock server config
+  pub config: MockServerConfig,
+  /// Metrics collected by the mock server
+  pub metrics: MockServerMetrics,
+  /// JSON form of the pact the mock server is based on
+  pub pact: Value,
+  /// Sequence number of the last entry in the journal
+  pub last_sequence: u64
+}
+
+impl MockServerSnapshot {
+  /// Takes the state of the mock server, apart from its journal
+  pub fn from_mock_server(mock_server: &MockServer) -> anyhow::Result<MockServerSnapshot> {
+    Ok(MockServerSnapshot {
+      id: mock_server.id.clone(),
+      tls: matches!(mock_server.scheme, MockServerScheme::HTTPS),
+      port: mock_server.port,
+      address: mock_server.address.clone(),
+      config: mock_server.config.clone(),
+      metrics: mock_server.metrics.as_ref().clone(),
+      pact: mock_server.pact.to_json(mock_server.pact.specification_version())?,
+      last_sequence: mock_server.journal().lock().unwrap().last_sequence()
+    })
+  }
+
+  /// Loads the pact from the snapshot
+  pub fn load_pact(&self) -> anyhow::Result<Box<dyn Pact + Send + Sync>> {
+    load_pact_from_json(format!("snapshot of mock server {}", self.id).as_str(), &self.pact)
+  }
+}
+
+/// Writes a snapshot of a mock server. The journal is copied out in batches, so the mock server
+/// can keep handling requests while it is being written. Returns the number of journal entries
+/// written.
+pub fn write_snapshot(
+  snapshot: &MockServerSnapshot,
+  journal: &Arc<Mutex<MatchJournal>>,
+  expected: &[Option<HttpRequest>],
+  out: impl Write + Send + 'static,
+  compress: bool
+) -> anyhow::Result<usize> {
+  let mut records = RecordWriter::new(out, MAGIC, compress)?;
+  let mut record = vec![RECORD_HEADER];
+  records.write_string(&mut record, &snapshot.id)?;
+  record.push(snapshot.tls as u8);
+  write_varint(&mut record, snapshot.port.unwrap_or_default() as u64);
+  write_varint(&mut record, snapshot.last_sequence);
+  write_bytes(&mut record, snapshot.config.to_json().to_string().as_bytes());
+  write_bytes(&mut record, serde_json::to_string(&snapshot.metrics)?.as_bytes());
+  write_bytes(&mut record, snapshot.pact.to_string().as_bytes());
+  records.write_optional_string(&mut record, snapshot.address.as_deref())?;
+  records.write_record(&record)?;
+
+  let entries = for_each_exported_entry(journal, expected, |entry| records.write_entry(&mut record, entry))?;
+  records.flush()?;
+  debug!("Wrote snapshot of mock server {} with {} journal entries", snapshot.id, entries);
+  Ok(entries)
+}
+
+/// Reads a snapshot. The header is read when the reader is created, and the reader is then an
+/// iterator over the journal entries in the snapshot (which can be passed to `import_journal`).
+pub struct SnapshotReader {
+  records: RecordReader,
+  snapshot: MockServerSnapshot
+}
+
+impl SnapshotReader {
+  /// Creates a reader, reading and validating the snapshot header from `input`
+  pub fn new(input: impl Read + Send + 'static) -> anyhow::Result<SnapshotReader> {
+    let mut records = RecordReader::new(input, MAGIC)
+      .map_err(|err| anyhow!("Not a valid mock server snapshot - {}", err))?;
+    let snapshot = records.read_record(|reader, record_type, cursor| {
+      if record_type != RECORD_HEADER {
+        return Err(anyhow!("Mock server snapshot does not start with a header"));
+      }
+      let id = reader.string(cursor)?;
+      let tls = cursor.byte()? != 0;
+      let port = match cursor.varint()? {
+        0 => None,
+        port => Some(port as u16)
+      };
+      let last_sequence = cursor.varint()?;
+      let config: Value = serde_json::from_slice(cursor.bytes()?)?;
+      let metrics: MockServerMetrics = serde_json::from_slice(cursor.bytes()?)?;
+      let pact: Value = serde_json::from_slice(cursor.bytes()?)?;
+      let address = if cursor.at_end() { None } else { reader.optional_string(cursor)? };
+      Ok(MockServerSnapshot {
+        id,
+        tls,
+        port,
+        address,
+        config: MockServerConfig::from_json(&config),
+        metrics,
+        pact,
+        last_sequence
+      })
+    })?.ok_or_else(|| anyhow!("Mock server snapshot is empty"))?;
+    Ok(SnapshotReader { records, snapshot })
+  }
+
+  /// State of the mock server from the snapshot header
+  pub fn snapshot(&self) -> &MockServerSnapshot {
+    &self.snapshot
+  }
+
+  /// If the snapshot is compressed
+  pub fn compressed(&self) -> bool {
+    self.records.compressed()
+  }
+
+  /// Reads the next journal entry, returning `None` at the end of the snapshot
+  pub fn read_entry(&mut self) -> anyhow::Result<Option<ExportedEntry>> {
+    self.records.read_record(|reader, record_type, cursor| {
+      if record_type == RECORD_ENTRY {
+        decode_entry(reader, cursor)
+      } else {
+        Err(anyhow!("Unknown mock server snapshot record type {}", record_type))
+      }
+    })
+  }
+}
+
+impl Iterator for SnapshotReader {
+  type Item = anyhow::Result<ExportedEntry>;
+
+  fn next(&mut self) -> Option<Self::Item> {
+    self.read_entry().transpose()
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use std::io;
+
+  use expectest::prelude::*;
+  use maplit::hashmap;
+  use pact_models::PactSpecification;
+  use pact_models::sync_pact::RequestResponsePact;
+
+  use crate::matching::MatchResult;
+
+  use super::*;
+
+  #[derive(Clone, Default)]
+  struct SharedBuffer(Arc<Mutex<Vec<u8>>>);
+
+  impl Write for SharedBuffer {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+      self.0.lock().unwrap().write(buf)
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+      Ok(())
+    }
+  }
+
+  #[test]
+  fn snapshot_can_be_read_back() {
+    let snapshot = MockServerSnapshot {
+      id: "snapshot-test".to_string(),
+      tls: false,
+      port: Some(1234),
+      address: Some("0.0.0.0".to_string()),
+      config: MockServerConfig {
+        cors_preflight: true,
+        pact_specification: PactSpecification::V4,
+        journal_limit: Some(4096),
+        .. MockServerConfig::default()
+      },
+      metrics: MockServerMetrics {
+        requests: 2,
+        requests_by_path: hashmap!{ "/unexpected".to_string() => 2 },
+        .. MockServerMetrics::default()
+      },
+      pact: RequestResponsePact::default().to_json(PactSpecification::V3).unwrap(),
+      last_sequence: 2
+    };
+    let journal = Arc::new(Mutex::new(MatchJournal::default()));
+    {
+      let mut journal = journal.lock().unwrap();
+      let request = HttpRequest { path: "/unexpected".to_string(), .. HttpRequest::default() };
+      journal.push(MatchResult::RequestNotFound(request.clone()));
+      journal.push_for_session(MatchResult::RequestNotFound(request), Some("one".to_string()));
+    }
+
+    let buffer = SharedBuffer::default();
+    let entries = write_snapshot(&snapshot, &journal, &[], buffer.clone(), false).unwrap();
+    expect!(entries).to(be_equal_to(2));
+
+    let data = buffer.0.lock().unwrap().clone();
+    let reader = SnapshotReader::new(io::Cursor::new(data)).unwrap();
+    expect!(reader.snapshot()).to(be_equal_to(&snapshot));
+    let entries: Vec<ExportedEntry> = reader.collect::<anyhow::Result<_>>().unwrap();
+    expect!(entries.len()).to(be_equal_to(2));
+    expect!(entries[1].sequence).to(be_equal_to(2));
+    expect!(entries[1].session.clone()).to(be_some().value("one"));
+  }
+
+  #[test]
+  fn reader_rejects_a_journal_export() {
+    let buffer = SharedBuffer::default();
+    let journal = Arc::new(Mutex::new(MatchJournal::default()));
+    let mut writer = crate::journal_export::JournalExportWriter::new(buffer.clone(), false).unwrap();
+    crate::journal_export::export_journal(&journal, &[], &mut writer).unwrap();
+    writer.finish().unwrap();
+
+    let data = buffer.0.lock().unwrap().clone();
+    expect!(SnapshotReader::new(io::Cursor::new(data))).to(be_err());
+  }
+}
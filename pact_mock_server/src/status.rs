@@ -0,0 +1,157 @@
+//!
+//! Structured status of a mock server, with its request counters, a latency histogram and the
+//! coverage of the interactions in its pact. The status is built from counters that are kept up
+//! to date as requests are received, so it can be polled at a high frequency without rendering the
+//! mismatches as JSON (unlike `MockServer::to_json` and `mock_server_mismatches`).
+//!
+//! `MockServerStatus` is `#[repr(C)]` and only has fixed size fields, so it can be passed as is
+//! across an FFI boundary.
+//!
+
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Duration;
+
+/// Number of buckets in the latency histogram
+pub const LATENCY_BUCKETS: usize = 12;
+
+/// Upper limits (inclusive, in microseconds) of the latency histogram buckets. The last bucket has
+/// no upper limit.
+pub const LATENCY_BUCKET_LIMITS: [u64; LATENCY_BUCKETS - 1] = [
+  50, 100, 250, 500, 1_000, 2_500, 5_000, 10_000, 25_000, 50_000, 100_000
+];
+
+/// Status of a mock server
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct MockServerStatus {
+  /// Requests that have been responded to
+  pub requests: u64,
+  /// Requests that matched an interaction
+  pub matched: u64,
+  /// Requests that did not match the interaction they were expected to match
+  pub mismatched: u64,
+  /// Requests that were not expected (apart from CORS pre-flight requests)
+  pub not_found: u64,
+  /// Unexpected CORS pre-flight (OPTIONS) requests
+  pub cors_preflight: u64,
+  /// Mismatches that have been evicted from the match journal
+  pub evicted_mismatches: u64,
+  /// HTTP interactions in the pact
+  pub interactions: u64,
+  /// HTTP interactions that have received at least one request
+  pub interactions_received: u64,
+  /// Count of the requests in each latency bucket (see `LATENCY_BUCKET_LIMITS`)
+  pub latency_buckets: [u64; LATENCY_BUCKETS],
+  /// Total time taken to respond to the requests, in microseconds
+  pub latency_total_us: u64,
+  /// Longest time taken to respond to a request, in microseconds
+  pub latency_max_us: u64
+}
+
+impl MockServerStatus {
+  /// HTTP interactions that have not received any requests
+  pub fn missing(&self) -> u64 {
+    self.interactions.saturating_sub(self.interactions_received)
+  }
+
+  /// If all the requests matched and all the interactions were received. This is the same result
+  /// as `MockServer::all_matched`, without building the mismatches.
+  pub fn all_matched(&self) -> bool {
+    self.mismatched == 0 && self.not_found == 0 && self.evicted_mismatches == 0 && self.missing() == 0
+  }
+
+  /// Upper limit of the latency bucket the percentile (0 to 100) falls in, in microseconds. Returns
+  /// `None` if no requests have been received, and the longest latency if the percentile falls in
+  /// the last bucket.
+  pub fn latency_percentile(&self, percentile: f64) -> Option<u64> {
+    let total: u64 = self.latency_buckets.iter().sum();
+    if total == 0 {
+      return None;
+    }
+    let target = ((percentile.clamp(0.0, 100.0) / 100.0) * total as f64).ceil().max(1.0) as u64;
+    let mut count = 0;
+    for (index, bucket) in self.latency_buckets.iter().enumerate() {
+      count += bucket;
+      if count >= target {
+        return Some(LATENCY_BUCKET_LIMITS.get(index).copied().unwrap_or(self.latency_max_us));
+      }
+    }
+    Some(self.latency_max_us)
+  }
+}
+
+/// Request counters that are updated by the running server without taking any locks
+#[derive(Debug, Default)]
+pub(crate) struct RequestStats {
+  requests: AtomicU64,
+  latency_buckets: [AtomicU64; LATENCY_BUCKETS],
+  latency_total_us: AtomicU64,
+  latency_max_us: AtomicU64
+}
+
+impl RequestStats {
+  /// Records a request that took `latency` to respond to
+  pub(crate) fn record(&self, latency: Duration) {
+    let micros = latency.as_micros().min(u64::MAX as u128) as u64;
+    let bucket = LATENCY_BUCKET_LIMITS.iter()
+      .position(|limit| micros <= *limit)
+      .unwrap_or(LATENCY_BUCKETS - 1);
+    self.requests.fetch_add(1, Ordering::Relaxed);
+    self.latency_buckets[bucket].fetch_add(1, Ordering::Relaxed);
+    self.latency_total_us.fetch_add(micros, Ordering::Relaxed);
+    self.latency_max_us.fetch_max(micros, Ordering::Relaxed);
+  }
+
+  /// Clears the counters
+  pub(crate) fn reset(&self) {
+    self.requests.store(0, Ordering::Relaxed);
+    for bucket in &self.latency_buckets {
+      bucket.store(0, Ordering::Relaxed);
+    }
+    self.latency_total_us.store(0, Ordering::Relaxed);
+    self.latency_max_us.store(0, Ordering::Relaxed);
+  }
+
+  /// Copies the counters into the status
+  pub(crate) fn fill(&self, status: &mut MockServerStatus) {
+    status.requests = self.requests.load(Ordering::Relaxed);
+    for (count, bucket) in status.latency_buckets.iter_mut().zip(&self.latency_buckets) {
+      *count = bucket.load(Ordering::Relaxed);
+    }
+    status.latency_total_us = self.latency_total_us.load(Ordering::Relaxed);
+    status.latency_max_us = self.latency_max_us.load(Ordering::Relaxed);
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use expectest::prelude::*;
+
+  use super::*;
+
+  #[test]
+  fn request_stats_records_latencies_in_buckets() {
+    let stats = RequestStats::default();
+    stats.record(Duration::from_micros(10));
+    stats.record(Duration::from_micros(50));
+    stats.record(Duration::from_micros(700));
+    stats.record(Duration::from_millis(500));
+
+    let mut status = MockServerStatus::default();
+    stats.fill(&mut status);
+    expect!(status.requests).to(be_equal_to(4));
+    expect!(status.latency_buckets[0]).to(be_equal_to(2));
+    expect!(status.latency_buckets[4]).to(be_equal_to(1));
+    expect!(status.latency_buckets[LATENCY_BUCKETS - 1]).to(be_equal_to(1));
+    expect!(status.latency_max_us).to(be_equal_to(500_000));
+    expect!(status.latency_percentile(50.0)).to(be_some().value(50));
+    expect!(status.latency_percentile(75.0)).to(be_some().value(1_000));
+    expect!(status.latency_percentile(100.0)).to(be_some().value(500_000));
+
+    stats.reset();
+    let mut status = MockServerStatus::default();
+    stats.fill(&mut status);
+    expect!(status).to(be_equal_to(MockServerStatus::default()));
+    expect!(status.latency_percentile(50.0)).to(be_none());
+  }
+}
@@ -11,7 +11,7 @@ use pact_models::matchingrules::MatchingRule;
 use pact_models::prelude::v4::{SynchronousHttp, V4Pact};
 use pact_models::v4::http_parts::{HttpRequest, HttpResponse};
 
-use crate::matching::{match_request, MatchResult};
+use crate::matching::{match_request, match_request_with_index, MatchResult, RoutingIndex};
 
 use super::*;
 use pact_models::v4::interaction::V4Interaction;
@@ -27,6 +27,23 @@ async fn match_request_returns_a_match_for_identical_requests() {
       interaction.response.clone(), request.clone())));
 }
 
+#[tokio::test]
+async fn match_request_with_index_only_matches_interactions_with_the_same_method() {
+    let get = SynchronousHttp { request: HttpRequest { path: "/items".to_string(), .. HttpRequest::default() }, .. SynchronousHttp::default() };
+    let post = SynchronousHttp { request: HttpRequest { method: "POST".to_string(), path: "/items".to_string(), .. HttpRequest::default() }, .. SynchronousHttp::default() };
+    let pact = V4Pact { interactions: vec![get.boxed_v4(), post.boxed_v4()], .. V4Pact::default() };
+    let index = RoutingIndex::new(pact);
+    expect!(index.candidates("post")).to(be_equal_to(&[1_usize][..]));
+
+    let request = HttpRequest { method: "post".to_string(), path: "/items".to_string(), .. HttpRequest::default() };
+    let result = match_request_with_index(&request, &index).await;
+    expect!(result).to(be_equal_to(MatchResult::RequestMatch(post.request.clone(), post.response.clone(), request.clone())));
+
+    let request = HttpRequest { method: "DELETE".to_string(), path: "/items".to_string(), .. HttpRequest::default() };
+    let result = match_request_with_index(&request, &index).await;
+    expect!(result).to(be_equal_to(MatchResult::RequestNotFound(request)));
+}
+
 #[tokio::test]
 async fn match_request_returns_a_not_found_for_no_interactions() {
     let request = HttpRequest::default();
@@ -293,3 +310,102 @@ fn basic_mock_server_test() {
   expect!(mismatches).to(be_some().value("[]"));
   expect!(response.unwrap().status()).to(be_equal_to(200));
 }
+
+#[test]
+fn mock_server_can_be_restored_from_a_snapshot() {
+  let pact = V4Pact {
+    interactions: vec![
+      SynchronousHttp {
+        request: HttpRequest { path: "/expected".to_string(), .. HttpRequest::default() },
+        .. SynchronousHttp::default()
+      }.boxed_v4()
+    ],
+    .. V4Pact::default()
+  };
+  let id = "mock_server_can_be_restored_from_a_snapshot".to_string();
+  let addr: std::net::SocketAddr = "127.0.0.1:0".parse().unwrap();
+  let port = start_mock_server_with_config(id.clone(), pact.boxed(), addr, MockServerConfig::default()).unwrap();
+
+  let client = reqwest::blocking::Client::new();
+  let response = client.get(format!("http://127.0.0.1:{}/unexpected", port).as_str()).send();
+  expect!(response.unwrap().status()).to(be_equal_to(500));
+
+  let path = std::env::temp_dir().join(format!("{}.snapshot", id));
+  let entries = snapshot_mock_server(port, &path, false);
+  shutdown_mock_server(port);
+  expect!(entries.unwrap()).to(be_equal_to(1));
+
+  let restored_port = restore_mock_server_snapshot(&path, Some(0)).unwrap();
+  let mismatches = mock_server_mismatches(restored_port).unwrap_or_default();
+  let all_matched = mock_server_matched(restored_port);
+  shutdown_mock_server(restored_port);
+  let _ = std::fs::remove_file(&path);
+
+  expect!(all_matched).to(be_false());
+  expect!(mismatches.contains("/unexpected")).to(be_true());
+}
+
+#[tokio::test(flavor = "multi_thread")]
+async fn async_api_starts_verifies_and_shuts_down_a_mock_server() {
+  let pact = V4Pact {
+    interactions: vec![
+      SynchronousHttp {
+        request: HttpRequest { path: "/expected".to_string(), .. HttpRequest::default() },
+        .. SynchronousHttp::default()
+      }.boxed_v4()
+    ],
+    .. V4Pact::default()
+  };
+  let id = "async_api_starts_verifies_and_shuts_down_a_mock_server".to_string();
+  let addr: std::net::SocketAddr = "127.0.0.1:0".parse().unwrap();
+  let port = start_mock_server_async(id, pact.boxed(), addr, MockServerConfig::default()).await.unwrap();
+
+  let verification = verify_mock_server_async(port).await.unwrap();
+  expect!(verification.matched()).to(be_false());
+  expect!(verification.mismatches.len()).to(be_equal_to(1));
+
+  let (tx, rx) = futures::channel::oneshot::channel();
+  spawn_with_callback(shutdown_mock_server_async(port), move |result| {
+    let _ = tx.send(result);
+  });
+  expect!(rx.await.unwrap()).to(be_true());
+  expect!(verify_mock_server_async(port).await).to(be_none());
+}
+
+#[test]
+fn multi_pact_mock_server_verifies_each_pact_independently() {
+  let pact = |provider: &str, path: &str| V4Pact {
+    provider: pact_models::prelude::Provider { name: provider.to_string() },
+    interactions: vec![
+      SynchronousHttp {
+        request: HttpRequest { path: path.to_string(), .. HttpRequest::default() },
+        .. SynchronousHttp::default()
+      }.boxed_v4()
+    ],
+    .. V4Pact::default()
+  }.boxed();
+  let id = "multi_pact_mock_server_verifies_each_pact_independently".to_string();
+  let addr: std::net::SocketAddr = "127.0.0.1:0".parse().unwrap();
+  let port = start_multi_pact_mock_server(id, vec![pact("orders", "/orders"), pact("users", "/users")],
+    addr, MockServerConfig::default()).unwrap();
+
+  let client = reqwest::blocking::Client::new();
+  let response = client.get(format!("http://127.0.0.1:{}/orders", port).as_str()).send();
+  expect!(response.unwrap().status()).to(be_equal_to(200));
+  let response = client.get(format!("http://127.0.0.1:{}/unexpected", port).as_str()).send();
+  expect!(response.unwrap().status()).to(be_equal_to(500));
+
+  let orders = verify_mock_server_pact(port, 0).unwrap();
+  let users = verify_mock_server_pact(port, 1).unwrap();
+  let missing = verify_mock_server_pact(port, 2);
+  let all_matched = mock_server_matched(port);
+  shutdown_mock_server(port);
+
+  expect!(orders.matched()).to(be_true());
+  expect!(orders.mock_server["provider"].clone()).to(be_equal_to(json!("orders")));
+  expect!(users.matched()).to(be_false());
+  expect!(users.mismatches.len()).to(be_equal_to(1));
+  expect!(users.mismatches[0]["type"].clone()).to(be_equal_to(json!("missing-request")));
+  expect!(missing.is_none()).to(be_true());
+  expect!(all_matched).to(be_false());
+}
@@ -9,3 +9,11 @@ pub(crate) fn json_to_bool(value: &Value) -> Option<bool> {
     _ => None
   }
 }
+
+/// Unpack a JSON number value as a usize, returning a None if the JSON value is not a positive integer
+pub(crate) fn json_to_usize(value: &Value) -> Option<usize> {
+  match value {
+    Value::Number(n) => n.as_u64().map(|n| n as usize),
+    _ => None
+  }
+}
@@ -0,0 +1,37 @@
+#!/usr/bin/env python3
+#
+# Stub plugin used by the warm plugin pool tests. It answers every gRPC call from the plugin
+# driver with an empty message (so it provides no catalogue entries), and appends its process ID
+# to the file in STUB_PLUGIN_LOG when it starts, so the tests can count the plugin processes.
+#
+# Requires python3 with the grpcio package.
+
+import json
+import os
+import uuid
+from concurrent import futures
+
+import grpc
+
+
+class EmptyResponses(grpc.GenericRpcHandler):
+    def service(self, handler_call_details):
+        return grpc.unary_unary_rpc_method_handler(lambda request, context: b'')
+
+
+def main():
+    log = os.environ.get('STUB_PLUGIN_LOG')
+    if log:
+        with open(log, 'a') as f:
+            f.write('{}\n'.format(os.getpid()))
+
+    server = grpc.server(futures.ThreadPoolExecutor(max_workers=4))
+    server.add_generic_rpc_handlers((EmptyResponses(),))
+    port = server.add_insecure_port('127.0.0.1:0')
+    server.start()
+    print(json.dumps({'port': port, 'serverKey': str(uuid.uuid4())}), flush=True)
+    server.wait_for_termination()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,222 @@
+//!
+//! Master server endpoints that are handled asynchronously, outside of the webmachine dispatcher.
+//! These are the endpoints that need to wait on a mock server (long polls, event streams and bulk
+//! shutdowns), or stream a large response, so must not block the thread handling the request.
+//!
+
+use std::collections::HashMap;
+use std::time::Duration;
+
+use hyper::{Body, Method, Request, Response};
+use hyper::body::{Bytes, Sender};
+use serde_json::{json, Value};
+use tracing::debug;
+
+use pact_mock_server::journal::wait_for_matches;
+use pact_mock_server::mock_server::MockServer;
+
+use crate::events::{all_events, mock_server_events};
+use crate::server::{bulk_shutdown, shutdown_selector};
+use crate::SERVER_MANAGER;
+
+/// Header a wait request can use to wait on the requests for a session
+const SESSION_HEADER: &str = "X-Pact-Session";
+/// Default time to wait for matches if no timeout is given
+const DEFAULT_WAIT_TIMEOUT_MS: u64 = 5000;
+/// Maximum time a long poll request can wait
+const MAX_WAIT_TIMEOUT_MS: u64 = 300_000;
+/// Default number of mismatches read from a journal at a time when streaming them
+const DEFAULT_MISMATCH_PAGE_SIZE: usize = 500;
+/// Maximum number of mismatches read from a journal at a time when streaming them
+const MAX_MISMATCH_PAGE_SIZE: usize = 10_000;
+
+/// Endpoints handled by this module
+#[derive(Debug, Clone, PartialEq)]
+pub(crate) enum AsyncRoute {
+  /// GET /mockserver/:id/wait, or GET /mockserver/:id/_session/:session/wait for a session
+  Wait(String, Option<String>),
+  /// GET /mockserver/:id/events
+  Events(String),
+  /// GET /events
+  AllEvents,
+  /// GET /mockserver/:id/mismatches, with an `Accept: application/x-ndjson` header
+  Mismatches(String),
+  /// DELETE /
+  Shutdown
+}
+
+/// Returns the route for the request if it is handled by this module
+pub(crate) fn async_route(req: &Request<Body>) -> Option<AsyncRoute> {
+  let paths: Vec<&str> = req.uri().path()
+    .split('/')
+    .filter(|p| !p.is_empty())
+    .collect();
+  match (req.method(), paths.as_slice()) {
+    (&Method::GET, ["mockserver", id, "wait"]) => Some(AsyncRoute::Wait(id.to_string(), None)),
+    (&Method::GET, ["mockserver", id, "_session", session, "wait"]) =>
+      Some(AsyncRoute::Wait(id.to_string(), Some(session.to_string()))),
+    (&Method::GET, ["mockserver", id, "events"]) => Some(AsyncRoute::Events(id.to_string())),
+    (&Method::GET, ["events"]) => Some(AsyncRoute::AllEvents),
+    (&Method::GET, ["mockserver", id, "mismatches"]) if accepts_ndjson(req) =>
+      Some(AsyncRoute::Mismatches(id.to_string())),
+    (&Method::DELETE, []) => Some(AsyncRoute::Shutdown),
+    _ => None
+  }
+}
+
+/// Handles a request for one of the routes from `async_route`
+pub(crate) async fn handle_async_route(route: AsyncRoute, req: Request<Body>) -> Response<Body> {
+  debug!("Handling async route {:?}", route);
+  let query = query_parameters(&req);
+  match route {
+    AsyncRoute::Wait(id, session) => {
+      let session = session
+        .or_else(|| req.headers().get(SESSION_HEADER)
+          .and_then(|session| session.to_str().ok())
+          .map(|session| session.to_string()))
+        .or_else(|| query.get("session").cloned())
+        .filter(|session| !session.is_empty());
+      wait_for_mock_server_matches(id.as_str(), session, &query).await
+    }
+    AsyncRoute::Events(id) => mock_server_events(id.as_str(), &req, &query).await,
+    AsyncRoute::AllEvents => all_events(&req, &query).await,
+    AsyncRoute::Mismatches(id) => stream_mismatches(id.as_str(), &query),
+    AsyncRoute::Shutdown => shutdown_mock_servers(&req).await
+  }
+}
+
+fn accepts_ndjson(req: &Request<Body>) -> bool {
+  req.headers().get(hyper::header::ACCEPT)
+    .and_then(|accept| accept.to_str().ok())
+    .map(|accept| accept.contains("application/x-ndjson"))
+    .unwrap_or_default()
+}
+
+fn query_parameters(req: &Request<Body>) -> HashMap<String, String> {
+  req.uri().query()
+    .map(|query| url::form_urlencoded::parse(query.as_bytes()).into_owned().collect())
+    .unwrap_or_default()
+}
+
+/// Query parameters of the request, with all the values for parameters that are repeated
+pub(crate) fn query_parameter_values(req: &Request<Body>) -> HashMap<String, Vec<String>> {
+  req.uri().query()
+    .map(|query| url::form_urlencoded::parse(query.as_bytes()).into_owned()
+      .fold(HashMap::new(), |mut map: HashMap<String, Vec<String>>, (key, value)| {
+        map.entry(key).or_default().push(value);
+        map
+      }))
+    .unwrap_or_default()
+}
+
+/// Finds a mock server by ID or port number, and maps it with the supplied function
+pub(crate) fn with_mock_server<R>(id: &str, f: &dyn Fn(&MockServer) -> R) -> Option<R> {
+  let mut manager = SERVER_MANAGER.lock().unwrap();
+  if id.chars().all(|ch| ch.is_ascii_digit()) {
+    id.parse::<u16>().ok()
+      .and_then(|port| manager.find_mock_server_by_port(port, &|_, _, ms| ms.left().map(|ms| f(ms))))
+      .flatten()
+  } else {
+    manager.find_mock_server_by_id(&id.to_string(), &|_, ms| ms.left().map(|ms| f(ms)))
+      .flatten()
+  }
+}
+
+pub(crate) fn json_response(status: u16, body: Value) -> Response<Body> {
+  Response::builder()
+    .status(status)
+    .header(hyper::header::CONTENT_TYPE, "application/json")
+    .body(Body::from(body.to_string()))
+    .unwrap()
+}
+
+/// Shuts down the mock servers selected by the query parameters (see `shutdown_selector`),
+/// awaiting them to stop rather than blocking the thread handling the request
+async fn shutdown_mock_servers(req: &Request<Body>) -> Response<Body> {
+  let (selector, deadline) = shutdown_selector(&query_parameter_values(req));
+  let report = bulk_shutdown(selector, deadline).await;
+  json_response(200, json!(report))
+}
+
+async fn wait_for_mock_server_matches(
+  id: &str,
+  session: Option<String>,
+  query: &HashMap<String, String>
+) -> Response<Body> {
+  let count = query.get("count")
+    .and_then(|count| count.parse::<usize>().ok())
+    .unwrap_or(1);
+  let timeout = query.get("timeout")
+    .and_then(|timeout| timeout.parse::<u64>().ok())
+    .unwrap_or(DEFAULT_WAIT_TIMEOUT_MS)
+    .min(MAX_WAIT_TIMEOUT_MS);
+  let interaction = query.get("interaction").cloned();
+
+  let found = with_mock_server(id, &|ms| {
+    (ms.journal(), ms.wait_condition(interaction.as_deref(), count))
+  });
+  match found {
+    Some((journal, Some(condition))) => {
+      let condition = match &session {
+        Some(session) => condition.for_session(session),
+        None => condition
+      };
+      let matched = wait_for_matches(journal.clone(), condition, Duration::from_millis(timeout)).await;
+      let matches = match &session {
+        Some(session) => journal.lock().unwrap().session_matched(session),
+        None => journal.lock().unwrap().matched()
+      };
+      json_response(200, json!({ "matched": matched, "matches": matches }))
+    }
+    Some((_, None)) => json_response(422, json!({
+      "error": format!("No interaction found with description '{}'", interaction.unwrap_or_default())
+    })),
+    None => json_response(404, json!({ "error": format!("No mock server found with ID or port '{}'", id) }))
+  }
+}
+
+/// Streams the mismatches of a mock server as newline delimited JSON, reading them from the match
+/// journal a page at a time so the full set of mismatches is never built in memory. The expected
+/// requests that were not received are sent at the end of the stream.
+fn stream_mismatches(id: &str, query: &HashMap<String, String>) -> Response<Body> {
+  let since = query.get("since")
+    .and_then(|since| since.parse::<u64>().ok())
+    .unwrap_or_default();
+  let page_size = query.get("pageSize")
+    .and_then(|size| size.parse::<usize>().ok())
+    .unwrap_or(DEFAULT_MISMATCH_PAGE_SIZE)
+    .clamp(1, MAX_MISMATCH_PAGE_SIZE);
+  match with_mock_server(id, &|ms| ms.clone()) {
+    Some(mock_server) => {
+      debug!("Streaming mismatches for mock server {} from sequence {}", mock_server.id, since);
+      let (sender, body) = Body::channel();
+      tokio::spawn(send_mismatches(mock_server, since, page_size, sender));
+      Response::builder()
+        .status(200)
+        .header(hyper::header::CONTENT_TYPE, "application/x-ndjson")
+        .header(hyper::header::CACHE_CONTROL, "no-cache")
+        .body(body)
+        .unwrap()
+    }
+    None => json_response(404, json!({ "error": format!("No mock server found with ID or port '{}'", id) }))
+  }
+}
+
+async fn send_mismatches(mock_server: MockServer, mut cursor: u64, page_size: usize, mut sender: Sender) {
+  loop {
+    let page = mock_server.mismatches_page(cursor, page_size);
+    let mut chunk = String::new();
+    for mismatch in &page.mismatches {
+      chunk.push_str(mismatch.to_string().as_str());
+      chunk.push('\n');
+    }
+    if !chunk.is_empty() && sender.send_data(Bytes::from(chunk)).await.is_err() {
+      debug!("Client for mock server {} mismatches has gone away", mock_server.id);
+      return;
+    }
+    if page.complete {
+      return;
+    }
+    cursor = page.cursor;
+  }
+}
@@ -0,0 +1,410 @@
+//!
+//! Clustering of master servers. Several master servers (on one or more hosts) can be started with
+//! the URLs of each other, and mock servers are then placed on the nodes of the cluster by
+//! consistent hashing of their IDs. Any node can accept requests: requests for a mock server ID
+//! that is owned by another node are forwarded to it, new mock servers are created on the node
+//! that owns their (newly allocated) ID, and listings and bulk shutdowns are spread over all the
+//! nodes.
+//!
+//! All the nodes must be started with the same set of node URLs, so they build the same ring.
+//! Mock servers referred to by port number are always handled by the node receiving the request,
+//! as ports are only unique for a node.
+//!
+
+use std::collections::BTreeMap;
+use std::sync::{Arc, RwLock};
+use std::time::Duration;
+
+use futures::future::join_all;
+use hyper::{Body, Client, Method, Request, Response, Uri};
+use hyper::client::HttpConnector;
+use hyper::header::{HeaderValue, HOST};
+use itertools::Either;
+use lazy_static::lazy_static;
+use serde_json::{json, Value};
+use tracing::{debug, info, warn};
+use uuid::Uuid;
+
+use pact_mock_server::server_manager::{ShutdownReport, ShutdownSelector};
+
+use crate::async_api::{json_response, query_parameter_values};
+use crate::server::{bulk_shutdown, shutdown_selector};
+use crate::SERVER_MANAGER;
+
+/// Header set on requests forwarded between the nodes, so they are not forwarded again
+pub(crate) const FORWARDED_HEADER: &str = "X-Pact-Forwarded";
+/// Header with the ID to use for a new mock server, set when the ID has been allocated by the
+/// node that received the request
+pub(crate) const MOCK_SERVER_ID_HEADER: &str = "X-Pact-Mock-Server-Id";
+/// Number of points each node has on the ring
+const VIRTUAL_NODES: usize = 64;
+/// Time to wait for a node when aggregating a listing
+const LISTING_TIMEOUT: Duration = Duration::from_secs(5);
+
+lazy_static! {
+  static ref CLUSTER: RwLock<Option<Arc<Cluster>>> = RwLock::new(None);
+}
+
+/// 64 bit FNV-1a hash
+pub(crate) fn fnv1a(bytes: &[u8]) -> u64 {
+  let mut hash: u64 = 0xcbf29ce484222325;
+  for byte in bytes {
+    hash ^= *byte as u64;
+    hash = hash.wrapping_mul(0x100000001b3);
+  }
+  hash
+}
+
+/// Position of a key on the ring. FNV-1a is followed by a final mix, as FNV leaves keys that only
+/// differ in their last bytes (like the virtual node names) close together.
+fn ring_position(key: &str) -> u64 {
+  let mut hash = fnv1a(key.as_bytes());
+  hash ^= hash >> 33;
+  hash = hash.wrapping_mul(0xff51afd7ed558ccd);
+  hash ^= hash >> 33;
+  hash = hash.wrapping_mul(0xc4ceb9fe1a85ec53);
+  hash ^ (hash >> 33)
+}
+
+/// Consistent hash ring of the nodes in the cluster
+#[derive(Debug, Clone)]
+pub(crate) struct HashRing {
+  nodes: Vec<String>,
+  points: Vec<(u64, usize)>
+}
+
+impl HashRing {
+  /// Creates a ring with the nodes, each with `virtual_nodes` points on the ring
+  pub(crate) fn new(nodes: &[String], virtual_nodes: usize) -> HashRing {
+    let mut nodes = nodes.to_vec();
+    nodes.sort();
+    nodes.dedup();
+    let mut points: Vec<(u64, usize)> = nodes.iter().enumerate()
+      .flat_map(|(index, node)| (0..virtual_nodes.max(1))
+        .map(move |vnode| (ring_position(format!("{}#{}", node, vnode).as_str()), index)))
+      .collect();
+    points.sort();
+    HashRing { nodes, points }
+  }
+
+  /// Returns the node that owns the key
+  pub(crate) fn node_for(&self, key: &str) -> &str {
+    let position = ring_position(key);
+    let index = match self.points.binary_search_by(|(point, _)| point.cmp(&position)) {
+      Ok(index) => index,
+      Err(index) => index % self.points.len()
+    };
+    self.nodes[self.points[index].1].as_str()
+  }
+
+  /// Nodes in the ring
+  pub(crate) fn nodes(&self) -> &[String] {
+    &self.nodes
+  }
+}
+
+/// This node and the ring of the cluster it is part of
+#[derive(Debug)]
+pub(crate) struct Cluster {
+  node: String,
+  ring: HashRing,
+  client: Client<HttpConnector>
+}
+
+impl Cluster {
+  fn owner(&self, id: &str) -> Option<&str> {
+    let node = self.ring.node_for(id);
+    if node == self.node { None } else { Some(node) }
+  }
+}
+
+fn normalise_url(url: &str) -> String {
+  url.trim().trim_end_matches('/').to_string()
+}
+
+/// Sets up the cluster this node is part of. `node` is the URL the other nodes use for this node,
+/// and `peers` are the URLs of the other nodes.
+pub(crate) fn configure(node: &str, peers: &[String]) -> anyhow::Result<()> {
+  let node = normalise_url(node);
+  let mut nodes: Vec<String> = peers.iter()
+    .map(|peer| normalise_url(peer))
+    .filter(|peer| !peer.is_empty())
+    .collect();
+  nodes.push(node.clone());
+  for url in &nodes {
+    let uri = url.parse::<Uri>()?;
+    if uri.scheme_str() != Some("http") || uri.authority().is_none() {
+      return Err(anyhow::anyhow!("Cluster node URL '{}' must be an absolute http URL", url));
+    }
+  }
+  let ring = HashRing::new(&nodes, VIRTUAL_NODES);
+  info!("Master server {} is part of a cluster of {} nodes", node, ring.nodes().len());
+  *CLUSTER.write().unwrap() = Some(Arc::new(Cluster { node, ring, client: Client::new() }));
+  Ok(())
+}
+
+fn cluster() -> Option<Arc<Cluster>> {
+  CLUSTER.read().unwrap().clone()
+}
+
+/// If this master server is part of a cluster
+pub(crate) fn enabled() -> bool {
+  CLUSTER.read().unwrap().is_some()
+}
+
+/// Handles the cluster routing of a request to the master server. Returns either the response (if
+/// the request was forwarded or aggregated) or the request to handle on this node, which may have
+/// had the ID for a new mock server added.
+pub(crate) async fn route_request(mut req: Request<Body>) -> Either<Response<Body>, Request<Body>> {
+  let cluster = match cluster() {
+    Some(cluster) if !req.headers().contains_key(FORWARDED_HEADER) => cluster,
+    _ => return Either::Right(req)
+  };
+
+  let paths: Vec<String> = req.uri().path()
+    .split('/')
+    .filter(|p| !p.is_empty())
+    .map(|p| p.to_string())
+    .collect();
+  let paths: Vec<&str> = paths.iter().map(|p| p.as_str()).collect();
+  match (req.method().clone(), paths.as_slice()) {
+    (Method::GET, []) => Either::Left(aggregate_listing(&cluster).await),
+    (Method::DELETE, []) => Either::Left(cluster_shutdown(&cluster, &req).await),
+    (Method::POST, []) => {
+      let id = Uuid::new_v4().to_string();
+      let id_header = HeaderValue::from_str(id.as_str()).unwrap();
+      req.headers_mut().insert(MOCK_SERVER_ID_HEADER, id_header);
+      match cluster.owner(&id) {
+        Some(node) => Either::Left(forward_request(&cluster, node, req).await),
+        None => {
+          // Mark the request as routed, so the allocated ID is used
+          req.headers_mut().insert(FORWARDED_HEADER, HeaderValue::from_str(cluster.node.as_str())
+            .unwrap_or_else(|_| HeaderValue::from_static("true")));
+          Either::Right(req)
+        }
+      }
+    }
+    (_, ["mockserver", id, ..]) if !id.chars().all(|ch| ch.is_ascii_digit()) => match cluster.owner(id) {
+      Some(node) => Either::Left(forward_request(&cluster, node, req).await),
+      None => Either::Right(req)
+    },
+    _ => Either::Right(req)
+  }
+}
+
+/// Forwards the request to the node. The response is streamed back, so long polls and event
+/// streams work through any node.
+async fn forward_request(cluster: &Cluster, node: &str, req: Request<Body>) -> Response<Body> {
+  let path_and_query = req.uri().path_and_query().map(|pq| pq.as_str()).unwrap_or("/");
+  let uri = match format!("{}{}", node, path_and_query).parse::<Uri>() {
+    Ok(uri) => uri,
+    Err(err) => return json_response(500, json!({ "error": format!("Invalid cluster node URL - {}", err) }))
+  };
+  debug!("Forwarding {} {} to cluster node {}", req.method(), path_and_query, node);
+
+  let (mut parts, body) = req.into_parts();
+  parts.uri = uri;
+  parts.headers.remove(HOST);
+  parts.headers.insert(FORWARDED_HEADER, HeaderValue::from_str(cluster.node.as_str())
+    .unwrap_or_else(|_| HeaderValue::from_static("true")));
+  match cluster.client.request(Request::from_parts(parts, body)).await {
+    Ok(response) => response,
+    Err(err) => {
+      warn!("Failed to forward request to cluster node {} - {}", node, err);
+      json_response(502, json!({ "error": format!("Cluster node {} is not reachable - {}", node, err) }))
+    }
+  }
+}
+
+/// Lists the mock servers of all the nodes in the cluster. Each mock server has the URL of the node
+/// it is running on added, and nodes that could not be reached are listed separately.
+async fn aggregate_listing(cluster: &Cluster) -> Response<Body> {
+  let local: Vec<Value> = SERVER_MANAGER.lock().unwrap().mock_servers_json();
+  let mut mock_servers = with_node(local, cluster.node.as_str());
+  let mut unreachable = vec![];
+
+  let peers: Vec<&String> = cluster.ring.nodes().iter().filter(|node| **node != cluster.node).collect();
+  let listings = join_all(peers.iter().map(|node| node_listing(cluster, node.as_str()))).await;
+  for (node, listing) in peers.iter().zip(listings) {
+    match listing {
+      Ok(listing) => mock_servers.extend(with_node(listing, node.as_str())),
+      Err(err) => {
+        warn!("Failed to get the mock servers from cluster node {} - {}", node, err);
+        unreachable.push(node.to_string());
+      }
+    }
+  }
+
+  let mut body = json!({ "mockServers": mock_servers });
+  if !unreachable.is_empty() {
+    body["unreachableNodes"] = json!(unreachable);
+  }
+  json_response(200, body)
+}
+
+/// Shuts down a group of mock servers across the cluster. Mock servers selected by ID are shut
+/// down by the nodes that own them, while tags (or all the mock servers) are sent to every node.
+/// The reports from the nodes are merged, and nodes that could not be reached are listed separately.
+async fn cluster_shutdown(cluster: &Cluster, req: &Request<Body>) -> Response<Body> {
+  let (selector, deadline) = shutdown_selector(&query_parameter_values(req));
+
+  let mut targets: BTreeMap<String, ShutdownSelector> = BTreeMap::new();
+  match &selector {
+    ShutdownSelector::Ids(ids) => for id in ids {
+      let node = cluster.ring.node_for(id).to_string();
+      if let ShutdownSelector::Ids(ids) = targets.entry(node).or_insert_with(|| ShutdownSelector::Ids(vec![])) {
+        ids.push(id.clone());
+      }
+    },
+    _ => for node in cluster.ring.nodes() {
+      targets.insert(node.clone(), selector.clone());
+    }
+  }
+
+  let results = join_all(targets.into_iter().map(|(node, selector)| async move {
+    let result = if node == cluster.node {
+      Ok(bulk_shutdown(selector, deadline).await)
+    } else {
+      node_shutdown(cluster, node.as_str(), &selector, deadline).await
+    };
+    (node, result)
+  })).await;
+
+  let mut report = ShutdownReport::default();
+  let mut unreachable = vec![];
+  for (node, result) in results {
+    match result {
+      Ok(node_report) => {
+        report.stopped.extend(node_report.stopped);
+        report.forced.extend(node_report.forced);
+        report.failed.extend(node_report.failed);
+        report.not_found.extend(node_report.not_found);
+        report.drained_connections += node_report.drained_connections;
+        report.aborted_connections += node_report.aborted_connections;
+      }
+      Err(err) => {
+        warn!("Failed to shut down the mock servers on cluster node {} - {}", node, err);
+        unreachable.push(node);
+      }
+    }
+  }
+
+  let mut body = serde_json::to_value(&report).unwrap_or_default();
+  if !unreachable.is_empty() {
+    body["unreachableNodes"] = json!(unreachable);
+  }
+  json_response(200, body)
+}
+
+async fn node_shutdown(
+  cluster: &Cluster,
+  node: &str,
+  selector: &ShutdownSelector,
+  deadline: Duration
+) -> anyhow::Result<ShutdownReport> {
+  let mut query = url::form_urlencoded::Serializer::new(String::new());
+  match selector {
+    ShutdownSelector::Ids(ids) => for id in ids {
+      query.append_pair("id", id);
+    },
+    ShutdownSelector::Tag(tag) => {
+      query.append_pair("tag", tag);
+    }
+    ShutdownSelector::All => {}
+  }
+  query.append_pair("deadline", deadline.as_millis().to_string().as_str());
+  let request = Request::delete(format!("{}/?{}", node, query.finish()))
+    .header(FORWARDED_HEADER, cluster.node.as_str())
+    .body(Body::empty())?;
+  // Give the node time to reach its deadline before giving up on it
+  let timeout = deadline + LISTING_TIMEOUT;
+  let response = tokio::time::timeout(timeout, cluster.client.request(request)).await??;
+  if !response.status().is_success() {
+    return Err(anyhow::anyhow!("Request failed with status {}", response.status()));
+  }
+  let body = tokio::time::timeout(LISTING_TIMEOUT, hyper::body::to_bytes(response.into_body())).await??;
+  Ok(serde_json::from_slice(&body)?)
+}
+
+fn with_node(mock_servers: Vec<Value>, node: &str) -> Vec<Value> {
+  mock_servers.into_iter()
+    .map(|mut ms| {
+      if let Value::Object(map) = &mut ms {
+        map.insert("node".to_string(), json!(node));
+      }
+      ms
+    })
+    .collect()
+}
+
+async fn node_listing(cluster: &Cluster, node: &str) -> anyhow::Result<Vec<Value>> {
+  let request = Request::get(format!("{}/", node))
+    .header(FORWARDED_HEADER, cluster.node.as_str())
+    .body(Body::empty())?;
+  let response = tokio::time::timeout(LISTING_TIMEOUT, cluster.client.request(request)).await??;
+  if !response.status().is_success() {
+    return Err(anyhow::anyhow!("Request failed with status {}", response.status()));
+  }
+  let body = tokio::time::timeout(LISTING_TIMEOUT, hyper::body::to_bytes(response.into_body())).await??;
+  let json: Value = serde_json::from_slice(&body)?;
+  Ok(json.get("mockServers").and_then(Value::as_array).cloned().unwrap_or_default())
+}
+
+#[cfg(test)]
+mod tests {
+  use std::collections::HashMap;
+
+  use expectest::prelude::*;
+
+  use super::*;
+
+  fn nodes(count: usize) -> Vec<String> {
+    (0..count).map(|i| format!("http://127.0.0.1:{}", 8080 + i)).collect()
+  }
+
+  #[test]
+  fn ring_is_independent_of_the_node_order() {
+    let mut reversed = nodes(3);
+    reversed.reverse();
+    let ring = HashRing::new(&nodes(3), VIRTUAL_NODES);
+    let other = HashRing::new(&reversed, VIRTUAL_NODES);
+    for _ in 0..100 {
+      let id = Uuid::new_v4().to_string();
+      expect!(ring.node_for(&id)).to(be_equal_to(other.node_for(&id)));
+    }
+  }
+
+  #[test]
+  fn keys_are_spread_over_the_nodes() {
+    let ring = HashRing::new(&nodes(3), VIRTUAL_NODES);
+    let mut counts: HashMap<String, usize> = HashMap::new();
+    for _ in 0..3000 {
+      *counts.entry(ring.node_for(&Uuid::new_v4().to_string()).to_string()).or_default() += 1;
+    }
+    expect!(counts.len()).to(be_equal_to(3));
+    for count in counts.values() {
+      expect!(*count).to(be_greater_than(600));
+      expect!(*count).to(be_less_than(1400));
+    }
+  }
+
+  #[test]
+  fn removing_a_node_only_moves_its_keys() {
+    let ring = HashRing::new(&nodes(4), VIRTUAL_NODES);
+    let smaller = HashRing::new(&nodes(3), VIRTUAL_NODES);
+    let removed = nodes(4).pop().unwrap();
+    for _ in 0..1000 {
+      let id = Uuid::new_v4().to_string();
+      let owner = ring.node_for(&id);
+      if owner != removed {
+        expect!(smaller.node_for(&id)).to(be_equal_to(owner));
+      }
+    }
+  }
+
+  #[test]
+  fn fnv1a_matches_the_reference_values() {
+    expect!(fnv1a(b"")).to(be_equal_to(0xcbf29ce484222325));
+    expect!(fnv1a(b"a")).to(be_equal_to(0xaf63dc4c8601ec8c));
+  }
+}
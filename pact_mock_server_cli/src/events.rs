@@ -0,0 +1,287 @@
+//!
+//! Streams of the match results journaled by the mock servers, either as server-sent events or
+//! newline delimited JSON. Each stream is driven by its own task, which is woken when a journal is
+//! appended to and then reads the new entries from the journal by sequence number. Nothing is
+//! buffered for a subscriber apart from the batch being written, so a slow subscriber only delays
+//! its own stream and never the handling of requests by the mock servers.
+//!
+
+use std::collections::HashMap;
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+
+use futures::future::select_all;
+use hyper::{Body, Request, Response};
+use hyper::body::{Bytes, Sender};
+use serde_json::{json, Value};
+use tracing::{debug, trace};
+
+use pact_mock_server::journal::MatchJournal;
+
+use crate::async_api::{json_response, with_mock_server};
+use crate::SERVER_MANAGER;
+
+/// Maximum number of entries read from a journal while it is locked
+const MAX_BATCH: usize = 100;
+/// Interval a heartbeat is sent on an idle stream. This is also how a stream notices that its
+/// subscriber has gone away.
+const HEARTBEAT_INTERVAL: Duration = Duration::from_secs(15);
+/// Interval the global stream checks for mock servers that have been started or shut down
+const REFRESH_INTERVAL: Duration = Duration::from_secs(1);
+
+/// Format of an event stream
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub(crate) enum EventFormat {
+  /// `text/event-stream`, with the cursor sent as the event ID
+  ServerSentEvents,
+  /// `application/x-ndjson`, one JSON event per line
+  NdJson
+}
+
+impl EventFormat {
+  /// Server-sent events are used if the request accepts `text/event-stream` or has a
+  /// `format=sse` query parameter, otherwise newline delimited JSON is used
+  pub(crate) fn from_request(req: &Request<Body>, query: &HashMap<String, String>) -> EventFormat {
+    let accepts_sse = req.headers().get(hyper::header::ACCEPT)
+      .and_then(|accept| accept.to_str().ok())
+      .map(|accept| accept.contains("text/event-stream"))
+      .unwrap_or(false);
+    if accepts_sse || query.get("format").map(|f| f == "sse").unwrap_or(false) {
+      EventFormat::ServerSentEvents
+    } else {
+      EventFormat::NdJson
+    }
+  }
+
+  fn content_type(&self) -> &'static str {
+    match self {
+      EventFormat::ServerSentEvents => "text/event-stream",
+      EventFormat::NdJson => "application/x-ndjson"
+    }
+  }
+
+  fn render(&self, event: &Value, cursor: &str) -> Bytes {
+    match self {
+      EventFormat::ServerSentEvents => Bytes::from(format!("id: {}\ndata: {}\n\n", cursor, event)),
+      EventFormat::NdJson => Bytes::from(format!("{}\n", event))
+    }
+  }
+
+  fn heartbeat(&self) -> Bytes {
+    match self {
+      EventFormat::ServerSentEvents => Bytes::from_static(b": keep-alive\n\n"),
+      EventFormat::NdJson => Bytes::from_static(b"\n")
+    }
+  }
+}
+
+/// Journal of a mock server that events are streamed from
+struct EventSource {
+  id: String,
+  port: u16,
+  journal: Arc<Mutex<MatchJournal>>
+}
+
+impl EventSource {
+  /// Reads the next batch of events after the cursor, returning the sequence number of each one
+  fn next_batch(&self, cursor: u64) -> Vec<(u64, Value)> {
+    let journal = self.journal.lock().unwrap();
+    journal.entries_since(cursor).iter()
+      .take(MAX_BATCH)
+      .map(|entry| {
+        let mut event = entry.to_json();
+        if let Value::Object(map) = &mut event {
+          map.insert("server".to_string(), json!(self.id));
+          map.insert("port".to_string(), json!(self.port));
+        }
+        (entry.sequence, event)
+      })
+      .collect()
+  }
+}
+
+/// Starts a stream of the events for the mock server with the given ID or port. The stream
+/// resumes after the sequence number given with the `since` query parameter or the
+/// `Last-Event-ID` header, otherwise it starts with the first entry in the journal.
+pub(crate) async fn mock_server_events(
+  id: &str,
+  req: &Request<Body>,
+  query: &HashMap<String, String>
+) -> Response<Body> {
+  let format = EventFormat::from_request(req, query);
+  let since = resume_cursor(req, query)
+    .and_then(|cursor| cursor.parse::<u64>().ok())
+    .unwrap_or(0);
+  let source = with_mock_server(id, &|ms| EventSource {
+    id: ms.id.clone(),
+    port: ms.port.unwrap_or_default(),
+    journal: ms.journal()
+  });
+  match source {
+    Some(source) => {
+      debug!("Streaming events for mock server {} from sequence {}", source.id, since);
+      let (sender, body) = Body::channel();
+      tokio::spawn(stream_mock_server_events(source, since, format, sender));
+      stream_response(format, body)
+    }
+    None => json_response(404, json!({ "error": format!("No mock server found with ID or port '{}'", id) }))
+  }
+}
+
+/// Starts a stream of the events for all the mock servers. As each mock server has its own
+/// sequence numbers, the cursor is a comma separated list of `<mock server id>:<sequence>` pairs.
+/// Mock servers that are not in the cursor stream from the first entry in their journal.
+pub(crate) async fn all_events(req: &Request<Body>, query: &HashMap<String, String>) -> Response<Body> {
+  let format = EventFormat::from_request(req, query);
+  let cursors = resume_cursor(req, query)
+    .map(|cursor| parse_cursors(cursor.as_str()))
+    .unwrap_or_default();
+  debug!("Streaming events for all mock servers from {:?}", cursors);
+  let (sender, body) = Body::channel();
+  tokio::spawn(stream_all_events(cursors, format, sender));
+  stream_response(format, body)
+}
+
+fn stream_response(format: EventFormat, body: Body) -> Response<Body> {
+  Response::builder()
+    .status(200)
+    .header(hyper::header::CONTENT_TYPE, format.content_type())
+    .header(hyper::header::CACHE_CONTROL, "no-cache")
+    .body(body)
+    .unwrap()
+}
+
+fn resume_cursor(req: &Request<Body>, query: &HashMap<String, String>) -> Option<String> {
+  query.get("since").cloned()
+    .or_else(|| req.headers().get("last-event-id")
+      .and_then(|id| id.to_str().ok())
+      .map(|id| id.to_string()))
+}
+
+fn parse_cursors(cursor: &str) -> HashMap<String, u64> {
+  cursor.split(',')
+    .filter_map(|pair| pair.trim().rsplit_once(':'))
+    .filter_map(|(id, sequence)| sequence.parse::<u64>().ok().map(|sequence| (id.to_string(), sequence)))
+    .collect()
+}
+
+fn format_cursors(cursors: &HashMap<String, u64>) -> String {
+  let mut pairs: Vec<String> = cursors.iter()
+    .map(|(id, sequence)| format!("{}:{}", id, sequence))
+    .collect();
+  pairs.sort();
+  pairs.join(",")
+}
+
+async fn stream_mock_server_events(source: EventSource, mut cursor: u64, format: EventFormat, mut sender: Sender) {
+  let mut receiver = source.journal.lock().unwrap().subscribe();
+  loop {
+    loop {
+      let batch = source.next_batch(cursor);
+      if batch.is_empty() {
+        break;
+      }
+      for (sequence, event) in batch {
+        cursor = sequence;
+        if sender.send_data(format.render(&event, cursor.to_string().as_str())).await.is_err() {
+          debug!("Subscriber for mock server {} events has gone away", source.id);
+          return;
+        }
+      }
+    }
+
+    match tokio::time::timeout(HEARTBEAT_INTERVAL, receiver.changed()).await {
+      Ok(Ok(())) => trace!("Journal for mock server {} has been appended to", source.id),
+      Ok(Err(_)) => return,
+      Err(_) => {
+        if with_mock_server(source.id.as_str(), &|_| ()).is_none() {
+          debug!("Mock server {} has been shut down, ending event stream", source.id);
+          return;
+        }
+        if sender.send_data(format.heartbeat()).await.is_err() {
+          debug!("Subscriber for mock server {} events has gone away", source.id);
+          return;
+        }
+      }
+    }
+  }
+}
+
+async fn stream_all_events(mut cursors: HashMap<String, u64>, format: EventFormat, mut sender: Sender) {
+  let mut last_sent = Instant::now();
+  loop {
+    let sources = SERVER_MANAGER.lock().unwrap().map_mock_servers(|ms| EventSource {
+      id: ms.id.clone(),
+      port: ms.port.unwrap_or_default(),
+      journal: ms.journal()
+    });
+    cursors.retain(|id, _| sources.iter().any(|source| &source.id == id));
+    let mut receivers: Vec<_> = sources.iter()
+      .map(|source| source.journal.lock().unwrap().subscribe())
+      .collect();
+
+    for source in &sources {
+      loop {
+        let cursor = cursors.get(&source.id).copied().unwrap_or_default();
+        let batch = source.next_batch(cursor);
+        if batch.is_empty() {
+          break;
+        }
+        for (sequence, event) in batch {
+          cursors.insert(source.id.clone(), sequence);
+          if sender.send_data(format.render(&event, format_cursors(&cursors).as_str())).await.is_err() {
+            debug!("Subscriber for mock server events has gone away");
+            return;
+          }
+          last_sent = Instant::now();
+        }
+      }
+    }
+
+    if receivers.is_empty() {
+      tokio::time::sleep(REFRESH_INTERVAL).await;
+    } else {
+      let changes = receivers.iter_mut().map(|receiver| Box::pin(receiver.changed()));
+      let _ = tokio::time::timeout(REFRESH_INTERVAL, select_all(changes)).await;
+    }
+
+    if last_sent.elapsed() >= HEARTBEAT_INTERVAL {
+      if sender.send_data(format.heartbeat()).await.is_err() {
+        debug!("Subscriber for mock server events has gone away");
+        return;
+      }
+      last_sent = Instant::now();
+    }
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use expectest::prelude::*;
+  use maplit::hashmap;
+
+  use super::*;
+
+  #[test]
+  fn cursors_can_be_round_tripped() {
+    let cursors = hashmap!{ "a".to_string() => 2, "b".to_string() => 10 };
+    expect!(format_cursors(&cursors)).to(be_equal_to("a:2,b:10"));
+    expect!(parse_cursors("a:2,b:10")).to(be_equal_to(cursors));
+    expect!(parse_cursors("a:2,b,c:x").len()).to(be_equal_to(1));
+  }
+
+  #[test]
+  fn event_format_defaults_to_ndjson() {
+    let request = Request::get("/events").body(Body::empty()).unwrap();
+    expect!(EventFormat::from_request(&request, &hashmap!{})).to(be_equal_to(EventFormat::NdJson));
+
+    let request = Request::get("/events")
+      .header("accept", "text/event-stream")
+      .body(Body::empty())
+      .unwrap();
+    expect!(EventFormat::from_request(&request, &hashmap!{})).to(be_equal_to(EventFormat::ServerSentEvents));
+    let sse = hashmap!{ "format".to_string() => "sse".to_string() };
+    let request = Request::get("/events").body(Body::empty()).unwrap();
+    expect!(EventFormat::from_request(&request, &sse)).to(be_equal_to(EventFormat::ServerSentEvents));
+  }
+}
@@ -0,0 +1,155 @@
+//!
+//! Reads match journal exports (written by `POST /mockserver/:id/export`), either summarising
+//! them or converting them to JSON lines.
+//!
+
+use std::collections::{BTreeMap, HashMap};
+use std::fs::File;
+use std::io::{self, BufWriter, Write};
+
+use clap::ArgMatches;
+
+use pact_mock_server::journal_export::{EntryKind, ExportedEntry, JournalExportReader};
+
+use crate::handle_error;
+
+/// Maximum number of distinct request paths tracked for the summary, so summarising an export
+/// uses bounded memory
+const MAX_SUMMARY_PATHS: usize = 10000;
+/// Number of paths displayed in the summary
+const TOP_PATHS: usize = 10;
+
+#[derive(Debug, Default)]
+struct Summary {
+  entries: usize,
+  first_sequence: Option<u64>,
+  last_sequence: Option<u64>,
+  kinds: BTreeMap<String, usize>,
+  sessions: HashMap<String, usize>,
+  interactions: BTreeMap<usize, usize>,
+  mismatched_paths: HashMap<String, usize>,
+  other_paths: usize
+}
+
+impl Summary {
+  fn add(&mut self, entry: &ExportedEntry) {
+    self.entries += 1;
+    self.first_sequence.get_or_insert(entry.sequence);
+    self.last_sequence = Some(entry.sequence);
+    *self.kinds.entry(entry.kind.to_string()).or_default() += 1;
+    if let Some(session) = &entry.session {
+      if let Some(count) = self.sessions.get_mut(session) {
+        *count += 1;
+      } else if self.sessions.len() < MAX_SUMMARY_PATHS {
+        self.sessions.insert(session.clone(), 1);
+      }
+    }
+    if let Some(interaction) = entry.interaction {
+      *self.interactions.entry(interaction).or_default() += 1;
+    }
+    if entry.kind != EntryKind::Matched && entry.kind != EntryKind::Proxied {
+      let key = format!("{} {}", entry.request.method, entry.request.path);
+      if let Some(count) = self.mismatched_paths.get_mut(&key) {
+        *count += 1;
+      } else if self.mismatched_paths.len() < MAX_SUMMARY_PATHS {
+        self.mismatched_paths.insert(key, 1);
+      } else {
+        self.other_paths += 1;
+      }
+    }
+  }
+
+  fn display(&self, file: &str, compressed: bool) {
+    println!("Journal export {}{}", file, if compressed { " (compressed)" } else { "" });
+    println!("  Entries:   {}", self.entries);
+    if let (Some(first), Some(last)) = (self.first_sequence, self.last_sequence) {
+      println!("  Sequences: {} - {}", first, last);
+    }
+    println!("  Sessions:  {}", self.sessions.len());
+    println!();
+    println!("Results:");
+    for (kind, count) in &self.kinds {
+      println!("  {:20} {}", kind, count);
+    }
+    if !self.interactions.is_empty() {
+      println!();
+      println!("Requests per interaction:");
+      for (interaction, count) in &self.interactions {
+        println!("  {:5} {}", interaction, count);
+      }
+    }
+    if !self.mismatched_paths.is_empty() {
+      let mut paths: Vec<(&String, &usize)> = self.mismatched_paths.iter().collect();
+      paths.sort_by(|a, b| b.1.cmp(a.1).then_with(|| a.0.cmp(b.0)));
+      println!();
+      println!("Top mismatched requests:");
+      for (path, count) in paths.iter().take(TOP_PATHS) {
+        println!("  {:8} {}", count, path);
+      }
+      if self.other_paths > 0 {
+        println!("  {:8} <other requests>", self.other_paths);
+      }
+    }
+  }
+}
+
+/// Reads the journal export given on the command line, either displaying a summary or writing
+/// each entry as a line of JSON to standard out
+pub fn read_journal_export(args: &ArgMatches) -> Result<(), i32> {
+  let file_name = args.get_one::<String>("file").unwrap();
+  let file = File::open(file_name)
+    .map_err(|err| handle_error(format!("Failed to open journal export '{}' - {}", file_name, err).as_str()))?;
+  let reader = JournalExportReader::new(file)
+    .map_err(|err| handle_error(format!("Failed to read journal export '{}' - {}", file_name, err).as_str()))?;
+  let compressed = reader.compressed();
+
+  if args.get_flag("json") {
+    let stdout = io::stdout();
+    let mut out = BufWriter::new(stdout.lock());
+    for entry in reader {
+      let entry = entry.map_err(|err| handle_error(err.to_string().as_str()))?;
+      if writeln!(out, "{}", entry.to_json()).is_err() {
+        return Err(1);
+      }
+    }
+    out.flush().map_err(|_| 1)
+  } else {
+    let mut summary = Summary::default();
+    for entry in reader {
+      let entry = entry.map_err(|err| handle_error(err.to_string().as_str()))?;
+      summary.add(&entry);
+    }
+    summary.display(file_name, compressed);
+    Ok(())
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use expectest::prelude::*;
+  use pact_models::v4::http_parts::HttpRequest;
+
+  use super::*;
+
+  #[test]
+  fn summary_counts_the_entries() {
+    let mut summary = Summary::default();
+    let entry = ExportedEntry {
+      sequence: 4,
+      session: Some("a".to_string()),
+      kind: EntryKind::NotFound,
+      interaction: None,
+      request: HttpRequest { path: "/unexpected".to_string(), .. HttpRequest::default() },
+      mismatches: vec![]
+    };
+    summary.add(&entry);
+    summary.add(&ExportedEntry { sequence: 5, kind: EntryKind::Matched, interaction: Some(0), .. entry.clone() });
+
+    expect!(summary.entries).to(be_equal_to(2));
+    expect!(summary.first_sequence).to(be_some().value(4));
+    expect!(summary.last_sequence).to(be_some().value(5));
+    expect!(summary.sessions.get("a").cloned()).to(be_some().value(2));
+    expect!(summary.interactions.get(&0).cloned()).to(be_some().value(1));
+    expect!(summary.mismatched_paths.get("GET /unexpected").cloned()).to(be_some().value(1));
+  }
+}
@@ -43,6 +43,13 @@ mod create_mock;
 mod list;
 mod verify;
 mod shutdown;
+mod reaper;
+mod async_api;
+mod events;
+mod journal;
+mod replay;
+mod state;
+mod cluster;
 
 fn print_version() {
     println!("pact mock server version  : v{}", clap::crate_version!());
@@ -101,14 +108,17 @@ async fn main() {
 pub(crate) struct ServerOpts {
   pub output_path: Option<String>,
   pub base_port: Option<u16>,
-  pub server_key: String
+  pub server_key: String,
+  /// If mock servers can proxy to hosts other than the loopback interface
+  pub allow_remote_proxy: bool
 }
 
 lazy_static!{
   pub(crate) static ref SERVER_OPTIONS: Mutex<RefCell<ServerOpts>> = Mutex::new(RefCell::new(ServerOpts {
     output_path: None,
     base_port: None,
-    server_key: String::default()
+    server_key: String::default(),
+    allow_remote_proxy: false
   }));
   pub(crate) static ref SERVER_MANAGER: Mutex<ServerManager> = Mutex::new(ServerManager::new());
 }
@@ -155,6 +165,20 @@ async fn handle_command_args() -> Result<(), i32> {
             options.output_path = output_path;
             options.base_port = base_port;
             options.server_key = server_key;
+            options.allow_remote_proxy = sub_matches.get_flag("allow-remote-proxy");
+          }
+          if let Some(state_file) = sub_matches.get_one::<String>("state-file") {
+            if let Err(err) = state::restore_and_open(state_file).await {
+              return Err(handle_error(format!("Failed to restore from state file '{}' - {}", state_file, err).as_str()));
+            }
+          }
+          if let Some(peers) = sub_matches.get_many::<String>("peers") {
+            let peers: Vec<String> = peers.cloned().collect();
+            let node_url = sub_matches.get_one::<String>("node-url").cloned()
+              .unwrap_or_else(|| format!("http://{}:{}", host, port));
+            if let Err(err) = cluster::configure(node_url.as_str(), &peers) {
+              return Err(handle_error(format!("Failed to configure the cluster - {}", err).as_str()));
+            }
           }
           server::start_server(port).await
         },
@@ -163,6 +187,8 @@ async fn handle_command_args() -> Result<(), i32> {
         Some(("verify", sub_matches)) => verify::verify_mock_server(host, port, sub_matches, usage.as_str()).await,
         Some(("shutdown", sub_matches)) => shutdown::shutdown_mock_server(host, port, sub_matches, usage.as_str()).await,
         Some(("shutdown-master", sub_matches)) => shutdown::shutdown_master_server(host, port, sub_matches, usage.as_str()).await,
+        Some(("journal", sub_matches)) => journal::read_journal_export(sub_matches),
+        Some(("replay", sub_matches)) => replay::replay_requests(sub_matches).await,
         _ => Err(3)
       }
     },
@@ -273,6 +299,24 @@ fn setup_args() -> Command {
         .long("server-key")
         .action(ArgAction::Set)
         .help("the server key to use to authenticate shutdown requests (defaults to a random generated one)"))
+      .arg(Arg::new("state-file")
+        .long("state-file")
+        .action(ArgAction::Set)
+        .help("file to persist the state of the mock servers to, so they can be restored when the master server is restarted"))
+      .arg(Arg::new("node-url")
+        .long("node-url")
+        .action(ArgAction::Set)
+        .requires("peers")
+        .help("the URL the other master servers in the cluster use for this one (defaults to http://<host>:<port>)"))
+      .arg(Arg::new("peers")
+        .long("peers")
+        .action(ArgAction::Set)
+        .value_delimiter(',')
+        .help("comma separated URLs of the other master servers in the cluster. Mock servers are placed on the master servers by consistent hashing of their IDs"))
+      .arg(Arg::new("allow-remote-proxy")
+        .long("allow-remote-proxy")
+        .action(ArgAction::SetTrue)
+        .help("allow mock servers to proxy unexpected requests to hosts other than localhost"))
       )
     .subcommand(Command::new("list")
       .about("Lists all the running mock servers")
@@ -331,6 +375,57 @@ fn setup_args() -> Command {
         .help("the period of time in milliseconds to allow the server to shutdown (defaults to 100ms)")
         .value_parser(integer_value))
       )
+    .subcommand(Command::new("journal")
+      .about("Reads a match journal export, displaying a summary or converting it to JSON lines")
+      .version(clap::crate_version!())
+      .arg(Arg::new("file")
+        .action(ArgAction::Set)
+        .required(true)
+        .help("the journal export file to read"))
+      .arg(Arg::new("json")
+        .long("json")
+        .action(ArgAction::SetTrue)
+        .help("write each entry as a line of JSON instead of displaying a summary"))
+      )
+    .subcommand(Command::new("replay")
+      .about("Replays the requests from a capture file or pact file against a mock server, reporting the throughput and latencies")
+      .version(clap::crate_version!())
+      .arg(Arg::new("file")
+        .short('f')
+        .long("file")
+        .action(ArgAction::Set)
+        .required(true)
+        .help("the capture file or pact file to replay the requests from"))
+      .arg(Arg::new("url")
+        .short('u')
+        .long("url")
+        .action(ArgAction::Set)
+        .required(true)
+        .help("the base URL of the mock server to send the requests to"))
+      .arg(Arg::new("timing")
+        .long("timing")
+        .action(ArgAction::Set)
+        .default_value("original")
+        .value_parser(["original", "max"])
+        .help("send the requests with their original timing, or as fast as possible"))
+      .arg(Arg::new("rate")
+        .long("rate")
+        .action(ArgAction::Set)
+        .value_parser(clap::value_parser!(f64))
+        .help("multiplier applied to the original request rate (defaults to 1.0)"))
+      .arg(Arg::new("connections")
+        .short('c')
+        .long("connections")
+        .action(ArgAction::Set)
+        .value_parser(clap::value_parser!(usize))
+        .help("the number of concurrent connections to use (defaults to 1)"))
+      .arg(Arg::new("iterations")
+        .short('n')
+        .long("iterations")
+        .action(ArgAction::Set)
+        .value_parser(clap::value_parser!(usize))
+        .help("the number of times to send the requests from a pact file (defaults to 1)"))
+      )
 }
 
 #[cfg(test)]
@@ -0,0 +1,244 @@
+//!
+//! Background reaper that shuts down mock servers that have been idle for longer than their TTL.
+//!
+
+use std::cmp::Reverse;
+use std::collections::{BinaryHeap, HashMap};
+use std::sync::{Condvar, Mutex, Once};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use lazy_static::lazy_static;
+use tracing::{debug, error, info, warn};
+
+use crate::{SERVER_MANAGER, SERVER_OPTIONS};
+use crate::state::STATE_LOG;
+
+#[derive(Debug, Clone)]
+struct ReaperEntry {
+  ttl: Duration,
+  write_pact: bool
+}
+
+#[derive(Debug, Default)]
+struct ReaperState {
+  /// Mock server IDs ordered by when they are next due to be checked
+  deadlines: BinaryHeap<Reverse<(Instant, String)>>,
+  servers: HashMap<String, ReaperEntry>
+}
+
+impl ReaperState {
+  fn register(&mut self, id: String, entry: ReaperEntry, now: Instant) {
+    self.deadlines.push(Reverse((now + entry.ttl, id.clone())));
+    self.servers.insert(id, entry);
+  }
+
+  /// Removes the mock server. Its deadline is left in the heap, and is skipped when reached.
+  fn deregister(&mut self, id: &str) -> bool {
+    self.servers.remove(id).is_some()
+  }
+
+  fn next_deadline(&self) -> Option<Instant> {
+    self.deadlines.peek().map(|Reverse((deadline, _))| *deadline)
+  }
+
+  /// Pops the next deadline if it has been reached, returning the mock server it is for (if it is
+  /// still registered)
+  fn pop_due(&mut self, now: Instant) -> Option<Option<(String, ReaperEntry)>> {
+    match self.next_deadline() {
+      Some(deadline) if deadline <= now => self.deadlines.pop()
+        .map(|Reverse((_, id))| self.servers.get(&id).map(|entry| (id.clone(), entry.clone()))),
+      _ => None
+    }
+  }
+
+  /// Checks a mock server whose deadline has been reached against its last activity (or `None` if
+  /// the mock server no longer exists). Returns true if the mock server has expired and should be
+  /// shut down, otherwise it is scheduled again for when it will next expire.
+  fn check(&mut self, id: String, entry: &ReaperEntry, last_activity: Option<Instant>, now: Instant) -> bool {
+    match last_activity {
+      Some(last_activity) if last_activity + entry.ttl > now => {
+        self.deadlines.push(Reverse((last_activity + entry.ttl, id)));
+        false
+      }
+      Some(_) => {
+        self.servers.remove(&id);
+        true
+      }
+      None => {
+        debug!("Mock server {} has already been shut down", id);
+        self.servers.remove(&id);
+        false
+      }
+    }
+  }
+}
+
+/// Tracks the mock servers created with a TTL. Expiry is tracked with a min-heap of deadlines, and
+/// the deadline is only checked against the last activity of the mock server when it is reached,
+/// so requests to the mock server never need to touch the reaper.
+pub(crate) struct Reaper {
+  state: Mutex<ReaperState>,
+  condvar: Condvar,
+  started: Once
+}
+
+lazy_static! {
+  pub(crate) static ref REAPER: Reaper = Reaper {
+    state: Mutex::new(ReaperState::default()),
+    condvar: Condvar::new(),
+    started: Once::new()
+  };
+}
+
+impl Reaper {
+  /// Registers a mock server to be shut down once it has been idle for the TTL. If `write_pact` is
+  /// set, the pact file will be written for the mock server if it has matched all its requests.
+  pub(crate) fn register(&'static self, id: String, ttl: Duration, write_pact: bool) {
+    self.started.call_once(|| {
+      if let Err(err) = thread::Builder::new()
+        .name("mock-server-reaper".to_string())
+        .spawn(move || self.run()) {
+        error!("Failed to start the mock server reaper thread - {}", err);
+      }
+    });
+
+    debug!("Mock server {} will be shut down after being idle for {:?}", id, ttl);
+    self.state.lock().unwrap().register(id, ReaperEntry { ttl, write_pact }, Instant::now());
+    self.condvar.notify_one();
+  }
+
+  /// Deregisters a mock server that has been shut down
+  pub(crate) fn deregister(&self, id: &str) {
+    if self.state.lock().unwrap().deregister(id) {
+      debug!("Mock server {} has been deregistered from the reaper", id);
+    }
+  }
+
+  fn run(&self) {
+    loop {
+      let (id, entry) = self.next_due();
+      let last_activity = SERVER_MANAGER.lock().unwrap()
+        .find_mock_server_by_id(&id, &|_, ms| ms.left().map(|ms| ms.last_activity()))
+        .flatten();
+      let expired = self.state.lock().unwrap().check(id.clone(), &entry, last_activity, Instant::now());
+      if expired {
+        reap(&id, &entry);
+      }
+    }
+  }
+
+  /// Blocks until the next deadline is reached, returning the mock server it is for
+  fn next_due(&self) -> (String, ReaperEntry) {
+    let mut state = self.state.lock().unwrap();
+    loop {
+      let now = Instant::now();
+      match state.next_deadline() {
+        None => state = self.condvar.wait(state).unwrap(),
+        Some(deadline) if deadline > now => {
+          state = self.condvar.wait_timeout(state, deadline - now).unwrap().0;
+        }
+        Some(_) => if let Some(Some(due)) = state.pop_due(now) {
+          return due;
+        }
+      }
+    }
+  }
+}
+
+fn reap(id: &String, entry: &ReaperEntry) {
+  info!("Mock server {} has been idle for longer than {:?}, shutting it down", id, entry.ttl);
+  let mut manager = SERVER_MANAGER.lock().unwrap();
+
+  if entry.write_pact {
+    let output_path = SERVER_OPTIONS.lock().unwrap().borrow().output_path.clone();
+    let result = manager.find_mock_server_by_id(id, &|_, ms| {
+      match ms.left() {
+        Some(ms) if ms.all_matched() => ms.write_pact(&output_path, false)
+          .map_err(|err| err.to_string()),
+        Some(_) => Err("the mock server has mismatches".to_string()),
+        None => Err("plugin mock servers are not supported".to_string())
+      }
+    });
+    if let Some(Err(err)) = result {
+      warn!("Not writing pact file for expired mock server {} - {}", id, err);
+    }
+  }
+
+  if manager.shutdown_mock_server_by_id(id.clone()) {
+    STATE_LOG.record_delete(id);
+  } else {
+    warn!("Failed to shut down expired mock server {}", id);
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use expectest::prelude::*;
+
+  use super::*;
+
+  fn entry(ttl: u64) -> ReaperEntry {
+    ReaperEntry { ttl: Duration::from_secs(ttl), write_pact: false }
+  }
+
+  #[test]
+  fn mock_servers_are_due_in_order_of_expiry() {
+    let now = Instant::now();
+    let mut state = ReaperState::default();
+    state.register("a".to_string(), entry(30), now);
+    state.register("b".to_string(), entry(10), now);
+    state.register("c".to_string(), entry(20), now);
+
+    expect!(state.pop_due(now).is_none()).to(be_true());
+    let due = state.pop_due(now + Duration::from_secs(25)).flatten().map(|(id, _)| id);
+    expect!(due).to(be_some().value("b".to_string()));
+    let due = state.pop_due(now + Duration::from_secs(25)).flatten().map(|(id, _)| id);
+    expect!(due).to(be_some().value("c".to_string()));
+    expect!(state.pop_due(now + Duration::from_secs(25)).is_none()).to(be_true());
+    expect!(state.next_deadline()).to(be_some().value(now + Duration::from_secs(30)));
+  }
+
+  #[test]
+  fn activity_refreshes_the_ttl() {
+    let now = Instant::now();
+    let mut state = ReaperState::default();
+    state.register("a".to_string(), entry(10), now);
+
+    let deadline = now + Duration::from_secs(10);
+    let (id, due) = state.pop_due(deadline).flatten().unwrap();
+    let last_activity = now + Duration::from_secs(5);
+    expect!(state.check(id, &due, Some(last_activity), deadline)).to(be_false());
+    expect!(state.next_deadline()).to(be_some().value(last_activity + Duration::from_secs(10)));
+
+    let deadline = last_activity + Duration::from_secs(10);
+    let (id, due) = state.pop_due(deadline).flatten().unwrap();
+    expect!(state.check(id, &due, Some(last_activity), deadline)).to(be_true());
+    expect!(state.servers.is_empty()).to(be_true());
+  }
+
+  #[test]
+  fn deregistered_mock_servers_are_skipped() {
+    let now = Instant::now();
+    let mut state = ReaperState::default();
+    state.register("a".to_string(), entry(10), now);
+
+    expect!(state.deregister("a")).to(be_true());
+    expect!(state.deregister("a")).to(be_false());
+    expect!(state.pop_due(now + Duration::from_secs(10)).map(|due| due.is_none())).to(be_some().value(true));
+    expect!(state.next_deadline()).to(be_none());
+  }
+
+  #[test]
+  fn mock_servers_that_have_been_shut_down_are_not_reaped() {
+    let now = Instant::now();
+    let mut state = ReaperState::default();
+    state.register("a".to_string(), entry(10), now);
+
+    let deadline = now + Duration::from_secs(10);
+    let (id, due) = state.pop_due(deadline).flatten().unwrap();
+    expect!(state.check(id, &due, None, deadline)).to(be_false());
+    expect!(state.servers.is_empty()).to(be_true());
+    expect!(state.next_deadline()).to(be_none());
+  }
+}
@@ -0,0 +1,320 @@
+//!
+//! Replays the requests from a capture file (or the interactions from a pact file) against a mock
+//! server, reporting the throughput, latencies and match results.
+//!
+
+use std::fs::File;
+use std::path::Path;
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+use hyper::body::Bytes;
+use clap::ArgMatches;
+use pact_models::bodies::OptionalBody;
+use pact_models::pact::read_pact;
+use pact_models::v4::http_parts::HttpRequest;
+use reqwest::Method;
+use tokio::sync::{mpsc, Mutex};
+use tracing::{debug, error, info, warn};
+
+use pact_mock_server::capture::{CaptureReader, CapturedRequest, is_capture_file};
+
+use crate::handle_error;
+
+/// Headers that are set by the HTTP client, and are not replayed
+const SKIPPED_HEADERS: [&str; 4] = ["host", "content-length", "connection", "transfer-encoding"];
+
+/// How the requests are paced
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Timing {
+  /// With the original gaps between the requests, divided by the rate multiplier
+  Original(f64),
+  /// As fast as possible
+  Max
+}
+
+/// Result of replaying a single request
+#[derive(Debug, Clone, Copy, PartialEq)]
+enum Outcome {
+  Matched,
+  Mismatched,
+  Error
+}
+
+#[derive(Debug, Default)]
+struct Report {
+  latencies: Vec<Duration>,
+  matched: usize,
+  mismatched: usize,
+  errors: usize
+}
+
+impl Report {
+  fn add(&mut self, outcome: Outcome, latency: Duration) {
+    match outcome {
+      Outcome::Matched => self.matched += 1,
+      Outcome::Mismatched => self.mismatched += 1,
+      Outcome::Error => self.errors += 1
+    }
+    self.latencies.push(latency);
+  }
+
+  fn merge(&mut self, other: Report) {
+    self.latencies.extend(other.latencies);
+    self.matched += other.matched;
+    self.mismatched += other.mismatched;
+    self.errors += other.errors;
+  }
+
+  fn percentile(sorted: &[Duration], percentile: f64) -> Duration {
+    if sorted.is_empty() {
+      Duration::default()
+    } else {
+      let index = ((sorted.len() as f64 * percentile / 100.0).ceil() as usize).clamp(1, sorted.len()) - 1;
+      sorted[index]
+    }
+  }
+
+  fn display(&mut self, elapsed: Duration, connections: usize) {
+    let total = self.latencies.len();
+    let seconds = elapsed.as_secs_f64();
+    let throughput = if seconds > 0.0 { total as f64 / seconds } else { 0.0 };
+    println!("Replayed {} requests in {:.3}s ({:.1} requests/second) using {} connections",
+      total, seconds, throughput, connections);
+    println!("  Matched:    {}", self.matched);
+    println!("  Mismatched: {}", self.mismatched);
+    println!("  Errors:     {}", self.errors);
+
+    self.latencies.sort();
+    let ms = |duration: Duration| duration.as_secs_f64() * 1000.0;
+    println!("Latency (ms): p50 {:.2}, p90 {:.2}, p99 {:.2}, max {:.2}",
+      ms(Report::percentile(&self.latencies, 50.0)),
+      ms(Report::percentile(&self.latencies, 90.0)),
+      ms(Report::percentile(&self.latencies, 99.0)),
+      ms(self.latencies.last().cloned().unwrap_or_default()));
+  }
+}
+
+/// Replays the requests from the file given on the command line against the mock server
+pub async fn replay_requests(matches: &ArgMatches) -> Result<(), i32> {
+  let file = matches.get_one::<String>("file").unwrap().clone();
+  let url = matches.get_one::<String>("url").unwrap().trim_end_matches('/').to_string();
+  let connections = (*matches.get_one::<usize>("connections").unwrap_or(&1)).max(1);
+  let iterations = *matches.get_one::<usize>("iterations").unwrap_or(&1);
+  let timing = match matches.get_one::<String>("timing").map(|t| t.as_str()) {
+    Some("max") => Timing::Max,
+    _ => Timing::Original(*matches.get_one::<f64>("rate").unwrap_or(&1.0))
+  };
+
+  let requests = load_requests(&file, iterations)
+    .map_err(|err| handle_error(format!("Failed to read requests from '{}' - {}", file, err).as_str()))?;
+  info!("Replaying requests from {} against {} ({:?}, {} connections)", file, url, timing, connections);
+
+  let client = reqwest::Client::builder()
+    .pool_max_idle_per_host(connections)
+    .build()
+    .map_err(|err| handle_error(format!("Failed to create the HTTP client - {}", err).as_str()))?;
+
+  // Requests are read and paced on a separate thread, and handed to the workers over a bounded
+  // channel, so the capture file is never fully loaded into memory
+  let (sender, receiver) = mpsc::channel::<CapturedRequest>(connections * 2);
+  let producer = thread::spawn(move || pace_requests(requests, timing, sender));
+
+  let receiver = Arc::new(Mutex::new(receiver));
+  let start = Instant::now();
+  let workers: Vec<_> = (0..connections).map(|_| {
+    let client = client.clone();
+    let receiver = receiver.clone();
+    let url = url.clone();
+    tokio::spawn(async move {
+      let mut report = Report::default();
+      loop {
+        let request = receiver.lock().await.recv().await;
+        match request {
+          Some(request) => {
+            let sent = Instant::now();
+            let outcome = send_request(&client, &url, request).await;
+            report.add(outcome, sent.elapsed());
+          }
+          None => break
+        }
+      }
+      report
+    })
+  }).collect();
+
+  let mut report = Report::default();
+  for worker in workers {
+    match worker.await {
+      Ok(worker_report) => report.merge(worker_report),
+      Err(err) => error!("Replay worker failed - {}", err)
+    }
+  }
+  let elapsed = start.elapsed();
+
+  match producer.join() {
+    Ok(Ok(())) => {}
+    Ok(Err(err)) => warn!("Failed to read all the requests - {}", err),
+    Err(_) => error!("Request reader thread panicked")
+  }
+
+  report.display(elapsed, connections);
+  Ok(())
+}
+
+type RequestIterator = Box<dyn Iterator<Item = anyhow::Result<CapturedRequest>> + Send>;
+
+/// Loads the requests from either a capture file or a pact file (repeating the interactions of
+/// the pact for the number of iterations)
+fn load_requests(file: &str, iterations: usize) -> anyhow::Result<RequestIterator> {
+  if is_capture_file(File::open(file)?) {
+    debug!("Reading requests from capture file {}", file);
+    Ok(Box::new(CaptureReader::new(File::open(file)?)?))
+  } else {
+    debug!("Reading requests from pact file {}", file);
+    let pact = read_pact(Path::new(file))?;
+    let requests: Vec<CapturedRequest> = pact.interactions().iter()
+      .filter_map(|interaction| interaction.as_v4_http())
+      .map(|interaction| pact_request_to_captured_request(&interaction.request))
+      .collect();
+    Ok(Box::new((0..iterations).flat_map(move |_| requests.clone().into_iter().map(Ok))))
+  }
+}
+
+fn pact_request_to_captured_request(request: &HttpRequest) -> CapturedRequest {
+  let query = request.query.as_ref().map(|query| {
+    let mut serializer = url::form_urlencoded::Serializer::new(String::new());
+    for (key, values) in query {
+      for value in values {
+        match value {
+          Some(value) => serializer.append_pair(key, value),
+          None => serializer.append_key_only(key)
+        };
+      }
+    }
+    serializer.finish()
+  });
+  let headers = request.headers.as_ref()
+    .map(|headers| headers.iter()
+      .flat_map(|(name, values)| values.iter().map(move |value| (name.clone(), value.clone())))
+      .collect())
+    .unwrap_or_default();
+  let body = match &request.body {
+    OptionalBody::Present(body, _, _) => body.clone(),
+    _ => Bytes::new()
+  };
+  CapturedRequest {
+    timestamp: 0,
+    session: None,
+    method: request.method.clone(),
+    path: request.path.clone(),
+    query,
+    headers,
+    body
+  }
+}
+
+/// Sends the requests to the workers, waiting until each one is due
+fn pace_requests(
+  requests: RequestIterator,
+  timing: Timing,
+  sender: mpsc::Sender<CapturedRequest>
+) -> anyhow::Result<()> {
+  let start = Instant::now();
+  let mut first_timestamp = None;
+  for request in requests {
+    let request = request?;
+    if let Timing::Original(rate) = timing {
+      let first = *first_timestamp.get_or_insert(request.timestamp);
+      let offset = Duration::from_micros(request.timestamp.saturating_sub(first));
+      let due = start + offset.div_f64(rate.max(0.001));
+      let now = Instant::now();
+      if due > now {
+        thread::sleep(due - now);
+      }
+    }
+    if sender.blocking_send(request).is_err() {
+      break;
+    }
+  }
+  Ok(())
+}
+
+async fn send_request(client: &reqwest::Client, url: &str, request: CapturedRequest) -> Outcome {
+  let method = match Method::from_bytes(request.method.as_bytes()) {
+    Ok(method) => method,
+    Err(err) => {
+      warn!("Request has an invalid method '{}' - {}", request.method, err);
+      return Outcome::Error;
+    }
+  };
+  let url = match &request.query {
+    Some(query) => format!("{}{}?{}", url, request.path, query),
+    None => format!("{}{}", url, request.path)
+  };
+
+  let mut builder = client.request(method, url);
+  for (name, value) in &request.headers {
+    if !SKIPPED_HEADERS.contains(&name.to_lowercase().as_str()) {
+      builder = builder.header(name.as_str(), value.as_str());
+    }
+  }
+  if let Some(session) = &request.session {
+    builder = builder.header("X-Pact-Session", session.as_str());
+  }
+  if !request.body.is_empty() {
+    builder = builder.body(request.body);
+  }
+
+  match builder.send().await {
+    Ok(response) => {
+      let mismatched = response.headers().contains_key("x-pact");
+      // Read the body so the connection can be reused
+      match response.bytes().await {
+        Ok(_) if mismatched => Outcome::Mismatched,
+        Ok(_) => Outcome::Matched,
+        Err(err) => {
+          debug!("Failed to read the response body - {}", err);
+          Outcome::Error
+        }
+      }
+    }
+    Err(err) => {
+      debug!("Request failed - {}", err);
+      Outcome::Error
+    }
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use expectest::prelude::*;
+  use maplit::hashmap;
+
+  use super::*;
+
+  #[test]
+  fn percentiles_are_taken_from_the_sorted_latencies() {
+    let latencies: Vec<Duration> = (1..=100).map(Duration::from_millis).collect();
+    expect!(Report::percentile(&latencies, 50.0)).to(be_equal_to(Duration::from_millis(50)));
+    expect!(Report::percentile(&latencies, 99.0)).to(be_equal_to(Duration::from_millis(99)));
+    expect!(Report::percentile(&[], 99.0)).to(be_equal_to(Duration::default()));
+  }
+
+  #[test]
+  fn pact_requests_are_converted_to_captured_requests() {
+    let request = HttpRequest {
+      method: "POST".to_string(),
+      path: "/test".to_string(),
+      query: Some(hashmap!{ "a".to_string() => vec![Some("1 2".to_string())] }),
+      headers: Some(hashmap!{ "x-test".to_string() => vec!["a".to_string(), "b".to_string()] }),
+      body: OptionalBody::Present("body".into(), None, None),
+      .. HttpRequest::default()
+    };
+    let captured = pact_request_to_captured_request(&request);
+    expect!(captured.query).to(be_some().value("a=1+2"));
+    expect!(captured.headers.len()).to(be_equal_to(2));
+    expect!(captured.body).to(be_equal_to(Bytes::from("body")));
+  }
+}
@@ -1,38 +1,89 @@
 use std::{
   net::TcpListener,
   process,
-  sync::mpsc,
+  sync::{Arc, mpsc, Mutex},
   thread,
   time::Duration
 };
+use std::collections::HashMap;
 use std::convert::Infallible;
+use std::fs::File;
 use std::net::{IpAddr, SocketAddr};
+use std::path::{Component, Path, PathBuf};
+use std::time::Instant;
 
+use anyhow::anyhow;
 use futures::channel::oneshot::channel;
+use hyper::{Body, Request};
 use hyper::server::Server;
-use hyper::service::make_service_fn;
+use hyper::service::{make_service_fn, service_fn};
 use itertools::Either;
 use maplit::*;
-use pact_models::pact::load_pact_from_json;
+use pact_models::pact::{load_pact_from_json, Pact};
 use pact_models::PactSpecification;
 use serde_json::{self, json, Value};
 use tracing::{debug, error, info, trace};
+use url::{Host, Url};
 use uuid::Uuid;
 use webmachine_rust::*;
 use webmachine_rust::context::*;
 use webmachine_rust::headers::*;
 
+use pact_mock_server::journal::MatchJournal;
+use pact_mock_server::journal_export::{export_journal, import_journal, JournalExportWriter};
 use pact_mock_server::mock_server::{MockServer, MockServerConfig};
+use pact_mock_server::server_manager::{MockServerStart, ServerManager, ShutdownReport, ShutdownSelector};
+use pact_mock_server::snapshot::{MockServerSnapshot, SnapshotReader, write_snapshot};
 #[cfg(feature = "tls")] use pact_mock_server::tls::TlsConfigBuilder;
 
 use crate::{SERVER_MANAGER, SERVER_OPTIONS, ServerOpts};
+use crate::async_api::{async_route, handle_async_route};
+use crate::cluster::{self, FORWARDED_HEADER, MOCK_SERVER_ID_HEADER};
+use crate::reaper::REAPER;
+use crate::state::{ServerState, STATE_LOG};
 use crate::verify;
 
+/// Default time to wait for mock servers to stop when shutting down a group of them
+const DEFAULT_SHUTDOWN_DEADLINE: Duration = Duration::from_secs(5);
+
 fn json_error(error: String) -> String {
     let json_response = json!({ "error" : json!(error) });
     json_response.to_string()
 }
 
+/// Resolves a file given in a request against the output directory. The file must be a relative
+/// path that stays within the output directory, so absolute paths and paths with `..` are rejected.
+fn output_file(output_path: &Option<String>, file: &str) -> Result<PathBuf, String> {
+  let relative = Path::new(file);
+  if file.is_empty() || !relative.components().all(|c| matches!(c, Component::Normal(_) | Component::CurDir)) {
+    return Err(format!("'{}' is not a relative path within the output directory", file));
+  }
+  let mut path = output_path.clone().map(PathBuf::from).unwrap_or_default();
+  path.push(relative);
+  Ok(path)
+}
+
+/// Checks the proxy URL given in a request. Mock servers can only proxy to the loopback interface,
+/// unless the master server was started with `--allow-remote-proxy`, so clients of the master
+/// server can not use it to send requests to any other host.
+fn proxy_url(url: &str, allow_remote: bool) -> Result<String, String> {
+  let parsed = Url::parse(url).map_err(|err| format!("'{}' is not a valid URL - {}", url, err))?;
+  if parsed.scheme() != "http" {
+    return Err(format!("'{}' is not an http URL", url));
+  }
+  let loopback = match parsed.host() {
+    Some(Host::Domain(domain)) => domain.eq_ignore_ascii_case("localhost"),
+    Some(Host::Ipv4(ip)) => ip.is_loopback(),
+    Some(Host::Ipv6(ip)) => ip.is_loopback(),
+    None => return Err(format!("'{}' does not have a host", url))
+  };
+  if loopback || allow_remote {
+    Ok(url.to_string())
+  } else {
+    Err(format!("'{}' is not on the loopback interface, and the master server does not allow proxying to other hosts", url))
+  }
+}
+
 fn get_next_port(base_port: Option<u16>) -> u16 {
   match base_port {
     None => 0,
@@ -65,50 +116,77 @@ fn start_provider(context: &mut WebmachineContext, options: ServerOpts) -> Resul
               422_u16
             })?;
           debug!("Loaded pact = {:?}", pact);
-          let mock_server_id = Uuid::new_v4().to_string();
+          let capture_file = match query_param_value(context, "captureFile") {
+            Some(file) => match output_file(&options.output_path, &file) {
+              Ok(path) => Some(path.to_string_lossy().to_string()),
+              Err(err) => {
+                error!("Invalid capture file - {}", err);
+                context.response.body = Some(json_error(format!("Invalid capture file - {}", err)).into_bytes());
+                return Err(422);
+              }
+            },
+            None => None
+          };
+          let proxy_url = match query_param_value(context, "proxyUrl") {
+            Some(url) => match proxy_url(&url, options.allow_remote_proxy) {
+              Ok(url) => Some(url),
+              Err(err) => {
+                error!("Invalid proxy URL - {}", err);
+                context.response.body = Some(json_error(format!("Invalid proxy URL - {}", err)).into_bytes());
+                return Err(400);
+              }
+            },
+            None => None
+          };
+          // Nodes of a cluster allocate the ID before forwarding the request to the node that owns
+          // it, so the ID is only taken from requests that have been routed by the cluster
+          let forwarded = cluster::enabled() && !context.request.find_header(&FORWARDED_HEADER.to_string()).is_empty();
+          let mock_server_id = context.request.find_header(&MOCK_SERVER_ID_HEADER.to_string()).first()
+            .filter(|_| forwarded)
+            .and_then(|id| Uuid::parse_str(id.value.as_str()).ok())
+            .unwrap_or_else(Uuid::new_v4)
+            .to_string();
           let config = MockServerConfig {
             cors_preflight: query_param_set(context, "cors"),
             pact_specification: PactSpecification::default(),
-            transport_config: Default::default()
+            transport_config: Default::default(),
+            journal_limit: query_param_value(context, "journalLimit")
+              .and_then(|limit| limit.parse::<usize>().ok()),
+            session_path_prefix: query_param_set(context, "sessionPathPrefix"),
+            capture_file,
+            proxy_url,
+            proxy_body_limit: query_param_value(context, "proxyBodyLimit")
+              .and_then(|limit| limit.parse::<usize>().ok()),
+            drain_timeout: query_param_value(context, "drainTimeout")
+              .and_then(|timeout| timeout.parse::<u64>().ok())
+              .map(Duration::from_millis)
           };
           debug!("Mock server config = {:?}", config);
 
-          #[allow(unused_assignments)]
-          let mut result = Err("No mock server started yet".to_string());
-          #[cfg(feature = "tls")]
-          {
-            result = if query_param_set(context, "tls") {
-              debug!("Starting TLS mock server with id {}", &mock_server_id);
-              let key = include_str!("self-signed.key");
-              let cert = include_str!("self-signed.cert");
-              TlsConfigBuilder::new()
-                .key(key.as_bytes())
-                .cert(cert.as_bytes())
-                .build()
-                .map_err(|err| {
-                  format!("Failed to setup TLS using self-signed certificate - {}", err)
-                })
-                .and_then(|tls_config| {
-                  let mut guard = SERVER_MANAGER.lock().unwrap();
-                  guard.start_tls_mock_server(mock_server_id.clone(), pact, get_next_port(options.base_port), &tls_config, config)
-                })
-            } else {
-              debug!("Starting mock server with id {}", &mock_server_id);
-              let mut guard = SERVER_MANAGER.lock().unwrap();
-              guard.start_mock_server(mock_server_id.clone(), pact, get_next_port(options.base_port), config)
-            };
-          }
-
-          #[cfg(not(feature = "tls"))]
-          {
-            debug!("Starting mock server with id {}", &mock_server_id);
-            let mut guard = SERVER_MANAGER.lock().unwrap();
-            result = guard.start_mock_server(mock_server_id.clone(), pact, get_next_port(options.base_port), config);
-          }
+          let tls = query_param_set(context, "tls");
+          let ttl = query_param_value(context, "ttl").and_then(|ttl| ttl.parse::<u64>().ok());
+          let write_pact = query_param_set(context, "writePact");
+          let tags = context.request.query.get("tag").cloned().unwrap_or_default();
+          let result = start_mock_server(mock_server_id.clone(), pact, get_next_port(options.base_port), tls, config.clone());
 
           match result {
             Ok(mock_server) => {
               debug!("mock server started on port {}", mock_server);
+              if let Some(ttl) = ttl {
+                REAPER.register(mock_server_id.clone(), Duration::from_secs(ttl), write_pact);
+              }
+              if !tags.is_empty() {
+                SERVER_MANAGER.lock().unwrap().set_mock_server_tags(mock_server_id.as_str(), tags.clone());
+              }
+              STATE_LOG.record_create(&ServerState {
+                id: mock_server_id.clone(),
+                port: mock_server,
+                tls,
+                config: config.to_json(),
+                ttl,
+                write_pact,
+                tags
+              }, json);
               let mock_server_json = json!({
                 "id" : json!(mock_server_id),
                 "port" : json!(mock_server as i64),
@@ -140,27 +218,157 @@ fn start_provider(context: &mut WebmachineContext, options: ServerOpts) -> Resul
   }
 }
 
+/// Starts a mock server with the server manager. If `tls` is set, the mock server will use the
+/// self-signed certificate.
+pub(crate) fn start_mock_server(
+  id: String,
+  pact: Box<dyn Pact + Send + Sync>,
+  port: u16,
+  tls: bool,
+  config: MockServerConfig
+) -> Result<u16, String> {
+  #[cfg(feature = "tls")]
+  {
+    if tls {
+      debug!("Starting TLS mock server with id {}", &id);
+      let key = include_str!("self-signed.key");
+      let cert = include_str!("self-signed.cert");
+      return TlsConfigBuilder::new()
+        .key(key.as_bytes())
+        .cert(cert.as_bytes())
+        .build()
+        .map_err(|err| {
+          format!("Failed to setup TLS using self-signed certificate - {}", err)
+        })
+        .and_then(|tls_config| {
+          let mut guard = SERVER_MANAGER.lock().unwrap();
+          check_id_is_free(&guard, &id)?;
+          guard.start_tls_mock_server(id, pact, port, &tls_config, config)
+        });
+    }
+  }
+
+  #[cfg(not(feature = "tls"))]
+  let _ = tls;
+
+  debug!("Starting mock server with id {}", &id);
+  let mut guard = SERVER_MANAGER.lock().unwrap();
+  check_id_is_free(&guard, &id)?;
+  guard.start_mock_server(id, pact, port, config)
+}
+
+/// Starts a mock server restored from a snapshot, with the journal that has been restored for it
+fn start_restored_mock_server(
+  snapshot: &MockServerSnapshot,
+  pact: Box<dyn Pact + Send + Sync>,
+  addr: SocketAddr,
+  journal: Arc<Mutex<MatchJournal>>
+) -> Result<u16, String> {
+  let id = snapshot.id.clone();
+  let config = snapshot.config.clone();
+  let metrics = snapshot.metrics.clone();
+
+  #[cfg(feature = "tls")]
+  {
+    if snapshot.tls {
+      debug!("Starting restored TLS mock server with id {}", &id);
+      let key = include_str!("self-signed.key");
+      let cert = include_str!("self-signed.cert");
+      return TlsConfigBuilder::new()
+        .key(key.as_bytes())
+        .cert(cert.as_bytes())
+        .build()
+        .map_err(|err| {
+          format!("Failed to setup TLS using self-signed certificate - {}", err)
+        })
+        .and_then(|tls_config| {
+          let mut guard = SERVER_MANAGER.lock().unwrap();
+          check_id_is_free(&guard, &id)?;
+          guard.start_restored_tls_mock_server(id, pact, addr, &tls_config, config, journal, metrics)
+        })
+        .map(|addr| addr.port());
+    }
+  }
+
+  debug!("Starting restored mock server with id {}", &id);
+  let mut guard = SERVER_MANAGER.lock().unwrap();
+  check_id_is_free(&guard, &id)?;
+  guard.start_restored_mock_server(id, pact, addr, config, journal, metrics)
+    .map(|addr| addr.port())
+}
+
+/// The server manager replaces any mock server with the same ID, so IDs given in requests (by
+/// other nodes of a cluster, or in snapshots) are checked before the mock server is started
+fn check_id_is_free(manager: &ServerManager, id: &String) -> Result<(), String> {
+  if manager.find_mock_server_by_id(id, &|_, _| ()).is_some() {
+    Err(format!("There is already a mock server with ID {}", id))
+  } else {
+    Ok(())
+  }
+}
+
+/// Details to start a mock server with `ServerManager::start_mock_servers`, using the self-signed
+/// certificate if `tls` is set
+pub(crate) fn mock_server_start(
+  id: String,
+  pact: Box<dyn Pact + Send + Sync>,
+  port: u16,
+  tls: bool,
+  config: MockServerConfig
+) -> Result<MockServerStart, String> {
+  #[allow(unused_mut)]
+  let mut start = MockServerStart::new(id, pact, ([0, 0, 0, 0], port).into(), config);
+
+  #[cfg(feature = "tls")]
+  if tls {
+    let key = include_str!("self-signed.key");
+    let cert = include_str!("self-signed.cert");
+    start.tls = Some(TlsConfigBuilder::new()
+      .key(key.as_bytes())
+      .cert(cert.as_bytes())
+      .build()
+      .map_err(|err| format!("Failed to setup TLS using self-signed certificate - {}", err))?);
+  }
+
+  #[cfg(not(feature = "tls"))]
+  let _ = tls;
+
+  Ok(start)
+}
+
 fn query_param_set(context: &mut WebmachineContext, name: &str) -> bool {
   context.request.query.get(name)
     .unwrap_or(&vec![]).first().unwrap_or(&String::default())
     .eq("true")
 }
 
+fn query_param_value(context: &WebmachineContext, name: &str) -> Option<String> {
+  context.request.query.get(name)
+    .and_then(|values| values.first())
+    .filter(|value| !value.is_empty())
+    .cloned()
+}
+
 pub fn verify_mock_server_request(context: &mut WebmachineContext) -> Result<bool, u16> {
   let id = context.metadata.get("id").cloned().unwrap_or_default();
-  match verify::validate_id(&id, &SERVER_MANAGER) {
+  let session = query_param_value(context, "session");
+  match verify::validate_id(&id, &SERVER_MANAGER, &MockServer::clone) {
     Ok(ms) => {
-      let mut map = btreemap!{ "mockServer" => ms.to_json() };
-      let mismatches = ms.mismatches();
-      if !mismatches.is_empty() {
-        map.insert("mismatches", json!(mismatches.iter()
-          .map(|m| m.to_json()).collect::<Vec<Value>>()));
+      // The mismatches are worked out once, after the server manager has been unlocked
+      let verification = match &session {
+        Some(session) => ms.verify_session(session.as_str()),
+        None => ms.verify()
+      };
+      let mut map = btreemap!{ "mockServer" => verification.mock_server.clone() };
+      if !verification.matched() {
+        map.insert("mismatches", json!(verification.mismatches));
         context.response.body = Some(json!(map).to_string().into_bytes());
         Err(422)
+      } else if session.is_some() {
+        Ok(true)
       } else {
-        let inner = SERVER_OPTIONS.lock().unwrap();
-        let options = inner.borrow();
-        match ms.write_pact(&options.output_path, false) {
+        let output_path = SERVER_OPTIONS.lock().unwrap().borrow().output_path.clone();
+        match ms.write_pact(&output_path, false) {
           Ok(_) => Ok(true),
           Err(err) => {
             map.insert("error", json!(format!("Failed to write pact to file - {}", err)));
@@ -174,6 +382,276 @@ pub fn verify_mock_server_request(context: &mut WebmachineContext) -> Result<boo
   }
 }
 
+fn reset_mock_server_request(context: &mut WebmachineContext) -> Result<bool, u16> {
+  let id = context.metadata.get("id").cloned().unwrap_or_default();
+  let verify = query_param_set(context, "verify");
+  let session = query_param_value(context, "session");
+  let result = SERVER_MANAGER.lock().unwrap()
+    .find_mock_server_by_id_mut(&id, &|ms| {
+      let journal = match &session {
+        Some(session) => ms.reset_session(session.as_str()),
+        None => ms.reset()
+      };
+      if verify {
+        Some(json!({
+          "mockServer": ms.to_json(),
+          "mismatches": ms.mismatches_json_for(&journal)
+        }))
+      } else {
+        None
+      }
+    });
+  match result {
+    Some(body) => {
+      if let Some(body) = body {
+        context.response.body = Some(body.to_string().into_bytes());
+      }
+      Ok(true)
+    }
+    None => Err(404)
+  }
+}
+
+fn export_mock_server_journal_request(context: &mut WebmachineContext) -> Result<bool, u16> {
+  let id = context.metadata.get("id").cloned().unwrap_or_default();
+  let compress = query_param_set(context, "compress");
+  let output_path = SERVER_OPTIONS.lock().unwrap().borrow().output_path.clone();
+  let found = SERVER_MANAGER.lock().unwrap()
+    .find_mock_server_by_id(&id, &|_, ms| ms.left().map(|ms| (ms.journal(), ms.expected_request_list())))
+    .flatten();
+  match found {
+    Some((journal, expected)) => {
+      let mut path = output_path.map(PathBuf::from).unwrap_or_default();
+      path.push(format!("{}.journal{}", id, if compress { ".zst" } else { "" }));
+      let result = File::create(&path)
+        .map_err(|err| anyhow!(err))
+        .and_then(|file| JournalExportWriter::new(file, compress))
+        .and_then(|mut writer| {
+          export_journal(&journal, &expected, &mut writer)?;
+          Ok(writer.finish()?)
+        });
+      match result {
+        Ok(entries) => {
+          info!("Exported {} journal entries for mock server {} to {}", entries, id, path.display());
+          context.response.body = Some(json!({
+            "file": path.to_string_lossy(),
+            "entries": entries
+          }).to_string().into_bytes());
+          Ok(true)
+        }
+        Err(err) => {
+          error!("Failed to export the journal for mock server {} - {}", id, err);
+          context.response.body = Some(json_error(format!("Failed to export the journal - {}", err)).into_bytes());
+          Err(500)
+        }
+      }
+    }
+    None => Err(404)
+  }
+}
+
+fn snapshot_mock_server_request(context: &mut WebmachineContext) -> Result<bool, u16> {
+  let id = context.metadata.get("id").cloned().unwrap_or_default();
+  let compress = query_param_set(context, "compress");
+  let output_path = SERVER_OPTIONS.lock().unwrap().borrow().output_path.clone();
+  let found = SERVER_MANAGER.lock().unwrap()
+    .find_mock_server_by_id(&id, &|_, ms| ms.left().map(|ms| {
+      MockServerSnapshot::from_mock_server(ms).map(|snapshot| (snapshot, ms.journal(), ms.expected_request_list()))
+    }))
+    .flatten();
+  match found {
+    Some(snapshot) => {
+      let mut path = output_path.map(PathBuf::from).unwrap_or_default();
+      path.push(format!("{}.snapshot{}", id, if compress { ".zst" } else { "" }));
+      let result = snapshot.and_then(|(snapshot, journal, expected)| {
+        let file = File::create(&path)?;
+        write_snapshot(&snapshot, &journal, &expected, file, compress)
+      });
+      match result {
+        Ok(entries) => {
+          info!("Wrote snapshot of mock server {} with {} journal entries to {}", id, entries, path.display());
+          context.response.body = Some(json!({
+            "file": path.to_string_lossy(),
+            "entries": entries
+          }).to_string().into_bytes());
+          Ok(true)
+        }
+        Err(err) => {
+          error!("Failed to write a snapshot of mock server {} - {}", id, err);
+          context.response.body = Some(json_error(format!("Failed to write the snapshot - {}", err)).into_bytes());
+          Err(500)
+        }
+      }
+    }
+    None => Err(404)
+  }
+}
+
+/// Restores a mock server from a snapshot file. The body of the request is a JSON document with
+/// the `file` to restore from (a relative path within the output directory) and optionally the `port` to use
+/// (the port from the snapshot is used if it is not given).
+fn restore_mock_server_request(context: &mut WebmachineContext, options: ServerOpts) -> Result<bool, u16> {
+  let body = context.request.body.as_ref()
+    .filter(|body| !body.is_empty())
+    .map(|body| serde_json::from_slice::<Value>(body));
+  let file = match &body {
+    Some(Ok(json)) => json.get("file").and_then(Value::as_str).map(|file| file.to_string()),
+    Some(Err(err)) => {
+      error!("Failed to parse json body - {}", err);
+      context.response.body = Some(json_error(format!("Failed to parse json body - {}", err)).into_bytes());
+      return Err(422);
+    }
+    None => None
+  };
+  let file = match file {
+    Some(file) => file,
+    None => {
+      context.response.body = Some(json_error("No snapshot file was supplied".to_string()).into_bytes());
+      return Err(422);
+    }
+  };
+  let path = match output_file(&options.output_path, &file) {
+    Ok(path) => path,
+    Err(err) => {
+      error!("Invalid snapshot file - {}", err);
+      context.response.body = Some(json_error(format!("Invalid snapshot file - {}", err)).into_bytes());
+      return Err(422);
+    }
+  };
+  let port = body.and_then(|body| body.ok())
+    .and_then(|json| json.get("port").and_then(Value::as_u64))
+    .map(|port| port as u16);
+
+  match restore_mock_server(&path, port) {
+    Ok((id, port, entries)) => {
+      info!("Restored mock server {} on port {} with {} journal entries from {}", id, port, entries, path.display());
+      context.response.body = Some(json!({
+        "mockServer": { "id": id, "port": port },
+        "entries": entries
+      }).to_string().into_bytes());
+      context.response.add_header("Location",
+        vec![HeaderValue::basic(format!("/mockserver/{}", id).as_str())]);
+      Ok(true)
+    }
+    Err(err) => {
+      error!("Failed to restore mock server from {} - {}", path.display(), err);
+      context.response.body = Some(json_error(format!("Failed to restore mock server - {}", err)).into_bytes());
+      Err(422)
+    }
+  }
+}
+
+/// Restores the journal from the snapshot, and then starts the mock server with it and the metrics
+/// from the snapshot, so no requests are handled before the journal is in place. The mock server is
+/// bound to the address from the snapshot (all interfaces for snapshots that do not have one).
+/// Returns the ID and port of the mock server, and the number of journal entries restored. This
+/// must not be called from a runtime thread, as the journal is imported with the manager runtime.
+fn restore_mock_server(path: &PathBuf, port: Option<u16>) -> anyhow::Result<(String, u16, usize)> {
+  let reader = SnapshotReader::new(File::open(path)?)?;
+  let snapshot = reader.snapshot().clone();
+  let pact = snapshot.load_pact()?;
+  let v4_pact = pact.as_v4_pact()?;
+  let journal = Arc::new(Mutex::new(MatchJournal::new(snapshot.config.journal_limit)));
+  let runtime = SERVER_MANAGER.lock().unwrap().runtime_handle();
+  let entries = runtime.block_on(import_journal(&journal, &v4_pact, reader))?;
+  journal.lock().unwrap().continue_from(snapshot.last_sequence);
+
+  let ip = snapshot.address.as_ref()
+    .and_then(|address| address.parse::<IpAddr>().ok())
+    .unwrap_or_else(|| [0, 0, 0, 0].into());
+  let addr = SocketAddr::new(ip, port.or(snapshot.port).unwrap_or_default());
+  let port = start_restored_mock_server(&snapshot, pact, addr, journal)
+    .map_err(|err| anyhow!(err))?;
+
+  STATE_LOG.record_create(&ServerState {
+    id: snapshot.id.clone(),
+    port,
+    tls: snapshot.tls,
+    config: snapshot.config.to_json(),
+    ttl: None,
+    write_pact: false,
+    tags: vec![]
+  }, &snapshot.pact);
+  Ok((snapshot.id, port, entries))
+}
+
+fn restore_resource<'a>() -> WebmachineResource<'a> {
+  WebmachineResource {
+    allowed_methods: vec!["OPTIONS", "POST"],
+    process_post: callback(&|context, _| {
+      debug!("restore_resource -> process_post");
+      let options = {
+        let inner = SERVER_OPTIONS.lock().unwrap();
+        inner.clone().into_inner()
+      };
+      let mut ctx = context.clone();
+      match thread::spawn(move || {
+        let result = restore_mock_server_request(&mut ctx, options);
+        (result, ctx)
+      }).join() {
+        Ok((result, ctx)) => {
+          context.response = ctx.response;
+          result
+        }
+        Err(err) => {
+          error!("Failed to spawn new thread to restore mock server - {:?}", err);
+          Err(500)
+        }
+      }
+    }),
+    ..WebmachineResource::default()
+  }
+}
+
+/// Shuts down the selected mock servers concurrently. The server manager is only locked to send
+/// the shutdown signals, and the mock servers are then waited on up to the deadline. This must not
+/// be called from a runtime thread.
+fn shutdown_mock_servers(selector: ShutdownSelector, deadline: Duration) -> ShutdownReport {
+  let (batch, runtime) = {
+    let mut manager = SERVER_MANAGER.lock().unwrap();
+    (manager.begin_shutdown(selector), manager.runtime_handle())
+  };
+  runtime.block_on(batch.wait(deadline))
+}
+
+/// Selects the mock servers to shut down from the query parameters: the ones with the IDs given
+/// in `id` parameters, or with the tag given in the `tag` parameter, otherwise all of them. The
+/// `deadline` parameter is the time in milliseconds to wait for them to stop before they are
+/// aborted.
+pub(crate) fn shutdown_selector(query: &HashMap<String, Vec<String>>) -> (ShutdownSelector, Duration) {
+  let first = |name: &str| query.get(name)
+    .and_then(|values| values.first())
+    .filter(|value| !value.is_empty())
+    .cloned();
+  let selector = match (query.get("id"), first("tag")) {
+    (Some(ids), _) if !ids.is_empty() => ShutdownSelector::Ids(ids.clone()),
+    (_, Some(tag)) => ShutdownSelector::Tag(tag),
+    _ => ShutdownSelector::All
+  };
+  let deadline = first("deadline")
+    .and_then(|deadline| deadline.parse::<u64>().ok())
+    .map(Duration::from_millis)
+    .unwrap_or(DEFAULT_SHUTDOWN_DEADLINE);
+  (selector, deadline)
+}
+
+/// Shuts down the selected mock servers, waiting for them to stop without blocking the thread,
+/// and removes the ones that have stopped from the state log
+pub(crate) async fn bulk_shutdown(selector: ShutdownSelector, deadline: Duration) -> ShutdownReport {
+  debug!("Shutting down mock servers {:?} with a deadline of {:?}", selector, deadline);
+  let batch = {
+    let mut manager = SERVER_MANAGER.lock().unwrap();
+    manager.begin_shutdown(selector)
+  };
+  let report = batch.wait(deadline).await;
+  for id in report.stopped.iter().chain(report.forced.iter()) {
+    REAPER.deregister(id);
+    STATE_LOG.record_delete(id);
+  }
+  info!("Shut down {} mock servers ({} forced)", report.stopped.len() + report.forced.len(), report.forced.len());
+  report
+}
+
 fn shutdown_resource<'a>() -> WebmachineResource<'a> {
   WebmachineResource {
     allowed_methods: vec!["POST"],
@@ -208,7 +686,15 @@ fn shutdown_resource<'a>() -> WebmachineResource<'a> {
           // shutdown.send(()).unwrap_or_default();
           thread::spawn(move || {
             info!("Scheduling master server to shutdown in {}ms", period);
-            thread::sleep(Duration::from_millis(period));
+            let start = Instant::now();
+            STATE_LOG.checkpoint();
+            // The mock servers are not removed from the state log, so they are restored on restart
+            let report = shutdown_mock_servers(ShutdownSelector::All, Duration::from_millis(period));
+            info!("Shut down {} mock servers ({} forced)", report.stopped.len() + report.forced.len(),
+              report.forced.len());
+            if let Some(remaining) = Duration::from_millis(period).checked_sub(start.elapsed()) {
+              thread::sleep(remaining);
+            }
             info!("Shutting down");
             process::exit(0);
           });
@@ -232,13 +718,13 @@ fn mock_server_resource<'a>() -> WebmachineResource<'a> {
         .map(|p| p.to_string())
         .collect();
       if !paths.is_empty() && paths.len() <= 2 {
-        match verify::validate_id(&paths[0].clone(), &SERVER_MANAGER) {
-          Ok(ms) => {
-            context.metadata.insert("id".to_string(), ms.id.clone());
-            context.metadata.insert("port".to_string(), ms.port.unwrap_or_default().to_string());
+        match verify::validate_id(&paths[0].clone(), &SERVER_MANAGER, &|ms| (ms.id.clone(), ms.port)) {
+          Ok((id, port)) => {
+            context.metadata.insert("id".to_string(), id);
+            context.metadata.insert("port".to_string(), port.unwrap_or_default().to_string());
             if paths.len() > 1 {
               context.metadata.insert("subpath".to_string(), paths[1].clone());
-              paths[1] == "verify"
+              ["verify", "reset", "mismatches", "export", "snapshot", "recorded"].contains(&paths[1].as_str())
             } else {
               true
             }
@@ -255,24 +741,37 @@ fn mock_server_resource<'a>() -> WebmachineResource<'a> {
         None => {
           let id = context.metadata.get("id").unwrap().clone();
           debug!("Mock server id = {}", id);
-          let response = {
-            let guard = SERVER_MANAGER.lock().unwrap();
-            guard.find_mock_server_by_id(&id, &|_, ms| match ms {
-              Either::Left(ms) => (Some(ms.to_json().to_string()), None),
-              Either::Right(_plugin) => {
-                error!("Plugin mock servers are not currently supported");
-                (None, Some(422))
-              }
-            })
-          };
-          match response {
-            Some((res, Some(status))) => {
-              context.response.status = status;
-              res
-            }
-            Some((res, None)) => res,
-            None => None
+          SERVER_MANAGER.lock().unwrap()
+            .mock_server_json(&id)
+            .map(|json| json.to_string())
+        }
+        Some(subpath) if subpath == "mismatches" => {
+          let id = context.metadata.get("id").unwrap().clone();
+          let since = query_param_value(context, "since")
+            .and_then(|since| since.parse::<u64>().ok())
+            .unwrap_or_default();
+          let response = SERVER_MANAGER.lock().unwrap()
+            .find_mock_server_by_id(&id, &|_, ms| ms.left().map(|ms| ms.mismatches_since_json(since).to_string()))
+            .flatten();
+          if response.is_none() {
+            context.response.status = 422;
           }
+          response
+        }
+        Some(subpath) if subpath == "recorded" => {
+          let id = context.metadata.get("id").unwrap().clone();
+          let response = SERVER_MANAGER.lock().unwrap()
+            .find_mock_server_by_id(&id, &|_, ms| ms.left().map(|ms| {
+              let interactions: Vec<Value> = ms.recorded_interactions().iter()
+                .map(|interaction| interaction.to_json())
+                .collect();
+              json!({ "interactions": interactions }).to_string()
+            }))
+            .flatten();
+          if response.is_none() {
+            context.response.status = 422;
+          }
+          response
         }
         Some(_) => {
           context.response.status = 405;
@@ -285,6 +784,12 @@ fn mock_server_resource<'a>() -> WebmachineResource<'a> {
       let subpath = context.metadata.get("subpath").unwrap().clone();
       if subpath == "verify" {
         verify_mock_server_request(context)
+      } else if subpath == "reset" {
+        reset_mock_server_request(context)
+      } else if subpath == "export" {
+        export_mock_server_journal_request(context)
+      } else if subpath == "snapshot" {
+        snapshot_mock_server_request(context)
       } else {
         Err(422)
       }
@@ -295,7 +800,9 @@ fn mock_server_resource<'a>() -> WebmachineResource<'a> {
         None => {
           let id = context.metadata.get("id").unwrap().clone();
           thread::spawn(move || {
-            if SERVER_MANAGER.lock().unwrap().shutdown_mock_server_by_id(id) {
+            if SERVER_MANAGER.lock().unwrap().shutdown_mock_server_by_id(id.clone()) {
+              REAPER.deregister(&id);
+              STATE_LOG.record_delete(&id);
               Ok(true)
             } else {
               Err(404)
@@ -322,7 +829,7 @@ fn dispatcher() -> WebmachineDispatcher<'static>  {
           debug!("main_resource -> render_response");
           let server_manager = SERVER_MANAGER.lock().unwrap();
           trace!("Unlocked server manager");
-          let mock_servers = server_manager.map_mock_servers(MockServer::to_json);
+          let mock_servers = server_manager.mock_servers_json();
           trace!("Got mock server JSON");
           let json_response = json!({ "mockServers" : mock_servers });
           trace!("Returning response");
@@ -374,6 +881,7 @@ fn dispatcher() -> WebmachineDispatcher<'static>  {
         .. WebmachineResource::default()
       },
       "/mockserver" => mock_server_resource(),
+      "/restore" => restore_resource(),
       "/shutdown" => shutdown_resource()
     }
   }
@@ -383,8 +891,25 @@ pub async fn start_server(port: u16) -> Result<(), i32> {
   let addr = SocketAddr::new(IpAddr::from([0, 0, 0, 0]), port);
   let (_shutdown_tx, shutdown_rx) = channel::<()>();
 
-  let make_svc = make_service_fn(|_| async {
-    Ok::<_, Infallible>(dispatcher())
+  // The dispatcher is built once and shared by all the connections, rather than for each request
+  let webmachine = Arc::new(dispatcher());
+  let make_svc = make_service_fn(move |_| {
+    let webmachine = webmachine.clone();
+    async move {
+      Ok::<_, Infallible>(service_fn(move |req: Request<Body>| {
+        let webmachine = webmachine.clone();
+        async move {
+          let req = match cluster::route_request(req).await {
+            Either::Left(response) => return Ok(response),
+            Either::Right(req) => req
+          };
+          match async_route(&req) {
+            Some(route) => Ok(handle_async_route(route, req).await),
+            None => webmachine.dispatch(req).await
+          }
+        }
+      }))
+    }
   });
   match Server::try_bind(&addr) {
     Ok(server) => {
@@ -406,3 +931,41 @@ pub async fn start_server(port: u16) -> Result<(), i32> {
     }
   }
 }
+
+#[cfg(test)]
+mod tests {
+  use expectest::prelude::*;
+
+  use super::*;
+
+  #[test]
+  fn output_file_resolves_the_file_against_the_output_directory() {
+    expect!(output_file(&Some("out".to_string()), "capture.json")).to(be_ok().value(PathBuf::from("out/capture.json")));
+    expect!(output_file(&None, "./captures/capture.json")).to(be_ok().value(PathBuf::from("./captures/capture.json")));
+  }
+
+  #[test]
+  fn output_file_rejects_paths_outside_the_output_directory() {
+    expect!(output_file(&Some("out".to_string()), "/etc/passwd")).to(be_err());
+    expect!(output_file(&Some("out".to_string()), "../capture.json")).to(be_err());
+    expect!(output_file(&Some("out".to_string()), "captures/../../capture.json")).to(be_err());
+    expect!(output_file(&Some("out".to_string()), "")).to(be_err());
+  }
+
+  #[test]
+  fn proxy_url_only_allows_loopback_hosts_by_default() {
+    expect!(proxy_url("http://localhost:8080", false)).to(be_ok());
+    expect!(proxy_url("http://127.0.0.1:8080/api", false)).to(be_ok());
+    expect!(proxy_url("http://[::1]:8080", false)).to(be_ok());
+    expect!(proxy_url("http://10.0.0.1:8080", false)).to(be_err());
+    expect!(proxy_url("http://example.com", false)).to(be_err());
+    expect!(proxy_url("https://localhost:8080", false)).to(be_err());
+    expect!(proxy_url("not a url", false)).to(be_err());
+  }
+
+  #[test]
+  fn proxy_url_allows_other_hosts_when_enabled() {
+    expect!(proxy_url("http://example.com", true)).to(be_ok());
+    expect!(proxy_url("https://example.com", true)).to(be_err());
+  }
+}
@@ -0,0 +1,556 @@
+//!
+//! Persistent state log for the master server, so that the mock servers (and their journals) can
+//! be rebuilt if the master server is restarted.
+//!
+//! The log is a file of JSON lines that is only ever appended to. It records the mock servers that
+//! are created (with their port, config and the hash of their pact) and deleted, the pacts (once
+//! for each distinct content hash) and checkpoints of the match journals. Journals are
+//! checkpointed in the background using the journal export format, and only when they have
+//! changed since their last checkpoint.
+//!
+//! When the master server is started with a state log, the mock servers in it are rebuilt as one
+//! batch on the same ports, their journals are imported in parallel from the last checkpoints, and
+//! the log is then compacted to only have the live mock servers.
+//!
+
+use std::collections::{BTreeMap, HashMap, HashSet};
+use std::fs::{self, File, OpenOptions};
+use std::io::{BufRead, BufReader, BufWriter, Write};
+use std::path::{Path, PathBuf};
+use std::sync::{Mutex, Once};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use anyhow::anyhow;
+use lazy_static::lazy_static;
+use pact_models::pact::load_pact_from_json;
+use serde_json::{json, Value};
+use tracing::{debug, error, info, warn};
+
+use pact_mock_server::journal_export::{export_journal, import_journal, JournalExportReader, JournalExportWriter};
+use pact_mock_server::mock_server::MockServerConfig;
+use pact_mock_server::server_manager::MockServerStart;
+
+use crate::cluster::fnv1a;
+use crate::reaper::REAPER;
+use crate::server::mock_server_start;
+use crate::SERVER_MANAGER;
+
+/// How often the journals are checkpointed
+const CHECKPOINT_INTERVAL: Duration = Duration::from_secs(5);
+
+/// State of a mock server, as recorded in the log
+#[derive(Debug, Clone, PartialEq)]
+pub(crate) struct ServerState {
+  /// Mock server ID
+  pub id: String,
+  /// Port the mock server is running on
+  pub port: u16,
+  /// If the mock server is using TLS
+  pub tls: bool,
+  /// Mock server config (see `MockServerConfig::to_json`)
+  pub config: Value,
+  /// Idle time (in seconds) after which the mock server is shut down
+  pub ttl: Option<u64>,
+  /// If the pact file is written when the mock server is shut down after the TTL
+  pub write_pact: bool,
+  /// Tags of the mock server
+  pub tags: Vec<String>
+}
+
+impl ServerState {
+  fn to_json(&self, pact_hash: &str) -> Value {
+    json!({
+      "type": "create",
+      "id": self.id,
+      "port": self.port,
+      "tls": self.tls,
+      "config": self.config,
+      "ttl": self.ttl,
+      "writePact": self.write_pact,
+      "tags": self.tags,
+      "pact": pact_hash
+    })
+  }
+
+  fn from_json(json: &Value) -> Option<(ServerState, String)> {
+    let state = ServerState {
+      id: json.get("id")?.as_str()?.to_string(),
+      port: json.get("port")?.as_u64()? as u16,
+      tls: json.get("tls").and_then(|tls| tls.as_bool()).unwrap_or_default(),
+      config: json.get("config").cloned().unwrap_or_default(),
+      ttl: json.get("ttl").and_then(|ttl| ttl.as_u64()),
+      write_pact: json.get("writePact").and_then(|write| write.as_bool()).unwrap_or_default(),
+      tags: json.get("tags").and_then(|tags| tags.as_array())
+        .map(|tags| tags.iter().filter_map(|tag| tag.as_str().map(|tag| tag.to_string())).collect())
+        .unwrap_or_default()
+    };
+    Some((state, json.get("pact")?.as_str()?.to_string()))
+  }
+}
+
+/// Last checkpoint of a mock server journal
+#[derive(Debug, Clone, PartialEq)]
+struct Checkpoint {
+  file: PathBuf,
+  sequence: u64,
+  entries: usize
+}
+
+/// State read back from the log
+#[derive(Debug, Default)]
+struct LoadedState {
+  pacts: HashMap<String, Value>,
+  servers: BTreeMap<String, (ServerState, String)>,
+  checkpoints: HashMap<String, Checkpoint>
+}
+
+#[derive(Debug, Default)]
+struct LogState {
+  path: Option<PathBuf>,
+  out: Option<BufWriter<File>>,
+  /// Hashes of the pacts that have been written to the log
+  pacts: HashSet<String>,
+  /// Sequence number of the last checkpoint for each mock server
+  checkpoints: HashMap<String, u64>
+}
+
+/// Persistent state log of the master server. Recording to the log does nothing unless the master
+/// server was started with a state file.
+pub(crate) struct StateLog {
+  state: Mutex<LogState>,
+  started: Once
+}
+
+lazy_static! {
+  pub(crate) static ref STATE_LOG: StateLog = StateLog {
+    state: Mutex::new(LogState::default()),
+    started: Once::new()
+  };
+}
+
+impl StateLog {
+  /// Records that a mock server has been created from the pact JSON
+  pub(crate) fn record_create(&self, server: &ServerState, pact: &Value) {
+    let mut state = self.state.lock().unwrap();
+    if state.out.is_none() {
+      return;
+    }
+    let hash = pact_hash(pact);
+    if !state.pacts.contains(&hash) {
+      append(&mut state, &json!({ "type": "pact", "hash": hash, "pact": pact }));
+      state.pacts.insert(hash.clone());
+    }
+    append(&mut state, &server.to_json(&hash));
+  }
+
+  /// Records that a mock server has been shut down
+  pub(crate) fn record_delete(&self, id: &str) {
+    let mut state = self.state.lock().unwrap();
+    if state.out.is_none() {
+      return;
+    }
+    append(&mut state, &json!({ "type": "delete", "id": id }));
+    if state.checkpoints.remove(id).is_some() {
+      if let Some(path) = &state.path {
+        let _ = fs::remove_file(checkpoint_file(path, id));
+      }
+    }
+  }
+
+  /// Checkpoints the journals of all the mock servers that have changed since their last
+  /// checkpoint
+  pub(crate) fn checkpoint(&self) {
+    let (path, checkpoints) = {
+      let state = self.state.lock().unwrap();
+      match &state.path {
+        Some(path) if state.out.is_some() => (path.clone(), state.checkpoints.clone()),
+        _ => return
+      }
+    };
+
+    let changed = SERVER_MANAGER.lock().unwrap().map_mock_servers(|ms| {
+      let journal = ms.journal();
+      let sequence = journal.lock().unwrap().last_sequence();
+      if checkpoints.get(&ms.id).cloned().unwrap_or_default() != sequence {
+        Some((ms.id.clone(), journal, ms.expected_request_list()))
+      } else {
+        None
+      }
+    });
+
+    for (id, journal, expected) in changed.into_iter().flatten() {
+      let file = checkpoint_file(&path, &id);
+      let tmp = file.with_extension("journal.tmp");
+      let result = File::create(&tmp)
+        .map_err(|err| anyhow!(err))
+        .and_then(|out| JournalExportWriter::new(out, false))
+        .and_then(|mut writer| {
+          // Take the sequence first, as entries appended during the export will be included
+          let sequence = journal.lock().unwrap().last_sequence();
+          export_journal(&journal, &expected, &mut writer)?;
+          Ok((sequence, writer.finish()?))
+        })
+        .and_then(|result| fs::rename(&tmp, &file).map(|_| result).map_err(|err| anyhow!(err)));
+      match result {
+        Ok((sequence, entries)) => {
+          debug!("Checkpointed {} journal entries for mock server {}", entries, id);
+          let mut state = self.state.lock().unwrap();
+          append(&mut state, &json!({
+            "type": "checkpoint",
+            "id": id,
+            "file": file.to_string_lossy(),
+            "sequence": sequence,
+            "entries": entries
+          }));
+          state.checkpoints.insert(id, sequence);
+        }
+        Err(err) => error!("Failed to checkpoint the journal for mock server {} - {}", id, err)
+      }
+    }
+  }
+
+  /// Rewrites the log with only the given state, and opens it for appending. Also starts the
+  /// background thread that checkpoints the journals.
+  fn open(&'static self, path: &Path, loaded: &LoadedState) -> anyhow::Result<()> {
+    let tmp = path.with_extension("tmp");
+    let mut pacts = HashSet::new();
+    {
+      let mut out = BufWriter::new(File::create(&tmp)?);
+      for (state, hash) in loaded.servers.values() {
+        if let Some(pact) = loaded.pacts.get(hash) {
+          if pacts.insert(hash.clone()) {
+            writeln!(out, "{}", json!({ "type": "pact", "hash": hash, "pact": pact }))?;
+          }
+          writeln!(out, "{}", state.to_json(hash))?;
+        }
+      }
+      for (id, checkpoint) in &loaded.checkpoints {
+        writeln!(out, "{}", json!({
+          "type": "checkpoint",
+          "id": id,
+          "file": checkpoint.file.to_string_lossy(),
+          "sequence": checkpoint.sequence,
+          "entries": checkpoint.entries
+        }))?;
+      }
+      out.flush()?;
+    }
+    fs::rename(&tmp, path)?;
+    fs::create_dir_all(checkpoint_dir(path))?;
+
+    {
+      let mut state = self.state.lock().unwrap();
+      state.out = Some(BufWriter::new(OpenOptions::new().append(true).open(path)?));
+      state.path = Some(path.to_path_buf());
+      state.pacts = pacts;
+      state.checkpoints = loaded.checkpoints.iter()
+        .map(|(id, checkpoint)| (id.clone(), checkpoint.sequence))
+        .collect();
+    }
+
+    self.started.call_once(|| {
+      if let Err(err) = thread::Builder::new()
+        .name("state-checkpoint".to_string())
+        .spawn(move || loop {
+          thread::sleep(CHECKPOINT_INTERVAL);
+          self.checkpoint();
+        }) {
+        error!("Failed to start the journal checkpoint thread - {}", err);
+      }
+    });
+    Ok(())
+  }
+
+  fn append_record(&self, record: &Value) {
+    let mut state = self.state.lock().unwrap();
+    append(&mut state, record);
+  }
+}
+
+fn append(state: &mut LogState, record: &Value) {
+  if let Some(out) = &mut state.out {
+    let result = writeln!(out, "{}", record).and_then(|_| out.flush());
+    if let Err(err) = result {
+      error!("Failed to write to the state log - {}", err);
+    }
+  }
+}
+
+fn checkpoint_dir(path: &Path) -> PathBuf {
+  let mut dir = path.as_os_str().to_os_string();
+  dir.push(".journals");
+  PathBuf::from(dir)
+}
+
+fn checkpoint_file(path: &Path, id: &str) -> PathBuf {
+  checkpoint_dir(path).join(format!("{}.journal", id))
+}
+
+/// FNV-1a hash of the pact JSON, used to only store each distinct pact once
+fn pact_hash(pact: &Value) -> String {
+  format!("{:016x}", fnv1a(pact.to_string().as_bytes()))
+}
+
+/// Reads the records from the log. A record that can not be read (such as a partially written
+/// last line) is skipped.
+fn read_state_log(input: impl BufRead) -> anyhow::Result<LoadedState> {
+  let mut loaded = LoadedState::default();
+  for (index, line) in input.lines().enumerate() {
+    let line = line?;
+    if line.trim().is_empty() {
+      continue;
+    }
+    let record: Value = match serde_json::from_str(&line) {
+      Ok(record) => record,
+      Err(err) => {
+        warn!("Ignoring invalid record on line {} of the state log - {}", index + 1, err);
+        continue;
+      }
+    };
+    match record.get("type").and_then(|t| t.as_str()) {
+      Some("pact") => if let (Some(hash), Some(pact)) = (record.get("hash").and_then(|h| h.as_str()), record.get("pact")) {
+        loaded.pacts.insert(hash.to_string(), pact.clone());
+      },
+      Some("create") => if let Some((state, hash)) = ServerState::from_json(&record) {
+        loaded.servers.insert(state.id.clone(), (state, hash));
+      },
+      Some("delete") => if let Some(id) = record.get("id").and_then(|id| id.as_str()) {
+        loaded.servers.remove(id);
+        loaded.checkpoints.remove(id);
+      },
+      Some("checkpoint") => if let (Some(id), Some(file)) = (record.get("id").and_then(|id| id.as_str()),
+                                                           record.get("file").and_then(|f| f.as_str())) {
+        loaded.checkpoints.insert(id.to_string(), Checkpoint {
+          file: PathBuf::from(file),
+          sequence: record.get("sequence").and_then(|s| s.as_u64()).unwrap_or_default(),
+          entries: record.get("entries").and_then(|e| e.as_u64()).unwrap_or_default() as usize
+        });
+      },
+      _ => {}
+    }
+  }
+  loaded.checkpoints.retain(|id, _| loaded.servers.contains_key(id));
+  Ok(loaded)
+}
+
+/// Rebuilds the mock servers from the loaded state. The mock servers are bound concurrently as one
+/// batch (see `ServerManager::start_mock_servers`), and their journals are then imported on a
+/// thread per core. Returns the state of the mock servers that were rebuilt.
+fn restore_servers(loaded: LoadedState) -> LoadedState {
+  let servers: Vec<(ServerState, String)> = loaded.servers.values().cloned().collect();
+  if servers.is_empty() {
+    return loaded;
+  }
+
+  // Starting the mock servers one at a time from several threads would just serialise on the
+  // server manager lock, so they are all started as one batch
+  let mut starts = vec![];
+  let mut pending = vec![];
+  for (server, hash) in servers {
+    match server_start(&server, &hash, &loaded) {
+      Ok(start) => {
+        starts.push(start);
+        pending.push(server);
+      }
+      Err(err) => error!("Failed to restore mock server {} - {}", server.id, err)
+    }
+  }
+  let results = SERVER_MANAGER.lock().unwrap().start_mock_servers(starts);
+  let started: Vec<ServerState> = pending.into_iter()
+    .zip(results)
+    .filter_map(|(server, result)| match result {
+      Ok(_) => Some(server),
+      Err(err) => {
+        error!("Failed to restore mock server {} - {}", server.id, err);
+        None
+      }
+    })
+    .collect();
+  if started.is_empty() {
+    let mut loaded = loaded;
+    loaded.servers.clear();
+    loaded.checkpoints.clear();
+    return loaded;
+  }
+
+  let threads = thread::available_parallelism().map(|n| n.get()).unwrap_or(1).min(started.len());
+  let chunk_size = (started.len() + threads - 1) / threads;
+  let state = &loaded;
+  let restored: Vec<String> = thread::scope(|scope| {
+    let handles: Vec<_> = started.chunks(chunk_size)
+      .map(|chunk| scope.spawn(move || {
+        chunk.iter()
+          .filter_map(|server| match restore_server(server, state) {
+            Ok(()) => Some(server.id.clone()),
+            Err(err) => {
+              error!("Failed to restore mock server {} - {}", server.id, err);
+              None
+            }
+          })
+          .collect::<Vec<_>>()
+      }))
+      .collect();
+    handles.into_iter()
+      .flat_map(|handle| handle.join().unwrap_or_default())
+      .collect()
+  });
+
+  let restored: HashSet<String> = restored.into_iter().collect();
+  let mut loaded = loaded;
+  loaded.servers.retain(|id, _| restored.contains(id));
+  loaded.checkpoints.retain(|id, _| restored.contains(id));
+  loaded
+}
+
+fn server_start(state: &ServerState, hash: &str, loaded: &LoadedState) -> anyhow::Result<MockServerStart> {
+  let pact_json = loaded.pacts.get(hash)
+    .ok_or_else(|| anyhow!("Pact with hash {} is not in the state log", hash))?;
+  let pact = load_pact_from_json(state.id.as_str(), pact_json)?;
+  let config = MockServerConfig::from_json(&state.config);
+  mock_server_start(state.id.clone(), pact, state.port, state.tls, config)
+    .map_err(|err| anyhow!(err))
+}
+
+/// Restores the rest of the state of a mock server that has been started (its tags, TTL and journal)
+fn restore_server(state: &ServerState, loaded: &LoadedState) -> anyhow::Result<()> {
+  if !state.tags.is_empty() {
+    SERVER_MANAGER.lock().unwrap().set_mock_server_tags(state.id.as_str(), state.tags.clone());
+  }
+  if let Some(ttl) = state.ttl {
+    REAPER.register(state.id.clone(), Duration::from_secs(ttl), state.write_pact);
+  }
+
+  if let Some(checkpoint) = loaded.checkpoints.get(&state.id) {
+    let found = SERVER_MANAGER.lock().unwrap()
+      .find_mock_server_by_id(&state.id, &|manager, ms| ms.left().map(|ms| {
+        (ms.journal(), ms.pact.as_v4_pact(), manager.runtime_handle())
+      }))
+      .flatten();
+    if let Some((journal, pact, runtime)) = found {
+      let pact = pact?;
+      let reader = JournalExportReader::new(File::open(&checkpoint.file)?)?;
+      let entries = runtime.block_on(import_journal(&journal, &pact, reader))?;
+      debug!("Restored {} journal entries for mock server {}", entries, state.id);
+    }
+  }
+  Ok(())
+}
+
+/// Rebuilds the mock servers recorded in the state log (if it exists), and then opens the log to
+/// record the state of the master server from now on. The time taken to restore the mock servers
+/// is logged, and recorded in the log.
+pub(crate) async fn restore_and_open(path: &str) -> anyhow::Result<()> {
+  let path = PathBuf::from(path);
+  let start = Instant::now();
+  let loaded = if path.exists() {
+    read_state_log(BufReader::new(File::open(&path)?))?
+  } else {
+    LoadedState::default()
+  };
+  let total = loaded.servers.len();
+
+  let restored = tokio::task::spawn_blocking(move || restore_servers(loaded)).await?;
+  let duration = start.elapsed();
+  if total > 0 {
+    info!("Restored {} of {} mock servers from the state log in {}ms", restored.servers.len(),
+      total, duration.as_millis());
+  }
+
+  STATE_LOG.open(&path, &restored)?;
+  STATE_LOG.append_record(&json!({
+    "type": "restart",
+    "servers": restored.servers.len(),
+    "failed": total - restored.servers.len(),
+    "durationMs": duration.as_millis() as u64
+  }));
+  Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+  use std::io::Cursor;
+
+  use expectest::prelude::*;
+
+  use super::*;
+
+  #[test]
+  fn pact_hash_is_stable() {
+    expect!(pact_hash(&json!({ "a": 1, "b": [1, 2] }))).to(be_equal_to(pact_hash(&json!({ "b": [1, 2], "a": 1 }))));
+    expect!(pact_hash(&json!({ "a": 1 }))).to_not(be_equal_to(pact_hash(&json!({ "a": 2 }))));
+    expect!(pact_hash(&json!({})).len()).to(be_equal_to(16));
+  }
+
+  #[test]
+  fn state_log_only_has_the_live_servers() {
+    let server = |id: &str, port: u16| ServerState {
+      id: id.to_string(),
+      port,
+      tls: false,
+      config: json!({ "corsPreflight": true }),
+      ttl: Some(60),
+      write_pact: false,
+      tags: vec!["run-1".to_string()]
+    };
+    let log = vec![
+      json!({ "type": "pact", "hash": "abc", "pact": { "consumer": { "name": "c" } } }).to_string(),
+      server("one", 1234).to_json("abc").to_string(),
+      server("two", 1235).to_json("abc").to_string(),
+      json!({ "type": "checkpoint", "id": "one", "file": "one.journal", "sequence": 4, "entries": 4 }).to_string(),
+      json!({ "type": "checkpoint", "id": "two", "file": "two.journal", "sequence": 2, "entries": 2 }).to_string(),
+      json!({ "type": "delete", "id": "two" }).to_string(),
+      json!({ "type": "checkpoint", "id": "one", "file": "one.journal", "sequence": 10, "entries": 9 }).to_string(),
+      "{\"type\": \"create\", \"id\": \"thr".to_string()
+    ].join("\n");
+
+    let loaded = read_state_log(Cursor::new(log)).unwrap();
+    expect!(loaded.pacts.len()).to(be_equal_to(1));
+    expect!(loaded.servers.keys().cloned().collect::<Vec<_>>()).to(be_equal_to(vec!["one".to_string()]));
+    expect!(loaded.servers.get("one").cloned()).to(be_some().value((server("one", 1234), "abc".to_string())));
+    expect!(loaded.checkpoints.get("one").map(|c| c.sequence)).to(be_some().value(10));
+    expect!(loaded.checkpoints.contains_key("two")).to(be_false());
+  }
+
+  #[test]
+  #[ignore]
+  fn restore_time_for_1000_mock_servers() {
+    let pact = json!({
+      "consumer": { "name": "consumer" },
+      "provider": { "name": "provider" },
+      "interactions": [
+        {
+          "description": "a request",
+          "request": { "method": "GET", "path": "/" },
+          "response": { "status": 200 }
+        }
+      ],
+      "metadata": { "pactSpecification": { "version": "3.0.0" } }
+    });
+    let hash = pact_hash(&pact);
+    let mut loaded = LoadedState::default();
+    loaded.pacts.insert(hash.clone(), pact);
+    for i in 0..1000 {
+      let state = ServerState {
+        id: format!("restore-{}", i),
+        port: 0,
+        tls: false,
+        config: json!({}),
+        ttl: None,
+        write_pact: false,
+        tags: vec![]
+      };
+      loaded.servers.insert(state.id.clone(), (state, hash.clone()));
+    }
+
+    let start = Instant::now();
+    let restored = restore_servers(loaded);
+    println!("Restored {} mock servers in {}ms", restored.servers.len(), start.elapsed().as_millis());
+    expect!(restored.servers.len()).to(be_equal_to(1000));
+
+    let mut manager = SERVER_MANAGER.lock().unwrap();
+    for id in restored.servers.keys() {
+      manager.shutdown_mock_server_by_id(id.clone());
+    }
+  }
+}
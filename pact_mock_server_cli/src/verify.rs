@@ -76,27 +76,27 @@ pub async fn verify_mock_server(host: &str, port: u16, matches: &ArgMatches, usa
   }
 }
 
-fn validate_port(port: u16, server_manager: &Mutex<ServerManager>) -> Result<MockServer, String> {
+fn validate_port<R>(port: u16, server_manager: &Mutex<ServerManager>, f: &dyn Fn(&MockServer) -> R) -> Result<R, String> {
     server_manager.lock().unwrap()
-        .find_mock_server_by_port_mut(port, &|ms| {
-            ms.clone()
-        })
+        .find_mock_server_by_port_mut(port, &|ms| f(ms))
         .ok_or(format!("No mock server running with port '{}'", port))
 }
 
-fn validate_uuid(id: &str, server_manager: &Mutex<ServerManager>) -> Result<MockServer, String> {
+fn validate_uuid<R>(id: &str, server_manager: &Mutex<ServerManager>, f: &dyn Fn(&MockServer) -> R) -> Result<R, String> {
     server_manager.lock().unwrap()
-        .find_mock_server_by_id(&id.to_string(), &|_, ms| {
-            ms.unwrap_left().clone()
-        })
+        .find_mock_server_by_id(&id.to_string(), &|_, ms| ms.left().map(|ms| f(ms)))
+        .flatten()
         .ok_or(format!("No mock server running with id '{}'", id))
 }
 
-pub fn validate_id(id: &str, server_manager: &Mutex<ServerManager>) -> Result<MockServer, String> {
+/// Finds the mock server by ID or port number, and maps it with the supplied function while the
+/// server manager is locked. To work on the mock server after the lock has been released, map it
+/// to a clone, which shares the Pact and match journal with the running mock server.
+pub fn validate_id<R>(id: &str, server_manager: &Mutex<ServerManager>, f: &dyn Fn(&MockServer) -> R) -> Result<R, String> {
     if id.chars().all(|ch| ch.is_digit(10)) {
-        validate_port(id.parse::<u16>().unwrap(), server_manager)
+        validate_port(id.parse::<u16>().unwrap(), server_manager, f)
     } else {
-        validate_uuid(id, server_manager)
+        validate_uuid(id, server_manager, f)
     }
 }
 
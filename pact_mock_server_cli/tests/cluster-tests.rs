@@ -0,0 +1,155 @@
+use std::net::TcpListener;
+use std::path::PathBuf;
+use std::process::{Child, Command, Stdio};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use reqwest::blocking::Client;
+use reqwest::StatusCode;
+use serde_json::{json, Value};
+
+/// Master servers of a cluster, which are killed when dropped
+struct Cluster {
+  urls: Vec<String>,
+  nodes: Vec<Child>,
+  output: PathBuf
+}
+
+impl Cluster {
+  fn start(count: usize) -> Cluster {
+    let ports: Vec<u16> = (0..count).map(|_| free_port()).collect();
+    let urls: Vec<String> = ports.iter().map(|port| format!("http://127.0.0.1:{}", port)).collect();
+    let output = std::env::temp_dir().join(format!("pact-mock-server-cluster-{}", std::process::id()));
+    std::fs::create_dir_all(&output).unwrap();
+
+    let nodes = ports.iter().zip(&urls).map(|(port, url)| {
+      let peers: Vec<&str> = urls.iter().filter(|peer| *peer != url).map(|peer| peer.as_str()).collect();
+      Command::new(env!("CARGO_BIN_EXE_pact_mock_server_cli"))
+        .args(["start", "--no-file-log", "--port", port.to_string().as_str(), "--node-url", url.as_str(),
+          "--peers", peers.join(",").as_str(), "--output", output.to_string_lossy().as_ref()])
+        .stdout(Stdio::null())
+        .stderr(Stdio::null())
+        .spawn()
+        .unwrap()
+    }).collect();
+    let cluster = Cluster { urls, nodes, output };
+
+    let client = Client::new();
+    for url in &cluster.urls {
+      let start = Instant::now();
+      while client.get(format!("{}/", url)).header("X-Pact-Forwarded", "test").send().is_err() {
+        if start.elapsed() > Duration::from_secs(30) {
+          panic!("Master server {} did not start", url);
+        }
+        thread::sleep(Duration::from_millis(100));
+      }
+    }
+    cluster
+  }
+}
+
+impl Drop for Cluster {
+  fn drop(&mut self) {
+    for node in self.nodes.iter_mut() {
+      let _ = node.kill();
+      let _ = node.wait();
+    }
+    let _ = std::fs::remove_dir_all(&self.output);
+  }
+}
+
+fn free_port() -> u16 {
+  TcpListener::bind("127.0.0.1:0").unwrap().local_addr().unwrap().port()
+}
+
+fn pact() -> Value {
+  json!({
+    "consumer": { "name": "cluster-consumer" },
+    "provider": { "name": "cluster-provider" },
+    "interactions": [],
+    "metadata": { "pactSpecification": { "version": "3.0.0" } }
+  })
+}
+
+fn listed_ids(client: &Client, url: &str) -> Vec<(String, String)> {
+  let listing: Value = client.get(format!("{}/", url)).send().unwrap().json().unwrap();
+  listing["mockServers"].as_array().unwrap().iter()
+    .map(|ms| (ms["id"].as_str().unwrap().to_string(), ms["node"].as_str().unwrap_or_default().to_string()))
+    .collect()
+}
+
+#[test]
+#[cfg(not(windows))]
+fn mock_servers_are_spread_over_the_cluster_and_can_be_used_through_any_node() {
+  let cluster = Cluster::start(3);
+  let client = Client::new();
+
+  // Create mock servers through the first node until at least one has been placed on another node
+  let mut ids = vec![];
+  while ids.len() < 20 {
+    let response = client.post(format!("{}/", cluster.urls[0])).json(&pact()).send().unwrap();
+    expect_success(response.status());
+    let body: Value = response.json().unwrap();
+    ids.push(body["mockServer"]["id"].as_str().unwrap().to_string());
+
+    let listed = listed_ids(&client, cluster.urls[1].as_str());
+    if ids.len() >= 3 && listed.iter().any(|(_, node)| *node != cluster.urls[0]) {
+      break;
+    }
+  }
+
+  // The listing from any node has all the mock servers, with the node they are running on
+  let listed = listed_ids(&client, cluster.urls[2].as_str());
+  assert_eq!(listed.len(), ids.len());
+  for id in &ids {
+    assert!(listed.iter().any(|(listed_id, node)| listed_id == id && cluster.urls.contains(node)),
+      "mock server {} was not listed", id);
+  }
+  assert!(listed.iter().any(|(_, node)| *node != cluster.urls[0]), "no mock servers were placed on another node");
+
+  // The mock servers can be verified through any node
+  for id in &ids {
+    let response = client.post(format!("{}/mockserver/{}/verify", cluster.urls[1], id)).send().unwrap();
+    expect_success(response.status());
+  }
+
+  // A forwarded request can not reuse the ID of a running mock server
+  let (id, node) = listed[0].clone();
+  let response = client.post(format!("{}/", node))
+    .header("X-Pact-Forwarded", "test")
+    .header("X-Pact-Mock-Server-Id", id.as_str())
+    .json(&pact())
+    .send()
+    .unwrap();
+  expect_status(response.status(), StatusCode::UNPROCESSABLE_ENTITY);
+
+  // A mock server ID is ignored in requests that have not been forwarded by the cluster
+  let other = uuid::Uuid::new_v4().to_string();
+  let response = client.post(format!("{}/", cluster.urls[0]))
+    .header("X-Pact-Mock-Server-Id", other.as_str())
+    .json(&pact())
+    .send()
+    .unwrap();
+  expect_success(response.status());
+  let body: Value = response.json().unwrap();
+  let created = body["mockServer"]["id"].as_str().unwrap().to_string();
+  assert_ne!(created, other);
+  ids.push(created);
+
+  // Shutting down through any node stops the mock servers on all the nodes
+  let query: Vec<(&str, &str)> = ids.iter().map(|id| ("id", id.as_str())).collect();
+  let response = client.delete(format!("{}/", cluster.urls[2])).query(&query).send().unwrap();
+  expect_success(response.status());
+  let report: Value = response.json().unwrap();
+  let stopped = report["stopped"].as_array().unwrap().len() + report["forced"].as_array().unwrap().len();
+  assert_eq!(stopped, ids.len());
+  assert!(listed_ids(&client, cluster.urls[0].as_str()).is_empty());
+}
+
+fn expect_success(status: StatusCode) {
+  assert!(status.is_success(), "expected a successful response but got {}", status);
+}
+
+fn expect_status(status: StatusCode, expected: StatusCode) {
+  assert_eq!(status, expected, "expected status {} but got {}", expected, status);
+}